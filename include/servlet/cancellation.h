@@ -0,0 +1,159 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef SERVLET_CANCELLATION_H
+#define SERVLET_CANCELLATION_H
+
+#include <atomic>
+#include <chrono>
+
+#include <servlet/lib/exception.h>
+
+/**
+ * @file cancellation.h
+ * @brief Definitions for request deadlines and cooperative cancellation.
+ */
+
+namespace servlet
+{
+
+/**
+ * Reason of the request cancellation.
+ */
+enum class cancel_reason
+{
+    none,         /**< Request is not cancelled */
+    deadline,     /**< Deadline of the request has passed */
+    client_abort, /**< Client has closed the connection */
+    cancelled     /**< Request was cancelled with cancellation_token#cancel */
+};
+
+/**
+ * Token to check if the processing of a request should be stopped.
+ *
+ * <p>The token fires when the deadline of the request passes, when the
+ * client aborts the connection or when #cancel is called. Once fired it
+ * stays fired. Blocking operations of the container (reading request
+ * body, writing response, includes) check the token and fail with
+ * <code>request_cancelled_exception</code>; long running servlets are
+ * expected to check #is_cancelled from time to time and give up the
+ * work which nobody waits for anymore.</p>
+ *
+ * <p>#cancel may be called from any thread.</p>
+ *
+ * @see http_request#get_cancellation_token
+ */
+class cancellation_token
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+    typedef clock_type::time_point    time_point;
+
+    /**
+     * Constructs token without deadline.
+     */
+    cancellation_token() noexcept : _deadline{time_point::max()} {}
+    /**
+     * Constructs token with the given deadline.
+     * @param deadline The deadline, <code>time_point::max()</code> for no deadline.
+     */
+    explicit cancellation_token(time_point deadline) noexcept : _deadline{deadline} {}
+
+    virtual ~cancellation_token() noexcept = default;
+
+    cancellation_token(const cancellation_token&) = delete;
+    cancellation_token& operator=(const cancellation_token&) = delete;
+
+    /**
+     * Returns <code>true</code> if the request has a deadline.
+     * @return <code>true</code> if the request has a deadline.
+     */
+    bool has_deadline() const noexcept { return _deadline != time_point::max(); }
+
+    /**
+     * Returns the deadline of the request.
+     * @return the deadline or <code>time_point::max()</code> if there is no deadline.
+     */
+    time_point deadline() const noexcept { return _deadline; }
+
+    /**
+     * Returns time left until the deadline.
+     *
+     * <p>The result can be passed on as a timeout to downstream calls.</p>
+     * @return time left, zero if the deadline has passed or
+     *         <code>milliseconds::max()</code> if there is no deadline.
+     */
+    std::chrono::milliseconds remaining_time() const noexcept
+    {
+        if (!has_deadline()) return std::chrono::milliseconds::max();
+        time_point now = clock_type::now();
+        if (now >= _deadline) return std::chrono::milliseconds::zero();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(_deadline - now);
+    }
+
+    /**
+     * Returns the reason the request is cancelled for.
+     * @return the reason or cancel_reason::none if the request is not cancelled.
+     */
+    cancel_reason reason() const noexcept
+    {
+        cancel_reason r = _reason.load(std::memory_order_acquire);
+        if (r != cancel_reason::none) return r;
+        if (client_aborted()) return _fire(cancel_reason::client_abort);
+        if (has_deadline() && clock_type::now() >= _deadline) return _fire(cancel_reason::deadline);
+        return cancel_reason::none;
+    }
+
+    /**
+     * Returns <code>true</code> if the request is cancelled.
+     * @return <code>true</code> if the request is cancelled.
+     */
+    bool is_cancelled() const noexcept { return reason() != cancel_reason::none; }
+
+    /**
+     * Cancels the request.
+     */
+    void cancel() noexcept { _fire(cancel_reason::cancelled); }
+
+    /**
+     * Throws <code>request_cancelled_exception</code> if the request is cancelled.
+     * @throws request_cancelled_exception if the request is cancelled.
+     */
+    void throw_if_cancelled() const
+    {
+        switch (reason())
+        {
+            case cancel_reason::none: return;
+            case cancel_reason::deadline: throw request_cancelled_exception{"Request deadline exceeded"};
+            case cancel_reason::client_abort: throw request_cancelled_exception{"Client aborted the connection"};
+            default: throw request_cancelled_exception{"Request cancelled"};
+        }
+    }
+
+protected:
+    /**
+     * Checks if the client has aborted the connection.
+     * @return <code>true</code> if the client has aborted the connection.
+     */
+    virtual bool client_aborted() const noexcept { return false; }
+
+private:
+    /* First reason wins */
+    cancel_reason _fire(cancel_reason r) const noexcept
+    {
+        cancel_reason expected = cancel_reason::none;
+        if (_reason.compare_exchange_strong(expected, r, std::memory_order_acq_rel)) return r;
+        return expected;
+    }
+
+    time_point _deadline;
+    mutable std::atomic<cancel_reason> _reason{cancel_reason::none};
+};
+
+} // end of servlet namespace
+
+#endif // SERVLET_CANCELLATION_H
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef SERVLET_HEADER_H
+#define SERVLET_HEADER_H
+
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <experimental/string_view>
+
+/**
+ * @file header.h
+ * @brief Definitions for allocation free access to HTTP headers.
+ */
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+/**
+ * Well known HTTP headers.
+ *
+ * <p>Names of these headers are stored as string literals, so
+ * accessing a header by this enum neither allocates nor copies the
+ * name.</p>
+ * @see header_name
+ */
+enum class http_header
+{
+    accept, accept_charset, accept_encoding, accept_language, accept_ranges, age, allow,
+    authorization, cache_control, connection, content_disposition, content_encoding,
+    content_language, content_length, content_location, content_range, content_type,
+    cookie, date, etag, expect, expires, host, if_match, if_modified_since, if_none_match,
+    if_range, if_unmodified_since, last_modified, location, origin, pragma, range, referer,
+    retry_after, server, set_cookie, te, transfer_encoding, upgrade, user_agent, vary,
+    www_authenticate, x_forwarded_for, x_forwarded_proto, x_requested_with
+};
+
+/**
+ * Returns the name of a well known header.
+ * @param header The header.
+ * @return Null terminated name of the header with static storage duration.
+ */
+inline const char* header_name(http_header header) noexcept
+{
+    static const char* const NAMES[] =
+    {
+        "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Accept-Ranges", "Age", "Allow",
+        "Authorization", "Cache-Control", "Connection", "Content-Disposition", "Content-Encoding",
+        "Content-Language", "Content-Length", "Content-Location", "Content-Range", "Content-Type",
+        "Cookie", "Date", "ETag", "Expect", "Expires", "Host", "If-Match", "If-Modified-Since", "If-None-Match",
+        "If-Range", "If-Unmodified-Since", "Last-Modified", "Location", "Origin", "Pragma", "Range", "Referer",
+        "Retry-After", "Server", "Set-Cookie", "TE", "Transfer-Encoding", "Upgrade", "User-Agent", "Vary",
+        "WWW-Authenticate", "X-Forwarded-For", "X-Forwarded-Proto", "X-Requested-With"
+    };
+    return NAMES[static_cast<std::size_t>(header)];
+}
+
+/**
+ * Null terminated copy of a header name given as <code>string_view</code>.
+ *
+ * <p>Apache looks up headers by null terminated names. Usual names are
+ * copied to the buffer inside of this object, so no memory is
+ * allocated.</p>
+ */
+class header_name_buffer
+{
+public:
+    /**
+     * Constructs null terminated copy of the name
+     * @param name Name of the header.
+     */
+    explicit header_name_buffer(string_view name)
+    {
+        if (name.size() < sizeof(_buf))
+        {
+            std::memcpy(_buf, name.data(), name.size());
+            _buf[name.size()] = '\0';
+            _ptr = _buf;
+        }
+        else
+        {
+            _long.assign(name.data(), name.size());
+            _ptr = _long.c_str();
+        }
+    }
+    header_name_buffer(const header_name_buffer&) = delete;
+    header_name_buffer& operator=(const header_name_buffer&) = delete;
+
+    /**
+     * Returns null terminated name
+     * @return null terminated name
+     */
+    const char* c_str() const noexcept { return _ptr; }
+private:
+    char _buf[64];
+    std::string _long;
+    const char *_ptr;
+};
+
+/**
+ * Type of function called for every visited header.
+ *
+ * <p>First argument is user data passed along with the function, the
+ * second and third ones are name and value of the header. Views are
+ * valid until the end of the request. Returning <code>false</code>
+ * stops the iteration.</p>
+ */
+typedef bool (*header_visit_fn)(void *data, string_view name, string_view value);
+
+/* Adapts an arbitrary visitor returning either bool or void to header_visit_fn */
+template<typename Visitor>
+struct header_visitor_adapter
+{
+    static bool visit(void *data, string_view name, string_view value)
+    {
+        return _call(*static_cast<Visitor*>(data), name, value,
+                     std::is_same<decltype(std::declval<Visitor&>()(name, value)), void>{});
+    }
+private:
+    static bool _call(Visitor& visitor, string_view name, string_view value, std::true_type)
+    {
+        visitor(name, value);
+        return true;
+    }
+    static bool _call(Visitor& visitor, string_view name, string_view value, std::false_type)
+    {
+        return static_cast<bool>(visitor(name, value));
+    }
+};
+
+} // end of servlet namespace
+
+#endif // SERVLET_HEADER_H
@@ -0,0 +1,325 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_COW_ANY_MAP_H
+#define MOD_SERVLET_COW_ANY_MAP_H
+
+/**
+ * @file cow_any_map.h
+ * @brief Containes the implementation of <code>cow_any_map</code> class
+ *        and related type definitions.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include <experimental/any>
+
+namespace servlet
+{
+
+using std::experimental::any;
+using std::experimental::any_cast;
+
+/**
+ * Thread safe map of <code>std::any</code> values optimized for reads.
+ *
+ * <p>The records are kept in an immutable sorted array which is replaced as
+ * a whole on every modification. Readers take the current array with an
+ * atomic load of <code>std::shared_ptr</code> and never wait for writers
+ * or for each other. Writers are serialized by a mutex of the map; they copy
+ * the array which only holds the keys and pointers to values, so values
+ * themselves are never copied. All empty maps share one array, so that a map
+ * without records doesn't allocate any memory.</p>
+ *
+ * <p>Values are immutable once stored: #get returns a pointer to a const
+ * value which stays valid even if the record is replaced or removed in the
+ * meantime. To change a value replace it with #put or atomically with
+ * #compute.</p>
+ *
+ * ~~~~~{.cpp}
+ * cow_any_map m;
+ * m.put<std::string>("name", "value");
+ * std::shared_ptr<const std::string> name = m.get<std::string>("name");
+ * m.compute_if_absent<std::vector<int>>("list", [](const std::string&) { return std::vector<int>{1, 2}; });
+ * m.compute<int>("counter", [](const int *old) { return old ? *old + 1 : 1; });
+ * ~~~~~
+ *
+ * @tparam _Key type of the keys
+ * @tparam _Compare comparison of the keys. Transparent comparison enables
+ *                  lookups with types comparable to the key.
+ */
+template<typename _Key = std::string, typename _Compare = std::less<>>
+class cow_any_value_map
+{
+public:
+    /**
+     * Container's key type
+     */
+    typedef _Key key_type;
+    /**
+     * Pointer to an immutable value
+     */
+    typedef std::shared_ptr<const any> value_ptr;
+    /**
+     * Record of the container
+     */
+    typedef std::pair<key_type, value_ptr> value_type;
+    /**
+     * Immutable state of the container, sorted by key.
+     */
+    typedef std::vector<value_type> snapshot_type;
+    /**
+     * An unsigned integral type to represent the size of this container.
+     */
+    typedef typename snapshot_type::size_type size_type;
+
+    /**
+     * Constructs an empty container, with no elements.
+     */
+    cow_any_value_map() : _records{_empty()} {}
+
+    cow_any_value_map(const cow_any_value_map&) = delete;
+    cow_any_value_map& operator=(const cow_any_value_map&) = delete;
+
+    /**
+     * Destroys the object.
+     */
+    ~cow_any_value_map() = default;
+
+    /**
+     * Returns current state of the container. The returned records are
+     * not affected by later modifications, so that they can be iterated
+     * while the container is modified by other threads.
+     * @return sorted records of the container.
+     */
+    std::shared_ptr<const snapshot_type> snapshot() const { return std::atomic_load(&_records); }
+
+    /**
+     * Returns the number of records in the container.
+     * @return the number of records in the container.
+     */
+    size_type size() const { return snapshot()->size(); }
+
+    /**
+     * Tests whether the container is empty.
+     * @return <code>true</code> if there are no records in the container.
+     */
+    bool empty() const { return snapshot()->empty(); }
+
+    /**
+     * Tests whether value with a given key exists in this container
+     * @tparam KeyType a type comparable to the key type
+     * @param key Key to test.
+     * @return <code>true</code> if a value with a given key exists in
+     *         this container, <code>false</code> otherwise.
+     */
+    template<typename KeyType>
+    bool contains_key(const KeyType &key) const
+    {
+        std::shared_ptr<const snapshot_type> records = snapshot();
+        return _find(*records, key) != records->end();
+    }
+
+    /**
+     * Returns a pointer to the value with a given key.
+     * @tparam T type of the value to return
+     * @tparam KeyType a type comparable to the key type
+     * @param key Key to be searched for.
+     * @return pointer to the found value, or empty pointer if a value with
+     *         a given key doesn't exists in this container.
+     * @throws bad_any_cast if the value is found, but couldn't be casted
+     *         to the requested type
+     */
+    template<typename T, typename KeyType>
+    std::shared_ptr<const T> get(const KeyType &key) const
+    {
+        std::shared_ptr<const snapshot_type> records = snapshot();
+        auto it = _find(*records, key);
+        return it == records->end() ? std::shared_ptr<const T>{} : _cast<T>(it->second);
+    }
+
+    /**
+     * Associates a value of specified type created with a given arguments
+     * with the specified key in this map. If the map previously contained
+     * a mapping for the key, the old value is replaced.
+     * @tparam T type of the value to associate with the key
+     * @tparam Args types of the arguments to construct a mapped value.
+     * @param key key with which the specified value is to be associated
+     * @param args argument to create the mapped value
+     * @return <code>bool</code> denoting whether the insertion took place.
+     */
+    template<typename T, typename... Args>
+    bool put(const key_type &key, Args &&... args)
+    {
+        return put_any(key, any{T{std::forward<Args>(args)...}});
+    }
+
+    /**
+     * Associates a value with the specified key in this map. If the map previously
+     * contained a mapping for the key, the old value is replaced.
+     * @param key key with which the specified value is to be associated
+     * @param value value to associate with the key
+     * @return <code>bool</code> denoting whether the insertion took place.
+     */
+    bool put_any(const key_type &key, any value)
+    {
+        value_ptr ptr = std::make_shared<const any>(std::move(value));
+        std::lock_guard<std::mutex> lock{_write_mx};
+        return _set(key, std::move(ptr));
+    }
+
+    /**
+     * Returns the value with a given key. If the value doesn't exist
+     * it is created with the given function and stored atomically: the
+     * function is called at most once however many threads request the
+     * same value at the same time.
+     * @tparam T type of the value
+     * @tparam Function type of function <code>T(const key_type&)</code>
+     * @param key Key to be searched for.
+     * @param fn Function creating the value. The container is locked for
+     *           modifications while it is called.
+     * @return pointer to the found or created value.
+     * @throws bad_any_cast if the value is found, but couldn't be casted
+     *         to the requested type
+     */
+    template<typename T, typename Function>
+    std::shared_ptr<const T> compute_if_absent(const key_type &key, Function fn)
+    {
+        std::shared_ptr<const T> found = get<T>(key);
+        if (found) return found;
+        std::lock_guard<std::mutex> lock{_write_mx};
+        /* Could have been created while waiting for the lock */
+        auto it = _find(*_records, key);
+        if (it != _records->end()) return _cast<T>(it->second);
+        value_ptr ptr = std::make_shared<const any>(T{fn(key)});
+        _set(key, ptr);
+        return _cast<T>(ptr);
+    }
+
+    /**
+     * Atomically replaces the value with a given key with the value computed
+     * from the current one. Concurrent computations of the map are serialized.
+     * @tparam T type of the value
+     * @tparam Function type of function <code>T(const T*)</code> which is given
+     *         <code>nullptr</code> if the value doesn't exist.
+     * @param key Key of the value to replace.
+     * @param fn Function computing the new value. The container is locked for
+     *           modifications while it is called.
+     * @return pointer to the new value.
+     * @throws bad_any_cast if the value is found, but couldn't be casted
+     *         to the requested type
+     */
+    template<typename T, typename Function>
+    std::shared_ptr<const T> compute(const key_type &key, Function fn)
+    {
+        std::lock_guard<std::mutex> lock{_write_mx};
+        auto it = _find(*_records, key);
+        const T *old = it == _records->end() ? nullptr : &any_cast<const T&>(*it->second);
+        value_ptr ptr = std::make_shared<const any>(T{fn(old)});
+        _set(key, ptr);
+        return _cast<T>(ptr);
+    }
+
+    /**
+     * Removes the value with a given key.
+     * @tparam KeyType a type comparable to the key type
+     * @param key Key of the value to remove.
+     * @return <code>true</code> if the value has been removed.
+     */
+    template<typename KeyType>
+    bool erase(const KeyType &key)
+    {
+        std::lock_guard<std::mutex> lock{_write_mx};
+        auto it = _find(*_records, key);
+        if (it == _records->end()) return false;
+        if (_records->size() == 1)
+        {
+            std::atomic_store(&_records, _empty());
+            return true;
+        }
+        auto records = std::make_shared<snapshot_type>();
+        records->reserve(_records->size() - 1);
+        records->insert(records->end(), _records->begin(), it);
+        records->insert(records->end(), it + 1, _records->end());
+        _publish(std::move(records));
+        return true;
+    }
+
+    /**
+     * Removes all the values.
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock{_write_mx};
+        std::atomic_store(&_records, _empty());
+    }
+
+private:
+    static const std::shared_ptr<const snapshot_type> &_empty()
+    {
+        static const std::shared_ptr<const snapshot_type> EMPTY = std::make_shared<const snapshot_type>();
+        return EMPTY;
+    }
+
+    template<typename KeyType>
+    static typename snapshot_type::const_iterator _lower_bound(const snapshot_type &records, const KeyType &key)
+    {
+        return std::lower_bound(records.begin(), records.end(), key,
+                                [](const value_type &r, const KeyType &k) { return _Compare{}(r.first, k); });
+    }
+
+    template<typename KeyType>
+    static typename snapshot_type::const_iterator _find(const snapshot_type &records, const KeyType &key)
+    {
+        auto it = _lower_bound(records, key);
+        return it != records.end() && !_Compare{}(key, it->first) ? it : records.end();
+    }
+
+    template<typename T>
+    static std::shared_ptr<const T> _cast(const value_ptr &value)
+    {
+        /* Shares ownership of the stored value */
+        return std::shared_ptr<const T>{value, &any_cast<const T&>(*value)};
+    }
+
+    /* Is called with the write lock held, so that _records can be read directly */
+    bool _set(const key_type &key, value_ptr value)
+    {
+        auto records = std::make_shared<snapshot_type>();
+        records->reserve(_records->size() + 1);
+        auto it = _lower_bound(*_records, key);
+        bool inserted = it == _records->end() || _Compare{}(key, it->first);
+        records->insert(records->end(), _records->begin(), it);
+        records->emplace_back(key, std::move(value));
+        records->insert(records->end(), inserted ? it : it + 1, _records->end());
+        _publish(std::move(records));
+        return inserted;
+    }
+
+    void _publish(std::shared_ptr<snapshot_type> records)
+    {
+        std::atomic_store(&_records, std::shared_ptr<const snapshot_type>{std::move(records)});
+    }
+
+    std::shared_ptr<const snapshot_type> _records;
+    std::mutex _write_mx;
+};
+
+/**
+ * Type definition for <code>cow_any_value_map</code> with the key type
+ * <code>std::string</code>
+ */
+using cow_any_map = cow_any_value_map<>;
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_COW_ANY_MAP_H
@@ -48,6 +48,24 @@ struct io_exception : public std::runtime_error
 {
     using std::runtime_error::runtime_error;
 };
+/**
+ * Exception thrown when a request is cancelled: its deadline has passed,
+ * the client has aborted the connection or it was cancelled explicitly.
+ */
+struct request_cancelled_exception : public io_exception
+{
+    using io_exception::io_exception;
+};
+/**
+ * Exception thrown when the request exceeds a configured limit, for example
+ * a form parameter longer than <code>form.name.limit</code> or
+ * <code>form.value.limit</code>. The container answers such request with
+ * 413 (Request Entity Too Large).
+ */
+struct request_too_large_exception : public io_exception
+{
+    using io_exception::io_exception;
+};
 /**
  * Exception thrown on attempt to access <code>nullptr</code> object if this is
  * possible to catch this attempt.
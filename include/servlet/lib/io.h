@@ -8,8 +8,10 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef SERVLET_IO_H
 #define SERVLET_IO_H
 
+#include <algorithm>
 #include <type_traits>
 #include <iostream>
+#include <utility>
 #include <vector>
 
 #include <experimental/type_traits>
@@ -461,6 +463,25 @@ protected:
         return traits_type::to_int_type(*_buffer);
     }
 
+    /* Reads larger than the buffer go directly from the source to the caller's memory */
+    std::streamsize xsgetn(char_type* s, std::streamsize count) override
+    {
+        std::streamsize read = std::min<std::streamsize>(this->egptr() - this->gptr(), count);
+        if (read > 0)
+        {
+            traits_type::copy(s, this->gptr(), read);
+            this->gbump(static_cast<int>(read));
+        }
+        while (count - read >= static_cast<std::streamsize>(Buffering::buf_size))
+        {
+            std::streamsize new_size = _source.read(s + read, count - read);
+            if (new_size <= 0) return read;
+            read += new_size;
+            this->setg(_buffer, _buffer, _buffer);
+        }
+        return read < count ? read + std::basic_streambuf<CharT, Traits>::xsgetn(s + read, count - read) : read;
+    }
+
     int_type pbackfail(int_type ch) override
     {
         if (this->egptr() <= this->eback()) return traits_type::eof();
@@ -473,10 +494,37 @@ private:
     CharT *_buffer;
 };
 
+/**
+ * Interface of input stream buffers which can hand out their data
+ * without copying it.
+ *
+ * <p>Stream buffers of <code>servlet::basic_instream</code> built on
+ * buffer_provider implement this interface. It is used by #read_chunk.</p>
+ *
+ * @tparam CharT character type of the stream buffer.
+ */
+template<typename CharT>
+class zero_copy_inbuf
+{
+public:
+    virtual ~zero_copy_inbuf() noexcept = default;
+
+    /**
+     * Returns the next piece of data and marks it as consumed.
+     *
+     * <p>Data is returned in place, it stays valid until the next read
+     * from the stream buffer.</p>
+     *
+     * @return Pointer to the data and its size or <code>{nullptr, 0}</code>
+     *         if there is no more data.
+     */
+    virtual std::pair<const CharT*, std::size_t> next_chunk() = 0;
+};
+
 template<typename Source, typename CharT, typename Traits>
 class basic_inbuf<Source, non_buffered, CharT, Traits,
                   typename std::enable_if_t<std::is_same<typename Source::category, buffer_provider>::value>> :
-        public std::basic_streambuf<CharT, Traits>
+        public std::basic_streambuf<CharT, Traits>, public zero_copy_inbuf<CharT>
 {
 public:
     typedef CharT                     char_type;
@@ -504,6 +552,21 @@ public:
 
     void reset() { this->setg(this->eback(), this->eback(), this->egptr()); }
 
+    std::pair<const CharT*, std::size_t> next_chunk() override
+    {
+        if (this->gptr() < this->egptr())
+        {
+            std::pair<const CharT*, std::size_t> chunk{this->gptr(), static_cast<std::size_t>(this->egptr() - this->gptr())};
+            this->setg(this->eback(), this->egptr(), this->egptr());
+            return chunk;
+        }
+        std::pair<CharT*, std::size_t> buffer = _source.get_buffer();
+        if (!buffer.first || buffer.second <= 0) return {nullptr, 0};
+        /* The buffer becomes a fully consumed get area, so that putback still works */
+        this->setg(buffer.first, buffer.first + buffer.second, buffer.first + buffer.second);
+        return {buffer.first, buffer.second};
+    }
+
 protected:
     int_type underflow() override
     {
@@ -648,6 +711,39 @@ private:
     inline const _inbuf_type* buf() const { return static_cast<const _inbuf_type*>(this->rdbuf()); }
 };
 
+/**
+ * Reads the next chunk of data from the input stream.
+ *
+ * <p>If the stream buffer implements zero_copy_inbuf (streams built on
+ * buffer_provider, like the request body streams) the data is returned
+ * in place without copying, otherwise it is read into the given buffer.
+ * Either way the data stays valid until the next read from the stream.</p>
+ *
+ * <p>If there is no more data <code>eofbit</code> is set on the stream.</p>
+ *
+ * @param in Input stream to read from.
+ * @param buf Buffer to use if the stream cannot provide its data in place.
+ * @param buf_size Size of the buffer.
+ * @return Pointer to the data and its size or <code>{nullptr, 0}</code>
+ *         if there is no more data.
+ */
+template<typename CharT, typename Traits>
+std::pair<const CharT*, std::size_t> read_chunk(std::basic_istream<CharT, Traits>& in, CharT* buf, std::size_t buf_size)
+{
+    std::pair<const CharT*, std::size_t> chunk{nullptr, 0};
+    if (zero_copy_inbuf<CharT> *zc = dynamic_cast<zero_copy_inbuf<CharT>*>(in.rdbuf()))
+    {
+        chunk = zc->next_chunk();
+    }
+    else if (in.rdbuf())
+    {
+        std::streamsize read = in.rdbuf()->sgetn(buf, static_cast<std::streamsize>(buf_size));
+        if (read > 0) chunk = {buf, static_cast<std::size_t>(read)};
+    }
+    if (!chunk.first) in.setstate(std::ios_base::eofbit);
+    return chunk;
+}
+
 /**
  * Type definition for <code>basic_outstream</code> with <code>char</code> type.
  */
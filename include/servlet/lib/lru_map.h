@@ -8,15 +8,22 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_TIMED_MAP_H
 #define MOD_SERVLET_TIMED_MAP_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <servlet/lib/linked_map.h>
 
 /**
  * @file lru_map.h
- * @brief Containes the implementation of <code>timed_lru_map</code> class
- *        and related classes and type definitions.
+ * @brief Containes the implementation of <code>timed_lru_map</code> and
+ *        <code>sharded_lru_map</code> classes and related classes and type
+ *        definitions.
  */
 
 namespace servlet
@@ -401,7 +408,7 @@ private:
  */
 template<typename _Key, typename _Value, typename _Compare = std::less<>,
          typename _Alloc = std::allocator<std::pair<const _Key,
-                                                    typename std::list<std::pair<const _Key &, _Value>>::iterator>>>
+                                                    typename std::list<std::pair<const _Key &, timed_entry<_Value>>>::iterator>>>
 using lru_tree_map = lru_map<_Key, timed_entry<_Value>,
                              std::map<_Key, typename std::list<std::pair<const _Key &, timed_entry<_Value>>>::iterator,
                                       _Compare, _Alloc>>;
@@ -412,11 +419,524 @@ using lru_tree_map = lru_map<_Key, timed_entry<_Value>,
 template<typename _Key, typename _Value, typename _Hash = std::hash<_Key>,
          typename _Pred = std::equal_to<_Key>,
          typename _Alloc = std::allocator<std::pair<const _Key,
-                                                    typename std::list<std::pair<const _Key &, _Value>>::iterator>>>
+                                                    typename std::list<std::pair<const _Key &, timed_entry<_Value>>>::iterator>>>
 using lru_hash_map = lru_map<_Key, timed_entry<_Value>,
                              std::unordered_map<_Key, typename std::list<std::pair<const _Key &, timed_entry<_Value>>>::iterator,
                                                 _Hash, _Pred, _Alloc>>;
 
+/**
+ * Concurrent LRU (least recently used) timed cache.
+ *
+ * <p>This container provides the same operations as <code>lru_map</code>,
+ * but the elements are spread by key hash over a number of shards, each
+ * with its own lock and its own LRU list. Threads working with different
+ * keys rarely meet on the same lock, so the container scales with the
+ * number of threads. Elements which have not been accessed for longer
+ * than <code>timeout</code> are treated as absent, but are only removed
+ * by #expire, so that the cost of expiration is kept away from lookups
+ * and insertions. The LRU order is kept per shard, which is as good as a
+ * global one for expiration.</p>
+ *
+ * <p>Frequently used elements would make every lookup a write. So access
+ * time of an element is updated at most once per #touch_interval and the
+ * element is only queued for relinking in the LRU list; the queue is applied
+ * in a batch by #expire. Expiration is therefore precise to the touch
+ * interval.</p>
+ *
+ * <p>Elements may be given a weight, e.g. their approximate memory size, with
+ * #set_weight. The total #weight of the container can be kept within a budget
+ * by removing elements with #evict.</p>
+ *
+ * <p>Unlike <code>lru_map</code>, #get returns a copy of the value, as a
+ * reference into a concurrent container would not stay valid. The
+ * container is intended for cheap to copy values, like smart pointers.</p>
+ *
+ * This is a synchronized container.
+ *
+ * @tparam _Key type of the key
+ * @tparam _Tp type of the mapped value
+ * @tparam _Hash hash function for the keys
+ * @tparam _Shards number of shards
+ * @see lru_map
+ */
+template<typename _Key, typename _Tp, typename _Hash = std::hash<_Key>, std::size_t _Shards = 64>
+class sharded_lru_map
+{
+public:
+    /**
+     * Container's key type
+     */
+    typedef _Key        key_type;
+    /**
+     * Container's mapped type
+     */
+    typedef _Tp         mapped_type;
+    /**
+     * An unsigned integral type to represent the size of this container.
+     */
+    typedef std::size_t size_type;
+
+    /**
+     * Number of shards in this container.
+     */
+    static constexpr size_type shard_count = _Shards;
+
+    /**
+     * Constructs an empty container, with no elements.
+     *
+     * <p>The timeout argument is specified in seconds. After this number of seconds if
+     * element is not accessed it will be removed from this container.</p>
+     * @param timeout_sec Expiration time for elements in this container.
+     */
+    explicit sharded_lru_map(std::size_t timeout_sec) : _timeout{std::chrono::seconds{timeout_sec}} {}
+
+    /**
+     * Returns the minimal time between two updates of the access time of an
+     * element.
+     * @return the touch interval.
+     */
+    static constexpr std::chrono::milliseconds touch_interval() { return std::chrono::milliseconds{1000}; }
+
+    /* No copying, no moving */
+    sharded_lru_map(const sharded_lru_map&) = delete;
+    sharded_lru_map& operator=(const sharded_lru_map&) = delete;
+
+    ~sharded_lru_map() = default;
+
+    /**
+     * Sets the timeout after which inactive elements will be purged from the
+     * cache.
+     * @param timeout_sec Number of seconds after which inactive element will
+     *                    be removed.
+     */
+    void set_timeout(std::size_t timeout_sec)
+    {
+        _timeout.store(std::chrono::seconds{timeout_sec}, std::memory_order_relaxed);
+    }
+
+    /**
+     * Tests whether a not expired value with a given key exists in this container
+     * @param key Key to test.
+     * @return <code>true</code> if a value with a given key exists in
+     *         this container, <code>false</code> otherwise.
+     */
+    bool contains_key(const key_type &key) const
+    {
+        const _shard &sh = _get_shard(key);
+        std::lock_guard<std::mutex> guard{sh.mutex};
+        auto it = sh.index.find(key);
+        return it != sh.index.end() && !_expired(*it->second, clock_type::now());
+    }
+
+    /**
+     * Clear content
+     *
+     * <p>Removes all elements from the container (which are destroyed),
+     * leaving the container with a size of <code>0</code></p>
+     */
+    void clear()
+    {
+        for (auto &&sh : _shards)
+        {
+            std::lock_guard<std::mutex> guard{sh.mutex};
+            for (auto &&e : sh.lru) _weight.fetch_sub(e.weight, std::memory_order_relaxed);
+            sh.index.clear();
+            sh.lru.clear();
+            sh.pending.clear();
+        }
+    }
+
+    /**
+     * Returns the number of elements in this container, including those which
+     * has expired, but have not been removed yet.
+     * @return the number of elements in this container.
+     */
+    size_type size() const
+    {
+        size_type size = 0;
+        for (auto &&sh : _shards)
+        {
+            std::lock_guard<std::mutex> guard{sh.mutex};
+            size += sh.index.size();
+        }
+        return size;
+    }
+
+    /**
+     * Returns the total weight of the elements in this container.
+     * @return sum of the weights set with #set_weight.
+     * @see #set_weight
+     */
+    size_type weight() const { return _weight.load(std::memory_order_relaxed); }
+
+    /**
+     * Sets the weight of the element with a given key. The weight is reset
+     * to <code>0</code> when the value of the element is replaced.
+     * @param key Key of the element.
+     * @param weight New weight of the element.
+     * @return <code>false</code> if there is no element with a given key.
+     * @see #weight
+     */
+    bool set_weight(const key_type &key, size_type weight)
+    {
+        _shard &sh = _get_shard(key);
+        std::lock_guard<std::mutex> guard{sh.mutex};
+        auto it = sh.index.find(key);
+        if (it == sh.index.end()) return false;
+        _entry &e = *it->second;
+        /* The total is shared by all threads, it is only written if the weight changes */
+        if (e.weight == weight) return true;
+        _weight.fetch_add(weight, std::memory_order_relaxed);
+        _weight.fetch_sub(e.weight, std::memory_order_relaxed);
+        e.weight = weight;
+        return true;
+    }
+
+    /**
+     * Returns a copy of the value with a given key and marks it as recently used.
+     * @param key Key to be searched for.
+     * @return copy of the found value, or default constructed value if a not
+     *         expired value with a given key doesn't exists in this container.
+     */
+    mapped_type get(const key_type& key)
+    {
+        _shard &sh = _get_shard(key);
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> guard{sh.mutex};
+        auto it = sh.index.find(key);
+        if (it == sh.index.end()) return mapped_type{};
+        /* Expired element is left for #expire, so that its owner is notified */
+        if (_expired(*it->second, now)) return mapped_type{};
+        if (now - it->second->last_access >= touch_interval())
+        {
+            it->second->last_access = now;
+            _queue_relink(sh, it->second);
+        }
+        return it->second->value;
+    }
+
+    /**
+     * Associates a value of specified type created with a given arguments
+     * with the specified key in this map. If the map previously contained
+     * a mapping for the key, the old value is replaced.
+     * @tparam Args types of the arguments to be forwarded to new mapped
+     *         value constructor.
+     * @param key key with which the specified value is to be associated
+     * @param args arguments to create the mapped value
+     * @return <code>bool</code> denoting whether the previous value was replaced.
+     * @see #try_put
+     */
+    template<class... Args>
+    bool put(const key_type& key, Args &&... args)
+    {
+        return _put(key, true, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Associates a value of specified type created with a given arguments
+     * with the specified key in this map. If the map previously contained
+     * a mapping for the key, does nothing.
+     * @tparam Args types of the arguments to be forwarded to new mapped
+     *         value constructor.
+     * @param key key with which the specified value is to be associated
+     * @param args argument to create the mapped value
+     * @return <code>bool</code> denoting whether insertion took place.
+     * @see #put
+     */
+    template<class... Args>
+    bool try_put(const key_type& key, Args &&... args)
+    {
+        return !_put(key, false, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Erase element.
+     *
+     * Removes from the container a single element identified by
+     * a given key. Does nothing if the element with a given key is
+     * not found.
+     * @param key Key of the element to remove.
+     * @return <code>true</code> if the element was actually removed,
+     *         <code>false</code> otherwise.
+     */
+    bool erase(const key_type &key)
+    {
+        _shard &sh = _get_shard(key);
+        std::lock_guard<std::mutex> guard{sh.mutex};
+        auto it = sh.index.find(key);
+        if (it == sh.index.end()) return false;
+        if (it->second->pending_slot != _not_pending) sh.pending[it->second->pending_slot] = sh.lru.end();
+        _weight.fetch_sub(it->second->weight, std::memory_order_relaxed);
+        sh.lru.erase(it->second);
+        sh.index.erase(it);
+        return true;
+    }
+
+    /**
+     * Calls <code>fn(key, value)</code> for every not expired element of
+     * this container. The function is called with the lock of a shard
+     * held, so it must not use this container.
+     * @tparam Fn type of the function.
+     * @param fn Function called for every element.
+     */
+    template<class Fn>
+    void for_each(Fn fn) const
+    {
+        auto now = clock_type::now();
+        for (auto &&sh : _shards)
+        {
+            std::lock_guard<std::mutex> guard{sh.mutex};
+            for (auto &&e : sh.lru)
+            {
+                if (!_expired(e, now)) fn(*e.key, e.value);
+            }
+        }
+    }
+
+    /**
+     * Removes expired elements from this container.
+     *
+     * <p>Shards are visited in turn, starting from where the previous call
+     * stopped, and at most <code>max_count</code> elements are removed, so
+     * that a single call has a bounded cost. For every removed element
+     * <code>fn(key, value)</code> is called after the shard lock is released,
+     * so the function may use this container.</p>
+     * @tparam Fn type of the function called with removed elements.
+     * @param max_count Maximum number of elements to remove.
+     * @param fn Function called for every removed element.
+     * @return number of removed elements. If it equals to <code>max_count</code>
+     *         more expired elements may remain.
+     */
+    template<class Fn>
+    size_type expire(size_type max_count, Fn fn)
+    {
+        std::vector<std::pair<key_type, mapped_type>> expired;
+        size_type start = _sweep_cursor.load(std::memory_order_relaxed);
+        size_type visited = 0;
+        auto now = clock_type::now();
+        for (; visited < _Shards && expired.size() < max_count; ++visited)
+        {
+            _shard &sh = _shards[(start + visited) % _Shards];
+            std::lock_guard<std::mutex> guard{sh.mutex};
+            _relink(sh);
+            while (!sh.lru.empty() && expired.size() < max_count && _expired(sh.lru.front(), now))
+            {
+                auto idx = sh.index.find(*sh.lru.front().key);
+                expired.emplace_back(std::move(idx->first), std::move(sh.lru.front().value));
+                _weight.fetch_sub(sh.lru.front().weight, std::memory_order_relaxed);
+                sh.lru.pop_front();
+                sh.index.erase(idx);
+            }
+            /* Shard which might still have expired elements is visited first next time */
+            if (expired.size() == max_count) break;
+        }
+        _sweep_cursor.store((start + visited) % _Shards, std::memory_order_relaxed);
+        for (auto &&e : expired) fn(e.first, e.second);
+        return expired.size();
+    }
+
+    /**
+     * Removes one element to make room for others.
+     *
+     * <p>Up to <code>sample</code> non empty shards are visited in turn and
+     * up to <code>sample</code> least recently used elements of each are
+     * considered. An expired element is removed if one is found, otherwise
+     * the one for which <code>rank(key, value)</code> is the lowest, the least
+     * recently used of equal ones. <code>fn(key, value)</code> is called for
+     * the removed element after the shard lock is released, so the function
+     * may use this container.</p>
+     * @tparam Rank type of the function returning comparable rank of an element.
+     * @tparam Fn type of the function called with the removed element.
+     * @param sample Number of shards and of elements in a shard to choose from.
+     * @param rank Function ranking the elements, lower ranks are removed first.
+     *             It is called with the lock of a shard held.
+     * @param fn Function called for the removed element.
+     * @return <code>false</code> if the container is empty.
+     */
+    template<class Rank, class Fn>
+    bool evict(size_type sample, Rank rank, Fn fn)
+    {
+        size_type start = _evict_cursor.fetch_add(1, std::memory_order_relaxed);
+        auto now = clock_type::now();
+        size_type best = _Shards;
+        decltype(rank(std::declval<const key_type&>(), std::declval<const mapped_type&>())) best_rank{};
+        for (size_type i = 0, seen = 0; i < _Shards && seen < sample; ++i)
+        {
+            size_type index = (start + i) % _Shards;
+            _shard &sh = _shards[index];
+            std::lock_guard<std::mutex> guard{sh.mutex};
+            if (sh.lru.empty()) continue;
+            ++seen;
+            auto victim = _victim(sh, sample, rank, now);
+            if (_expired(*victim, now))
+            {
+                best = index;
+                break;
+            }
+            auto r = rank(*victim->key, victim->value);
+            if (best == _Shards || r < best_rank)
+            {
+                best = index;
+                best_rank = r;
+            }
+        }
+        if (best == _Shards) return false;
+        _shard &sh = _shards[best];
+        std::unique_lock<std::mutex> guard{sh.mutex};
+        /* The shard could have changed since it was chosen */
+        if (sh.lru.empty()) return true;
+        auto victim = _victim(sh, sample, rank, now);
+        auto idx = sh.index.find(*victim->key);
+        std::pair<key_type, mapped_type> removed{idx->first, std::move(victim->value)};
+        _weight.fetch_sub(victim->weight, std::memory_order_relaxed);
+        sh.lru.erase(victim);
+        sh.index.erase(idx);
+        guard.unlock();
+        fn(removed.first, removed.second);
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock clock_type;
+
+    struct _entry
+    {
+        template<class... Args>
+        _entry(const key_type *k, clock_type::time_point t, Args &&... args) :
+                key{k}, value(std::forward<Args>(args)...), last_access{t} {}
+
+        const key_type *key; /* points to the key in the index */
+        mapped_type value;
+        clock_type::time_point last_access;
+        size_type pending_slot = _not_pending;
+        size_type weight = 0;
+    };
+    typedef std::list<_entry> list_type;
+
+    static constexpr size_type _not_pending = static_cast<size_type>(-1);
+
+    /* Shards are cache line aligned, so that their locks don't share lines */
+    struct alignas(64) _shard
+    {
+        mutable std::mutex mutex;
+        list_type lru; /* least recently used first, except for the pending elements */
+        std::unordered_map<key_type, typename list_type::iterator, _Hash> index;
+        /* Elements accessed since the last #expire; erased ones are replaced with lru.end() */
+        std::vector<typename list_type::iterator> pending;
+    };
+
+    static void _queue_relink(_shard &sh, typename list_type::iterator e)
+    {
+        if (e->pending_slot != _not_pending) return;
+        e->pending_slot = sh.pending.size();
+        sh.pending.push_back(e);
+    }
+
+    /* Best candidate for eviction among sample least recently used elements of a non empty shard */
+    template<class Rank>
+    typename list_type::iterator _victim(_shard &sh, size_type sample, Rank &rank, clock_type::time_point now)
+    {
+        _relink(sh);
+        auto victim = sh.lru.begin();
+        if (_expired(*victim, now)) return victim;
+        auto victim_rank = rank(*victim->key, victim->value);
+        size_type n = 1;
+        for (auto e = std::next(victim); e != sh.lru.end() && n < sample; ++e, ++n)
+        {
+            if (_expired(*e, now)) return e;
+            auto r = rank(*e->key, e->value);
+            if (r < victim_rank)
+            {
+                victim = e;
+                victim_rank = r;
+            }
+        }
+        return victim;
+    }
+
+    /* Moves the accessed elements to the end of the LRU list in the order of their access */
+    static void _relink(_shard &sh)
+    {
+        if (sh.pending.empty()) return;
+        auto end = std::remove(sh.pending.begin(), sh.pending.end(), sh.lru.end());
+        std::sort(sh.pending.begin(), end, [](typename list_type::iterator a, typename list_type::iterator b)
+        {
+            return a->last_access < b->last_access;
+        });
+        for (auto e = sh.pending.begin(); e != end; ++e)
+        {
+            (*e)->pending_slot = _not_pending;
+            sh.lru.splice(sh.lru.end(), sh.lru, *e);
+        }
+        sh.pending.clear();
+    }
+
+    _shard& _get_shard(const key_type &key) { return _shards[_shard_index(key)]; }
+    const _shard& _get_shard(const key_type &key) const { return _shards[_shard_index(key)]; }
+
+    static size_type _shard_index(const key_type &key)
+    {
+        /* Hash is mixed, so that the index does not correlate with the buckets of the shard */
+        std::uint64_t h = static_cast<std::uint64_t>(_Hash{}(key)) * 0x9E3779B97F4A7C15ull;
+        return static_cast<size_type>(h >> 32) % _Shards;
+    }
+
+    bool _expired(const _entry &e, clock_type::time_point now) const
+    {
+        return now - e.last_access > _timeout.load(std::memory_order_relaxed);
+    }
+
+    /* Returns true if the key existed */
+    template<class... Args>
+    bool _put(const key_type& key, bool replace, Args &&... args)
+    {
+        _shard &sh = _get_shard(key);
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> guard{sh.mutex};
+        auto it = sh.index.find(key);
+        if (it != sh.index.end())
+        {
+            /* Expired element is not there for the callers and is simply replaced */
+            bool alive = !_expired(*it->second, now);
+            if (!replace && alive) return true;
+            it->second->value = mapped_type(std::forward<Args>(args)...);
+            it->second->last_access = now;
+            _weight.fetch_sub(it->second->weight, std::memory_order_relaxed);
+            it->second->weight = 0;
+            _queue_relink(sh, it->second);
+            return alive;
+        }
+        it = sh.index.emplace(key, sh.lru.end()).first;
+        try
+        {
+            it->second = sh.lru.emplace(sh.lru.end(), &it->first, now, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            sh.index.erase(it);
+            throw;
+        }
+        /* Elements accessed earlier may still be placed behind it */
+        try
+        {
+            _queue_relink(sh, it->second);
+        }
+        catch (...)
+        {
+            sh.lru.erase(it->second);
+            sh.index.erase(it);
+            throw;
+        }
+        return false;
+    }
+
+    std::atomic<clock_type::duration> _timeout;
+    std::atomic<size_type> _sweep_cursor{0};
+    std::atomic<size_type> _evict_cursor{0};
+    std::atomic<size_type> _weight{0};
+    _shard _shards[_Shards];
+};
+
 } // end of servlet namespace
 
 #endif // MOD_SERVLET_TIMED_MAP_H
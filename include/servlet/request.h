@@ -8,11 +8,16 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef SERVLET_REQUEST_H
 #define SERVLET_REQUEST_H
 
+#include <cstdint>
+#include <map>
+#include <string>
 #include <vector>
 #include <memory>
 
 #include <servlet/uri.h>
+#include <servlet/cancellation.h>
 #include <servlet/cookie.h>
+#include <servlet/header.h>
 #include <servlet/session.h>
 #include <servlet/ssl.h>
 #include <servlet/lib/io.h>
@@ -260,6 +265,35 @@ public:
      *         header of that name
      */
     virtual string_view get_header(const std::string& name) const = 0;
+    /**
+     * Returns the value of the specified request header.
+     *
+     * <p>The default implementation calls #get_header(const std::string&).</p>
+     * @param name null terminated header name
+     * @return a <code>string_view</code> containing the value of the requested
+     *         header, or empty view if the request does not have a
+     *         header of that name
+     */
+    virtual string_view get_header(const char* name) const { return get_header(std::string{name}); }
+    /**
+     * Returns the value of the specified request header.
+     *
+     * <p>Usual header names are copied to the stack to be null terminated,
+     * no memory is allocated.</p>
+     * @param name the header name
+     * @return the value of the requested header, or empty view if the request
+     *         does not have a header of that name
+     * @see #get_header(const char*)
+     */
+    string_view get_header(string_view name) const { return get_header(header_name_buffer{name}.c_str()); }
+    /**
+     * Returns the value of the specified well known request header.
+     * @param header the header
+     * @return the value of the requested header, or empty view if the request
+     *         does not have this header
+     * @see #get_header(const char*)
+     */
+    string_view get_header(http_header header) const { return get_header(header_name(header)); }
 
     /**
      * Returns the value of the specified request header as a <code>long</code>
@@ -281,6 +315,23 @@ public:
      * @exception stack_bad_cast If the header value can't be converted to a date
      */
     virtual long get_date_header(const std::string& name) const = 0;
+    /**
+     * Returns the value of the specified request header as a date.
+     *
+     * <p>The default implementation calls #get_date_header(const std::string&).</p>
+     * @param name null terminated name of the header
+     * @return the date, or -1 if the named header was not included with the request
+     * @exception stack_bad_cast If the header value can't be converted to a date
+     */
+    virtual long get_date_header(const char* name) const { return get_date_header(std::string{name}); }
+    /**
+     * @see #get_date_header(const char*)
+     */
+    long get_date_header(string_view name) const { return get_date_header(header_name_buffer{name}.c_str()); }
+    /**
+     * @see #get_date_header(const char*)
+     */
+    long get_date_header(http_header header) const { return get_date_header(header_name(header)); }
 
     /**
      * Returns the MIME type of the body of the request, or empty string if
@@ -317,10 +368,56 @@ public:
     /**
      * Fills the <code>std::vector</code> with all the request header values.
      *
+     * <p>All the names and values are copied, #for_each_header can be
+     * used to iterate over the headers without copying.</p>
      * @param headers The values for all the header values.
      */
     virtual void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const = 0;
 
+    /**
+     * Calls the visitor function for every request header, or for every
+     * header with the given name.
+     *
+     * <p>This is the low level interface behind #for_each_header.</p>
+     * @param name null terminated name of the headers to visit, or
+     *             <code>nullptr</code> to visit all the headers
+     * @param visitor Function to call for every header
+     * @param data User data to pass to the visitor
+     */
+    virtual void visit_headers(const char* name, header_visit_fn visitor, void *data) const = 0;
+
+    /**
+     * Calls the visitor for every request header.
+     *
+     * <p>Visitor is called with name and value of the header as
+     * <code>string_view</code> which point to the request data, so nothing
+     * is copied. If the visitor returns <code>bool</code>, returning
+     * <code>false</code> stops the iteration.</p>
+     * @tparam Visitor callable object accepting two <code>string_view</code> arguments
+     * @param visitor Visitor to call
+     */
+    template<typename Visitor>
+    void for_each_header(Visitor&& visitor) const
+    {
+        using visitor_type = typename std::remove_reference<Visitor>::type;
+        visit_headers(nullptr, &header_visitor_adapter<visitor_type>::visit,
+                      const_cast<void*>(static_cast<const void*>(&visitor)));
+    }
+    /**
+     * Calls the visitor for every request header with the given name.
+     * @tparam Visitor callable object accepting two <code>string_view</code> arguments
+     * @param name Name of the header
+     * @param visitor Visitor to call
+     * @see #for_each_header(Visitor&&)
+     */
+    template<typename Visitor>
+    void for_each_header(string_view name, Visitor&& visitor) const
+    {
+        using visitor_type = typename std::remove_reference<Visitor>::type;
+        visit_headers(header_name_buffer{name}.c_str(), &header_visitor_adapter<visitor_type>::visit,
+                      const_cast<void*>(static_cast<const void*>(&visitor)));
+    }
+
     /**
      * Returns the name of the HTTP method with which this request was made, for
      * example, GET, POST, or PUT. Same as the value of the CGI variable
@@ -530,7 +627,24 @@ public:
      * <code>get_input_stream</code> will return the input stream for the current part
      * of the multipart stream.
      *
+     * <p>If the body is compressed (<code>Content-Encoding</code> is "gzip" or
+     * "deflate") it is inflated transparently, so the stream contains the
+     * decompressed data. The input stream limit applies to the decompressed data,
+     * if it is exceeded the stream fails. Note that #get_content_length still
+     * returns the length of the compressed body.</p>
+     *
+     * <p>Normally the body can be read only once and every call returns the
+     * same stream. If the servlet is configured with <code>&lt;body-replay&gt;</code>
+     * in web.xml, the body is saved while it is read (in memory, or in a
+     * temporary file if it is larger than the <code>file-size-threshold</code> of
+     * <code>&lt;multipart-config&gt;</code>) and every call returns a new stream
+     * reading the body from the beginning. This way filters can inspect the body
+     * before the servlet reads it. If the body could not be read completely (the
+     * read failed or the body exceeded the input stream limit) it is not replayed:
+     * later calls throw <code>io_exception</code>.</p>
+     *
      * @return a <code>std::istream</code> object containing the body of the request
+     * @throws io_exception if the body is replayed and it was not read completely.
      * @see #get_multipart_input
      */
     virtual std::istream& get_input_stream() = 0;
@@ -565,6 +679,129 @@ public:
      * @see #get_input_stream
      */
     virtual bool is_multipart() const = 0;
+
+    /**
+     * Returns the cancellation token of this request.
+     *
+     * <p>The token carries the deadline of the request, which is configured
+     * for the servlet with <code>&lt;deadline&gt;</code> in web.xml (in
+     * milliseconds) or comes from the request header named by
+     * <code>&lt;deadline-header&gt;</code>; the earlier one applies. The token
+     * also fires if the client aborts the connection.</p>
+     *
+     * <p>Once the token fires, reads of the request body, writes to the
+     * response and includes fail with <code>request_cancelled_exception</code>
+     * (streams go to the bad state).</p>
+     *
+     * @return the cancellation token of this request.
+     * @see cancellation_token
+     */
+    virtual cancellation_token& get_cancellation_token() = 0;
+
+    /**
+     * Returns time left until the deadline of this request.
+     * @return time left, zero if the deadline has passed or
+     *         <code>milliseconds::max()</code> if the request has no deadline.
+     * @see #get_cancellation_token
+     */
+    std::chrono::milliseconds remaining_time() { return get_cancellation_token().remaining_time(); }
+};
+
+/**
+ * Part of a multipart stream saved by multipart_input#spool_part.
+ *
+ * <p>Parts not larger than the <code>file-size-threshold</code> of the
+ * webapp's <code>&lt;multipart-config&gt;</code> are kept in memory,
+ * larger ones are written to a temporary file in the
+ * <code>location</code> directory (<code>WEB-INF/work</code> by default)
+ * as they are read from the client. Either way #move_to puts the content
+ * to its final place; the temporary file is just renamed, so the data is
+ * not copied once again.</p>
+ *
+ * <p>Temporary file which has not been moved is removed when this object
+ * is destroyed.</p>
+ */
+class spooled_part
+{
+public:
+    spooled_part() = default;
+    /**
+     * Constructs spooled part.
+     * @param headers Headers of the part.
+     * @param data Content of the part if it is kept in memory.
+     * @param path Temporary file with the content of the part or empty
+     *             string if it is kept in memory.
+     * @param size Size of the content of the part.
+     */
+    spooled_part(const std::map<std::string, std::vector<std::string>, std::less<>> &headers,
+                 std::string &&data, std::string &&path, std::size_t size) :
+            _headers{headers}, _data{std::move(data)}, _path{std::move(path)}, _size{size},
+            _temporary{!_path.empty()} {}
+
+    spooled_part(const spooled_part&) = delete;
+    spooled_part(spooled_part&& other) noexcept :
+            _headers{std::move(other._headers)}, _data{std::move(other._data)},
+            _path{std::move(other._path)}, _size{other._size}, _temporary{other._temporary}
+    { other._temporary = false; }
+
+    spooled_part& operator=(const spooled_part&) = delete;
+    spooled_part& operator=(spooled_part&& other) noexcept;
+
+    ~spooled_part() noexcept;
+
+    /**
+     * Obtain all the headers of this part.
+     * @return All the headers of this part.
+     */
+    const std::map<std::string, std::vector<std::string>, std::less<>>& get_headers() const { return _headers; }
+
+    /**
+     * Returns whether the content of this part is kept in memory.
+     * @return <code>true</code> if the content is available with #get_data,
+     *         <code>false</code> if it is stored in the file #get_path.
+     */
+    bool in_memory() const noexcept { return _path.empty(); }
+
+    /**
+     * Returns path of the temporary file with the content of this part.
+     * @return Path to the temporary file or empty string if the content
+     *         is kept in memory.
+     */
+    const std::string& get_path() const noexcept { return _path; }
+
+    /**
+     * Returns the content of this part if it is kept in memory.
+     * @return Content of this part or empty string if it is stored in a file.
+     */
+    const std::string& get_data() const noexcept { return _data; }
+
+    /**
+     * Returns size of the content of this part.
+     * @return Size of the content in bytes.
+     */
+    std::size_t get_size() const noexcept { return _size; }
+
+    /**
+     * Moves the content of this part to the given file.
+     *
+     * <p>Temporary file is renamed, it is copied only if the destination
+     * is on a different file system. Content kept in memory is written to
+     * the file. After this call #get_path returns the new path.</p>
+     *
+     * <p>Renamed temporary file keeps its permissions: it is accessible by
+     * the server user only.</p>
+     *
+     * @param path Destination file path. Existing file is replaced.
+     * @throws io_exception if the file cannot be moved or written.
+     */
+    void move_to(const std::string &path);
+
+private:
+    std::map<std::string, std::vector<std::string>, std::less<>> _headers;
+    std::string _data;
+    std::string _path;
+    std::size_t _size = 0;
+    bool _temporary = false;
 };
 
 /**
@@ -673,6 +910,54 @@ public:
      */
     virtual std::istream& get_input_stream() = 0;
 
+    /**
+     * Reads the rest of the current part and saves it either in memory or,
+     * if it is larger than the configured threshold, in a temporary file.
+     *
+     * <p>Data goes from the request straight to the file, so there is no
+     * need to copy it through <code>std::istream</code>. After this call the
+     * input stream of the current part is exhausted.</p>
+     *
+     * @return Saved part with its headers.
+     * @throws io_exception if the temporary file cannot be written or if the
+     *         part is larger than the <code>max-file-size</code> of the
+     *         webapp's <code>&lt;multipart-config&gt;</code>.
+     * @see spooled_part
+     */
+    virtual spooled_part spool_part() = 0;
+
+    /**
+     * Saves the given stream as the content of the current part the same
+     * way as #spool_part does. This is meant for wrappers which transform
+     * the content of the parts.
+     *
+     * @param in Stream with the content of the current part.
+     * @return Saved part with the headers of the current part.
+     * @throws io_exception if the temporary file cannot be written or if the
+     *         part is larger than <code>max-file-size</code>.
+     */
+    virtual spooled_part spool_part(std::istream& in) = 0;
+
+    /**
+     * Returns the digest of the content of the current part.
+     *
+     * <p>The digest is computed while the part is scanned for the boundary,
+     * so it doesn't need another pass over the data. Its algorithm is set
+     * by the <code>digest</code> element of the webapp's
+     * <code>&lt;multipart-config&gt;</code>: <code>crc32c</code> (computed
+     * with SSE4.2 instruction where available) or <code>xxh64</code>. The
+     * digest is calculated over the raw content of the part, before any
+     * filters are applied.</p>
+     *
+     * <p>The digest becomes available once the part is read to its end,
+     * for example by #spool_part or by reading #get_input_stream until
+     * end of file.</p>
+     *
+     * @return Digest of the current part or empty reference if no digest
+     *         is configured or the part hasn't been read to its end yet.
+     */
+    virtual optional_ref<const std::uint64_t> get_digest() const = 0;
+
     /**
      * Moves this multipart_input to the next part.
      *
@@ -731,6 +1016,10 @@ public:
     string_view get_servlet_path() const override { return _req.get_servlet_path(); }
     const URI& get_request_uri() const override { return _req.get_request_uri(); }
     string_view get_path_info() const override { return _req.get_path_info(); }
+    using http_request::get_header;
+    using http_request::get_date_header;
+    /* Only the std::string forms are forwarded, so subclasses overriding them
+     * see the calls made with the other overloads as well */
     string_view get_header(const std::string& name) const override { return _req.get_header(name); }
     long get_date_header(const std::string& name) const override { return _req.get_date_header(name); }
 
@@ -741,6 +1030,8 @@ public:
     { return _req.get_headers(name, headers); }
     void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const override
     { return _req.get_headers(headers); }
+    void visit_headers(const char* name, header_visit_fn visitor, void *data) const override
+    { _req.visit_headers(name, visitor, data); }
 
     string_view get_method() const override { return _req.get_method(); }
 
@@ -771,6 +1062,8 @@ public:
 
     bool is_multipart() const override { return _req.is_multipart(); }
 
+    cancellation_token& get_cancellation_token() override { return _req.get_cancellation_token(); }
+
     std::istream& get_input_stream() override;
     multipart_input& get_multipart_input() override;
 
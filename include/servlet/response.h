@@ -13,6 +13,7 @@ http://boost.org/LICENSE_1_0.txt
 #include <experimental/string_view>
 
 #include <servlet/cookie.h>
+#include <servlet/header.h>
 #include <servlet/lib/io.h>
 #include <servlet/lib/io_filter.h>
 #include <servlet/lib/optional.h>
@@ -53,6 +54,29 @@ public:
      * @see #set_header
      */
     virtual void add_header(const std::string &name, const std::string &value) = 0;
+    /**
+     * Adds a well known response header with the given value.
+     *
+     * <p>Name of the header is not copied. The default implementation calls
+     * #add_header(const std::string&, const std::string&).</p>
+     * @param header the header
+     * @param value the additional header value
+     * @see #add_header(const std::string&, const std::string&)
+     */
+    virtual void add_header(http_header header, string_view value)
+    { add_header(std::string{header_name(header)}, value.to_string()); }
+
+    /**
+     * Adds a response header without copying its name and value.
+     *
+     * <p>Both strings must stay valid until the request is completed, so
+     * this method is suitable for string literals and other strings with
+     * static storage duration.</p>
+     * @param name null terminated name of the header
+     * @param value null terminated header value
+     * @see #add_header(const std::string&, const std::string&)
+     */
+    virtual void add_header_n(const char* name, const char* value) { add_header(std::string{name}, std::string{value}); }
 
     /**
      * Adds a response header with the given name and date-value. The date is
@@ -95,6 +119,29 @@ public:
      * @see #add_header
      */
     virtual void set_header(const std::string &name, const std::string &value) = 0;
+    /**
+     * Sets a well known response header with the given value.
+     *
+     * <p>Name of the header is not copied. The default implementation calls
+     * #set_header(const std::string&, const std::string&).</p>
+     * @param header the header
+     * @param value the header value
+     * @see #set_header(const std::string&, const std::string&)
+     */
+    virtual void set_header(http_header header, string_view value)
+    { set_header(std::string{header_name(header)}, value.to_string()); }
+
+    /**
+     * Sets a response header without copying its name and value.
+     *
+     * <p>Both strings must stay valid until the request is completed, so
+     * this method is suitable for string literals and other strings with
+     * static storage duration.</p>
+     * @param name null terminated name of the header
+     * @param value null terminated header value
+     * @see #set_header(const std::string&, const std::string&)
+     */
+    virtual void set_header_n(const char* name, const char* value) { set_header(std::string{name}, std::string{value}); }
 
     /**
      * Sets a response header with the given name and date-value. The date is
@@ -138,6 +185,24 @@ public:
      *         set; <code>false</code> otherwise
      */
     virtual bool contains_header(const std::string &name) const = 0;
+    /**
+     * Returns a boolean indicating whether the named response header has
+     * already been set.
+     *
+     * <p>The default implementation calls #contains_header(const std::string&).</p>
+     * @param name null terminated header name
+     * @return <code>true</code> if the named response header has already been
+     *         set; <code>false</code> otherwise
+     */
+    virtual bool contains_header(const char* name) const { return contains_header(std::string{name}); }
+    /**
+     * @see #contains_header(const char*)
+     */
+    bool contains_header(string_view name) const { return contains_header(header_name_buffer{name}.c_str()); }
+    /**
+     * @see #contains_header(const char*)
+     */
+    bool contains_header(http_header header) const { return contains_header(header_name(header)); }
 
     /**
      * Return the value for the specified header, or empty string if this
@@ -153,6 +218,23 @@ public:
      *         will be returned as a single header value .
      */
     virtual string_view get_header(const std::string& name) const = 0;
+    /**
+     * Return the value for the specified header, or empty string if this
+     * header has not been set.
+     *
+     * <p>The default implementation calls #get_header(const std::string&).</p>
+     * @param name Null terminated header name to look up
+     * @return The first value for the specified header.
+     */
+    virtual string_view get_header(const char* name) const { return get_header(std::string{name}); }
+    /**
+     * @see #get_header(const char*)
+     */
+    string_view get_header(string_view name) const { return get_header(header_name_buffer{name}.c_str()); }
+    /**
+     * @see #get_header(const char*)
+     */
+    string_view get_header(http_header header) const { return get_header(header_name(header)); }
 
     /**
      * Return the date value for the specified header, or <code>-1</code> if this
@@ -165,6 +247,23 @@ public:
      * @return The first value for the specified header converted into long.
      */
     virtual long get_date_header(const std::string& name) const = 0;
+    /**
+     * Return the date value for the specified header, or <code>-1</code> if this
+     * header has not been set.
+     *
+     * <p>The default implementation calls #get_date_header(const std::string&).</p>
+     * @param name Null terminated header name to look up
+     * @return The first value for the specified header converted into long.
+     */
+    virtual long get_date_header(const char* name) const { return get_date_header(std::string{name}); }
+    /**
+     * @see #get_date_header(const char*)
+     */
+    long get_date_header(string_view name) const { return get_date_header(header_name_buffer{name}.c_str()); }
+    /**
+     * @see #get_date_header(const char*)
+     */
+    long get_date_header(http_header header) const { return get_date_header(header_name(header)); }
 
     /**
      * Fills the <code>std::vector</code> with all the header values associated with the
@@ -180,10 +279,55 @@ public:
     /**
      * Fills the <code>std::vector</code> with all the response header values.
      *
+     * <p>All the names and values are copied, #for_each_header can be
+     * used to iterate over the headers without copying.</p>
      * @param headers The values for the headers.
      */
     virtual void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const = 0;
 
+    /**
+     * Calls the visitor function for every response header, or for every
+     * header with the given name.
+     *
+     * <p>This is the low level interface behind #for_each_header.</p>
+     * @param name null terminated name of the headers to visit, or
+     *             <code>nullptr</code> to visit all the headers
+     * @param visitor Function to call for every header
+     * @param data User data to pass to the visitor
+     */
+    virtual void visit_headers(const char* name, header_visit_fn visitor, void *data) const = 0;
+
+    /**
+     * Calls the visitor for every response header set so far.
+     *
+     * <p>Visitor is called with name and value of the header as
+     * <code>string_view</code>, nothing is copied. If the visitor returns
+     * <code>bool</code>, returning <code>false</code> stops the iteration.</p>
+     * @tparam Visitor callable object accepting two <code>string_view</code> arguments
+     * @param visitor Visitor to call
+     */
+    template<typename Visitor>
+    void for_each_header(Visitor&& visitor) const
+    {
+        using visitor_type = typename std::remove_reference<Visitor>::type;
+        visit_headers(nullptr, &header_visitor_adapter<visitor_type>::visit,
+                      const_cast<void*>(static_cast<const void*>(&visitor)));
+    }
+    /**
+     * Calls the visitor for every response header with the given name.
+     * @tparam Visitor callable object accepting two <code>string_view</code> arguments
+     * @param name Name of the header
+     * @param visitor Visitor to call
+     * @see #for_each_header(Visitor&&)
+     */
+    template<typename Visitor>
+    void for_each_header(string_view name, Visitor&& visitor) const
+    {
+        using visitor_type = typename std::remove_reference<Visitor>::type;
+        visit_headers(header_name_buffer{name}.c_str(), &header_visitor_adapter<visitor_type>::visit,
+                      const_cast<void*>(static_cast<const void*>(&visitor)));
+    }
+
     /**
      * Returns the content type used for the MIME body sent in this response.
      * The content type proper must have been specified using
@@ -237,6 +381,7 @@ public:
      * considered to be committed and should not be written to.
      *
      * @param redirectURL the redirect location URL
+     * @throws uri_syntax_error if the location is not a valid URI reference.
      */
     virtual void send_redirect(const std::string &redirectURL) = 0;
 
@@ -569,6 +714,15 @@ public:
     const http_response& get_wrapped_request() const { return _resp; }
 
     void add_cookie(const cookie& c) override { _resp.add_cookie(c); }
+    using http_response::add_header;
+    using http_response::add_date_header;
+    using http_response::set_header;
+    using http_response::set_date_header;
+    using http_response::contains_header;
+    using http_response::get_header;
+    using http_response::get_date_header;
+    /* Only the std::string forms are forwarded, so subclasses overriding them
+     * see the calls made with the other overloads as well */
     void add_header(const std::string &name, const std::string &value) override { _resp.add_header(name, value); }
     void add_date_header(const std::string &name, long timeSec) override { _resp.add_date_header(name, timeSec); }
     void set_header(const std::string &name, const std::string &value) override { _resp.set_header(name, value); }
@@ -581,6 +735,8 @@ public:
     { _resp.get_headers(name, headers); }
     void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const override
     { _resp.get_headers(headers); }
+    void visit_headers(const char* name, header_visit_fn visitor, void *data) const override
+    { _resp.visit_headers(name, visitor, data); }
 
     string_view get_content_type() const override { return _resp.get_content_type(); }
     void set_content_type(const std::string &content_type) override { _resp.set_content_type(content_type); }
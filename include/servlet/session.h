@@ -8,21 +8,149 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_SESSION_H
 #define MOD_SERVLET_SESSION_H
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
+#include <shared_mutex>
+#include <typeindex>
+#include <unordered_map>
 #include <experimental/string_view>
 
 #include <servlet/lib/any_map.h>
+#include <servlet/lib/cow_any_map.h>
+
+/**
+ * Macro to export the session listener factory method to make a listener
+ * available to <code>mod_servlet</code> container. For more details see
+ * documentation for servlet::http_session_listener.
+ */
+#define SESSION_LISTENER_EXPORT(factoryName, className) \
+    extern "C" servlet::http_session_listener* factoryName() { return new className{}; }
 
 namespace servlet
 {
 
-std::string generate_session_id();
-
 using std::experimental::string_view;
 using std::experimental::any;
 
+/**
+ * Identifier of a session.
+ *
+ * <p>It is 16 random bytes kept in binary form, so that it is stored inline
+ * in the session and in the session map. Its text form is 32 upper case
+ * hexadecimal digits, which is what cookies and session stores use.</p>
+ */
+class session_id
+{
+public:
+    /**
+     * Size of the identifier in bytes.
+     */
+    static constexpr std::size_t SIZE = 16;
+
+    /**
+     * Constructs the identifier with all bytes zero.
+     */
+    session_id() noexcept = default;
+
+    /**
+     * Generates a new random identifier.
+     * @return the generated identifier.
+     */
+    static session_id generate();
+
+    /**
+     * Parses the text form of the identifier.
+     * @param text Text to parse.
+     * @param id Identifier which is set if the text is valid.
+     * @return <code>true</code> if the text is 32 upper case hexadecimal
+     *         digits, <code>false</code> otherwise.
+     */
+    static bool parse(string_view text, session_id &id) noexcept;
+
+    /**
+     * Returns the text form of this identifier.
+     * @return 32 upper case hexadecimal digits.
+     */
+    std::string to_string() const;
+
+    /**
+     * Returns hash code of this identifier.
+     * @return hash code.
+     */
+    std::size_t hash() const noexcept
+    {
+        /* Bytes are random already */
+        std::size_t h;
+        std::memcpy(&h, _bytes, sizeof(h));
+        return h;
+    }
+
+    bool operator==(const session_id &other) const noexcept
+    {
+        return std::memcmp(_bytes, other._bytes, SIZE) == 0;
+    }
+    bool operator!=(const session_id &other) const noexcept { return !(*this == other); }
+
+private:
+    unsigned char _bytes[SIZE] = {};
+};
+
+/**
+ * Generates the text form of a new random session identifier.
+ * @return 32 upper case hexadecimal digits.
+ * @see session_id
+ */
+std::string generate_session_id();
+
+/**
+ * Client address of a session.
+ *
+ * <p>IPv4 and IPv6 addresses are packed in binary form. Any other string,
+ * as well as an address which isn't written in its canonical form, is kept
+ * as it is, shared by all sessions with the same string. Either way the
+ * address compares equal to exactly the string it was constructed from.</p>
+ */
+class client_address
+{
+public:
+    /**
+     * Constructs an empty address.
+     */
+    client_address() = default;
+
+    /**
+     * Constructs the address from its string.
+     * @param address Client address.
+     */
+    explicit client_address(string_view address);
+
+    /**
+     * Returns the string this address was constructed from.
+     * @return the address string.
+     */
+    std::string to_string() const;
+
+    /**
+     * Compares the address with a string.
+     * @param address String to compare with.
+     * @return <code>true</code> if this address was constructed from the
+     *         same string.
+     */
+    bool equals(string_view address) const;
+
+private:
+    /* AF_INET, AF_INET6 or 0 if the address is kept as a string */
+    unsigned char _family = 0;
+    unsigned char _bytes[16] = {};
+    std::shared_ptr<const std::string> _text;
+};
+
 class principal;
 
 /**
@@ -53,8 +181,13 @@ class principal;
  * <p>Session information is scoped only to the current web application
  * (<code>servlet_context</code>), so information stored in one context will
  * not be directly visible in another.
+ *
+ * <p>Several requests of the same user can be served at the same time, so
+ * attributes are kept in a thread safe <code>cow_any_map</code>: reads never
+ * wait, values are immutable and are replaced with <code>put</code> or
+ * atomically with <code>compute</code> and <code>compute_if_absent</code>.
  */
-class http_session : public tree_any_map
+class http_session : public cow_any_map
 {
 public:
     /**
@@ -69,15 +202,23 @@ public:
      *
      * @return a string specifying the identifier assigned to this session
      */
-    const std::string& get_id() const { return _session_id; }
+    std::string get_id() const { return _session_id.to_string(); }
+
+    /**
+     * Returns the identifier assigned to this session in its binary form.
+     *
+     * @return the identifier assigned to this session
+     * @see #get_id
+     */
+    const session_id& get_binary_id() const { return _session_id; }
 
     /**
      * Returns the time when this session was created as recorded by
-     * <code>std::chrono::system_clock</code>.
+     * <code>std::chrono::system_clock</code>, with the precision of a second.
      *
      * @return a <code>time_type</code> specifying when this session was created.
      */
-    time_type get_creation_time() const { return _created; }
+    time_type get_creation_time() const { return _to_time(_created); }
 
     /**
      * Returns the last time the client sent a request associated with this
@@ -87,10 +228,13 @@ public:
      * <p>Actions that your application takes, such as getting or setting a
      * value associated with the session, do not affect the access time.
      *
+     * <p>The time is updated at most once a second, so that frequent requests
+     * of one session don't contend on it.
+     *
      * @return a <code>time_type</code> representing the last time the client
      *         sent a request associated with this session
      */
-    time_type get_last_accessed_time() const { return _last_accessed; }
+    time_type get_last_accessed_time() const { return _to_time(_last_accessed.load(std::memory_order_relaxed)); }
 
     /**
      * Returns <code>true</code> if the client does not yet know about the
@@ -101,7 +245,7 @@ public:
      * @return <code>true</code> if the server has created a session, but the
      *         client has not yet joined
      */
-    bool is_new() const { return _new; }
+    bool is_new() const { return _new.load(std::memory_order_relaxed); }
 
     /**
      * Set the authenticated principal that is associated with this session.
@@ -111,7 +255,7 @@ public:
      *
      * @param p The new principal, or <code>nullptr</code> if none.
      */
-    void set_principal(principal* p) { _principal.reset(p); }
+    void set_principal(principal* p) { set_principal(std::shared_ptr<principal>{p}); }
 
     /**
      * Set the authenticated principal that is associated with this session.
@@ -122,7 +266,7 @@ public:
      * @param p <code>std::shared_ptr</code> to the new principal.
      * @see #set_principal(principal*)
      */
-    void set_principal(std::shared_ptr<principal> p) { _principal = p; }
+    void set_principal(std::shared_ptr<principal> p) { std::atomic_store(&_principal, std::move(p)); }
 
     /**
      * Set the authenticated principal that is associated with this session.
@@ -133,7 +277,7 @@ public:
      * @param p <code>std::unique_ptr</code> to the new principal.
      * @see #set_principal(principal*)
      */
-    void set_principal(std::unique_ptr<principal>&& p) { _principal = std::move(p); }
+    void set_principal(std::unique_ptr<principal>&& p) { set_principal(std::shared_ptr<principal>{std::move(p)}); }
 
     /**
      * Return the authenticated principal that is associated with this session.
@@ -144,7 +288,7 @@ public:
      * @return principal associated with this session or empty
      *         <code>std::shared_ptr</code>.
      */
-    std::shared_ptr<principal> get_principal() const { return _principal; }
+    std::shared_ptr<principal> get_principal() const { return std::atomic_load(&_principal); }
 
 protected:
     /**
@@ -154,6 +298,18 @@ protected:
      */
     http_session(const string_view &client_ip, const string_view &user_agent);
 
+    /**
+     * Protected constructor of a session restored by the container, for
+     * example from a store shared with other processes.
+     * @param id            Identifier of the session
+     * @param client_ip     Client IP for which this session was created
+     * @param user_agent    User agent for which this session was created
+     * @param created       Time when this session was created
+     * @param last_accessed Last time the client sent a request of this session
+     */
+    http_session(const session_id &id, const string_view &client_ip, const string_view &user_agent,
+                 time_type created, time_type last_accessed);
+
     /**
      * Validates client IP and user agent against this session ones.
      *
@@ -174,27 +330,45 @@ protected:
     virtual void reset_session_id();
 
     /**
-     * Client IP string.
+     * Converts time to the seconds since epoch kept in the session.
+     * @param time Time to convert.
+     * @return seconds since epoch.
+     */
+    static std::uint32_t _to_seconds(time_type time)
+    {
+        return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                time.time_since_epoch()).count());
+    }
+
+    /**
+     * Converts seconds since epoch kept in the session to time.
+     * @param seconds Seconds since epoch.
+     * @return time.
      */
-    std::string _client_ip;
+    static time_type _to_time(std::uint32_t seconds) { return time_type{std::chrono::seconds{seconds}}; }
+
     /**
-     * User agent string.
+     * Client address.
      */
-    std::string _user_agent;
+    client_address _client_ip;
+    /**
+     * User agent string, shared by all sessions with the same user agent.
+     */
+    std::shared_ptr<const std::string> _user_agent;
     /**
      * New flag for this session.
      * @see #is_new
      */
-    bool _new = true;
+    std::atomic<bool> _new{true};
     /**
-     * Last accessed timestamp. Updated on validation.
+     * Last accessed timestamp, in seconds since epoch. Updated on validation.
      * @see #get_last_accessed_time
      */
-    time_type _last_accessed;
+    std::atomic<std::uint32_t> _last_accessed;
 
 private:
-    std::string _session_id;
-    time_type _created;
+    session_id _session_id;
+    std::uint32_t _created;
     std::shared_ptr<principal> _principal;
 };
 
@@ -241,6 +415,253 @@ private:
     std::string _name;
 };
 
+/**
+ * Registry of functions which convert session attributes to bytes and back.
+ *
+ * <p>Sessions which are kept outside of the process, in memory shared by
+ * several processes, in an external session store or in a snapshot saved on
+ * restart, keep only the attributes of types registered here. Strings,
+ * <code>bool</code>, integral and floating point types are registered by
+ * the container. Web applications can register their own types, usually
+ * when their servlets are initialized:</p>
+ *
+ * ~~~~~{.cpp}
+ * session_attribute_codecs::instance().add<point>("myapp.point",
+ *         [](const point &p, std::string &out) { out.append(std::to_string(p.x)).append(1, ',')
+ *                                                   .append(std::to_string(p.y)); },
+ *         [](string_view data) { return parse_point(data); });
+ * ~~~~~
+ *
+ * <p>The name of the type is stored with the attribute, so it must be the
+ * same in every process and must not be used for another type. Codecs of
+ * a web application should be removed when it is destroyed, as their code
+ * goes away with its library.</p>
+ *
+ * This class is thread safe.
+ */
+class session_attribute_codecs
+{
+public:
+    /**
+     * Function which appends the encoded value to the string
+     */
+    typedef std::function<void(const any &value, std::string &out)> encoder_type;
+    /**
+     * Function which restores the value from its encoding. May throw if
+     * the data is invalid.
+     */
+    typedef std::function<any(string_view data)> decoder_type;
+
+    /**
+     * Returns the registry of the container.
+     * @return the registry.
+     */
+    static session_attribute_codecs &instance();
+
+    /**
+     * Registers encoder and decoder for a type.
+     * @tparam T Type of the attributes
+     * @tparam Encoder Type of function <code>void(const T&, std::string&)</code>
+     * @tparam Decoder Type of function <code>T(string_view)</code>
+     * @param name Name under which the type is stored.
+     * @param encoder Function which appends the encoded value to the string.
+     * @param decoder Function which restores the value.
+     */
+    template<typename T, typename Encoder, typename Decoder>
+    void add(std::string name, Encoder encoder, Decoder decoder)
+    {
+        add(typeid(T), std::move(name),
+            [encoder](const any &value, std::string &out) { encoder(any_cast<const T&>(value), out); },
+            [decoder](string_view data) { return any{decoder(data)}; });
+    }
+
+    /**
+     * Registers encoder and decoder for a type. Replaces the previous
+     * registration of the type or of the name.
+     * @param type Type of the attributes
+     * @param name Name under which the type is stored.
+     * @param encoder Function which appends the encoded value to the string.
+     * @param decoder Function which restores the value.
+     */
+    void add(const std::type_info &type, std::string name, encoder_type encoder, decoder_type decoder);
+
+    /**
+     * Removes the registration of a type.
+     * @param type Type to remove.
+     */
+    void remove(const std::type_info &type);
+
+    /**
+     * Encodes a value.
+     * @param value Value to encode.
+     * @param name Receives the name of the type of the value.
+     * @param out String to which the encoded value is appended.
+     * @return <code>false</code> if the type of the value is not registered.
+     */
+    bool encode(const any &value, std::string &name, std::string &out) const;
+
+    /**
+     * Tests whether values of a type can be encoded.
+     * @param type Type of the values.
+     * @return <code>true</code> if the type is registered.
+     */
+    bool can_encode(const std::type_info &type) const;
+
+    /**
+     * Decodes a value.
+     * @param name Name of the type of the value.
+     * @param data Encoded value.
+     * @return decoded value or empty <code>any</code> if the type is not registered.
+     */
+    any decode(string_view name, string_view data) const;
+
+private:
+    session_attribute_codecs();
+
+    struct _codec
+    {
+        std::string name;
+        encoder_type encoder;
+        decoder_type decoder;
+    };
+
+    mutable std::shared_mutex _mx;
+    std::unordered_map<std::type_index, std::shared_ptr<const _codec>> _by_type;
+    std::map<std::string, std::shared_ptr<const _codec>, std::less<>> _by_name;
+};
+
+/**
+ * Registry of functions which estimate memory used by session attributes.
+ *
+ * <p>The container keeps the memory used by the sessions of a web application
+ * within the configured budget, removing the least valuable sessions when it
+ * is exceeded. Memory of attributes is estimated with the functions registered
+ * here. Strings and arithmetic types are registered by the container, values
+ * of other types are counted as <code>DEFAULT_SIZE</code> bytes. Web
+ * applications keeping large objects in sessions should register their types:</p>
+ *
+ * ~~~~~{.cpp}
+ * session_attribute_sizes::instance().add<std::vector<item>>(
+ *         [](const std::vector<item> &v) { return v.capacity() * sizeof(item); });
+ * ~~~~~
+ */
+class session_attribute_sizes
+{
+public:
+    /**
+     * Function which returns the number of bytes used by the value
+     */
+    typedef std::function<std::size_t(const any &value)> estimator_type;
+
+    /**
+     * Estimated size of the values of unregistered types.
+     */
+    static constexpr std::size_t DEFAULT_SIZE = 64;
+
+    /**
+     * Returns the registry of the container.
+     * @return the registry.
+     */
+    static session_attribute_sizes &instance();
+
+    /**
+     * Registers size estimator for a type.
+     * @tparam T Type of the attributes
+     * @tparam Estimator Type of function <code>std::size_t(const T&)</code>
+     * @param estimator Function returning the number of bytes used by the value.
+     */
+    template<typename T, typename Estimator>
+    void add(Estimator estimator)
+    {
+        add(typeid(T), [estimator](const any &value) { return estimator(any_cast<const T&>(value)); });
+    }
+
+    /**
+     * Registers size estimator for a type. Replaces the previous registration
+     * of the type.
+     * @param type Type of the attributes
+     * @param estimator Function returning the number of bytes used by the value.
+     */
+    void add(const std::type_info &type, estimator_type estimator);
+
+    /**
+     * Removes the registration of a type.
+     * @param type Type to remove.
+     */
+    void remove(const std::type_info &type);
+
+    /**
+     * Estimates memory used by a value.
+     * @param value Value to estimate.
+     * @return number of bytes used by the value.
+     */
+    std::size_t estimate(const any &value) const;
+
+private:
+    session_attribute_sizes();
+
+    mutable std::shared_mutex _mx;
+    std::unordered_map<std::type_index, estimator_type> _estimators;
+};
+
+/**
+ * Receives notifications about changes to the list of active sessions
+ * of a web application.
+ *
+ * <p>Listeners are configured in web.xml:</p>
+ *
+ * ~~~~~{.xml}
+ * <listener>
+ *   <listener-factory>mywebapp.so:myListenerFac</listener-factory>
+ * </listener>
+ * ~~~~~
+ *
+ * <p>where the factory is exported with <code>SESSION_LISTENER_EXPORT</code>:</p>
+ *
+ * ~~~~~{.cpp}
+ * SESSION_LISTENER_EXPORT(myListenerFac, my_listener)
+ * ~~~~~
+ *
+ * <p>Sessions which time out are removed by the container in the background,
+ * so <code>session_destroyed</code> for them is called from a thread which is
+ * not serving any request. Listeners should be thread safe and should not
+ * block for long.</p>
+ *
+ * <p>If sessions are shared between web applications, listeners of every
+ * application are notified about every session.</p>
+ */
+class http_session_listener
+{
+public:
+    virtual ~http_session_listener() noexcept = default;
+
+    /**
+     * Receives notification that the given session has been created.
+     * Does nothing by default.
+     */
+    virtual void session_created(http_session &) {}
+
+    /**
+     * Receives notification that the given session has been invalidated
+     * or has timed out and is about to be destroyed. Does nothing by default.
+     */
+    virtual void session_destroyed(http_session &) {}
+};
+
 } // end of servlet namespace
 
+namespace std
+{
+
+/**
+ * Hash of <code>servlet::session_id</code>
+ */
+template<>
+struct hash<servlet::session_id>
+{
+    std::size_t operator()(const servlet::session_id &id) const noexcept { return id.hash(); }
+};
+
+} // end of std namespace
+
 #endif // MOD_SERVLET_SESSION_H
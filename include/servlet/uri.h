@@ -878,10 +878,9 @@ public:
     /**
      * Normalizes this URI's path.
      *
-     * <p>The path is normalized in a manner consistent with <a
-     * href="http://www.ietf.org/rfc/rfc2396.txt">RFC&nbsp;2396</a>,
-     * section&nbsp;5.2, step&nbsp;6, sub-steps&nbsp;c through&nbsp;f; that is:
-     * </p>
+     * <p>Dot segments are removed from the path in a single pass as
+     * described in <a href="http://www.ietf.org/rfc/rfc3986.txt">RFC&nbsp;3986</a>,
+     * section&nbsp;5.2.4; that is: </p>
      *
      * <ol>
      *
@@ -891,12 +890,18 @@ public:
      *   segment then both of these segments are removed.  This step is
      *   repeated until it is no longer applicable. </p></li>
      *
+     *   <li><p> If the removed segment was the last one the path keeps
+     *   the trailing slash. Empty segments are preserved. </p></li>
+     *
      * </ol>
      *
-     * <p> A normalized path will begin with one or more <tt>".."</tt> segments
-     * if there were insufficient non-<tt>".."</tt> segments preceding them to
-     * allow their removal. Otherwise, a normalized path will not contain any
-     * <tt>"."</tt> or <tt>".."</tt> segments. </p>
+     * <p> A normalized relative path will begin with one or more <tt>".."</tt>
+     * segments if there were insufficient non-<tt>".."</tt> segments preceding
+     * them to allow their removal. Such segments are dropped from the absolute
+     * path. Otherwise, a normalized path will not contain any <tt>"."</tt> or
+     * <tt>".."</tt> segments. </p>
+     *
+     * <p>The path is rewritten in place, no memory is allocated.</p>
      */
     void normalize_path();
 
@@ -1007,7 +1012,7 @@ public:
      *     against the path of this URI.  This is done by concatenating all but
      *     the last segment of this URI's path, if any, with the given URI's
      *     path and then normalizing the result as if by invoking the {@link
-     *     #normalize() normalize} method. </p></li>
+     *     #normalize_path() normalize_path} method. </p></li>
      *
      *   </ol>
      *
@@ -1072,6 +1077,8 @@ private:
     void _resize_parts(std::size_t offset, int_fast16_t resize_bytes);
     void _decode_encoded_unreserved_chars();
 
+    friend class uri_builder;
+
     string_type _uri;
     string_view _uri_view;
     string_view _scheme;
@@ -1087,6 +1094,146 @@ private:
     static const std::vector<std::pair<std::string, uint16_t>> DEFAULT_PORTS;
 };
 
+/**
+ * Builds URI objects from components.
+ *
+ * <p>Each URI setter (#URI::set_scheme, #URI::set_path, #URI::add_to_query
+ * etc.) reshapes the underlying URI string and moves all the component
+ * views. The builder only collects the components: #build computes the
+ * final length, writes the URI string into a single buffer and sets the
+ * component views of the result without parsing it again.</p>
+ *
+ * <p>As with the URI setters no encoding or character validation is
+ * performed. The builder doesn't copy the components, so all the string
+ * views passed to it must stay valid until #build is called.</p>
+ *
+ * ~~~~~{.cpp}
+ * URI uri = uri_builder{}.scheme("https").host("example.com").path("/login")
+ *                        .add_to_query("from", "account").build();
+ * ~~~~~
+ */
+class uri_builder
+{
+public:
+    /**
+     * Creates builder with all the components undefined.
+     */
+    uri_builder() = default;
+
+    /**
+     * Creates builder with all the components taken from the given URI.
+     *
+     * <p>Components are not copied, so the URI must outlive the builder.</p>
+     * @param uri URI to take components from.
+     */
+    explicit uri_builder(const URI& uri);
+
+    /**
+     * Sets scheme component.
+     * @param scheme New scheme, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& scheme(string_view scheme) { _scheme = scheme; return *this; }
+
+    /**
+     * Sets user info component.
+     * @param user_info New user info, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& user_info(string_view user_info) { _user_info = user_info; return *this; }
+
+    /**
+     * Sets host component.
+     * @param host New host, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& host(string_view host) { _host = host; return *this; }
+
+    /**
+     * Sets port component.
+     * @param port New port, or <tt>0</tt> to leave it undefined
+     * @return self
+     */
+    uri_builder& port(uint16_t port) { _port = port; return *this; }
+
+    /**
+     * Sets path component replacing all the previously set or appended path parts.
+     *
+     * <p>If URI has an authority and the path doesn't start with
+     * slash, the slash will be prepended to it.</p>
+     * @param path New path, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& path(string_view path) { _path_parts_num = 0; return append_path(path); }
+
+    /**
+     * Appends a part to the path component.
+     *
+     * <p>Slash is inserted between the current path and the appended part
+     * unless the path already ends with slash or the part starts with one.</p>
+     * @param part Path part to append
+     * @return self
+     * @throws uri_builder_error if there are too many path parts
+     */
+    uri_builder& append_path(string_view part);
+
+    /**
+     * Sets query component replacing all the name-value pairs added with #add_to_query.
+     * @param query New query, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& query(string_view query) { _query = query; _query_params.clear(); return *this; }
+
+    /**
+     * Adds name-value pair to the query component.
+     *
+     * <p>Pair is appended as <code>"name=value"</code> separated by
+     * <code>'&'</code> from the existing query. Same as with
+     * #URI::add_to_query no encoding is performed.</p>
+     * @param name Name of the pair
+     * @param value Value of the pair
+     * @return self
+     */
+    uri_builder& add_to_query(string_view name, string_view value)
+    {
+        _query_params.emplace_back(name, value);
+        return *this;
+    }
+
+    /**
+     * Sets fragment component.
+     * @param fragment New fragment, or empty view to leave it undefined
+     * @return self
+     */
+    uri_builder& fragment(string_view fragment) { _fragment = fragment; return *this; }
+
+    /**
+     * Builds the URI from the collected components.
+     *
+     * <p>The string is composed following the rules of
+     * #URI::URI(string_view, string_view, string_view, uint16_t, string_view, string_view, string_view)
+     * constructor, except that an authority without a scheme is prefixed with
+     * <code>"//"</code>.</p>
+     *
+     * @return New URI object
+     * @throws uri_builder_error if the components can't be combined into a URI
+     */
+    URI build() const;
+
+private:
+    static constexpr std::size_t MAX_PATH_PARTS = 4;
+
+    string_view _scheme;
+    string_view _user_info;
+    string_view _host;
+    uint16_t _port = 0;
+    string_view _path_parts[MAX_PATH_PARTS];
+    std::size_t _path_parts_num = 0;
+    string_view _query;
+    std::vector<std::pair<string_view, string_view>> _query_params;
+    string_view _fragment;
+};
+
 /**
  * Output streaming operator overload for URI class objects.
  * @param out Output stream
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <algorithm>
+#include <cstring>
+
+#include "body_replay.h"
+
+namespace servlet
+{
+
+/* Most bodies are small: memory buffer starts with this size and grows up to the threshold */
+static constexpr std::size_t INITIAL_REPLAY_BUFFER_SIZE = 16 * 1024;
+
+void body_replay::append(const char* data, std::size_t len)
+{
+    if (len == 0 || _failed) return;
+    if (!_file.is_open())
+    {
+        if (_size + len <= _threshold)
+        {
+            if (!_buffer || _buffer->size() < _size + len)
+            {
+                std::size_t new_size = std::max(_size + len, _buffer ? 2 * _buffer->size() : INITIAL_REPLAY_BUFFER_SIZE);
+                std::unique_ptr<pooled_buffer> buffer{new pooled_buffer{std::min(new_size, _threshold)}};
+                if (_size > 0) std::memcpy(buffer->data(), _buffer->data(), _size);
+                _buffer = std::move(buffer);
+            }
+            std::memcpy(_buffer->data() + _size, data, len);
+            _size += len;
+            return;
+        }
+        _file.open(_location, 0, "body_");
+        if (_size > 0) _file.write(_buffer->data(), _size);
+        _buffer.reset();
+    }
+    _file.write(data, len);
+    _size += len;
+}
+
+void body_replay::finish()
+{
+    if (_complete || _failed) return;
+    _complete = true;
+    if (_file.is_open()) _data = _file.map(_size);
+    else if (_buffer) _data = _buffer->data();
+}
+
+} // end of servlet namespace
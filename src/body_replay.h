@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_BODY_REPLAY_H
+#define MOD_SERVLET_IMPL_BODY_REPLAY_H
+
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <servlet/lib/io.h>
+
+#include "buffer_pool.h"
+#include "spool_file.h"
+
+namespace servlet
+{
+
+/**
+ * Copy of the request body which allows to read it more than once.
+ *
+ * <p>The body is collected while it is read for the first time. It is
+ * kept in a pooled buffer until it grows over the threshold, then it
+ * is moved to a temporary file. Once the body is complete it can be
+ * read again from memory or from the mapped file without copying.</p>
+ *
+ * <p>If the body cannot be read to the end the replay is marked as
+ * failed; it is never complete then, so that a partial body is not
+ * replayed as if it was the whole one.</p>
+ */
+class body_replay
+{
+public:
+    /**
+     * @param threshold Maximum size of the body kept in memory.
+     * @param location Directory for the temporary file.
+     */
+    body_replay(std::size_t threshold, const std::string &location) :
+            _threshold{threshold}, _location{location} {}
+
+    body_replay(const body_replay&) = delete;
+    body_replay& operator=(const body_replay&) = delete;
+
+    void append(const char* data, std::size_t len);
+    /* Marks the body as complete, it is mapped to memory if it has been spooled to file */
+    void finish();
+    /* Marks the body as failed: reading it failed or it was cut at the limit */
+    void fail() { if (!_complete) _failed = true; }
+
+    bool is_complete() const { return _complete; }
+    bool is_failed() const { return _failed; }
+    std::size_t size() const { return _size; }
+    /* Whole body, available when complete */
+    std::pair<char*, std::size_t> data() const { return {const_cast<char*>(_data), _size}; }
+
+private:
+    std::size_t _threshold;
+    const std::string &_location;
+    std::unique_ptr<pooled_buffer> _buffer;
+    std::size_t _size = 0;
+    _spool_file _file;
+    const char *_data = nullptr;
+    bool _complete = false;
+    bool _failed = false;
+};
+
+/**
+ * Source handing out the data of another stream and collecting it
+ * to <code>body_replay</code> on the way.
+ *
+ * <p>The replay fails if the stream throws or goes bad, or if the body
+ * reaches the limit at which the stream cuts it.</p>
+ */
+class tee_source
+{
+public:
+    typedef buffer_provider category;
+
+    tee_source(std::istream &in, body_replay &replay,
+               std::size_t limit = std::numeric_limits<std::size_t>::max()) :
+            _in{in}, _replay{replay}, _limit{limit} {}
+
+    std::pair<char*, std::size_t> get_buffer()
+    {
+        std::pair<const char*, std::size_t> chunk;
+        try
+        {
+            chunk = read_chunk(_in, _buf, sizeof(_buf));
+            if (chunk.first) _replay.append(chunk.first, chunk.second);
+        }
+        catch (...)
+        {
+            _replay.fail();
+            throw;
+        }
+        if (!chunk.first)
+        {
+            if (_in.bad() || _replay.size() >= _limit) _replay.fail();
+            else _replay.finish();
+            return {nullptr, 0};
+        }
+        /* Stream buffers never write to their get area */
+        return {const_cast<char*>(chunk.first), chunk.second};
+    }
+private:
+    std::istream &_in;
+    body_replay &_replay;
+    std::size_t _limit;
+    char _buf[buffer_8k::buf_size];
+};
+
+/**
+ * Source handing out complete <code>body_replay</code> data in place.
+ */
+class replay_source
+{
+public:
+    typedef buffer_provider category;
+
+    /* Incomplete replay is handed out as an empty body */
+    explicit replay_source(const body_replay &replay) :
+            _data{replay.is_complete() ? replay.data() : std::pair<char*, std::size_t>{nullptr, 0}} {}
+
+    std::pair<char*, std::size_t> get_buffer()
+    {
+        std::pair<char*, std::size_t> res = _data;
+        _data = {nullptr, 0};
+        return res.second > 0 ? res : std::pair<char*, std::size_t>{nullptr, 0};
+    }
+private:
+    std::pair<char*, std::size_t> _data;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_BODY_REPLAY_H
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_BOUNDARY_SEARCH_H
+#define MOD_SERVLET_IMPL_BOUNDARY_SEARCH_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace servlet
+{
+
+/**
+ * Finds multipart delimiters: a new line followed by the boundary
+ * (already with leading dashes).
+ *
+ * <p>Every delimiter starts with <code>'\n'</code>, so candidates are
+ * located with <code>memchr</code>, which scans a vector register at a
+ * time. Each candidate is checked by its last byte first and, on
+ * mismatch, the search skips ahead by the Boyer-Moore-Horspool shift for
+ * that byte before scanning for the next new line. Body data rarely
+ * contains the boundary characters at the right offsets, so most of the
+ * input is never compared byte by byte.</p>
+ */
+class boundary_searcher
+{
+public:
+    /**
+     * @param boundary Multipart boundary with leading dashes.
+     */
+    explicit boundary_searcher(const std::string &boundary) : _pattern{"\n" + boundary}
+    {
+        const std::size_t m = _pattern.size();
+        std::fill_n(_shift, 256, static_cast<unsigned char>(std::min<std::size_t>(m, 255)));
+        for (std::size_t i = 0; i + 1 < m; ++i)
+        {
+            _shift[static_cast<unsigned char>(_pattern[i])] = static_cast<unsigned char>(std::min<std::size_t>(m-1-i, 255));
+        }
+    }
+
+    /**
+     * Size of the delimiter: new line and the boundary.
+     */
+    std::size_t size() const noexcept { return _pattern.size(); }
+
+    /**
+     * Searches for the delimiter in the given range.
+     * @param first Beginning of the data to search.
+     * @param last End of the data to search.
+     * @return Pointer to the new line starting the delimiter or
+     *         <code>nullptr</code> if the range doesn't contain the whole
+     *         delimiter.
+     */
+    const char* search(const char* first, const char* last) const noexcept
+    {
+        const std::size_t m = _pattern.size();
+        if (m < 2 || static_cast<std::size_t>(last - first) < m) return nullptr;
+        const char* const pattern = _pattern.data();
+        const char* const stop = last - m; /* last possible delimiter start */
+        const char* it = static_cast<const char*>(std::memchr(first, '\n', stop - first + 1));
+        while (it)
+        {
+            unsigned char ch = static_cast<unsigned char>(it[m-1]);
+            if (ch == static_cast<unsigned char>(pattern[m-1]) && std::memcmp(it + 1, pattern + 1, m - 2) == 0)
+            {
+                return it;
+            }
+            const char* next = it + _shift[ch];
+            if (next > stop) return nullptr;
+            it = static_cast<const char*>(std::memchr(next, '\n', stop - next + 1));
+        }
+        return nullptr;
+    }
+
+private:
+    std::string _pattern;
+    unsigned char _shift[256];
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_BOUNDARY_SEARCH_H
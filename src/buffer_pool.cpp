@@ -0,0 +1,61 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.h"
+
+namespace servlet
+{
+
+/* Each thread rarely needs more than a couple of large buffers at once */
+static constexpr std::size_t MAX_POOLED_BUFFERS = 4;
+
+struct _buffer_free_list
+{
+    std::vector<std::pair<char*, std::size_t>> buffers;
+
+    ~_buffer_free_list() noexcept { for (auto &&buf : buffers) delete[] buf.first; }
+};
+
+static thread_local _buffer_free_list FREE_LIST;
+
+pooled_buffer::pooled_buffer(std::size_t size) : _data{nullptr}, _size{size}
+{
+    auto &buffers = FREE_LIST.buffers;
+    /* Take the smallest buffer which is big enough */
+    auto best = buffers.end();
+    for (auto it = buffers.begin(); it != buffers.end(); ++it)
+    {
+        if (it->second >= size && (best == buffers.end() || it->second < best->second)) best = it;
+    }
+    if (best != buffers.end())
+    {
+        _data = best->first;
+        _size = best->second;
+        buffers.erase(best);
+    }
+    else _data = new char[size];
+}
+
+pooled_buffer::~pooled_buffer() noexcept
+{
+    auto &buffers = FREE_LIST.buffers;
+    if (buffers.size() < MAX_POOLED_BUFFERS)
+    {
+        try
+        {
+            buffers.emplace_back(_data, _size);
+            return;
+        }
+        catch (...) {}
+    }
+    delete[] _data;
+}
+
+} // end of servlet namespace
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_BUFFER_POOL_H
+#define MOD_SERVLET_IMPL_BUFFER_POOL_H
+
+#include <cstddef>
+
+namespace servlet
+{
+
+/**
+ * Large scratch buffer taken from a per-thread pool.
+ *
+ * <p>Request body parsers need tens of kilobytes of contiguous memory
+ * for every request. Apache reuses its worker threads, so buffers are
+ * returned to a small free list owned by the current thread on
+ * destruction and handed out again to the next request without
+ * locking or touching the allocator.</p>
+ *
+ * <p>The buffer can be larger than requested if a bigger one was
+ * available in the pool; #size returns the actual size.</p>
+ */
+class pooled_buffer
+{
+public:
+    /**
+     * Takes a buffer of at least <code>size</code> bytes from the
+     * pool of the current thread or allocates a new one.
+     * @param size Minimum size of the buffer.
+     */
+    explicit pooled_buffer(std::size_t size);
+    /**
+     * Returns the buffer to the pool of the current thread. It must
+     * be destroyed by the thread which created it.
+     */
+    ~pooled_buffer() noexcept;
+
+    pooled_buffer(const pooled_buffer&) = delete;
+    pooled_buffer& operator=(const pooled_buffer&) = delete;
+
+    char* data() noexcept { return _data; }
+    const char* data() const noexcept { return _data; }
+    std::size_t size() const noexcept { return _size; }
+
+private:
+    char *_data;
+    std::size_t _size;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_BUFFER_POOL_H
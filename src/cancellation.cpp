@@ -0,0 +1,36 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "cancellation.h"
+
+#include <http_connection.h>
+
+namespace servlet
+{
+
+deadline_guard::deadline_guard(const cancellation_token *token, conn_rec *conn) noexcept : _token{token}, _conn{conn}
+{
+    if (!_token || !_token->has_deadline()) return;
+    apr_socket_t *socket = ap_get_conn_socket(_conn);
+    if (!socket || apr_socket_timeout_get(socket, &_timeout) != APR_SUCCESS) return;
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+            _token->deadline() - cancellation_token::clock_type::now()).count();
+    /* Zero timeout would turn the socket to non blocking mode, the smallest positive one times out right away */
+    if (left < 1) left = 1;
+    /* Negative timeout means the socket blocks without limit */
+    if (_timeout >= 0 && _timeout <= left) return;
+    if (apr_socket_timeout_set(socket, static_cast<apr_interval_time_t>(left)) == APR_SUCCESS) _socket = socket;
+}
+
+bool deadline_guard::cancelled() const noexcept
+{
+    if (!_token || !_token->is_cancelled()) return false;
+    _conn->keepalive = AP_CONN_CLOSE;
+    return true;
+}
+
+} // end of servlet namespace
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_CANCELLATION_H
+#define MOD_SERVLET_IMPL_CANCELLATION_H
+
+#include <servlet/cancellation.h>
+
+#include <httpd.h>
+#include <apr_network_io.h>
+
+namespace servlet
+{
+
+/**
+ * Cancellation token of a request which also fires when Apache notices
+ * that the client connection has been aborted.
+ */
+class request_cancellation : public cancellation_token
+{
+public:
+    request_cancellation(conn_rec *conn, time_point deadline) noexcept : cancellation_token{deadline}, _conn{conn} {}
+
+protected:
+    bool client_aborted() const noexcept override { return _conn->aborted; }
+
+private:
+    conn_rec *_conn;
+};
+
+/**
+ * Bounds blocking network I/O of the request by its deadline.
+ *
+ * <p>While the guard exists the timeout of the connection socket is
+ * lowered to the time left until the deadline, so a blocking read or
+ * write returns by the deadline instead of after the server Timeout.
+ * The original timeout is restored on destruction.</p>
+ *
+ * <p>Once the request is cancelled the rest of the request body is
+ * never read, so the connection is marked to be closed after the
+ * response.</p>
+ */
+class deadline_guard
+{
+public:
+    /* Null token means there is nothing to honor */
+    deadline_guard(const cancellation_token *token, conn_rec *conn) noexcept;
+    ~deadline_guard() noexcept { if (_socket) apr_socket_timeout_set(_socket, _timeout); }
+
+    deadline_guard(const deadline_guard&) = delete;
+    deadline_guard& operator=(const deadline_guard&) = delete;
+
+    /* Returns true if the request is cancelled */
+    bool cancelled() const noexcept;
+    /* Throws request_cancelled_exception if the request is cancelled */
+    void check() const { if (cancelled()) _token->throw_if_cancelled(); }
+
+private:
+    const cancellation_token *_token;
+    conn_rec *_conn;
+    apr_socket_t *_socket = nullptr;
+    apr_interval_time_t _timeout = 0;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_CANCELLATION_H
@@ -163,6 +163,84 @@ void finalize_servlet_config(servlet_config_t *cfg, apr_pool_t *tmp_pool)
             SERVLET_CONFIG.session_timeout = std::numeric_limits<std::size_t>::max(); /* 0 is no limit */
         }
     }
+    optional_ref<const std::string> sweep_interval = props.get("session.sweep.interval");
+    if (sweep_interval.has_value())
+    {
+        string_view trimmed = trim_view(*sweep_interval);
+        SERVLET_CONFIG.session_sweep_interval = from_string<std::size_t>(trimmed, 15);
+        if (SERVLET_CONFIG.session_sweep_interval == 0) SERVLET_CONFIG.session_sweep_interval = 15;
+    }
+    optional_ref<const std::string> shared_memory = props.get("session.shared.memory");
+    if (shared_memory.has_value()) /* In megabytes */
+    {
+        string_view trimmed = trim_view(*shared_memory);
+        SERVLET_CONFIG.session_shared_memory = from_string<std::size_t>(trimmed, 0) * 1024 * 1024;
+    }
+    optional_ref<const std::string> shared_slot_size = props.get("session.shared.slot.size");
+    if (shared_slot_size.has_value())
+    {
+        string_view trimmed = trim_view(*shared_slot_size);
+        SERVLET_CONFIG.session_shared_slot_size = from_string<std::size_t>(trimmed, DEFAULT_SESSION_SLOT_SIZE);
+    }
+    optional_ref<const std::string> memory_budget = props.get("session.memory.budget");
+    if (memory_budget.has_value()) /* In megabytes */
+    {
+        string_view trimmed = trim_view(*memory_budget);
+        SERVLET_CONFIG.session_memory_budget = from_string<std::size_t>(trimmed, 0) * 1024 * 1024;
+    }
+    optional_ref<const std::string> store = props.get("session.store");
+    if (store.has_value())
+    {
+        SERVLET_CONFIG.session_store = trim_view(*store).to_string();
+    }
+    optional_ref<const std::string> memcached_servers = props.get("session.memcached.servers");
+    if (memcached_servers.has_value())
+    {
+        SERVLET_CONFIG.session_memcached_servers = trim_view(*memcached_servers).to_string();
+    }
+    optional_ref<const std::string> memcached_pool = props.get("session.memcached.pool.size");
+    if (memcached_pool.has_value())
+    {
+        string_view trimmed = trim_view(*memcached_pool);
+        SERVLET_CONFIG.session_memcached_pool_size = from_string<std::size_t>(trimmed, DEFAULT_MEMCACHED_POOL_SIZE);
+    }
+    optional_ref<const std::string> memcached_timeout = props.get("session.memcached.timeout");
+    if (memcached_timeout.has_value()) /* In milliseconds */
+    {
+        string_view trimmed = trim_view(*memcached_timeout);
+        SERVLET_CONFIG.session_memcached_timeout = from_string<std::size_t>(trimmed, DEFAULT_MEMCACHED_TIMEOUT);
+    }
+    optional_ref<const std::string> near_cache = props.get("session.memcached.near.cache");
+    if (near_cache.has_value()) /* In milliseconds, 0 disables it */
+    {
+        string_view trimmed = trim_view(*near_cache);
+        SERVLET_CONFIG.session_memcached_near_cache = from_string<std::size_t>(trimmed, DEFAULT_MEMCACHED_NEAR_CACHE);
+    }
+    optional_ref<const std::string> cookie_secret = props.get("session.cookie.secret.file");
+    if (cookie_secret.has_value())
+    {
+        SERVLET_CONFIG.session_cookie_secret_file = trim_view(*cookie_secret).to_string();
+    }
+    optional_ref<const std::string> cookie_cipher = props.get("session.cookie.cipher");
+    if (cookie_cipher.has_value())
+    {
+        SERVLET_CONFIG.session_cookie_cipher = trim_view(*cookie_cipher).to_string();
+    }
+    optional_ref<const std::string> key_rotation = props.get("session.cookie.key.rotation");
+    if (key_rotation.has_value()) /* In hours */
+    {
+        string_view trimmed = trim_view(*key_rotation);
+        SERVLET_CONFIG.session_cookie_key_rotation = from_string<std::size_t>(trimmed, DEFAULT_COOKIE_KEY_ROTATION);
+        if (SERVLET_CONFIG.session_cookie_key_rotation == 0)
+        {
+            SERVLET_CONFIG.session_cookie_key_rotation = DEFAULT_COOKIE_KEY_ROTATION;
+        }
+    }
+    optional_ref<const std::string> snapshot_dir = props.get("session.snapshot.directory");
+    if (snapshot_dir.has_value())
+    {
+        SERVLET_CONFIG.session_snapshot_directory = trim_view(*snapshot_dir).to_string();
+    }
     optional_ref<const std::string> input_limit = props.get("input.stream.limit");
     if (input_limit.has_value())
     {
@@ -173,6 +251,18 @@ void finalize_servlet_config(servlet_config_t *cfg, apr_pool_t *tmp_pool)
             SERVLET_CONFIG.input_stream_limit = std::numeric_limits<std::size_t>::max(); /* 0 is no limit */
         }
     }
+    optional_ref<const std::string> form_name_limit = props.get("form.name.limit");
+    if (form_name_limit.has_value()) /* 0 is no limit, it is handled by the parser */
+    {
+        string_view trimmed = trim_view(*form_name_limit);
+        SERVLET_CONFIG.form_name_limit = from_string<std::size_t>(trimmed, DEFAULT_FORM_NAME_LIMIT);
+    }
+    optional_ref<const std::string> form_value_limit = props.get("form.value.limit");
+    if (form_value_limit.has_value())
+    {
+        string_view trimmed = trim_view(*form_value_limit);
+        SERVLET_CONFIG.form_value_limit = from_string<std::size_t>(trimmed, DEFAULT_FORM_VALUE_LIMIT);
+    }
 }
 
 void translate_path(request_rec* r, servlet::string_view uri_path)
@@ -228,9 +318,17 @@ void init_logging(servlet_config_t *cfg, apr_pool_t *tmp_pool)
                  << "Logging properties file: " << SERVLET_CONFIG.logging_properties_file << '\n'
                  << "Log directory: " << SERVLET_CONFIG.log_directory << '\n'
                  << "Input stream limit: " << SERVLET_CONFIG.input_stream_limit << '\n'
+                 << "Form name limit: " << SERVLET_CONFIG.form_name_limit << '\n'
+                 << "Form value limit: " << SERVLET_CONFIG.form_value_limit << '\n'
                  << "Translate path: " << std::boolalpha << SERVLET_CONFIG.translate_path << '\n'
                  << "Share sessions: " << SERVLET_CONFIG.share_sessions << '\n'
-                 << "Session timeout: " << SERVLET_CONFIG.session_timeout << std::endl;
+                 << "Session timeout: " << SERVLET_CONFIG.session_timeout << '\n'
+                 << "Session sweep interval: " << SERVLET_CONFIG.session_sweep_interval << '\n'
+                 << "Session shared memory: " << SERVLET_CONFIG.session_shared_memory << '\n'
+                 << "Session memory budget: " << SERVLET_CONFIG.session_memory_budget << '\n'
+                 << "Session store: " << SERVLET_CONFIG.session_store << '\n'
+                 << "Session memcached servers: " << SERVLET_CONFIG.session_memcached_servers << '\n'
+                 << "Session snapshot directory: " << SERVLET_CONFIG.session_snapshot_directory << std::endl;
 }
 
 std::shared_ptr<servlet::logging::logger> servlet_logger(const std::string& name) { return servlet_log_registry().log(name); }
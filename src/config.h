@@ -15,9 +15,21 @@ http://boost.org/LICENSE_1_0.txt
 
 #include <servlet/lib/logger.h>
 
+#include "digest.h"
+
 extern module AP_MODULE_DECLARE_DATA servlet_module;
 
 constexpr std::size_t DEFAULT_INPUT_STREAM_LIMIT = 1024 * 1024 * 2; /* 2Mb */
+constexpr std::size_t DEFAULT_FORM_NAME_LIMIT = 1024;
+constexpr std::size_t DEFAULT_FORM_VALUE_LIMIT = DEFAULT_INPUT_STREAM_LIMIT;
+constexpr std::size_t DEFAULT_MULTIPART_BUFFER_SIZE = 64 * 1024;
+constexpr std::size_t MIN_MULTIPART_BUFFER_SIZE = 4 * 1024;
+constexpr std::size_t DEFAULT_MULTIPART_FILE_SIZE_THRESHOLD = 64 * 1024;
+constexpr std::size_t DEFAULT_SESSION_SLOT_SIZE = 4 * 1024;
+constexpr std::size_t DEFAULT_MEMCACHED_POOL_SIZE = 8;
+constexpr std::size_t DEFAULT_MEMCACHED_TIMEOUT = 500; /* ms */
+constexpr std::size_t DEFAULT_MEMCACHED_NEAR_CACHE = 1000; /* ms */
+constexpr std::size_t DEFAULT_COOKIE_KEY_ROTATION = 24; /* hours */
 
 struct mod_servlet_config
 {
@@ -28,12 +40,48 @@ struct mod_servlet_config
     std::string logging_properties_file;
     bool translate_path = true;
     std::size_t input_stream_limit = DEFAULT_INPUT_STREAM_LIMIT;
+    std::size_t form_name_limit = DEFAULT_FORM_NAME_LIMIT;
+    std::size_t form_value_limit = DEFAULT_FORM_VALUE_LIMIT;
     bool share_sessions = false;
     std::size_t session_timeout = 30;
+    /* Seconds between the runs of the thread removing expired sessions */
+    std::size_t session_sweep_interval = 15;
+    /* Size of memory shared by child processes to keep sessions in, 0 if sessions are per process */
+    std::size_t session_shared_memory = 0;
+    std::size_t session_shared_slot_size = DEFAULT_SESSION_SLOT_SIZE;
+    /* Where sessions are kept: "local", "shm", "memcached" or "cookie". Empty is "shm" if shared memory is set */
+    std::string session_store;
+    /* Comma separated host:port list of memcached servers */
+    std::string session_memcached_servers;
+    std::size_t session_memcached_pool_size = DEFAULT_MEMCACHED_POOL_SIZE;
+    std::size_t session_memcached_timeout = DEFAULT_MEMCACHED_TIMEOUT;
+    std::size_t session_memcached_near_cache = DEFAULT_MEMCACHED_NEAR_CACHE;
+    /* File with the secret cookie keys are derived from; hosts sharing sessions share it */
+    std::string session_cookie_secret_file;
+    std::string session_cookie_cipher = "aes-256-gcm";
+    std::size_t session_cookie_key_rotation = DEFAULT_COOKIE_KEY_ROTATION;
+    /* Approximate memory the sessions of a web application may use in a process, 0 is no limit */
+    std::size_t session_memory_budget = 0;
+    /* Directory where sessions are saved on exit and restored from, empty if sessions are not saved */
+    std::string session_snapshot_directory;
 };
 
 extern mod_servlet_config SERVLET_CONFIG;
 
+/* Per webapp multipart/form-data settings: <multipart-config> element of web.xml */
+struct multipart_config
+{
+    std::size_t buffer_size = DEFAULT_MULTIPART_BUFFER_SIZE;
+    /* Spooled parts larger than this are stored in files */
+    std::size_t file_size_threshold = DEFAULT_MULTIPART_FILE_SIZE_THRESHOLD;
+    /* Spooled parts larger than this are rejected, 0 means no limit */
+    std::size_t max_file_size = 0;
+    /* Directory for spooled files. Relative to the webapp, WEB-INF/work by default */
+    std::string location;
+    /* Checksum computed for every part while it is read */
+    servlet::digest_algorithm digest = servlet::digest_algorithm::none;
+};
+
 void register_hooks(apr_pool_t* pool);
 void *make_config_servlet_state(apr_pool_t *pool, server_rec *s);
 void *merge_make_config_servlet_state(apr_pool_t *p, void *basev, void *addv);
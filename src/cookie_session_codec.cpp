@@ -0,0 +1,294 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "cookie_session_codec.h"
+
+#include <cstring>
+#include <mutex>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
+
+#include <servlet/lib/exception.h>
+
+#include "session.h"
+#include "session_codec.h"
+
+namespace servlet
+{
+
+constexpr std::uint8_t COOKIE_FORMAT = 1;
+constexpr std::size_t NONCE_SIZE = 12;
+constexpr std::size_t TAG_SIZE = 16;
+constexpr std::size_t HEADER_SIZE = 1 + 4 + NONCE_SIZE;
+/* Derived keys kept, enough for any session timeout with reasonable rotation */
+constexpr std::size_t MAX_KEYS = 64;
+
+static const char BASE64URL[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static std::string _base64url_encode(const unsigned char *data, std::size_t size)
+{
+    std::string out;
+    out.reserve((size * 4 + 2) / 3);
+    std::size_t i = 0;
+    for (; i + 3 <= size; i += 3)
+    {
+        std::uint32_t v = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+        out.push_back(BASE64URL[v >> 18]);
+        out.push_back(BASE64URL[(v >> 12) & 0x3f]);
+        out.push_back(BASE64URL[(v >> 6) & 0x3f]);
+        out.push_back(BASE64URL[v & 0x3f]);
+    }
+    if (i + 1 == size)
+    {
+        std::uint32_t v = data[i] << 16;
+        out.push_back(BASE64URL[v >> 18]);
+        out.push_back(BASE64URL[(v >> 12) & 0x3f]);
+    }
+    else if (i + 2 == size)
+    {
+        std::uint32_t v = (data[i] << 16) | (data[i + 1] << 8);
+        out.push_back(BASE64URL[v >> 18]);
+        out.push_back(BASE64URL[(v >> 12) & 0x3f]);
+        out.push_back(BASE64URL[(v >> 6) & 0x3f]);
+    }
+    return out;
+}
+
+static int _base64url_value(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '-') return 62;
+    if (c == '_') return 63;
+    return -1;
+}
+
+/* Returns false if the text is not unpadded base64url */
+static bool _base64url_decode(string_view text, std::string &out)
+{
+    if (text.size() % 4 == 1) return false;
+    out.clear();
+    out.reserve(text.size() * 3 / 4);
+    std::uint32_t acc = 0;
+    int bits = 0;
+    for (char c : text)
+    {
+        int v = _base64url_value(c);
+        if (v < 0) return false;
+        acc = (acc << 6) | v;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            out.push_back(static_cast<char>((acc >> bits) & 0xff));
+        }
+    }
+    return true;
+}
+
+static void _put_u32(unsigned char *out, std::uint32_t v)
+{
+    out[0] = static_cast<unsigned char>(v >> 24);
+    out[1] = static_cast<unsigned char>(v >> 16);
+    out[2] = static_cast<unsigned char>(v >> 8);
+    out[3] = static_cast<unsigned char>(v);
+}
+
+static std::uint32_t _get_u32(const unsigned char *in)
+{
+    return (std::uint32_t{in[0]} << 24) | (std::uint32_t{in[1]} << 16) | (std::uint32_t{in[2]} << 8) | in[3];
+}
+
+static const EVP_CIPHER *_evp_cipher(cookie_session_codec::cipher c)
+{
+    return c == cookie_session_codec::cipher::aes_256_gcm ? EVP_aes_256_gcm() : EVP_chacha20_poly1305();
+}
+
+/* Header of the cookie and the scope are authenticated, but not encrypted */
+static void _aad(const unsigned char *header, std::uint64_t scope, unsigned char *aad)
+{
+    std::memcpy(aad, header, 1 + 4);
+    _put_u32(aad + 5, static_cast<std::uint32_t>(scope >> 32));
+    _put_u32(aad + 9, static_cast<std::uint32_t>(scope));
+}
+
+constexpr std::size_t AAD_SIZE = 1 + 4 + 8;
+
+struct _cipher_ctx_deleter
+{
+    void operator()(EVP_CIPHER_CTX *ctx) const { EVP_CIPHER_CTX_free(ctx); }
+};
+typedef std::unique_ptr<EVP_CIPHER_CTX, _cipher_ctx_deleter> cipher_ctx_ptr;
+
+struct _pkey_ctx_deleter
+{
+    void operator()(EVP_PKEY_CTX *ctx) const { EVP_PKEY_CTX_free(ctx); }
+};
+
+cookie_session_codec::cookie_session_codec(std::string secret, cipher c, std::chrono::seconds rotation) :
+        _secret{std::move(secret)}, _cipher{c}, _rotation{rotation}
+{
+    if (_secret.size() < MIN_SECRET_SIZE)
+    {
+        OPENSSL_cleanse(&_secret[0], _secret.size());
+        throw config_exception{"Session cookie secret must be at least " + std::to_string(MIN_SECRET_SIZE) +
+                               " bytes long"};
+    }
+    if (_rotation.count() <= 0) throw config_exception{"Session cookie key rotation period must be positive"};
+}
+
+cookie_session_codec::~cookie_session_codec() noexcept
+{
+    OPENSSL_cleanse(&_secret[0], _secret.size());
+    for (auto &&k : _keys) OPENSSL_cleanse(k.second.data(), k.second.size());
+}
+
+cookie_session_codec::cipher cookie_session_codec::parse_cipher(string_view name)
+{
+    if (name == "aes-256-gcm") return cipher::aes_256_gcm;
+    if (name == "chacha20-poly1305") return cipher::chacha20_poly1305;
+    throw config_exception{"Unknown session cookie cipher '" + name.to_string() + "'"};
+}
+
+std::uint32_t cookie_session_codec::_period(time_point time) const
+{
+    return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(
+            time.time_since_epoch()).count() / _rotation.count());
+}
+
+cookie_session_codec::key_type cookie_session_codec::_key(std::uint32_t period)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock{_keys_mx};
+        auto it = _keys.find(period);
+        if (it != _keys.end()) return it->second;
+    }
+    /* Keys differ per cipher, so that a key is never used with two ciphers */
+    unsigned char info[] = {'m', 'o', 'd', '_', 's', 'e', 'r', 'v', 'l', 'e', 't', ' ', 's', 'e', 's', 's',
+                            'i', 'o', 'n', ' ', static_cast<unsigned char>(_cipher), 0, 0, 0, 0};
+    _put_u32(info + sizeof(info) - 4, period);
+    key_type key;
+    std::size_t size = key.size();
+    std::unique_ptr<EVP_PKEY_CTX, _pkey_ctx_deleter> ctx{EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr)};
+    if (!ctx || EVP_PKEY_derive_init(ctx.get()) <= 0 ||
+        EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha256()) <= 0 ||
+        EVP_PKEY_CTX_set1_hkdf_key(ctx.get(), reinterpret_cast<const unsigned char*>(_secret.data()),
+                                   static_cast<int>(_secret.size())) <= 0 ||
+        EVP_PKEY_CTX_add1_hkdf_info(ctx.get(), info, sizeof(info)) <= 0 ||
+        EVP_PKEY_derive(ctx.get(), key.data(), &size) <= 0 || size != key.size())
+    {
+        throw security_exception{"Failed to derive session cookie key"};
+    }
+    std::unique_lock<std::shared_mutex> lock{_keys_mx};
+    _keys.emplace(period, key);
+    while (_keys.size() > MAX_KEYS)
+    {
+        OPENSSL_cleanse(_keys.begin()->second.data(), KEY_SIZE);
+        _keys.erase(_keys.begin());
+    }
+    return key;
+}
+
+std::string cookie_session_codec::seal(const http_session_impl &session, std::uint64_t scope, time_point now)
+{
+    std::string plain = encode_session(session);
+    std::size_t sealed_size = HEADER_SIZE + plain.size() + TAG_SIZE;
+    if ((sealed_size * 4 + 2) / 3 > MAX_COOKIE_SIZE) return std::string{};
+
+    std::uint32_t period = _period(now);
+    key_type key = _key(period);
+    std::string sealed(sealed_size, '\0');
+    unsigned char *out = reinterpret_cast<unsigned char*>(&sealed[0]);
+    out[0] = COOKIE_FORMAT;
+    _put_u32(out + 1, period);
+    unsigned char *nonce = out + 5;
+    if (RAND_bytes(nonce, NONCE_SIZE) != 1) throw security_exception{"Failed to generate session cookie nonce"};
+    unsigned char aad[AAD_SIZE];
+    _aad(out, scope, aad);
+
+    cipher_ctx_ptr ctx{EVP_CIPHER_CTX_new()};
+    int len = 0;
+    unsigned char *cipher_text = out + HEADER_SIZE;
+    if (!ctx || EVP_EncryptInit_ex(ctx.get(), _evp_cipher(_cipher), nullptr, nullptr, nullptr) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, NONCE_SIZE, nullptr) != 1 ||
+        EVP_EncryptInit_ex(ctx.get(), nullptr, nullptr, key.data(), nonce) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), nullptr, &len, aad, sizeof(aad)) != 1 ||
+        EVP_EncryptUpdate(ctx.get(), cipher_text, &len, reinterpret_cast<const unsigned char*>(plain.data()),
+                          static_cast<int>(plain.size())) != 1 ||
+        EVP_EncryptFinal_ex(ctx.get(), cipher_text + len, &len) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, cipher_text + plain.size()) != 1)
+    {
+        OPENSSL_cleanse(key.data(), key.size());
+        throw security_exception{"Failed to seal session cookie"};
+    }
+    OPENSSL_cleanse(key.data(), key.size());
+    return _base64url_encode(out, sealed.size());
+}
+
+std::shared_ptr<http_session_impl> cookie_session_codec::open(string_view cookie, std::uint64_t scope,
+                                                              std::chrono::seconds timeout, bool &stale,
+                                                              time_point now)
+{
+    stale = false;
+    /* Anything longer has not been sealed here */
+    if (cookie.size() > MAX_COOKIE_SIZE) return nullptr;
+    std::string sealed;
+    if (!_base64url_decode(cookie, sealed) || sealed.size() < HEADER_SIZE + TAG_SIZE) return nullptr;
+    const unsigned char *in = reinterpret_cast<const unsigned char*>(sealed.data());
+    if (in[0] != COOKIE_FORMAT) return nullptr;
+
+    /* Clocks of the hosts may differ a bit, so the next period is accepted too */
+    std::uint32_t current = _period(now);
+    std::uint32_t period = _get_u32(in + 1);
+    if (period > current + 1) return nullptr;
+    std::uint64_t retained = static_cast<std::uint64_t>(timeout.count() / _rotation.count()) + 1;
+    if (period < current && current - period > retained) return nullptr;
+
+    key_type key = _key(period);
+    unsigned char aad[AAD_SIZE];
+    _aad(in, scope, aad);
+    const unsigned char *nonce = in + 5;
+    std::size_t size = sealed.size() - HEADER_SIZE - TAG_SIZE;
+    const unsigned char *cipher_text = in + HEADER_SIZE;
+    std::string plain(size, '\0');
+    unsigned char *out = reinterpret_cast<unsigned char*>(&plain[0]);
+
+    cipher_ctx_ptr ctx{EVP_CIPHER_CTX_new()};
+    int len = 0;
+    bool valid = ctx && EVP_DecryptInit_ex(ctx.get(), _evp_cipher(_cipher), nullptr, nullptr, nullptr) == 1 &&
+                 EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, NONCE_SIZE, nullptr) == 1 &&
+                 EVP_DecryptInit_ex(ctx.get(), nullptr, nullptr, key.data(), nonce) == 1 &&
+                 EVP_DecryptUpdate(ctx.get(), nullptr, &len, aad, sizeof(aad)) == 1 &&
+                 EVP_DecryptUpdate(ctx.get(), out, &len, cipher_text, static_cast<int>(size)) == 1 &&
+                 EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_TAG, TAG_SIZE,
+                                     const_cast<unsigned char*>(cipher_text + size)) == 1 &&
+                 EVP_DecryptFinal_ex(ctx.get(), out + len, &len) == 1;
+    OPENSSL_cleanse(key.data(), key.size());
+    if (!valid) return nullptr;
+
+    std::shared_ptr<http_session_impl> session;
+    try
+    {
+        session = decode_session(plain);
+    }
+    catch (const std::exception&)
+    {
+        /* Authentic, but written by an incompatible version */
+        return nullptr;
+    }
+    /* Access time of the session is the time it was sealed */
+    auto age = std::chrono::duration_cast<std::chrono::seconds>(now - session->get_last_accessed_time());
+    if (age > timeout) return nullptr;
+    stale = period != current;
+    return session;
+}
+
+} // end of servlet namespace
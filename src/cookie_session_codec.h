@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_COOKIE_SESSION_CODEC_H
+#define MOD_SERVLET_IMPL_COOKIE_SESSION_CODEC_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <experimental/string_view>
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+class http_session_impl;
+
+/*
+ * Seals whole sessions into cookie values with an authenticated cipher, so that
+ * sessions are not kept on the server at all.
+ *
+ * Keys are derived from the secret with HKDF-SHA256 for every rotation period, so
+ * hosts sharing the secret agree on the keys without any coordination. Cookies are
+ * sealed with the key of the current period. Keys of earlier periods open cookies
+ * as long as a session sealed with them could still be alive.
+ *
+ * Cookie value is base64url of the format byte, the key period (4 bytes), a random
+ * nonce (12 bytes), the encrypted session and the tag (16 bytes). The format, the
+ * key period and the scope of the web application are authenticated as well, so a
+ * cookie of one web application is not accepted by another one.
+ *
+ * This class is thread safe.
+ */
+class cookie_session_codec
+{
+public:
+    enum class cipher
+    {
+        aes_256_gcm,
+        chacha20_poly1305
+    };
+
+    typedef std::chrono::system_clock::time_point time_point;
+
+    static constexpr std::size_t MIN_SECRET_SIZE = 32;
+    /* Browsers keep cookies up to 4096 bytes together with the name and the attributes */
+    static constexpr std::size_t MAX_COOKIE_SIZE = 3800;
+
+    /* Throws config_exception if the secret is too short or the rotation period is 0 */
+    cookie_session_codec(std::string secret, cipher c, std::chrono::seconds rotation);
+    ~cookie_session_codec() noexcept;
+
+    cookie_session_codec(const cookie_session_codec&) = delete;
+    cookie_session_codec& operator=(const cookie_session_codec&) = delete;
+
+    /* Accepts "aes-256-gcm" and "chacha20-poly1305", throws config_exception otherwise */
+    static cipher parse_cipher(string_view name);
+
+    /* Returns the cookie value, or empty string if the session is too big to be kept in a cookie */
+    std::string seal(const http_session_impl &session, std::uint64_t scope, time_point now = time_point::clock::now());
+
+    /*
+     * Returns the session sealed in the cookie, or empty pointer if the cookie is forged,
+     * corrupted, timed out or sealed with a retired key. stale is set if the cookie is
+     * sealed with the key of an earlier period.
+     */
+    std::shared_ptr<http_session_impl> open(string_view cookie, std::uint64_t scope, std::chrono::seconds timeout,
+                                            bool &stale, time_point now = time_point::clock::now());
+
+private:
+    static constexpr std::size_t KEY_SIZE = 32;
+    typedef std::array<unsigned char, KEY_SIZE> key_type;
+
+    std::uint32_t _period(time_point time) const;
+    key_type _key(std::uint32_t period);
+
+    std::string _secret;
+    cipher _cipher;
+    std::chrono::seconds _rotation;
+
+    /* Keys derived so far, the ones of retired periods are dropped */
+    std::shared_mutex _keys_mx;
+    std::map<std::uint32_t, key_type> _keys;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_COOKIE_SESSION_CODEC_H
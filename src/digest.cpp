@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <cstring>
+
+#include "digest.h"
+
+#ifdef SERVLET_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+namespace servlet
+{
+
+/* CRC32C */
+
+struct _crc32c_table
+{
+    std::uint32_t values[256];
+
+    constexpr _crc32c_table() : values{}
+    {
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            values[i] = crc;
+        }
+    }
+};
+
+static constexpr _crc32c_table CRC32C_TABLE{};
+
+std::uint32_t crc32c_sw(std::uint32_t crc, const char* data, std::size_t len)
+{
+    crc = ~crc;
+    for (const char* end = data + len; data != end; ++data)
+    {
+        crc = CRC32C_TABLE.values[(crc ^ static_cast<unsigned char>(*data)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef SERVLET_CRC32C_SSE42
+
+__attribute__((target("sse4.2")))
+static std::uint32_t _crc32c_sse42(std::uint32_t crc, const char* data, std::size_t len)
+{
+    const char* const end = data + len;
+#ifdef __x86_64__
+    std::uint64_t crc64 = ~crc;
+    for (; end - data >= 8; data += 8)
+    {
+        std::uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+#else
+    crc = ~crc;
+    for (; end - data >= 4; data += 4)
+    {
+        std::uint32_t word;
+        std::memcpy(&word, data, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+#endif
+    for (; data != end; ++data) crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    return ~crc;
+}
+
+#endif // SERVLET_CRC32C_SSE42
+
+bool crc32c_hw_supported()
+{
+#ifdef SERVLET_CRC32C_SSE42
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+typedef std::uint32_t (*crc32c_func)(std::uint32_t, const char*, std::size_t);
+
+static crc32c_func _select_crc32c()
+{
+#ifdef SERVLET_CRC32C_SSE42
+    if (crc32c_hw_supported()) return _crc32c_sse42;
+#endif
+    return crc32c_sw;
+}
+
+static const crc32c_func _crc32c_impl = _select_crc32c();
+
+std::uint32_t crc32c(std::uint32_t crc, const char* data, std::size_t len)
+{
+    /* Can be called during static initialization before _crc32c_impl is set */
+    return _crc32c_impl ? _crc32c_impl(crc, data, len) : crc32c_sw(crc, data, len);
+}
+
+/* XXH64 */
+
+static constexpr std::uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static constexpr std::uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr std::uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+static constexpr std::uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static constexpr std::uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline std::uint64_t _rotl64(std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline std::uint64_t _read64(const void* ptr)
+{
+    std::uint64_t val;
+    std::memcpy(&val, ptr, 8);
+    return val;
+}
+
+static inline std::uint32_t _read32(const void* ptr)
+{
+    std::uint32_t val;
+    std::memcpy(&val, ptr, 4);
+    return val;
+}
+
+static inline std::uint64_t _xxh64_round(std::uint64_t acc, std::uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = _rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline std::uint64_t _xxh64_merge_round(std::uint64_t acc, std::uint64_t val)
+{
+    acc ^= _xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline void _xxh64_stripe(std::uint64_t (&acc)[4], const unsigned char* stripe)
+{
+    acc[0] = _xxh64_round(acc[0], _read64(stripe));
+    acc[1] = _xxh64_round(acc[1], _read64(stripe + 8));
+    acc[2] = _xxh64_round(acc[2], _read64(stripe + 16));
+    acc[3] = _xxh64_round(acc[3], _read64(stripe + 24));
+}
+
+void xxh64_state::update(const char* data, std::size_t len)
+{
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + len;
+    _total_len += len;
+    if (_stripe_size + len < 32)
+    {
+        std::memcpy(_stripe + _stripe_size, p, len);
+        _stripe_size += len;
+        return;
+    }
+    if (_stripe_size > 0)
+    {
+        std::size_t fill = 32 - _stripe_size;
+        std::memcpy(_stripe + _stripe_size, p, fill);
+        _xxh64_stripe(_acc, _stripe);
+        p += fill;
+        _stripe_size = 0;
+    }
+    for (; end - p >= 32; p += 32) _xxh64_stripe(_acc, p);
+    _stripe_size = static_cast<std::size_t>(end - p);
+    std::memcpy(_stripe, p, _stripe_size);
+}
+
+std::uint64_t xxh64_state::value() const
+{
+    std::uint64_t h;
+    if (_total_len >= 32)
+    {
+        h = _rotl64(_acc[0], 1) + _rotl64(_acc[1], 7) + _rotl64(_acc[2], 12) + _rotl64(_acc[3], 18);
+        for (std::uint64_t acc : _acc) h = _xxh64_merge_round(h, acc);
+    }
+    else h = XXH_PRIME64_5;
+    h += _total_len;
+    const unsigned char* p = _stripe;
+    const unsigned char* const end = _stripe + _stripe_size;
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= _xxh64_round(0, _read64(p));
+        h = _rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+    if (end - p >= 4)
+    {
+        h ^= static_cast<std::uint64_t>(_read32(p)) * XXH_PRIME64_1;
+        h = _rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    for (; p != end; ++p)
+    {
+        h ^= *p * XXH_PRIME64_5;
+        h = _rotl64(h, 11) * XXH_PRIME64_1;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // end of servlet namespace
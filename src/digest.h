@@ -0,0 +1,103 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_DIGEST_H
+#define MOD_SERVLET_IMPL_DIGEST_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SERVLET_CRC32C_SSE42
+#endif
+
+namespace servlet
+{
+
+enum class digest_algorithm
+{
+    none,
+    crc32c, /* Castagnoli CRC (iSCSI, ext4), SSE4.2 instruction if available */
+    xxh64   /* 64-bit xxHash with zero seed */
+};
+
+/**
+ * Updates CRC32C with the given data. Start with <code>0</code> and pass
+ * the result of the previous call to continue the same checksum.
+ *
+ * <p>SSE4.2 <code>crc32</code> instruction is used if the CPU supports
+ * it, otherwise a table driven implementation.</p>
+ */
+std::uint32_t crc32c(std::uint32_t crc, const char* data, std::size_t len);
+
+/**
+ * Table driven CRC32C, reference for the hardware implementation.
+ */
+std::uint32_t crc32c_sw(std::uint32_t crc, const char* data, std::size_t len);
+
+/**
+ * Returns whether #crc32c uses the SSE4.2 instruction.
+ */
+bool crc32c_hw_supported();
+
+/**
+ * Incremental 64-bit xxHash (XXH64) with zero seed.
+ */
+class xxh64_state
+{
+public:
+    void update(const char* data, std::size_t len);
+    std::uint64_t value() const;
+
+private:
+    /* Seed 0 accumulators: PRIME64_1 + PRIME64_2, PRIME64_2, 0, -PRIME64_1 */
+    std::uint64_t _acc[4] = {0x9E3779B185EBCA87ULL + 0xC2B2AE3D27D4EB4FULL, 0xC2B2AE3D27D4EB4FULL,
+                             0, 0 - 0x9E3779B185EBCA87ULL};
+    std::uint64_t _total_len = 0;
+    unsigned char _stripe[32];
+    std::size_t _stripe_size = 0;
+};
+
+/**
+ * Digest of multipart part content computed while the data passes
+ * through the parser.
+ */
+class part_digest
+{
+public:
+    explicit part_digest(digest_algorithm algorithm = digest_algorithm::none) : _algorithm{algorithm} {}
+
+    digest_algorithm algorithm() const noexcept { return _algorithm; }
+
+    void reset()
+    {
+        _crc = 0;
+        _xxh = xxh64_state{};
+    }
+
+    void update(const char* data, std::size_t len)
+    {
+        if (_algorithm == digest_algorithm::crc32c) _crc = crc32c(_crc, data, len);
+        else if (_algorithm == digest_algorithm::xxh64) _xxh.update(data, len);
+    }
+
+    std::uint64_t value() const
+    {
+        if (_algorithm == digest_algorithm::crc32c) return _crc;
+        else if (_algorithm == digest_algorithm::xxh64) return _xxh.value();
+        return 0;
+    }
+
+private:
+    digest_algorithm _algorithm;
+    std::uint32_t _crc = 0;
+    xxh64_state _xxh;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_DIGEST_H
@@ -7,18 +7,56 @@ http://boost.org/LICENSE_1_0.txt
 */
 #include "dispatcher.h"
 
+#include <cstdio>
 #include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <apr_shm.h>
 
 #include "filter_chain.h"
+#include "memcached_session_store.h"
 #include "request.h"
 #include "response.h"
+#include "shm_session_store.h"
 
 namespace servlet
 {
 
 namespace fs = std::experimental::filesystem;
 
-std::shared_ptr<dispatcher::session_map_type> GLOBAL_SESSIONS_MAP;
+std::shared_ptr<session_manager> GLOBAL_SESSIONS_MAP;
+std::shared_ptr<session_store> SHARED_SESSION_STORE;
+std::shared_ptr<cookie_session_codec> COOKIE_SESSION_CODEC;
+
+/* Snapshots of every web application are kept in their own directory */
+static std::string snapshot_directory(std::uint64_t scope)
+{
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(scope));
+    return std::string{SERVLET_CONFIG.session_snapshot_directory}.append(1, '/').append(name);
+}
+
+static void write_session_snapshot(session_manager &sessions, std::uint64_t scope, const std::string &name)
+{
+    if (SERVLET_CONFIG.session_snapshot_directory.empty()) return;
+    try
+    {
+        std::size_t count = sessions.write_snapshot(snapshot_directory(scope));
+        LG->config() << "Saved " << count << " sessions of " << name << std::endl;
+    }
+    catch (const std::exception &e)
+    {
+        LG->error() << "Failed to save sessions of " << name << ": " << e << std::endl;
+    }
+}
+
+static void restore_session_snapshot(session_manager &sessions, std::uint64_t scope, std::size_t timeout_sec)
+{
+    if (SERVLET_CONFIG.session_snapshot_directory.empty()) return;
+    sessions.set_snapshot(std::make_shared<session_snapshot>(snapshot_directory(scope),
+                                                             std::chrono::seconds{timeout_sec}));
+}
 
 class pool_guard
 {
@@ -225,7 +263,7 @@ optional_ptr<dispatcher::pair_type> dispatcher::_get_factory(string_view uri)
     return optional_ptr<pair_type>{new pair_type{uri.to_string(), false, _dflt_servlet}, true};
 }
 
-int dispatcher::service_request(request_rec* r, URI &uri)
+int dispatcher::service_request(request_rec* r, const request_uri &uri)
 {
     if (LG->is_loggable(logging::LEVEL::DEBUG)) LG->debug() << "Serving request " << uri << std::endl;
     string_view path = uri.path();
@@ -255,8 +293,45 @@ int dispatcher::service_request(request_rec* r, URI &uri)
     filter_pair_type *filters_pair = _filter_map.get_pair(servlet_path);
     std::shared_ptr<filter_chain_holder> url_filters;
     if (filters_pair) url_filters = filters_pair->value;
-    servlet::http_request_base req{r, uri, _ctx_path, servlet_ptr->uri_pattern, _session_map};
-    servlet::http_response_base resp{r};
+    servlet::http_request_base req{r, uri, _ctx_path, servlet_ptr->uri_pattern, _sessions,
+                                   _multipart_config, servlet_ptr->value->is_body_replay(),
+                                   _request_deadline(r, servlet_ptr->value->get_deadline())};
+    if (req.get_cancellation_token().is_cancelled()) /* Nobody waits for the response already */
+    {
+        if (LG->is_loggable(logging::LEVEL::DEBUG))
+            LG->debug() << "Request " << uri << " is past its deadline, not serving it" << std::endl;
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+    servlet::http_response_base resp{r, &req.get_cancellation_token(), [&req] { req.response_committed(); }};
+    try
+    {
+        _service(srvlt, named_filters.get(), url_filters.get(), req, resp, uri);
+        /* Headers of a response without a body are sent after the handler returns */
+        req.commit_session();
+    }
+    catch (const request_cancelled_exception& e)
+    {
+        if (LG->is_loggable(logging::LEVEL::DEBUG)) LG->debug() << "Request " << uri << ": " << e.what() << std::endl;
+        return HTTP_SERVICE_UNAVAILABLE;
+    }
+    catch (const request_too_large_exception& e)
+    {
+        if (LG->is_loggable(logging::LEVEL::INFO)) LG->info() << "Rejected request " << uri << ": " << e.what() << std::endl;
+        return HTTP_REQUEST_ENTITY_TOO_LARGE;
+    }
+    int status = resp.get_status();
+    auto found_it = _error_pages.find(status);
+    if (found_it != _error_pages.end())
+    {
+        status = OK;
+        req.forward(found_it->second);
+    }
+    return status;
+}
+
+void dispatcher::_service(http_servlet *srvlt, filter_chain_holder *named_filters, filter_chain_holder *url_filters,
+                          http_request &req, http_response &resp, const request_uri &uri)
+{
     if (named_filters)
     {
         if (url_filters)
@@ -283,14 +358,40 @@ int dispatcher::service_request(request_rec* r, URI &uri)
         }
         srvlt->service(req, resp);
     }
-    int status = resp.get_status();
-    auto found_it = _error_pages.find(status);
-    if (found_it != _error_pages.end())
+}
+
+/* Parses milliseconds from the deadline header, saturating at max.
+ * Returns -1 if the value is not a non-negative whole number. */
+static long _parse_deadline(string_view value, long max)
+{
+    if (value.empty()) return -1;
+    long ms = 0;
+    for (char c : value)
     {
-        status = OK;
-        req.forward(found_it->second);
+        if (c < '0' || c > '9') return -1;
+        ms = ms > (max - (c - '0')) / 10 ? max : ms * 10 + (c - '0');
     }
-    return status;
+    return ms;
+}
+
+cancellation_token::time_point dispatcher::_request_deadline(request_rec* r, std::chrono::milliseconds timeout) const
+{
+    /* Both values are clamped before they are added to the clock, so they cannot overflow it */
+    long max = _max_deadline.count();
+    long ms = timeout.count() > 0 ? std::min(timeout.count(), max) : -1;
+    if (!_deadline_header.empty())
+    {
+        const char *header = apr_table_get(r->headers_in, _deadline_header.c_str());
+        long header_ms = header ? _parse_deadline(trim_view(string_view{header}), max) : -1L;
+        if (header && header_ms < 0 && LG->is_loggable(logging::LEVEL::DEBUG))
+            LG->debug() << "Ignoring invalid " << _deadline_header << " header: '" << header << "'" << std::endl;
+        if (header_ms >= 0 && (ms < 0 || header_ms < ms)) ms = header_ms;
+    }
+    if (ms < 0) return cancellation_token::time_point::max();
+    /* The time goes from the moment the request arrived, not from the moment it is dispatched */
+    apr_time_t elapsed = apr_time_now() - r->request_time;
+    if (elapsed < 0) elapsed = 0;
+    return cancellation_token::clock_type::now() - std::chrono::microseconds{elapsed} + std::chrono::milliseconds{ms};
 }
 
 class _apr_file
@@ -535,7 +636,13 @@ dispatcher::~dispatcher() noexcept
     _dflt_servlet.reset();
     _dflt_dso.reset();
     _ext_map.clear();
-    _session_map.reset();
+    if (_sessions)
+    {
+        if (!SERVLET_CONFIG.share_sessions) write_session_snapshot(*_sessions, session_scope(_ctx_path), _ctx_path);
+        /* Shared sessions outlive this webapp, its listeners must not be called anymore */
+        _sessions->remove_listeners(this);
+        _sessions.reset();
+    }
     _servlet_map.clear();
     _filter_map.clear();
     _name_filter_map.clear();
@@ -566,8 +673,23 @@ void dispatcher::_init()
         _read_webapp_config(cfg, doc->root);
     }
     _content_types.reset(new content_type_map{std::move(cfg.get_mime_type_mapping())});
-    if (SERVLET_CONFIG.share_sessions) _session_map = GLOBAL_SESSIONS_MAP;
-    else _session_map.reset(new session_map_type{cfg.get_session_timeout()*60});
+    _multipart_config = cfg.get_multipart_config();
+    fs::path mp_location{_multipart_config.location.empty() ? "WEB-INF/work" : _multipart_config.location};
+    if (mp_location.is_relative()) mp_location = _path / mp_location;
+    _multipart_config.location = mp_location.generic_string();
+    _deadline_header = cfg.get_deadline_header();
+    _max_deadline = cfg.get_max_deadline();
+    if (SERVLET_CONFIG.share_sessions) _sessions = GLOBAL_SESSIONS_MAP;
+    else
+    {
+        _sessions.reset(new session_manager{cfg.get_session_timeout()*60});
+        _sessions->set_memory_budget(SERVLET_CONFIG.session_memory_budget);
+        _sessions->start(std::chrono::seconds{SERVLET_CONFIG.session_sweep_interval});
+        if (SHARED_SESSION_STORE) _sessions->set_shared_store(SHARED_SESSION_STORE, session_scope(_ctx_path));
+        if (COOKIE_SESSION_CODEC) _sessions->set_cookie_codec(COOKIE_SESSION_CODEC, session_scope(_ctx_path));
+        restore_session_snapshot(*_sessions, session_scope(_ctx_path), cfg.get_session_timeout()*60);
+    }
+    for (auto &&listener : cfg.get_listeners()) _sessions->add_listener(listener, this);
 
     _init_servlets(cfg);
     _init_filters(cfg);
@@ -577,7 +699,12 @@ void webapp_dispatcher::init()
 {
     if (SERVLET_CONFIG.share_sessions && !GLOBAL_SESSIONS_MAP)
     {
-        GLOBAL_SESSIONS_MAP.reset(new dispatcher::session_map_type{SERVLET_CONFIG.session_timeout*60});
+        GLOBAL_SESSIONS_MAP.reset(new session_manager{SERVLET_CONFIG.session_timeout*60});
+        GLOBAL_SESSIONS_MAP->set_memory_budget(SERVLET_CONFIG.session_memory_budget);
+        GLOBAL_SESSIONS_MAP->start(std::chrono::seconds{SERVLET_CONFIG.session_sweep_interval});
+        if (SHARED_SESSION_STORE) GLOBAL_SESSIONS_MAP->set_shared_store(SHARED_SESSION_STORE, session_scope("/"));
+        if (COOKIE_SESSION_CODEC) GLOBAL_SESSIONS_MAP->set_cookie_codec(COOKIE_SESSION_CODEC, session_scope("/"));
+        restore_session_snapshot(*GLOBAL_SESSIONS_MAP, session_scope("/"), SERVLET_CONFIG.session_timeout*60);
     }
     for (auto &&webapp : fs::directory_iterator{fs::path{SERVLET_CONFIG.webapp_root}})
     {
@@ -602,4 +729,92 @@ void webapp_dispatcher::init()
     }
 }
 
+static apr_status_t shared_sessions_cleanup(void *)
+{
+    SHARED_SESSION_STORE.reset();
+    COOKIE_SESSION_CODEC.reset();
+    return APR_SUCCESS;
+}
+
+static void init_cookie_sessions(apr_pool_t *pool)
+{
+    try
+    {
+        std::ifstream in{SERVLET_CONFIG.session_cookie_secret_file, std::ios::binary};
+        if (!in) throw config_exception{std::string{"Failed to read session cookie secret "}.
+                                        append(SERVLET_CONFIG.session_cookie_secret_file)};
+        std::string secret{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+        /* Line end of a text file is not a part of the secret */
+        while (!secret.empty() && (secret.back() == '\n' || secret.back() == '\r')) secret.pop_back();
+        COOKIE_SESSION_CODEC = std::make_shared<cookie_session_codec>(
+                std::move(secret), cookie_session_codec::parse_cipher(SERVLET_CONFIG.session_cookie_cipher),
+                std::chrono::hours{SERVLET_CONFIG.session_cookie_key_rotation});
+    }
+    catch (const std::exception &e)
+    {
+        LG->error() << "Failed to set up cookie sessions: " << e << ". Sessions are kept per process." << std::endl;
+        return;
+    }
+    apr_pool_cleanup_register(pool, NULL, shared_sessions_cleanup, NULL);
+    LG->config() << "Sessions are kept in cookies sealed with " << SERVLET_CONFIG.session_cookie_cipher
+                 << ", keys rotate every " << SERVLET_CONFIG.session_cookie_key_rotation << " hours" << std::endl;
+}
+
+static void init_memcached_sessions(apr_pool_t *pool)
+{
+    /* Connections are opened on demand, so every child process gets its own */
+    SHARED_SESSION_STORE = std::make_shared<memcached_session_store>(
+            SERVLET_CONFIG.session_memcached_servers, SERVLET_CONFIG.session_memcached_pool_size,
+            std::chrono::milliseconds{SERVLET_CONFIG.session_memcached_timeout},
+            std::chrono::milliseconds{SERVLET_CONFIG.session_memcached_near_cache});
+    apr_pool_cleanup_register(pool, NULL, shared_sessions_cleanup, NULL);
+    LG->config() << "Sessions are kept in memcached " << SERVLET_CONFIG.session_memcached_servers << std::endl;
+}
+
+static void init_shm_sessions(apr_pool_t *pool)
+{
+    if (SERVLET_CONFIG.session_shared_memory == 0)
+    {
+        LG->error() << "Size of shared memory for sessions is not set. Sessions are kept per process." << std::endl;
+        return;
+    }
+    apr_shm_t *shm;
+    apr_status_t rv = apr_shm_create(&shm, SERVLET_CONFIG.session_shared_memory, NULL, pool);
+    if (rv != APR_SUCCESS)
+    {
+        LG->error() << "Failed to create shared memory for sessions, error " << rv
+                    << ". Sessions are kept per process." << std::endl;
+        return;
+    }
+    void *base = apr_shm_baseaddr_get(shm);
+    std::size_t size = apr_shm_size_get(shm);
+    shm_session_store::format(base, size, SERVLET_CONFIG.session_shared_slot_size);
+    auto store = std::make_shared<shm_session_store>(base, size);
+    SHARED_SESSION_STORE = store;
+    /* The memory goes away with the pool on restart */
+    apr_pool_cleanup_register(pool, NULL, shared_sessions_cleanup, NULL);
+    LG->config() << "Sessions are shared by child processes in " << store->slot_count()
+                 << " slots of " << store->max_data_size() << " bytes" << std::endl;
+}
+
+void webapp_dispatcher::init_shared_sessions(apr_pool_t *pool)
+{
+    const std::string &type = SERVLET_CONFIG.session_store;
+    if (type == "memcached") init_memcached_sessions(pool);
+    else if (type == "cookie") init_cookie_sessions(pool);
+    else if (type == "shm" || (type.empty() && SERVLET_CONFIG.session_shared_memory > 0)) init_shm_sessions(pool);
+    else if (!type.empty() && type != "local")
+    {
+        LG->error() << "Unknown session store '" << type << "'. Sessions are kept per process." << std::endl;
+    }
+}
+
+void webapp_dispatcher::clear()
+{
+    pattern_map_type::clear();
+    if (GLOBAL_SESSIONS_MAP) write_session_snapshot(*GLOBAL_SESSIONS_MAP, session_scope("/"), "shared sessions");
+    /* Stops the sweeper thread before the module is unloaded */
+    GLOBAL_SESSIONS_MAP.reset();
+}
+
 } // end of servlet namespace
@@ -9,6 +9,7 @@ http://boost.org/LICENSE_1_0.txt
 #define SERVLET_DISPATCHER_H
 
 #include <algorithm>
+#include <chrono>
 #include <memory>
 #include <experimental/string_view>
 #include <experimental/filesystem>
@@ -25,6 +26,7 @@ http://boost.org/LICENSE_1_0.txt
 #include <apr_xml.h>
 #include <apr_dso.h>
 #include "context.h"
+#include "request_uri.h"
 #include "config.h"
 #include "map_ex.h"
 
@@ -70,6 +72,14 @@ public:
 
     int get_load_on_startup() const { return _load_on_startup; }
     _servlet_config* get_servlet_config() const { return _cfg.get(); }
+
+    /* Request body of this servlet can be read more than once, by filters and the servlet */
+    bool is_body_replay() const { return _body_replay; }
+    void set_body_replay(bool body_replay) { _body_replay = body_replay; }
+
+    /* Time requests to this servlet are allowed to take, zero if not limited */
+    std::chrono::milliseconds get_deadline() const { return _deadline; }
+    void set_deadline(std::chrono::milliseconds deadline) { _deadline = deadline; }
 private:
 
     std::unique_ptr<_servlet_config> _cfg;
@@ -77,6 +87,8 @@ private:
     http_servlet* (*_factory)();
     http_servlet* _servlet = nullptr;
     int _load_on_startup;
+    bool _body_replay = false;
+    std::chrono::milliseconds _deadline{0};
     std::atomic<bool> _servlet_inited{false};
     std::mutex _init_mutex;
 };
@@ -154,13 +166,26 @@ class _webapp_config
     tree_map<string_view, std::vector<std::pair<string_view, std::size_t>>> _filter_to_servlet_mapping;
     std::map<std::string, std::string, std::less<>> _mime_type_mapping;
     std::size_t _session_timeout = 30;
+    multipart_config _multipart_config;
+    std::string _deadline_header;
+    std::chrono::milliseconds _max_deadline{std::chrono::hours{24}};
+    std::vector<std::shared_ptr<http_session_listener>> _listeners;
 
 public:
     _webapp_config() {}
     std::size_t get_session_timeout() const { return _session_timeout; }
     void set_session_timeout(std::size_t session_timeout) { _session_timeout = session_timeout; }
+    multipart_config &get_multipart_config() { return _multipart_config; }
+    /** Request header carrying the time left to the request deadline in milliseconds */
+    const std::string &get_deadline_header() const { return _deadline_header; }
+    void set_deadline_header(std::string header) { _deadline_header = std::move(header); }
+    /** Upper bound of the deadlines from the header and from the servlet configuration */
+    std::chrono::milliseconds get_max_deadline() const { return _max_deadline; }
+    void set_max_deadline(std::chrono::milliseconds max_deadline) { _max_deadline = max_deadline; }
 
     std::map<string_view, _servlet_mapping, std::less<>>& get_servlets() { return _servlets; };
+    /** Session listeners in the order of declaration */
+    std::vector<std::shared_ptr<http_session_listener>> &get_listeners() { return _listeners; }
     /** filter name -> factory map */
     std::map<string_view, std::shared_ptr<filter_factory>, std::less<>> &get_filters() { return _filters; }
     /** filter url-pattern -> filter-name map */
@@ -180,7 +205,6 @@ public:
     typedef typename servlet_map_type::pair_type              pair_type;
     typedef pattern_map<std::shared_ptr<filter_chain_holder>> filter_map_type;
     typedef typename filter_map_type::pair_type               filter_pair_type;
-    typedef lru_tree_map<std::string, std::shared_ptr<http_session_impl>> session_map_type;
 
     dispatcher(const fs::path &path, std::string &&ctx_path) :
             _path{path}, _ctx_path{std::move(ctx_path)}, _max_ext_length{0} { _init(); }
@@ -190,10 +214,12 @@ public:
 
     const fs::path& webapp_path() const { return _path; }
 
-    int service_request(request_rec* r, URI &uri);
+    int service_request(request_rec* r, const request_uri &uri);
 
 private:
     optional_ptr<pair_type> _get_factory(string_view uri);
+    void _service(http_servlet *srvlt, filter_chain_holder *named_filters, filter_chain_holder *url_filters,
+                  http_request &req, http_response &resp, const request_uri &uri);
 
     void _init_filters(_webapp_config &cfg);
     void _init_servlets(_webapp_config &cfg);
@@ -201,10 +227,13 @@ private:
                            std::map<std::string, std::shared_ptr<dso>>& dso_map);
     void _read_filter_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
                           std::map<std::string, std::shared_ptr<dso>>& dso_map);
+    void _read_listener_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
+                            std::map<std::string, std::shared_ptr<dso>>& dso_map);
     std::shared_ptr<dso> _find_or_load_dso(std::map<std::string, std::shared_ptr<dso>>& dso_map,
                                            const std::string& lib_subpath);
     void _read_webapp_config(_webapp_config& cfg, apr_xml_elem *root);
     void _init();
+    cancellation_token::time_point _request_deadline(request_rec* r, std::chrono::milliseconds timeout) const;
 
     apr_pool_t *_pool;
     fs::path _path;
@@ -216,8 +245,11 @@ private:
     std::shared_ptr<dso> _dflt_dso;
     std::map<std::string, std::shared_ptr<servlet_factory>, std::less<>> _ext_map;
     std::size_t _max_ext_length;
-    std::shared_ptr<session_map_type> _session_map;
+    std::shared_ptr<session_manager> _sessions;
     std::shared_ptr<content_type_map> _content_types;
+    multipart_config _multipart_config;
+    std::string _deadline_header;
+    std::chrono::milliseconds _max_deadline;
 
     pattern_map<std::shared_ptr<servlet_factory>> _servlet_map;
 
@@ -233,6 +265,10 @@ public:
     typedef pattern_map<dispatcher> pattern_map_type;
 
     void init();
+    void clear();
+
+    /* Creates the store of sessions shared by the child processes or hosts. Is called in the parent process. */
+    static void init_shared_sessions(apr_pool_t *pool);
 };
 
 } // end of servlet namespace
@@ -0,0 +1,164 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <zlib.h>
+
+#include <servlet/lib/exception.h>
+
+#include "string.h"
+#include "inflate_filter.h"
+
+namespace servlet
+{
+
+content_coding parse_content_coding(string_view encoding)
+{
+    encoding = trim_view(encoding);
+    if (equal_ic(encoding, "gzip") || equal_ic(encoding, "x-gzip")) return content_coding::gzip;
+    if (equal_ic(encoding, "deflate")) return content_coding::deflate;
+    return content_coding::identity;
+}
+
+struct _inflate_state
+{
+    z_stream stream;
+
+    _inflate_state()
+    {
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, MAX_WBITS + 32) != Z_OK) throw std::bad_alloc{};
+    }
+    ~_inflate_state() noexcept { inflateEnd(&stream); }
+};
+
+/* One inflater per thread is enough: a request body is inflated by the
+ * thread handling the request and nested compressed bodies are rare. */
+struct _inflate_state_cache
+{
+    _inflate_state *state = nullptr;
+
+    ~_inflate_state_cache() noexcept { delete state; }
+};
+
+static thread_local _inflate_state_cache STATE_CACHE;
+
+inflate_filter::inflate_filter(content_coding coding, std::size_t limit, std::size_t buf_size) :
+        _state{nullptr}, _coding{coding}, _limit{limit}, _buffer{buf_size}
+{
+    if (STATE_CACHE.state)
+    {
+        _state = STATE_CACHE.state;
+        STATE_CACHE.state = nullptr;
+    }
+    else _state = new _inflate_state{};
+    _state->stream.next_in = nullptr;
+    _state->stream.avail_in = 0;
+}
+
+inflate_filter::~inflate_filter() noexcept
+{
+    if (!STATE_CACHE.state && inflateReset(&_state->stream) == Z_OK) STATE_CACHE.state = _state;
+    else delete _state;
+}
+
+void inflate_filter::_detect_format()
+{
+    int window_bits = MAX_WBITS + 16; /* gzip */
+    if (_coding == content_coding::deflate)
+    {
+        /* "deflate" is supposed to be zlib wrapped (RFC 7230), but
+         * some clients send raw deflate stream. zlib header is 2 bytes
+         * with compression method 8 and a check sum. */
+        z_stream &zs = _state->stream;
+        unsigned char b0 = zs.next_in[0];
+        unsigned char b1 = zs.avail_in > 1 ? zs.next_in[1] : 0;
+        bool zlib_header = zs.avail_in > 1 && (b0 & 0x0f) == Z_DEFLATED && (b0 >> 4) + 8 <= MAX_WBITS &&
+                           ((b0 << 8) | b1) % 31 == 0;
+        window_bits = zlib_header ? MAX_WBITS : -MAX_WBITS;
+    }
+    if (inflateReset2(&_state->stream, window_bits) != Z_OK)
+    {
+        throw io_exception{"Failed to initialize decompression of the request body"};
+    }
+    _started = true;
+}
+
+std::streamsize inflate_filter::read(char* s, std::streamsize n, basic_source<char>& src)
+{
+    if (_finished || n <= 0) return 0;
+    z_stream &zs = _state->stream;
+    zs.next_out = reinterpret_cast<Bytef*>(s);
+    zs.avail_out = static_cast<uInt>(std::min<std::streamsize>(n, UINT_MAX));
+    uInt out_size = zs.avail_out;
+    while (zs.avail_out == out_size)
+    {
+        if (zs.avail_in == 0)
+        {
+            std::streamsize size = src.read(_buffer.data(), _buffer.size());
+            if (size <= 0 && !_started)
+            {
+                /* Empty body has nothing to decompress */
+                _finished = true;
+                break;
+            }
+            if (size <= 0) throw io_exception{"Unexpected end of compressed request body"};
+            /* Format detection needs the whole 2 bytes header */
+            while (!_started && size < 2)
+            {
+                std::streamsize next = src.read(_buffer.data() + size, _buffer.size() - size);
+                if (next <= 0) break;
+                size += next;
+            }
+            zs.next_in = reinterpret_cast<Bytef*>(_buffer.data());
+            zs.avail_in = static_cast<uInt>(size);
+        }
+        if (!_started) _detect_format();
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            if (_coding == content_coding::gzip && zs.avail_in == 0)
+            {
+                std::streamsize size = src.read(_buffer.data(), _buffer.size());
+                zs.next_in = reinterpret_cast<Bytef*>(_buffer.data());
+                zs.avail_in = static_cast<uInt>(std::max<std::streamsize>(size, 0));
+            }
+            if (_coding != content_coding::gzip || zs.avail_in == 0)
+            {
+                _finished = true;
+                break;
+            }
+            /* gzip body can be several members one after another (RFC 1952) */
+            if (inflateReset(&zs) != Z_OK)
+            {
+                throw io_exception{"Failed to initialize decompression of the request body"};
+            }
+            continue;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            std::string msg{"Invalid compressed request body"};
+            if (zs.msg) msg.append(": ").append(zs.msg);
+            throw io_exception{msg};
+        }
+    }
+    std::size_t produced = out_size - zs.avail_out;
+    _total += produced;
+    if (_total > _limit)
+    {
+        throw io_exception{std::string{"Decompressed request body exceeds the limit of "}.
+                append(std::to_string(_limit)).append(" bytes")};
+    }
+    return static_cast<std::streamsize>(produced);
+}
+
+} // end of servlet namespace
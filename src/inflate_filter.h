@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_INFLATE_FILTER_H
+#define MOD_SERVLET_IMPL_INFLATE_FILTER_H
+
+#include <experimental/string_view>
+
+#include <servlet/lib/io_filter.h>
+
+#include "buffer_pool.h"
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+/**
+ * Content codings of the request body which can be decoded.
+ */
+enum class content_coding
+{
+    identity, gzip, deflate
+};
+
+/**
+ * Parses value of <code>Content-Encoding</code> header.
+ *
+ * <p>Returns <code>content_coding::identity</code> for empty and
+ * unsupported codings, the body is passed to the servlet as is then.</p>
+ * @param encoding Value of <code>Content-Encoding</code> header.
+ * @return the coding of the request body
+ */
+content_coding parse_content_coding(string_view encoding);
+
+struct _inflate_state;
+
+/**
+ * Input filter inflating gzip or deflate compressed data.
+ *
+ * <p>zlib state is taken from a per-thread cache and reset instead of
+ * being allocated and initialized for every request. Compressed data is
+ * read from the source into a pooled buffer.</p>
+ *
+ * <p>The amount of inflated data is limited, <code>io_exception</code>
+ * is thrown as soon as the limit is exceeded, so that a small malicious
+ * body cannot be inflated into gigabytes of memory.</p>
+ */
+class inflate_filter : public in_filter
+{
+public:
+    /**
+     * Constructs the filter.
+     * @param coding Either <code>content_coding::gzip</code> or
+     *               <code>content_coding::deflate</code>. For deflate
+     *               both zlib wrapped and raw streams are accepted.
+     * @param limit Maximum number of inflated bytes.
+     * @param buf_size Size of the buffer for compressed data.
+     */
+    inflate_filter(content_coding coding, std::size_t limit, std::size_t buf_size = 16*1024);
+    ~inflate_filter() noexcept override;
+
+    inflate_filter(const inflate_filter&) = delete;
+    inflate_filter& operator=(const inflate_filter&) = delete;
+
+    std::streamsize read(char* s, std::streamsize n, basic_source<char>& src) override;
+
+    /**
+     * Returns number of inflated bytes produced so far.
+     * @return number of inflated bytes
+     */
+    std::size_t total_out() const noexcept { return _total; }
+
+private:
+    void _detect_format();
+
+    _inflate_state *_state;
+    content_coding _coding;
+    std::size_t _limit;
+    std::size_t _total = 0;
+    pooled_buffer _buffer;
+    bool _started = false;
+    bool _finished = false;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_INFLATE_FILTER_H
@@ -0,0 +1,454 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "memcached_session_store.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <system_error>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <servlet/lib/exception.h>
+
+#include "os.h"
+
+namespace servlet
+{
+
+/* Larger expiration times are taken by memcached for absolute UNIX time */
+static constexpr long long MAX_RELATIVE_EXPTIME = 60 * 60 * 24 * 30;
+static constexpr std::size_t VERSION_SIZE = sizeof(std::uint64_t);
+/* Entries of the near cache are dropped in bulk when there are too many of them */
+static constexpr std::size_t MAX_NEAR_ENTRIES = 64 * 1024;
+
+struct memcached_session_store::_server
+{
+    std::string host;
+    std::string port;
+    std::mutex mx;
+    std::vector<std::unique_ptr<_connection>> idle;
+};
+
+class memcached_session_store::_connection
+{
+public:
+    _connection(const _server &server, std::chrono::milliseconds timeout)
+    {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *addrs;
+        int rc = getaddrinfo(server.host.data(), server.port.data(), &hints, &addrs);
+        if (rc != 0)
+        {
+            throw io_exception{std::string{"Failed to resolve memcached server "}.append(server.host).
+                    append(": ").append(gai_strerror(rc))};
+        }
+        timeval tv;
+        tv.tv_sec = timeout.count() / 1000;
+        tv.tv_usec = (timeout.count() % 1000) * 1000;
+        int err = 0;
+        for (addrinfo *ai = addrs; ai; ai = ai->ai_next)
+        {
+            _fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (_fd < 0)
+            {
+                err = errno;
+                continue;
+            }
+            /* Send timeout limits connect() as well */
+            setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            int one = 1;
+            setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+            err = errno;
+            ::close(_fd);
+            _fd = -1;
+        }
+        freeaddrinfo(addrs);
+        if (_fd < 0)
+        {
+            throw io_exception{std::string{"Failed to connect to memcached server "}.append(server.host).
+                    append(1, ':').append(server.port).append(": ").append(std::strerror(err))};
+        }
+    }
+    ~_connection() noexcept { ::close(_fd); }
+
+    _connection(const _connection&) = delete;
+    _connection& operator=(const _connection&) = delete;
+
+    void write(string_view data)
+    {
+        while (!data.empty())
+        {
+            ssize_t n = ::send(_fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR) continue;
+                throw io_exception{std::string{"Failed to send to memcached: "}.append(std::strerror(errno))};
+            }
+            data.remove_prefix(n);
+        }
+    }
+
+    /* Returns the next response line without CRLF, valid until the next read */
+    string_view read_line()
+    {
+        for (std::size_t scanned = 0;;)
+        {
+            const char *begin = _buf + _pos;
+            const char *nl = static_cast<const char*>(std::memchr(begin + scanned, '\n', _end - _pos - scanned));
+            if (nl)
+            {
+                std::size_t len = nl - begin;
+                _pos += len + 1;
+                if (len > 0 && begin[len - 1] == '\r') --len;
+                return string_view{begin, len};
+            }
+            scanned = _end - _pos;
+            if (_pos > 0)
+            {
+                std::memmove(_buf, _buf + _pos, scanned);
+                _end = scanned;
+                _pos = 0;
+            }
+            if (_end == sizeof(_buf)) throw io_exception{"Response line of memcached is too long"};
+            _fill();
+        }
+    }
+
+    /* Reads a data block followed by CRLF. out may be null to skip the data */
+    void read_data(std::size_t size, std::string *out)
+    {
+        std::size_t remaining = size + 2;
+        if (out)
+        {
+            out->clear();
+            out->reserve(size);
+        }
+        while (remaining > 0)
+        {
+            if (_pos == _end)
+            {
+                _pos = _end = 0;
+                _fill();
+            }
+            std::size_t n = std::min(remaining, _end - _pos);
+            std::size_t data_n = remaining > 2 ? std::min(n, remaining - 2) : 0;
+            if (out) out->append(_buf + _pos, data_n);
+            _pos += n;
+            remaining -= n;
+        }
+    }
+
+private:
+    void _fill()
+    {
+        for (;;)
+        {
+            ssize_t n = ::recv(_fd, _buf + _end, sizeof(_buf) - _end, 0);
+            if (n > 0)
+            {
+                _end += n;
+                return;
+            }
+            if (n == 0) throw io_exception{"Connection closed by memcached"};
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) throw io_exception{"Timeout reading from memcached"};
+            throw io_exception{std::string{"Failed to read from memcached: "}.append(std::strerror(errno))};
+        }
+    }
+
+    int _fd = -1;
+    char _buf[4096];
+    std::size_t _pos = 0;
+    std::size_t _end = 0;
+};
+
+/* Connection taken from the pool. It goes back only if release() is called, broken ones are closed */
+class memcached_session_store::_lease
+{
+public:
+    _lease(memcached_session_store &store, _server &server) : _store{store}, _server_ref{server}
+    {
+        {
+            std::lock_guard<std::mutex> lock{server.mx};
+            if (!server.idle.empty())
+            {
+                _conn = std::move(server.idle.back());
+                server.idle.pop_back();
+            }
+        }
+        if (!_conn) _conn.reset(new _connection{server, store._timeout});
+    }
+
+    _lease(const _lease&) = delete;
+    _lease& operator=(const _lease&) = delete;
+
+    _connection* operator->() { return _conn.get(); }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock{_server_ref.mx};
+        if (_server_ref.idle.size() < _store._pool_size) _server_ref.idle.push_back(std::move(_conn));
+    }
+
+private:
+    memcached_session_store &_store;
+    _server &_server_ref;
+    std::unique_ptr<_connection> _conn;
+};
+
+static void throw_response_error(string_view command, string_view line)
+{
+    throw io_exception{std::string{"Unexpected memcached response to "}.append(command.data(), command.size()).
+            append(": ").append(line.data(), line.size())};
+}
+
+static long long exptime(std::chrono::seconds timeout)
+{
+    long long t = timeout.count();
+    if (t <= 0) return -1; /* Expired immediately */
+    if (t <= MAX_RELATIVE_EXPTIME) return t;
+    long long now = std::time(nullptr);
+    /* Timeout too large for the 32 bit time of memcached means no expiration */
+    if (t > 0xffffffffll - now) return 0;
+    return now + t;
+}
+
+static std::uint64_t next_version()
+{
+    struct generator
+    {
+        std::mt19937_64 engine;
+        int pid = 0;
+    };
+    static thread_local generator GEN;
+    int pid = get_pid();
+    if (pid != GEN.pid)
+    {
+        /* Versions must differ between processes writing the same session */
+        std::uint64_t seed;
+        system_random_bytes(reinterpret_cast<unsigned char*>(&seed), sizeof(seed));
+        GEN.engine.seed(seed);
+        GEN.pid = pid;
+    }
+    std::uint64_t version;
+    while ((version = GEN.engine()) == 0);
+    return version;
+}
+
+memcached_session_store::memcached_session_store(string_view servers, std::size_t pool_size,
+                                                 std::chrono::milliseconds timeout,
+                                                 std::chrono::milliseconds near_cache) :
+        _pool_size{pool_size}, _timeout{timeout}, _near_ttl{near_cache}
+{
+    while (!servers.empty())
+    {
+        std::size_t comma = servers.find(',');
+        string_view server = servers.substr(0, comma);
+        servers.remove_prefix(comma == string_view::npos ? servers.size() : comma + 1);
+        while (!server.empty() && std::isspace(server.front())) server.remove_prefix(1);
+        while (!server.empty() && std::isspace(server.back())) server.remove_suffix(1);
+        if (server.empty()) continue;
+        std::size_t colon = server.rfind(':');
+        std::unique_ptr<_server> s{new _server};
+        if (colon == string_view::npos)
+        {
+            s->host = server.to_string();
+            s->port = "11211";
+        }
+        else
+        {
+            s->host = server.substr(0, colon).to_string();
+            s->port = server.substr(colon + 1).to_string();
+        }
+        _servers.push_back(std::move(s));
+    }
+    if (_servers.empty()) throw config_exception{"No memcached servers configured for sessions"};
+}
+
+memcached_session_store::~memcached_session_store() noexcept = default;
+
+bool memcached_session_store::_valid_id(string_view id)
+{
+    /* IDs come from cookies, they must not break the protocol */
+    if (id.empty() || id.size() > MAX_ID_LENGTH) return false;
+    for (char c : id)
+    {
+        if (c <= ' ' || c > '~') return false;
+    }
+    return true;
+}
+
+std::string memcached_session_store::_key(std::uint64_t scope, string_view id)
+{
+    char prefix[24];
+    int len = std::snprintf(prefix, sizeof(prefix), "ms:%016llx:", static_cast<unsigned long long>(scope));
+    return std::string(prefix, len).append(id.data(), id.size());
+}
+
+memcached_session_store::_server& memcached_session_store::_get_server(const std::string &key)
+{
+    if (_servers.size() == 1) return *_servers.front();
+    /* Every host must pick the same server for the key */
+    return *_servers[session_scope(key) % _servers.size()];
+}
+
+bool memcached_session_store::_near_hit(const std::string &key, std::uint64_t version)
+{
+    if (_near_ttl.count() <= 0 || version == 0) return false;
+    std::lock_guard<std::mutex> lock{_near_mx};
+    auto it = _near.find(key);
+    return it != _near.end() && it->second.version == version &&
+           clock_type::now() - it->second.fetched < _near_ttl;
+}
+
+void memcached_session_store::_near_put(const std::string &key, std::uint64_t version)
+{
+    if (_near_ttl.count() <= 0) return;
+    clock_type::time_point now = clock_type::now();
+    std::lock_guard<std::mutex> lock{_near_mx};
+    if (_near.size() >= MAX_NEAR_ENTRIES)
+    {
+        for (auto it = _near.begin(); it != _near.end();)
+        {
+            if (now - it->second.fetched >= _near_ttl) it = _near.erase(it);
+            else ++it;
+        }
+        if (_near.size() >= MAX_NEAR_ENTRIES) _near.clear();
+    }
+    _near[key] = _near_entry{version, now};
+}
+
+void memcached_session_store::_near_erase(const std::string &key)
+{
+    if (_near_ttl.count() <= 0) return;
+    std::lock_guard<std::mutex> lock{_near_mx};
+    _near.erase(key);
+}
+
+bool memcached_session_store::get(std::uint64_t scope, string_view id, std::chrono::seconds timeout,
+                                  std::uint64_t &version, std::string &data)
+{
+    if (!_valid_id(id)) return false;
+    std::string key = _key(scope, id);
+    if (_near_hit(key, version)) return true;
+
+    std::string request = std::string{"touch "}.append(key).append(1, ' ').
+            append(std::to_string(exptime(timeout))).append("\r\nget ").append(key).append("\r\n");
+    _lease conn{*this, _get_server(key)};
+    conn->write(request);
+    string_view line = conn->read_line();
+    if (line != "TOUCHED" && line != "NOT_FOUND") throw_response_error("touch", line);
+    line = conn->read_line();
+    if (line == "END")
+    {
+        conn.release();
+        _near_erase(key);
+        return false;
+    }
+    /* VALUE <key> <flags> <bytes> */
+    if (line.substr(0, 6) != "VALUE ") throw_response_error("get", line);
+    std::size_t space = line.rfind(' ');
+    std::size_t size = std::strtoull(line.substr(space + 1).to_string().data(), nullptr, 10);
+    std::string value;
+    conn->read_data(size, &value);
+    line = conn->read_line();
+    if (line != "END") throw_response_error("get", line);
+    conn.release();
+
+    if (value.size() < VERSION_SIZE) throw io_exception{"Malformed session in memcached"};
+    std::uint64_t stored_version;
+    std::memcpy(&stored_version, value.data(), VERSION_SIZE);
+    _near_put(key, stored_version);
+    if (stored_version == version) return true;
+    version = stored_version;
+    data.assign(value, VERSION_SIZE, std::string::npos);
+    return true;
+}
+
+std::uint64_t memcached_session_store::put(std::uint64_t scope, string_view id, string_view data,
+                                           std::chrono::seconds timeout, bool create)
+{
+    if (!_valid_id(id)) throw io_exception{"Session ID can't be stored in memcached"};
+    std::string key = _key(scope, id);
+    std::uint64_t version = next_version();
+
+    std::string request = std::string{create ? "add " : "set "}.append(key).append(" 0 ").
+            append(std::to_string(exptime(timeout))).append(1, ' ').
+            append(std::to_string(VERSION_SIZE + data.size())).append("\r\n");
+    request.append(reinterpret_cast<const char*>(&version), VERSION_SIZE).
+            append(data.data(), data.size()).append("\r\n");
+    _lease conn{*this, _get_server(key)};
+    conn->write(request);
+    string_view line = conn->read_line();
+    if (line == "NOT_STORED" && create)
+    {
+        conn.release();
+        return 0;
+    }
+    if (line != "STORED") throw_response_error(create ? "add" : "set", line);
+    conn.release();
+    _near_put(key, version);
+    return version;
+}
+
+bool memcached_session_store::touch(std::uint64_t scope, string_view id, std::chrono::seconds timeout)
+{
+    if (!_valid_id(id)) return false;
+    std::string key = _key(scope, id);
+    std::string request = std::string{"touch "}.append(key).append(1, ' ').
+            append(std::to_string(exptime(timeout))).append("\r\n");
+    _lease conn{*this, _get_server(key)};
+    conn->write(request);
+    string_view line = conn->read_line();
+    if (line != "TOUCHED" && line != "NOT_FOUND") throw_response_error("touch", line);
+    conn.release();
+    return line == "TOUCHED";
+}
+
+bool memcached_session_store::contains(std::uint64_t scope, string_view id)
+{
+    if (!_valid_id(id)) return false;
+    std::string key = _key(scope, id);
+    /* Meta get without flags only tells if the key exists, the value isn't sent */
+    _lease conn{*this, _get_server(key)};
+    conn->write(std::string{"mg "}.append(key).append("\r\n"));
+    string_view line = conn->read_line();
+    if (line != "HD" && line != "EN") throw_response_error("mg", line);
+    conn.release();
+    return line == "HD";
+}
+
+bool memcached_session_store::erase(std::uint64_t scope, string_view id)
+{
+    if (!_valid_id(id)) return false;
+    std::string key = _key(scope, id);
+    _near_erase(key);
+    _lease conn{*this, _get_server(key)};
+    conn->write(std::string{"delete "}.append(key).append("\r\n"));
+    string_view line = conn->read_line();
+    if (line != "DELETED" && line != "NOT_FOUND") throw_response_error("delete", line);
+    conn.release();
+    return line == "DELETED";
+}
+
+} // end of servlet namespace
@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_MEMCACHED_SESSION_STORE_H
+#define MOD_SERVLET_IMPL_MEMCACHED_SESSION_STORE_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <experimental/string_view>
+
+#include "session_store.h"
+
+namespace servlet
+{
+
+/*
+ * Session store kept in memcached servers, so that sessions are shared by hosts.
+ *
+ * Speaks the text protocol over pooled connections; a session lives on the server
+ * chosen by the hash of its key. Every stored value starts with the 8 byte version
+ * of the session generated by the writer. Touch and get of a lookup are sent in one
+ * write and their responses are read together. Existence of a session is checked
+ * with meta get which needs memcached 1.6 or later.
+ *
+ * Near cache remembers versions of the recently fetched sessions: for near cache
+ * time a lookup of a version the caller already has doesn't go to the server. So
+ * changes made on other hosts can be seen that much later.
+ *
+ * Connections are opened lazily, network failures are reported with io_exception
+ * and the connection is dropped.
+ */
+class memcached_session_store : public session_store
+{
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    /* Session IDs are a part of the memcached key which is limited to 250 bytes */
+    static constexpr std::size_t MAX_ID_LENGTH = 200;
+
+    /*
+     * servers is a comma separated list of host:port. pool_size is the number of idle
+     * connections kept per server, timeout is applied to every send and receive.
+     */
+    memcached_session_store(string_view servers, std::size_t pool_size,
+                            std::chrono::milliseconds timeout, std::chrono::milliseconds near_cache);
+    ~memcached_session_store() noexcept override;
+
+    memcached_session_store(const memcached_session_store&) = delete;
+    memcached_session_store& operator=(const memcached_session_store&) = delete;
+
+    bool get(std::uint64_t scope, string_view id, std::chrono::seconds timeout,
+             std::uint64_t &version, std::string &data) override;
+    std::uint64_t put(std::uint64_t scope, string_view id, string_view data,
+                      std::chrono::seconds timeout, bool create) override;
+    bool touch(std::uint64_t scope, string_view id, std::chrono::seconds timeout) override;
+    bool contains(std::uint64_t scope, string_view id) override;
+    bool erase(std::uint64_t scope, string_view id) override;
+
+    std::size_t server_count() const { return _servers.size(); }
+
+private:
+    class _connection;
+    class _lease;
+    struct _server;
+
+    struct _near_entry
+    {
+        std::uint64_t version;
+        clock_type::time_point fetched;
+    };
+
+    static bool _valid_id(string_view id);
+    static std::string _key(std::uint64_t scope, string_view id);
+    _server& _get_server(const std::string &key);
+
+    bool _near_hit(const std::string &key, std::uint64_t version);
+    void _near_put(const std::string &key, std::uint64_t version);
+    void _near_erase(const std::string &key);
+
+    std::vector<std::unique_ptr<_server>> _servers;
+    std::size_t _pool_size;
+    std::chrono::milliseconds _timeout;
+    std::chrono::milliseconds _near_ttl;
+
+    std::mutex _near_mx;
+    std::unordered_map<std::string, _near_entry> _near;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_MEMCACHED_SESSION_STORE_H
@@ -30,8 +30,7 @@ static int servlet_handler(request_rec* r)
     if (!r->handler || strcmp(r->handler, "servlet")) return DECLINED;
 
     int sc = OK;
-    URI uri{ap_run_http_scheme(r), ap_get_server_name_for_url(r), ap_get_server_port(r),
-            r->parsed_uri.path, r->parsed_uri.query};
+    request_uri uri{r};
 
     try
     {
@@ -63,6 +62,14 @@ int post_config(apr_pool_t *conf_pool, apr_pool_t *log_pool, apr_pool_t *tmp_poo
         finalize_servlet_config(cfg, tmp_pool);
         init_logging(cfg, tmp_pool);
     }
+    try
+    {
+        webapp_dispatcher::init_shared_sessions(conf_pool);
+    }
+    catch (const std::exception &e)
+    {
+        LG->error() << "Failed to initialize shared sessions: " << e << std::endl;
+    }
     return 0;
 }
 
@@ -5,7 +5,14 @@ https://github.com/novalexei
 Distributed under the Boost Software License, Version 1.0.
 http://boost.org/LICENSE_1_0.txt
 */
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
 #include "request.h"
+#include "spool_file.h"
 
 namespace servlet
 {
@@ -13,26 +20,32 @@ namespace servlet
 request_mutipart_source::request_mutipart_source(request_rec *request, const std::string &boundary,
                                                  std::size_t in_limit,
                                                  std::map<std::string, std::vector<std::string>, std::less<>> *params,
-                                                 std::size_t max_value_size, std::size_t buf_size) :
-        _request{request}, _boundary{boundary}, _in_limit{in_limit}, _remainder_buf{new char[boundary.size() + 2]},
-        _remainder{_remainder_buf}, _buf_size{buf_size > 0 ? buf_size : 1024},
-        _params{params}, _max_value_size{max_value_size}
+                                                 std::size_t max_value_size, std::size_t buf_size,
+                                                 digest_algorithm digest, const cancellation_token *cancel,
+                                                 std::istream *body) :
+        _request{request}, _body{body}, _in_limit{in_limit}, _cancel{cancel}, _boundary{boundary}, _searcher{boundary},
+        _params{params}, _max_value_size{max_value_size},
+        /* Buffer always has room for the kept delimiter tail and plenty of new data */
+        _buffer{std::max({buf_size, MIN_MULTIPART_BUFFER_SIZE, 4*(boundary.size()+2)})}, _digest{digest}
 {
-    _buffer = new char[_buf_size];
     if (_max_value_size == 0) _max_value_size = std::numeric_limits<std::size_t>::max();
     if (_in_limit == 0) _in_limit = std::numeric_limits<std::size_t>::max();
+    /* Replayed body is read from the beginning whoever read it before */
+    if (_body) return;
     if (ap_setup_client_block(_request, REQUEST_CHUNKED_DECHUNK) != OK || !ap_should_client_block(_request))
     {
         _request = nullptr;
+        _state = part_state::closed;
     }
 }
 
 std::pair<char*, std::size_t> request_mutipart_source::get_buffer()
 {
-    if (!_request || _in_count >= _in_limit) return {nullptr, 0};
+    if ((!_request && !_body) || _in_count >= _in_limit) return {nullptr, 0};
     std::pair<char*, std::size_t> res = _get_buffer();
     if (res.second + _in_count > _in_limit) res.second = _in_limit-_in_count;
     _in_count += res.second;
+    if (res.second > 0 && _digest.algorithm() != digest_algorithm::none) _digest.update(res.first, res.second);
     if (_reading_value)
     {
         auto name_it = _headers.find("name");
@@ -44,12 +57,12 @@ std::pair<char*, std::size_t> request_mutipart_source::get_buffer()
                 _value.clear();
                 _reading_value = false;
             }
-            else if (_value.size() < _max_value_size)
+            else if (res.second > _max_value_size - _value.size())
             {
-                std::size_t sz = res.second > _max_value_size-_value.size() ?
-                                 _max_value_size-_value.size() : res.second;
-                _value.append(res.first, sz);
+                throw request_too_large_exception{std::string{"Form parameter "}.append(name_it->second.front())
+                        .append(" is longer than ").append(std::to_string(_max_value_size))};
             }
+            else _value.append(res.first, res.second);
         }
     }
     return res;
@@ -57,74 +70,53 @@ std::pair<char*, std::size_t> request_mutipart_source::get_buffer()
 
 std::pair<char*, std::size_t> request_mutipart_source::_get_buffer()
 {
-    if (_stream_closed || (_current_stream_cosed && !_skip_to_next)) return {nullptr, 0};
-    if (_next_size > 0)
+    if (_state != part_state::body) return {nullptr, 0};
+    while (true)
     {
-        if (_skip_to_next)
+        char* data = _buffer.data();
+        auto take = [this, data](std::size_t end) -> std::pair<char*, std::size_t>
         {
-            _next_ptr = nullptr;
-            _next_size = 0;
-        }
-        else
+            std::pair<char*, std::size_t> res{data + _buf_ptr, end - _buf_ptr};
+            _buf_ptr = end;
+            return res;
+        };
+        const char* found = _searcher.search(data + _buf_ptr, data + _in_buf);
+        if (found)
         {
-            if (_next_size > 0)
+            std::size_t end = found - data;
+            if (end > _buf_ptr && data[end-1] == '\r') --end;
+            if (end > _buf_ptr) return take(end);
+            /* The part ends here */
+            _buf_ptr = found - data + _searcher.size();
+            _state = part_state::delimiter;
+            /* Truncated part has no digest, only the one ended by the delimiter has */
+            if (_digest.algorithm() != digest_algorithm::none)
             {
-                char* next_ptr = _next_ptr;
-                std::size_t next_size = _next_size;
-                _next_ptr = nullptr;
-                _next_size = 0;
-                return {next_ptr, next_size};
+                _digest_value = _digest.value();
+                _digest_complete = true;
             }
-        }
-    }
-    if (_next_buf_ptr != 0)
-    {
-        if (!_skip_to_next) return {nullptr, 0};
-        _buf_ptr = _next_buf_ptr;
-        _next_buf_ptr = 0;
-    }
-    while(true)
-    {
-        std::streamsize res = _process_buffer();
-        if (res == 0)
-        {
-            if (_buf_ptr < _in_buf && _skip_to_next) continue;
-            _read_to_buf();
-            if (_in_buf == 0) return {nullptr, 0};
-        }
-        else if (res == -1)
-        {
-            std::size_t res_size = _remainder_size;
-            std::size_t df = _remainder-_remainder_buf;
-            _remainder_size = 0;
-            _remainder = _remainder_buf;
-            if (_skip_to_next) continue;
-            return {_remainder_buf, res_size+df};
-        }
-        else if (res == -2)
-        {
             return {nullptr, 0};
         }
-        else /* res > 0 */
+        /* The tail can be the beginning of a delimiter, it is kept until more data is read */
+        if (_in_buf - _buf_ptr > _searcher.size()) return take(_in_buf - _searcher.size());
+        if (!_fill())
         {
-            char* res_buffer = _buffer + _buf_ptr;
-            _buf_ptr = _in_buf;
-            if (_skip_to_next) continue;
-            return {res_buffer, res};
+            /* The input ended without closing delimiter: whatever left belongs to this part */
+            _state = part_state::closed;
+            return _in_buf > _buf_ptr ? take(_in_buf) : std::pair<char*, std::size_t>{nullptr, 0};
         }
     }
 }
 
 bool request_mutipart_source::next()
 {
-    if (_stream_closed) return false;
-    _skip_to_next = true;
-    std::pair<char*, size_t> nb = get_buffer();
-    if (_stream_closed || !nb.first) return false;
-    _current_stream_cosed = false;
-    _skip_to_next = false;
-    _headers.clear();
-    _parse_headers(nb.first, nb.second);
+    /* Skip the rest of the current part */
+    while (_state == part_state::body)
+    {
+        /* Part isn't over, but no more data is given: input limit is reached */
+        if (!get_buffer().first && _state == part_state::body) _state = part_state::closed;
+    }
+    if (!_open_part()) return false;
     _reading_value = _params && _headers.find("filename") == _headers.end();
     if (_reading_value)
     {
@@ -134,192 +126,237 @@ bool request_mutipart_source::next()
     return true;
 }
 
-void request_mutipart_source::_read_to_buf()
+bool request_mutipart_source::_open_part()
 {
-    if (_stream_closed)
+    if (_state == part_state::preamble)
     {
-        _in_buf = 0;
-        return;
+        /* Normally the body starts with the boundary right away */
+        while (_in_buf - _buf_ptr < _boundary.size() && _fill());
+        if (_in_buf - _buf_ptr >= _boundary.size() &&
+            std::memcmp(_buffer.data() + _buf_ptr, _boundary.data(), _boundary.size()) == 0)
+        {
+            _buf_ptr += _boundary.size();
+            _state = part_state::delimiter;
+        }
+        else
+        {
+            /* Skip the preamble the same way as the data of a part */
+            _state = part_state::body;
+            while (_get_buffer().first);
+        }
     }
-    std::streamsize read = ap_get_client_block(_request, _buffer, _buf_size);
-    _buf_ptr = 0;
-    _next_buf_ptr = 0;
-    _in_buf = read < 0 ? 0 : static_cast<std::size_t>(read);
-}
-
-/* Doesn't equal = -1; equals = 0; partially equals = 1 */
-int_fast16_t __cmp(const std::string& str, std::size_t start_pos, const char* to_cmp, std::size_t to_cmp_len)
-{
-    if (to_cmp_len >= str.size()-start_pos)
+    if (_state != part_state::delimiter) return false;
+    /* Two dashes after the boundary close the stream */
+    while (_in_buf - _buf_ptr < 2 && _fill());
+    if (_in_buf - _buf_ptr >= 2 && _buffer.data()[_buf_ptr] == '-' && _buffer.data()[_buf_ptr+1] == '-')
     {
-        if (str.compare(start_pos, str.size()-start_pos, to_cmp, str.size()-start_pos) == 0) return 0;
-        return -1; /* Doesn't equal */
+        _state = part_state::closed;
+        return false;
+    }
+    /* Headers start on the next line and end with an empty one. The whole block
+     * is brought into the buffer before parsing. Offsets are kept relative to
+     * _buf_ptr since reading more data moves the unconsumed data to the front. */
+    bool boundary_line = true;
+    std::size_t line_offset = 0;
+    while (true)
+    {
+        char* data = _buffer.data();
+        std::size_t line = _buf_ptr + line_offset;
+        const char* nl = line < _in_buf ?
+                         static_cast<const char*>(std::memchr(data + line, '\n', _in_buf - line)) : nullptr;
+        if (!nl)
+        {
+            if (_fill()) continue;
+            _state = part_state::closed;
+            return false;
+        }
+        std::size_t nl_pos = nl - data;
+        if (boundary_line)
+        {
+            /* Whatever is left of the boundary line (transport padding) is ignored */
+            _buf_ptr = nl_pos + 1;
+            boundary_line = false;
+        }
+        else if (nl_pos == line || (nl_pos == line+1 && data[line] == '\r'))
+        {
+            _headers.clear();
+            _parse_headers(data + _buf_ptr, line - _buf_ptr);
+            _digest.reset();
+            _digest_complete = false;
+            _buf_ptr = nl_pos + 1;
+            _state = part_state::body;
+            return true;
+        }
+        else line_offset = nl_pos + 1 - _buf_ptr;
     }
-    else if(str.compare(start_pos, to_cmp_len, to_cmp, to_cmp_len) == 0) return 1;
-    return -1;
 }
 
-inline int_fast16_t __eat_new_line(const char* buffer, std::size_t len)
+std::size_t request_mutipart_source::remaining_size() const
 {
-    int_fast16_t num_eaten = 0;
-    while (num_eaten < len && (buffer[num_eaten] == '\r' || buffer[num_eaten] == '\n')) ++ num_eaten;
-    return num_eaten;
-}
-inline int_fast16_t __check_for_dashes(const char* buffer, std::size_t len)
-{
-    int_fast16_t num_found = 0;
-    while (num_found < len && buffer[num_found] == '-') ++num_found;
-    return num_found;
+    if (!_request || _body || _state != part_state::body || _request->remaining <= 0) return 0;
+    std::size_t remaining = _in_buf - _buf_ptr + static_cast<std::size_t>(_request->remaining);
+    return std::min(remaining, _in_limit - _in_count);
 }
 
-void request_mutipart_source::_reinit_remainder(char rn1, char rn2)
+bool request_mutipart_source::_fill()
 {
-    if (rn1 != '\0')
+    if (_eof) return false;
+    char* data = _buffer.data();
+    if (_buf_ptr > 0)
+    {
+        std::memmove(data, data + _buf_ptr, _in_buf - _buf_ptr);
+        _in_buf -= _buf_ptr;
+        _buf_ptr = 0;
+    }
+    if (_in_buf >= _buffer.size()) return false;
+    if (_body)
     {
-        _remainder_buf[0] = rn1;
-        _remainder = _remainder_buf+1;
+        _body->read(data + _in_buf, _buffer.size() - _in_buf);
+        std::streamsize count = _body->gcount();
+        if (count <= 0)
+        {
+            _eof = true;
+            return false;
+        }
+        _in_buf += static_cast<std::size_t>(count);
+        return true;
     }
-    if (rn2 != '\0')
+    deadline_guard guard{_cancel, _request->connection};
+    guard.check();
+    long read = ap_get_client_block(_request, data + _in_buf, _buffer.size() - _in_buf);
+    if (read <= 0)
     {
-        _remainder_buf[1] = rn2;
-        _remainder = _remainder_buf+2;
+        /* Read timed out on the deadline or the client went away */
+        guard.check();
+        _eof = true;
+        return false;
     }
-    _remainder_size = 0;
+    _in_buf += static_cast<std::size_t>(read);
+    return true;
 }
 
-/* returns val == -1 if buffer needs to be copied to remainder; val == -2 return empty buffer;
- * val == 0 if needs to read more and val > 0 to return buffer with a given size */
-std::streamsize request_mutipart_source::_process_buffer()
+/* Keeps part content in memory until it grows over the threshold, then moves it to a file */
+class _part_spooler
 {
-    if (_in_buf <= _buf_ptr) return 0;
-    if (_check_for_ending_dashes)
+public:
+    explicit _part_spooler(const multipart_config &config) : _config{config} {}
+
+    /* size_hint is what is left of the request, used to preallocate the file */
+    void consume(const char* buf, std::size_t len, std::size_t size_hint = 0)
     {
-        int_fast16_t dashes = __check_for_dashes(_buffer+_buf_ptr, _in_buf-_buf_ptr);
-        if (dashes+_ending_dashes_read >= 2)
+        _size += len;
+        if (_config.max_file_size > 0 && _size > _config.max_file_size)
         {
-            _in_buf = 0;
-            _stream_closed = true;
-            return -2;
+            throw io_exception{std::string{"Multipart part is larger than max-file-size "}
+                                       .append(std::to_string(_config.max_file_size))};
         }
-        else if (_in_buf <= _buf_ptr+dashes)
+        if (!_file.is_open())
         {
-            _ending_dashes_read += dashes;
-            _buf_ptr += dashes;
-            return 0;
+            if (_data.size() + len <= _config.file_size_threshold)
+            {
+                _data.append(buf, len);
+                return;
+            }
+            /* Rest of the request can hold other parts as well, the part itself
+             * cannot grow over its limit */
+            std::size_t expected = _size + size_hint;
+            if (_config.max_file_size > 0) expected = std::min(expected, _config.max_file_size);
+            _file.open(_config.location, expected);
+            _file.write(_data.data(), _data.size());
+            _data.clear();
+            _data.shrink_to_fit();
         }
-        _ending_dashes_read = 0;
-        _check_for_ending_dashes = false;
-        _eat_new_line = true;
+        _file.write(buf, len);
     }
-    if (_eat_new_line)
+
+    spooled_part finish(const std::map<std::string, std::vector<std::string>, std::less<>> &headers)
     {
-        _buf_ptr += __eat_new_line(_buffer+_buf_ptr, _in_buf-_buf_ptr);
-        if (_in_buf <= _buf_ptr) return 0;
-        _eat_new_line = false;
-        _current_stream_cosed = true;
-        if (!_skip_to_next) return -2;
-        _skip_to_next = false;
+        std::string path;
+        if (_file.is_open()) path = _file.release(_size);
+        return spooled_part{headers, std::move(_data), std::move(path), _size};
     }
-    if (_remainder_size == 0 && _remainder-_remainder_buf == 1 && _buffer[_buf_ptr] == '\n' && _remainder_buf[0] == '\r')
+
+private:
+    const multipart_config &_config;
+    std::string _data;
+    _spool_file _file;
+    std::size_t _size = 0;
+};
+
+spooled_part multipart_input_impl::spool_part()
+{
+    _part_spooler spooler{_config};
+    /* Part could have been partially read already, take over what is left in the stream buffer */
+    std::streambuf *buf = _in.rdbuf();
+    char leftover[1024];
+    for (std::streamsize avail = buf->in_avail(); avail > 0; avail = buf->in_avail())
     {
-        _reinit_remainder('\0', '\n');
-        ++_buf_ptr;
+        std::streamsize read = buf->sgetn(leftover, std::min<std::streamsize>(avail, sizeof(leftover)));
+        spooler.consume(leftover, static_cast<std::size_t>(read));
     }
-    if (_remainder_buf != _remainder || _remainder_size > 0 || _initializing)
+    /* The rest goes from the request buffer straight to the destination */
+    for (std::pair<char*, std::size_t> chunk = _in->get_buffer(); chunk.first; chunk = _in->get_buffer())
     {
-        _initializing = false;
-        int_fast16_t res = __cmp(_boundary, _remainder_size, _buffer+_buf_ptr, _in_buf-_buf_ptr);
-        if (res < 0)
-        {
-            if (_remainder_size > 0 || _remainder_buf != _remainder) return -1; /* feed remainder */
-        }
-        else if (res == 0)
-        {
-            _buf_ptr += _boundary.size()-_remainder_size;
-            _remainder_size = 0;
-            _remainder = _remainder_buf;
-            _check_for_ending_dashes = true;
-            return _skip_to_next ? 0 : -2;
-        }
-        else /* res > 0 */
-        {
-            std::copy_n(_buffer+_buf_ptr, _in_buf-_buf_ptr, _remainder+_remainder_size);
-            _remainder_size += _in_buf-_buf_ptr;
-            _buf_ptr = _in_buf;
-            return 0; /* Read more */
-        }
+        spooler.consume(chunk.first, chunk.second, _in->remaining_size());
     }
-    /* here _remainder_size should always be 0 */
-    string_view buf_view{_buffer+_buf_ptr, _in_buf-_buf_ptr};
-    string_view::size_type start_pos = 0;
-    while (true)
+    return spooler.finish(_in->get_headers());
+}
+
+spooled_part multipart_input_impl::spool_part(std::istream& in)
+{
+    _part_spooler spooler{_config};
+    pooled_buffer buf{_config.buffer_size};
+    std::streambuf *sb = in.rdbuf();
+    for (std::streamsize read = sb->sgetn(buf.data(), buf.size()); read > 0; read = sb->sgetn(buf.data(), buf.size()))
     {
-        start_pos = buf_view.find('\n', start_pos);
-        if (start_pos == string_view::npos)
-        {
-            if (buf_view[buf_view.size()-1] == '\r')
-            {
-                _reinit_remainder('\r');
-                return _in_buf-_buf_ptr-1;
-            }
-            return _in_buf-_buf_ptr;
-        }
-        else if (start_pos+1 == buf_view.size())
-        {
-            if (buf_view.size() > 1)
-            {
-                if (buf_view[buf_view.size()-2] == '\r')
-                {
-                    _reinit_remainder('\r', '\n');
-                    return _in_buf-_buf_ptr-2;
-                }
-                else
-                {
-                    _reinit_remainder('\n');
-                    return _in_buf-_buf_ptr-1;
-                }
-            }
-            else if (_remainder-_remainder_buf == 1 && _remainder_buf[0] == '\r')
-            {
-                _reinit_remainder('\0', '\n');
-                return _in_buf-_buf_ptr-1;
-            }
-            else
-            {
-                _reinit_remainder('\n');
-                return _in_buf-_buf_ptr-1;
-            }
-        }
-        ++start_pos;
-        int_fast16_t res = __cmp(_boundary, 0, _buffer+_buf_ptr+start_pos, _in_buf-_buf_ptr-start_pos);
-        if (res == 0)
-        {
-            _check_for_ending_dashes = true;
-            _next_buf_ptr = _buf_ptr + start_pos + _boundary.size();
-            if (start_pos == 1 || (start_pos == 2 && buf_view[0] == '\r'))
-            {
-                _remainder = _remainder_buf;
-                _remainder_size = 0;
-                return -2;
-            }
-            return start_pos - (buf_view[start_pos-2] == '\r' ? 2 : 1);
-        }
-        else if (res < 0) continue;
-        else /* res > 0 */
+        spooler.consume(buf.data(), static_cast<std::size_t>(read));
+    }
+    return spooler.finish(_in->get_headers());
+}
+
+spooled_part& spooled_part::operator=(spooled_part&& other) noexcept
+{
+    if (this == &other) return *this;
+    if (_temporary) std::remove(_path.data());
+    _headers = std::move(other._headers);
+    _data = std::move(other._data);
+    _path = std::move(other._path);
+    _size = other._size;
+    _temporary = other._temporary;
+    other._temporary = false;
+    return *this;
+}
+
+spooled_part::~spooled_part() noexcept
+{
+    if (_temporary) std::remove(_path.data());
+}
+
+void spooled_part::move_to(const std::string &path)
+{
+    if (!_path.empty())
+    {
+        if (std::rename(_path.data(), path.data()) != 0)
         {
-            --start_pos;
-            string_view::size_type r_adjust = 1;
-            if (start_pos > 0 && buf_view[start_pos-1] == '\r')
+            if (errno != EXDEV) throw io_exception{__errno_message(("Failed to move " + _path + " to").data(), path)};
+            /* Different file system: the only case the data is copied */
             {
-                r_adjust = 2;
-                --start_pos;
+                std::ifstream in{_path, std::ios::binary};
+                std::ofstream out{path, std::ios::binary | std::ios::trunc};
+                if (!(out << in.rdbuf()) || !out.flush()) throw io_exception{"Failed to copy " + _path + " to " + path};
             }
-            std::copy_n(_buffer+_buf_ptr+start_pos, _in_buf-_buf_ptr-start_pos, _remainder_buf);
-            _remainder_size += _in_buf-_buf_ptr-start_pos-r_adjust;
-            _remainder = _remainder_buf+r_adjust;
-            return start_pos;
+            std::remove(_path.data());
         }
     }
+    else
+    {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        if (!out.write(_data.data(), _data.size()) || !out.flush()) throw io_exception{"Failed to write to " + path};
+        _data.clear();
+        _data.shrink_to_fit();
+    }
+    _path = path;
+    _temporary = false;
 }
 
 void __trim_if_needs(std::string& str, bool remove_quotes)
@@ -341,71 +378,33 @@ void __add_to_headers(std::string& name, std::string& value, tree_map<std::strin
     value.clear();
 }
 
-void request_mutipart_source::_parse_headers(char* buf, std::size_t buf_size)
+void request_mutipart_source::_parse_headers(const char* buf, std::size_t buf_size)
 {
     std::string name;
     std::string value;
-    int new_lines_in_a_raw = 0;
     bool parsingName = true;
-    bool parsing = true;
-    std::size_t idx = 0;
-    for (; parsing; ++idx)
+    for (std::size_t idx = 0; idx < buf_size; ++idx)
     {
-        if (idx >= buf_size)
-        {
-            std::pair<char*, size_t> nb = get_buffer();
-            if (_stream_closed || !nb.first)
-            {
-                __add_to_headers(name, value, _headers);
-                break;
-            }
-            idx = 0;
-            buf = nb.first;
-            buf_size = nb.second;
-        }
         char ch = buf[idx];
         switch(ch)
         {
             case ':':
-                parsingName = false;
-                new_lines_in_a_raw = 0;
-                break;
             case '=':
                 parsingName = false;
-                new_lines_in_a_raw = 0;
                 break;
             case '\r':
-                __add_to_headers(name, value, _headers);
-                parsingName = true;
-                break;
             case '\n':
-                __add_to_headers(name, value, _headers);
-                parsingName = true;
-                ++new_lines_in_a_raw;
-                if (new_lines_in_a_raw >= 2) parsing = false;
-                break;
             case ';':
                 __add_to_headers(name, value, _headers);
                 parsingName = true;
-                new_lines_in_a_raw = 0;
                 break;
             default:
                 if (parsingName) name.push_back(ch);
                 else value.push_back(ch);
-                new_lines_in_a_raw = 0;
                 break;
         }
     }
-    if (idx < buf_size)
-    {
-        _next_ptr = buf+idx;
-        _next_size = buf_size-idx;
-    }
-    else
-    {
-        _next_ptr = nullptr;
-        _next_size = 0;
-    }
+    __add_to_headers(name, value, _headers);
 }
 
 } // end of servlet namespace
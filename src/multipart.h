@@ -8,12 +8,32 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_IMPL_MULTIPART_H
 #define MOD_SERVLET_IMPL_MULTIPART_H
 
+#include <limits>
+
 #include <servlet/request.h>
 #include "map_ex.h"
+#include "config.h"
+#include "buffer_pool.h"
+#include "boundary_search.h"
+#include "digest.h"
 
 namespace servlet
 {
 
+/**
+ * Source of multipart/form-data parts.
+ *
+ * <p>Request body is read into one large buffer (see
+ * {@link multipart_config#buffer_size}) taken from the per-thread
+ * {@link pooled_buffer} pool. Part data is handed out as views into this
+ * buffer up to the next delimiter found by {@link boundary_searcher}, so
+ * it is scanned only once and never copied. The tail of the buffer which
+ * can still be the beginning of a delimiter is kept and moved to the
+ * front before the next read.</p>
+ *
+ * <p>With body replay the parts are parsed from the replayed body stream
+ * instead of the request, so that filters could read the body before.</p>
+ */
 class request_mutipart_source
 {
 public:
@@ -21,53 +41,63 @@ public:
 
     request_mutipart_source(request_rec* request, const std::string &boundary, std::size_t in_limit,
                             std::map<std::string, std::vector<std::string>, std::less<>> *params,
-                            std::size_t max_value_size, std::size_t buf_size = 1024);
-    ~request_mutipart_source() noexcept { delete[] _buffer; ap_discard_request_body(_request); }
+                            std::size_t max_value_size, std::size_t buf_size = DEFAULT_MULTIPART_BUFFER_SIZE,
+                            digest_algorithm digest = digest_algorithm::none,
+                            const cancellation_token *cancel = nullptr, std::istream *body = nullptr);
+    ~request_mutipart_source() noexcept { if (_request && !_body) ap_discard_request_body(_request); }
 
     std::pair<char*, std::size_t> get_buffer();
 
     bool next();
     const tree_map<std::string, std::vector<std::string>> &get_headers() const { return _headers; }
 
+    /* Digest of the current part once all its data has been handed out */
+    optional_ref<const std::uint64_t> get_digest() const
+    {
+        return _digest_complete ? optional_ref<const std::uint64_t>{_digest_value} : optional_ref<const std::uint64_t>{};
+    }
+
+    /* Upper estimate of the data left for the current part, 0 if unknown (chunked request) */
+    std::size_t remaining_size() const;
+
 private:
-    std::pair<char *, std::size_t> _get_buffer();
-    void _parse_headers(char* buf, std::size_t buf_size);
-    std::streamsize _process_buffer();
-    void _read_to_buf();
-    void _reinit_remainder(char rn1, char rn2 = '\0');
+    enum class part_state
+    {
+        preamble,   /* before the first boundary */
+        delimiter,  /* right after a boundary */
+        body,       /* inside of the part data */
+        closed      /* after the closing boundary or the end of the input */
+    };
+
+    std::pair<char*, std::size_t> _get_buffer();
+    bool _open_part();
+    bool _fill();
+    void _parse_headers(const char* buf, std::size_t buf_size);
 
     request_rec *_request;
+    std::istream *_body;
     std::size_t _in_limit;
+    const cancellation_token *_cancel;
     std::string _boundary;
+    boundary_searcher _searcher;
 
     std::map<std::string, std::vector<std::string>, std::less<>> *_params;
     std::size_t _max_value_size;
     std::string _value;
     bool _reading_value = false;
 
-    char *_remainder_buf;
-    char *_remainder;
-    std::size_t _remainder_size = 0;
-
-    char *_buffer;
-    std::size_t _buf_size;
-    std::size_t _buf_ptr = 0;
-    std::size_t _next_buf_ptr = 0;
-    std::size_t _in_buf = 0;
-
-    char * _next_ptr = nullptr;
-    std::size_t _next_size = 0;
-    bool _skip_to_next = false;
-
-    bool _initializing = true;
-    bool _eat_new_line = false;
-    bool _check_for_ending_dashes = false;
-    int_fast16_t _ending_dashes_read = 0;
-    bool _current_stream_cosed = true;
-    bool _stream_closed = false;
+    pooled_buffer _buffer;
+    std::size_t _buf_ptr = 0; /* beginning of unconsumed data */
+    std::size_t _in_buf = 0;  /* end of data */
+    bool _eof = false;
+    part_state _state = part_state::preamble;
 
     std::size_t _in_count = 0;
 
+    part_digest _digest;
+    std::uint64_t _digest_value = 0;
+    bool _digest_complete = false;
+
     tree_map<std::string, std::vector<std::string>> _headers;
 };
 
@@ -78,9 +108,24 @@ public:
 
     bool next()
     {
-        if (this->bad() || this->fail() || !(*this)->next()) return false;
+        if (this->bad()) return false;
+        /* Consume the rest of the current part, so that nothing stale is left in the stream buffer.
+         * Errors of the source, like a form value over its limit, are thrown rather than swallowed */
+        this->clear();
+        std::ios_base::iostate mask = this->exceptions();
+        this->exceptions(std::ios_base::badbit);
+        try
+        {
+            this->ignore(std::numeric_limits<std::streamsize>::max());
+        }
+        catch (...)
+        {
+            this->exceptions(mask);
+            throw;
+        }
+        this->exceptions(mask);
         this->clear();
-        return true;
+        return (*this)->next();
     }
 };
 
@@ -88,17 +133,24 @@ class multipart_input_impl : public multipart_input
 {
 public:
     multipart_input_impl(request_rec* request, const std::string &boundary, std::size_t in_limit,
-                         std::map<std::string, std::vector<std::string>, std::less<>> *params, std::size_t max_value_size) :
-            _in{request, boundary, in_limit, params, max_value_size} {}
+                         std::map<std::string, std::vector<std::string>, std::less<>> *params, std::size_t max_value_size,
+                         const multipart_config &config, const cancellation_token *cancel = nullptr,
+                         std::istream *body = nullptr) :
+            _in{request, boundary, in_limit, params, max_value_size, config.buffer_size, config.digest, cancel, body},
+            _config{config} {}
 
     const std::map<std::string, std::vector<std::string>, std::less<>>& get_headers() const override
     { return _in->get_headers(); }
 
     std::istream& get_input_stream() override { return _in; }
-    bool to_next_part() override { return _in->next(); }
+    spooled_part spool_part() override;
+    spooled_part spool_part(std::istream& in) override;
+    optional_ref<const std::uint64_t> get_digest() const override { return _in->get_digest(); }
+    bool to_next_part() override { return _in.next(); }
 
 private:
     multipart_instream _in;
+    const multipart_config &_config;
 };
 
 } // end of servlet namespace
@@ -1,4 +1,7 @@
+#include <cerrno>
 #include <mutex>
+#include <random>
+#include <system_error>
 
 #include "os.h"
 
@@ -9,6 +12,14 @@
 #elif _POSIX_C_SOURCE >= 1 || defined(_XOPEN_SOURCE) || defined(_BSD_SOURCE) || defined(_SVID_SOURCE) || defined(_POSIX_SOURCE) || defined (__linux__)
 #define SERVLET_POSIX
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/random.h>)
+#define SERVLET_GETRANDOM
+#include <sys/random.h>
+#endif
+#endif
 #endif
 
 namespace servlet
@@ -57,4 +68,51 @@ int get_pid()
 #endif
 }
 
+void preallocate_file(int fd, std::size_t size)
+{
+#if defined(__linux__)
+    fallocate(fd, 0, 0, static_cast<off_t>(size));
+#elif defined(SERVLET_POSIX)
+    posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+}
+
+void system_random_bytes(unsigned char *buf, std::size_t size)
+{
+#ifdef SERVLET_GETRANDOM
+    while (size > 0)
+    {
+        ssize_t n = getrandom(buf, size, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            throw std::system_error{errno, std::system_category(), "getrandom failed"};
+        }
+        buf += n;
+        size -= static_cast<std::size_t>(n);
+    }
+#else
+    /* Is backed by the OS random source on the supported platforms */
+    std::random_device rd;
+    for (std::size_t i = 0; i < size; i += sizeof(unsigned int))
+    {
+        unsigned int r = rd();
+        for (std::size_t j = 0; j < sizeof(r) && i + j < size; ++j) buf[i + j] = static_cast<unsigned char>(r >> (j * 8));
+    }
+#endif
+}
+
+std::chrono::system_clock::time_point coarse_system_now()
+{
+#ifdef CLOCK_REALTIME_COARSE
+    timespec ts;
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0)
+    {
+        return std::chrono::system_clock::time_point{std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec})};
+    }
+#endif
+    return std::chrono::system_clock::now();
+}
+
 } // end of servlet namespace
@@ -8,6 +8,8 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_OS_H
 #define MOD_SERVLET_OS_H
 
+#include <chrono>
+#include <cstddef>
 #include <ctime>
 
 /* Some OS dependent calls */
@@ -21,6 +23,15 @@ std::tm get_gmtm(std::time_t epoch);
 
 int get_pid();
 
+/* Reserves disk space for the file to be written; failures are ignored as it is only a hint */
+void preallocate_file(int fd, std::size_t size);
+
+/* Fills the buffer with cryptographically secure random bytes of the OS. Throws std::system_error on failure */
+void system_random_bytes(unsigned char *buf, std::size_t size);
+
+/* Current time with the resolution of the scheduler tick where the OS has a cheaper clock for it */
+std::chrono::system_clock::time_point coarse_system_now();
+
 } // end of servlet namespace
 
 #endif // MOD_SERVLET_OS_H
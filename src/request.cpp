@@ -5,25 +5,27 @@ https://github.com/novalexei
 Distributed under the Boost Software License, Version 1.0.
 http://boost.org/LICENSE_1_0.txt
 */
+#include <limits>
+
 #include "request.h"
+#include "urlencoded_parser.h"
+#include "inflate_filter.h"
 
 #include <http_request.h>
 
 namespace servlet
 {
 
-constexpr std::size_t MAX_POST_DATA_VALUE_SIZE = 2048;
-
 const std::string http_request_base::SESSION_COOKIE_NAME = "CSESSIONID";
 
 static std::string _to_local_path(const std::string &location, bool prepend_context,
-                                  const string_view &context, const URI &uri)
+                                  const string_view &context, const request_uri &uri)
 {
     if (location.empty()) return prepend_context ? context.to_string() : uri.path().to_string();
 
     if (location.front() != '/') /* Relative path */
     {
-        URI relative = uri.resolve(URI{location});
+        URI relative = uri.uri().resolve(URI{location});
         return relative.uri_view().to_string();
     }
     else if (prepend_context)
@@ -36,25 +38,111 @@ static std::string _to_local_path(const std::string &location, bool prepend_cont
     return location;
 }
 
-http_request_base::http_request_base(request_rec *request, const URI &uri, const std::string &context_path,
-                                     const std::string &srvlt_path, std::shared_ptr<session_type_map> session_map) :
-        _request{request}, _uri{uri}, _ctx{context_path}, _srvlt_path{srvlt_path}, _session_map{session_map}
+/* Amount of data asked from the input filters at once. Buckets are usually smaller. */
+static constexpr apr_off_t BRIGADE_READ_SIZE = 64 * 1024;
+
+std::pair<char*, std::size_t> request_source::get_buffer()
+{
+    if (!_request) return {nullptr, 0};
+    /* Data of the bucket handed out last time has been consumed by now */
+    if (_bucket)
+    {
+        apr_bucket_delete(_bucket);
+        _bucket = nullptr;
+    }
+    while (_count < _in_limit && !_eos)
+    {
+        if (APR_BRIGADE_EMPTY(_brigade))
+        {
+            deadline_guard guard{_cancel, _request->connection};
+            guard.check();
+            apr_status_t rv = ap_get_brigade(_request->input_filters, _brigade, AP_MODE_READBYTES,
+                                             APR_BLOCK_READ, BRIGADE_READ_SIZE);
+            if (rv != APR_SUCCESS || APR_BRIGADE_EMPTY(_brigade))
+            {
+                /* Read timed out on the deadline or the client went away */
+                guard.check();
+                _eos = true;
+                if (rv != APR_SUCCESS) throw io_exception{"Failed to read request body"};
+                break;
+            }
+        }
+        apr_bucket *bucket = APR_BRIGADE_FIRST(_brigade);
+        if (APR_BUCKET_IS_EOS(bucket))
+        {
+            _eos = true;
+            break;
+        }
+        const char *data = nullptr;
+        apr_size_t len = 0;
+        if (!APR_BUCKET_IS_METADATA(bucket) && apr_bucket_read(bucket, &data, &len, APR_BLOCK_READ) != APR_SUCCESS)
+        {
+            _eos = true;
+            throw io_exception{"Failed to read request body"};
+        }
+        if (len == 0)
+        {
+            apr_bucket_delete(bucket);
+            continue;
+        }
+        if (len > _in_limit - _count) len = _in_limit - _count;
+        _count += len;
+        _bucket = bucket;
+        /* Stream buffers never write to their get area */
+        return {const_cast<char*>(data), len};
+    }
+    apr_brigade_cleanup(_brigade);
+    return {nullptr, 0};
+}
+
+std::streamsize request_body_source::read(char* s, std::streamsize n)
+{
+    std::streamsize count = 0;
+    while (count < n)
+    {
+        if (_chunk.second == 0)
+        {
+            _chunk = _src.get_buffer();
+            if (_chunk.second == 0) break;
+        }
+        std::size_t size = std::min<std::size_t>(_chunk.second, n - count);
+        std::copy(_chunk.first, _chunk.first + size, s + count);
+        _chunk.first += size;
+        _chunk.second -= size;
+        count += size;
+    }
+    return count;
+}
+
+http_request_base::http_request_base(request_rec *request, const request_uri &uri, const std::string &context_path,
+                                     const std::string &srvlt_path, std::shared_ptr<session_manager> sessions,
+                                     const multipart_config &mp_config, bool body_replay,
+                                     cancellation_token::time_point deadline) :
+        _request{request}, _uri{uri}, _ctx{context_path}, _srvlt_path{srvlt_path}, _sessions{sessions},
+        _mp_config{mp_config}, _body_replay{body_replay}, _cancellation{request->connection, deadline}
 {
     if (_srvlt_path.back() == '/') _srvlt_path = _srvlt_path.substr(0, _srvlt_path.length() - 1);
     const char *session_id = apr_table_get(_request->headers_in, "X-Set-CSESSION");
     if (!session_id) return;
+    if (_sessions->is_stateless())
+    {
+        /* It is the cookie of the forwarding request, this one sends it */
+        bool reissue = false;
+        _session = _sessions->open_cookie(session_id, reissue);
+        if (_session) _track_cookie_session(true);
+        return;
+    }
     _set_session_cookie(session_id);
-    auto ref = _session_map->get(session_id);
-    if (ref) _session = *ref;
+    _session = _sessions->find(session_id);
 }
 
-string_view http_request_base::get_header(const std::string& name) const
+string_view http_request_base::get_header(const char* name) const
 {
-    const char *header = apr_table_get(_request->headers_in, name.data());
+    const char *header = apr_table_get(_request->headers_in, name);
     return header ? string_view{header} : string_view{};
 }
 
-long http_request_base::get_date_header(const std::string& name) const
+long http_request_base::get_date_header(const char* name) const
 {
     string_view view = get_header(name);
     return view.empty() ? -1L : string_cast<long>(view, true);
@@ -62,11 +150,11 @@ long http_request_base::get_date_header(const std::string& name) const
 
 string_view http_request_base::get_content_type() const
 {
-    return get_header("content-type");
+    return get_header(http_header::content_type);
 }
 long http_request_base::get_content_length() const
 {
-    return from_string<long>(get_header("content-length"), -1l);
+    return from_string<long>(get_header(http_header::content_length), -1l);
 }
 static int add_value(std::vector<std::string> *values, const char *key, const char *val)
 {
@@ -77,7 +165,7 @@ static int add_value(std::vector<std::string> *values, const char *key, const ch
 void http_request_base::get_headers(const std::string& name, std::vector<std::string>& headers) const
 {
     apr_table_do((int (*) (void *, const char *, const char *)) add_value,
-                 (void *) &headers, _request->headers_in, name.data(), NULL);
+                 (void *) &headers, _request->headers_in, name.c_str(), NULL);
 }
 
 static int add_key_value(std::vector<std::pair<std::string, std::string>> *values, const char *key, const char *val)
@@ -92,6 +180,24 @@ void http_request_base::get_headers(std::vector<std::pair<std::string, std::stri
                  (void *) &headers, _request->headers_in, NULL);
 }
 
+struct header_visitor_data
+{
+    header_visit_fn visitor;
+    void *data;
+};
+static int visit_header(header_visitor_data *visitor, const char *key, const char *val)
+{
+    return visitor->visitor(visitor->data, key, val) ? 1 : 0;
+}
+
+void http_request_base::visit_headers(const char* name, header_visit_fn visitor, void *data) const
+{
+    header_visitor_data visitor_data{visitor, data};
+    /* NULL name means all the headers */
+    apr_table_do((int (*) (void *, const char *, const char *)) visit_header,
+                 (void *) &visitor_data, _request->headers_in, name, NULL);
+}
+
 static const char* _get_user(request_rec* req)
 {
     const char *user = ap_get_remote_logname(req);
@@ -137,7 +243,17 @@ void http_request_base::_parse_cookies()
 
 void http_request_base::forward(const std::string &redirectURL, bool from_context_path)
 {
-    if (_session && _session->is_new() || !get_header("X-Set-CSESSION").empty())
+    _cancellation.throw_if_cancelled();
+    if (_sessions->is_stateless())
+    {
+        /* Headers of this request are not sent, so the cookie is passed on */
+        if (_session && _cookie_session_changed())
+        {
+            std::string value = _sessions->seal_cookie(*_session);
+            if (!value.empty()) apr_table_set(_request->headers_in, "X-Set-CSESSION", value.data());
+        }
+    }
+    else if (_session && _session->is_new() || !get_header("X-Set-CSESSION").empty())
     {
         apr_table_add(_request->headers_in, "X-Set-CSESSION", _session->get_id().data());
     }
@@ -145,10 +261,14 @@ void http_request_base::forward(const std::string &redirectURL, bool from_contex
 }
 int http_request_base::include(const std::string &includeURL, bool from_context_path)
 {
+    /* Output of the included request is bounded by the deadline as well */
+    deadline_guard guard{&_cancellation, _request->connection};
+    guard.check();
     request_rec *subr = ap_sub_req_lookup_uri(_to_local_path(includeURL, from_context_path, _ctx, _uri).data(),
                                               _request, _request->output_filters);
     int status = ap_run_sub_req(subr);
     ap_destroy_sub_req(subr);
+    if (status != OK) guard.check();
     return status;
 }
 
@@ -170,21 +290,38 @@ const std::string *http_request_base::_find_session_id_from_cookie()
     return nullptr;
 }
 
+http_request_base::~http_request_base() noexcept
+{
+    if (_multipart_in) delete _multipart_in;
+    else if (!_replay) delete _in;
+    if (!_session || _sessions->is_stateless()) return;
+    try
+    {
+        /* Changes made while serving the request become visible to other processes */
+        _sessions->save(*_session);
+    }
+    catch (const std::exception &e)
+    {
+        LG->warning() << "Failed to store session " << _session->get_id() << ": " << e << std::endl;
+    }
+}
+
 http_session &http_request_base::get_session()
 {
     if (_session) return *_session;
-    const std::string* sid = _find_session_id_from_cookie();
     string_view client_ip = get_client_addr();
-    string_view user_agent = get_header("User-Agent");
+    string_view user_agent = get_header(http_header::user_agent);
+    if (_sessions->is_stateless()) return _get_cookie_session(client_ip, user_agent);
+    const std::string* sid = _find_session_id_from_cookie();
     if (sid)
     {
         LG->warning() << "Found session ID " << *sid << std::endl;
-        auto ref = _session_map->get(*sid);
-        if (ref)
+        std::shared_ptr<http_session_impl> found = _sessions->find(*sid);
+        if (found)
         {
             LG->warning() << "Found session for ID " << *sid << std::endl;
-            (*(*ref))->validate(client_ip, user_agent);
-            _session = *ref;
+            found->validate(client_ip, user_agent);
+            _session = std::move(found);
             if (_session->get_principal()) return *_session;
             const char *user = _get_user(_request);
             if (user && *user) _session->set_principal(new named_principal{user});
@@ -192,7 +329,7 @@ http_session &http_request_base::get_session()
         }
     }
     _session.reset(new http_session_impl{client_ip, user_agent});
-    while (!_session_map->try_put(_session->get_id(), _session))
+    while (!_sessions->insert(_session))
     {
         _session->reset_session_id();
     }
@@ -200,6 +337,7 @@ http_session &http_request_base::get_session()
     _set_session_cookie(_session->get_id());
     const char *user = _get_user(_request);
     if (user && *user) _session->set_principal(new named_principal{user});
+    _sessions->created(*_session);
     return *_session;
 }
 
@@ -211,30 +349,112 @@ void http_request_base::_set_session_cookie(const std::string& id)
     apr_table_add(_request->headers_out, "Set-cookie", sc.to_string().data());
 }
 
+http_session &http_request_base::_get_cookie_session(string_view client_ip, string_view user_agent)
+{
+    const std::string* value = _find_session_id_from_cookie();
+    bool reissue = false;
+    std::shared_ptr<http_session_impl> found = value ? _sessions->open_cookie(*value, reissue) : nullptr;
+    if (found)
+    {
+        found->validate(client_ip, user_agent);
+        _session = std::move(found);
+        _track_cookie_session(reissue);
+        if (_session->get_principal()) return *_session;
+        const char *user = _get_user(_request);
+        if (user && *user) _session->set_principal(new named_principal{user});
+        return *_session;
+    }
+    /* The cookie is sent when the response is committed, with whatever the servlet puts in the session */
+    _session = std::make_shared<http_session_impl>(client_ip, user_agent);
+    _track_cookie_session(true);
+    const char *user = _get_user(_request);
+    if (user && *user) _session->set_principal(new named_principal{user});
+    _sessions->created(*_session);
+    return *_session;
+}
+
+void http_request_base::_track_cookie_session(bool reissue)
+{
+    _sealed_attributes = _session->snapshot();
+    _sealed_principal = _session->get_principal();
+    _cookie_reissue = reissue;
+}
+
+bool http_request_base::_cookie_session_changed() const
+{
+    /* Every change of the attributes replaces their snapshot */
+    return _cookie_reissue || _session->snapshot() != _sealed_attributes ||
+           _session->get_principal() != _sealed_principal;
+}
+
+void http_request_base::commit_session()
+{
+    if (!_session || !_sessions->is_stateless() || !_cookie_session_changed()) return;
+    if (_response_committed)
+    {
+        LG->warning() << "Session " << _session->get_id()
+                      << " has changed after the response was committed, the change is lost" << std::endl;
+        _track_cookie_session(false);
+        return;
+    }
+    try
+    {
+        std::string value = _sessions->seal_cookie(*_session);
+        if (value.empty())
+        {
+            LG->warning() << "Session " << _session->get_id() << " is too big to be kept in a cookie" << std::endl;
+        }
+        else _set_session_cookie(value);
+    }
+    catch (const std::exception &e)
+    {
+        LG->warning() << "Failed to seal session " << _session->get_id() << ": " << e << std::endl;
+    }
+    _track_cookie_session(false);
+}
+
+void http_request_base::response_committed()
+{
+    commit_session();
+    _response_committed = true;
+}
+
 bool http_request_base::has_session()
 {
     if (_session) return true;
     const std::string* sid = _find_session_id_from_cookie();
     if (sid)
     {
-        auto ref = _session_map->get(*sid);
-        if (ref.has_value()) return true;
+        if (_sessions->is_stateless())
+        {
+            bool reissue = false;
+            return static_cast<bool>(_sessions->open_cookie(*sid, reissue));
+        }
+        if (_sessions->contains(*sid)) return true;
     }
     return false;
 }
 
 void http_request_base::invalidate_session()
 {
-    if (!_session)
+    const std::string* sid = _find_session_id_from_cookie();
+    std::shared_ptr<http_session_impl> session = std::move(_session);
+    _session.reset();
+    if (_sessions->is_stateless())
     {
-        _session_map->erase(_session->get_id());
-        _session.reset();
-        return;
+        /* Nothing is kept on the server, the cookie itself is deleted below */
+        bool reissue = false;
+        if (!session && sid) session = _sessions->open_cookie(*sid, reissue);
+        if (session) _sessions->destroyed(*session);
+    }
+    else
+    {
+        if (!session && sid) session = _sessions->find(*sid);
+        /* Listeners are notified once, even if the session is invalidated concurrently */
+        if (session && _sessions->erase(session->get_id())) _sessions->destroyed(*session);
     }
-    const std::string* sid = _find_session_id_from_cookie();
     if (sid)
     {
-        _session_map->erase(*sid);
         /* Delete the cookie */
         cookie sc{SESSION_COOKIE_NAME, *sid};
         sc.set_max_age(0);
@@ -245,7 +465,7 @@ void http_request_base::invalidate_session()
 const string_view& http_request_base::_get_content_type() const
 {
     if (!_content_type.empty()) return _content_type;
-    string_view ct = get_header("content-type");
+    string_view ct = get_header(http_header::content_type);
     if (ct.empty()) return _content_type;
     typename string_view::size_type idx = ct.find(';');
     if (idx == string_view::npos) _content_type = trim_view(ct);
@@ -255,18 +475,69 @@ const string_view& http_request_base::_get_content_type() const
 
 std::istream& http_request_base::get_input_stream()
 {
+    if (_body_replay && !_multipart_in) return _replay_input_stream();
     if (_in) return *_in;
     if (_multipart_in) return *(_in = &_multipart_in->get_input_stream());
-    return *(_in = new request_instream{_request, SERVLET_CONFIG.input_stream_limit});
+    return *(_in = _open_input_stream());
+}
+
+std::istream* http_request_base::_open_input_stream()
+{
+    const char *encoding = apr_table_get(_request->headers_in, header_name(http_header::content_encoding));
+    content_coding coding = encoding ? parse_content_coding(encoding) : content_coding::identity;
+    if (coding == content_coding::identity)
+        return new request_instream{_request, SERVLET_CONFIG.input_stream_limit, &_cancellation};
+    /* Compressed body is inflated transparently, the input stream limit
+     * applies to the inflated data which is what the servlet reads */
+    auto *fin = new basic_filtered_instream<char, buffer_8k>{
+            new request_body_source{_request, SERVLET_CONFIG.input_stream_limit, &_cancellation}};
+    std::unique_ptr<std::istream> guard{fin};
+    (*fin)->add_filter(new inflate_filter{coding, SERVLET_CONFIG.input_stream_limit});
+    return guard.release();
+}
+
+std::istream& http_request_base::_replay_input_stream()
+{
+    if (!_replay)
+    {
+        /* First reader gets the body as it comes and it is collected on the way */
+        _body_in.reset(_open_input_stream());
+        _replay.reset(new body_replay{_mp_config.file_size_threshold, _mp_config.location});
+        _replay_streams.emplace_back(new instream<tee_source>{*_body_in, *_replay,
+                                                              SERVLET_CONFIG.input_stream_limit});
+    }
+    else
+    {
+        if (!_replay->is_complete() && !_replay->is_failed())
+        {
+            /* Previous reader didn't read the body to the end, read the rest for it */
+            std::istream &tee = *_replay_streams.front();
+            tee.clear();
+            tee.ignore(std::numeric_limits<std::streamsize>::max());
+        }
+        /* Partial body is not handed out as if it was the whole one */
+        if (!_replay->is_complete()) throw io_exception{"Request body cannot be replayed: it was not read completely"};
+        /* Streams handed out before stay valid until the end of the request */
+        _replay_streams.emplace_back(new instream<replay_source>{*_replay});
+    }
+    return *(_in = _replay_streams.back().get());
 }
 
 multipart_input& http_request_base::get_multipart_input()
 {
-    if (_in)
+    if (_multipart_in) return *_multipart_in;
+    std::istream *body = nullptr;
+    if (_body_replay)
+    {
+        /* Parts are parsed from a replay of the body, which filters could have read already */
+        body = &_replay_input_stream();
+        _in = nullptr;
+    }
+    else if (_in)
     {
         throw io_exception{"Failed to initialize multipart input. Regular input stream has already been initialized."};
     }
-    string_view ct = get_header("content-type");
+    string_view ct = get_header(http_header::content_type);
     if (_get_content_type() != "multipart/form-data")
     {
         throw io_exception{"Failed to initialize multipart input. Invalid content type: " + ct};
@@ -285,7 +556,8 @@ multipart_input& http_request_base::get_multipart_input()
                 boundary.reserve(boundary_view.size()+2);
                 boundary.append(2, '-').append(boundary_view.data(), boundary_view.size());
                 _multipart_in = new multipart_input_impl{_request, boundary, SERVLET_CONFIG.input_stream_limit,
-                                                         &_params, MAX_POST_DATA_VALUE_SIZE};
+                                                         &_params, SERVLET_CONFIG.form_value_limit, _mp_config,
+                                                         &_cancellation, body};
                 return *_multipart_in;
             }
         }
@@ -328,9 +600,9 @@ std::shared_ptr<SSL_information> http_request_base::ssl_information()
 {
     if (_ssl_inited) return _issl;
     _ssl_inited = true;
-    auto it = get_env().find("HTTPS");
-    if (it == _env.end() || (!equal_ic(it->second, "on") && !equal_ic(it->second, "true"))) return _issl;
-    _issl.reset(new SSL_info{get_env()});
+    const char *https = apr_table_get(_request->subprocess_env, "HTTPS");
+    if (!https || (!equal_ic(https, "on") && !equal_ic(https, "true"))) return _issl;
+    _issl.reset(new SSL_info{_request->subprocess_env});
     return _issl;
 }
 
@@ -350,12 +622,22 @@ void http_request_base::_parse_params()
             while (input.to_next_part()) ; /* Just read the stream, it will be parsed automatically */
         }
         else if (ct != "application/x-www-form-urlencoded") return;
-        else /* otherwise read form data */
+        else /* otherwise parse form data chunk by chunk as it is read */
         {
+            urlencoded_parser parser{[this] (std::string&& name, std::string&& value)
+                                     {
+                                         this->_params.try_emplace(std::move(name)).first->second.emplace_back(std::move(value));
+                                     }, SERVLET_CONFIG.form_name_limit, SERVLET_CONFIG.form_value_limit};
+            /* Request body buckets are parsed in place, the local buffer is
+             * used only if the input stream has been filtered */
             std::istream &in = get_input_stream();
-            inplace_ostream out{SERVLET_CONFIG.input_stream_limit};
-            out << in.rdbuf();
-            if (out->characters_written() > 0) _parse_params(string_view{out->str()});
+            char buf[buffer_8k::buf_size];
+            for (auto chunk = read_chunk(in, buf, sizeof(buf)); chunk.first; chunk = read_chunk(in, buf, sizeof(buf)))
+            {
+                parser.parse(chunk.first, chunk.second);
+            }
+            parser.finish();
+            for (auto &&param : _params) param.second.shrink_to_fit();
         }
     }
 }
@@ -394,6 +676,10 @@ public:
         (*_fin)->add_filter(_filter, false);
         return *_fin;
     }
+
+    spooled_part spool_part() override { return _in.spool_part(get_input_stream()); }
+    spooled_part spool_part(std::istream& in) override { return _in.spool_part(in); }
+    optional_ref<const std::uint64_t> get_digest() const override { return _in.get_digest(); }
 private:
     multipart_input& _in;
     filtered_instream *_fin = nullptr;
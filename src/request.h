@@ -10,56 +10,94 @@ http://boost.org/LICENSE_1_0.txt
 
 #include <servlet/request.h>
 #include <servlet/lib/io.h>
+#include <servlet/lib/io_filter.h>
 #include "string.h"
 #include <servlet/lib/lru_map.h>
 
 #include <httpd.h>
 #include <http_protocol.h>
 #include <http_core.h>
+#include <util_filter.h>
+#include <apr_buckets.h>
 
 #include "multipart.h"
 #include "session.h"
 #include "ssl.h"
+#include "request_uri.h"
+#include "body_replay.h"
+#include "cancellation.h"
 
 namespace servlet
 {
 
+/**
+ * Request body source reading Apache input brigades directly.
+ *
+ * <p>Data of each bucket is handed to the stream buffer in place, so
+ * it is not copied between Apache and the servlet. The bucket is
+ * deleted when the next one is requested.</p>
+ */
 class request_source
 {
 public:
-    request_source(request_rec *request, std::size_t in_limit) : _request{request}, _in_limit{in_limit}
+    typedef buffer_provider category;
+
+    request_source(request_rec *request, std::size_t in_limit, const cancellation_token *cancel = nullptr) :
+            _request{request}, _in_limit{in_limit}, _cancel{cancel}
     {
         if (ap_setup_client_block(_request, REQUEST_CHUNKED_DECHUNK) != OK || !ap_should_client_block(_request))
         {
             _request = nullptr;
+            return;
         }
+        _brigade = apr_brigade_create(_request->pool, _request->connection->bucket_alloc);
     }
-    ~request_source() noexcept { if (!_request) ap_discard_request_body(_request); }
-    std::streamsize read(char *buffer, std::size_t buf_size)
+    ~request_source() noexcept
     {
-        if (!_request || _count >= _in_limit) return 0;
-        std::streamsize read = ap_get_client_block(_request, buffer, buf_size);
-        _count += read;
-        return read;
+        if (!_request) return;
+        apr_brigade_destroy(_brigade);
+        ap_discard_request_body(_request);
     }
-    std::streamsize remaining() { return _request ? _request->remaining : 0; }
+    std::pair<char*, std::size_t> get_buffer();
 private:
     request_rec *_request;
     std::size_t _in_limit;
+    const cancellation_token *_cancel;
     std::size_t _count = 0;
+    apr_bucket_brigade *_brigade = nullptr;
+    apr_bucket *_bucket = nullptr; /* bucket handed out last */
+    bool _eos = false;
 };
 
-typedef basic_instream<request_source, buffer_1k, char> request_instream;
+typedef instream<request_source> request_instream;
 
-class http_request_base : public http_request
+/**
+ * Request body as a source for filtered streams.
+ *
+ * <p>Used when the body has to be decoded before it is passed to the
+ * servlet, for example if it is compressed.</p>
+ */
+class request_body_source : public basic_source<char>
 {
 public:
-    typedef lru_tree_map<std::string, std::shared_ptr<http_session_impl>> session_type_map;
+    request_body_source(request_rec *request, std::size_t in_limit, const cancellation_token *cancel = nullptr) :
+            _src{request, in_limit, cancel} {}
+
+    std::streamsize read(char* s, std::streamsize n) override;
+private:
+    request_source _src;
+    std::pair<char*, std::size_t> _chunk{nullptr, 0};
+};
 
-    http_request_base(request_rec *request, const URI &uri, const std::string &context_path,
-                      const std::string &srvlt_path, std::shared_ptr<session_type_map> session_map);
+class http_request_base : public http_request
+{
+public:
+    http_request_base(request_rec *request, const request_uri &uri, const std::string &context_path,
+                      const std::string &srvlt_path, std::shared_ptr<session_manager> sessions,
+                      const multipart_config &mp_config, bool body_replay = false,
+                      cancellation_token::time_point deadline = cancellation_token::time_point::max());
 
-    ~http_request_base() noexcept override { if (_multipart_in) delete _multipart_in; else delete _in; }
+    ~http_request_base() noexcept override;
 
     tree_any_map& get_attributes() override { return _attributes; }
     const tree_any_map& get_attributes() const override { return _attributes; }
@@ -78,16 +116,21 @@ public:
     const std::vector<cookie>& get_cookies() override { if (!_cookies_parsed) _parse_cookies(); return _cookies; }
     string_view get_context_path() const override { return _ctx; }
     string_view get_servlet_path() const override { return _srvlt_path; }
-    const URI& get_request_uri() const override { return _uri; }
+    const URI& get_request_uri() const override { return _uri.uri(); }
     string_view get_path_info() const override;
-    string_view get_header(const std::string& name) const override;
-    long get_date_header(const std::string& name) const override;
+    using http_request::get_header;
+    using http_request::get_date_header;
+    string_view get_header(const std::string& name) const override { return get_header(name.c_str()); }
+    string_view get_header(const char* name) const override;
+    long get_date_header(const std::string& name) const override { return get_date_header(name.c_str()); }
+    long get_date_header(const char* name) const override;
 
     string_view get_content_type() const override;
     long get_content_length() const override;
 
     void get_headers(const std::string& name, std::vector<std::string>& headers) const override;
     void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const override;
+    void visit_headers(const char* name, header_visit_fn visitor, void *data) const override;
 
     string_view get_method() const override { return _request->method; }
 
@@ -122,6 +165,13 @@ public:
     multipart_input& get_multipart_input() override;
     bool is_multipart() const override;
 
+    cancellation_token& get_cancellation_token() override { return _cancellation; }
+
+    /* Sends the cookie of a session kept in cookies if the session has changed */
+    void commit_session();
+    /* Is called before the response headers are sent, changes of the session after it are not sent */
+    void response_committed();
+
 private:
     const string_view& _get_content_type() const;
     void _parse_cookies();
@@ -129,17 +179,29 @@ private:
     void _parse_params();
     void _parse_params(string_view query);
     void _set_session_cookie(const std::string &id);
+    http_session &_get_cookie_session(string_view client_ip, string_view user_agent);
+    /* Remembers the state of the session sent in the cookie */
+    void _track_cookie_session(bool reissue);
+    bool _cookie_session_changed() const;
+    std::istream* _open_input_stream();
+    std::istream& _replay_input_stream();
 
     const static std::string SESSION_COOKIE_NAME;
 
     request_rec *_request;
-    const URI &_uri;
+    const request_uri &_uri;
     string_view _ctx;
     string_view _srvlt_path;
     std::vector<cookie> _cookies;
     bool _cookies_parsed = false;
     std::shared_ptr<http_session_impl> _session;
-    std::shared_ptr<session_type_map> _session_map;
+    std::shared_ptr<session_manager> _sessions;
+    /* State of the session kept in the cookie as the client has it */
+    std::shared_ptr<const cow_any_map::snapshot_type> _sealed_attributes;
+    std::shared_ptr<principal> _sealed_principal;
+    bool _cookie_reissue = false;
+    bool _response_committed = false;
+    const multipart_config &_mp_config;
 
     std::map<std::string, std::vector<std::string>, std::less<>> _params;
     bool _params_parsed = false;
@@ -151,6 +213,15 @@ private:
     std::istream *_in = nullptr;
     multipart_input_impl *_multipart_in = nullptr;
 
+    /* Body replay: the body is collected while it is read by the first stream,
+     * every stream returned later reads it from the beginning */
+    bool _body_replay;
+    std::unique_ptr<std::istream> _body_in;
+    std::unique_ptr<body_replay> _replay;
+    std::vector<std::unique_ptr<std::istream>> _replay_streams;
+
+    request_cancellation _cancellation;
+
     tree_any_map _attributes;
     std::shared_ptr<SSL_info> _issl;
     bool _ssl_inited = false;
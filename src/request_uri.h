@@ -0,0 +1,73 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_REQUEST_URI_H
+#define MOD_SERVLET_IMPL_REQUEST_URI_H
+
+#include <ostream>
+
+#include <servlet/uri.h>
+
+#include <httpd.h>
+#include <http_protocol.h>
+#include <http_core.h>
+
+namespace servlet
+{
+
+/**
+ * Request URI which borrows path and query already parsed by Apache
+ * (<code>request_rec::parsed_uri</code>).
+ *
+ * <p>Routing only needs the path, so nothing is copied or parsed on
+ * the request path. The full URI (with scheme, server name and port)
+ * is built on first call to #uri and cached.</p>
+ */
+class request_uri
+{
+public:
+    explicit request_uri(request_rec *request) : _request{request},
+            _path{request->parsed_uri.path ? request->parsed_uri.path : ""},
+            _query{request->parsed_uri.query ? request->parsed_uri.query : ""} {}
+
+    request_uri(const request_uri&) = delete;
+    request_uri& operator=(const request_uri&) = delete;
+
+    string_view path() const noexcept { return _path; }
+    string_view query() const noexcept { return _query; }
+
+    const URI& uri() const
+    {
+        if (!_uri_built)
+        {
+            _uri = URI{ap_run_http_scheme(_request), ap_get_server_name_for_url(_request),
+                       ap_get_server_port(_request), _path, _query};
+            _uri_built = true;
+        }
+        return _uri;
+    }
+
+private:
+    request_rec *_request;
+    string_view _path;
+    string_view _query;
+    mutable URI _uri;
+    mutable bool _uri_built = false;
+};
+
+/* Prints path and query only, it doesn't force the full URI to be built */
+template<typename CharT, typename Traits>
+inline std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& out, const request_uri& uri)
+{
+    out << uri.path();
+    if (!uri.query().empty()) out << '?' << uri.query();
+    return out;
+}
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_REQUEST_URI_H
@@ -8,74 +8,71 @@ http://boost.org/LICENSE_1_0.txt
 #include "response.h"
 
 #include <http_core.h>
+#include <apr_strings.h>
 
 namespace servlet
 {
 
-inline static bool _is_scheme_char(char c)
-{
-    return std::isalnum(c) || c == '+' || c == '-' || c == '.';
-}
-
-inline static bool _has_scheme(const std::string& location)
-{
-    bool firstChar = true;
-    for (auto ch : location)
-    {
-        if(ch == ':') return !firstChar;
-        else if(!_is_scheme_char(ch)) return false;
-        firstChar = false;
-    }
-    return false;
-}
-
-static optional_ptr<const std::string> _to_absolute(const std::string &location, request_rec *r)
+optional_ptr<const std::string> absolute_location(const std::string &location, string_view scheme,
+                                                  string_view host, int port, string_view base_path)
 {
     if (location.empty()) return {&location};
+    /* Malformed location is rejected rather than sent to the client */
+    URI parsed{location};
+    if (parsed.is_absolute()) return {&location};
 
-    bool leadingSlash = location.front() == '/';
-
-    if (location.size() > 1 && leadingSlash && location[1] == '/') /* location starts with "//" */
+    if (location.size() > 1 && location[0] == '/' && location[1] == '/') /* location starts with "//" */
     {
         std::string *res = new std::string{};
-        string_view scheme{ap_run_http_scheme(r)};
         res->reserve(scheme.length() + location.length() + 1);
         res->append(scheme.data(), scheme.length()).append(1, ':').append(location);
         return {res, true};
     }
-    else if (leadingSlash || !_has_scheme(location))
-    {
-        string_view scheme{ap_run_http_scheme(r)};
-        string_view host{ap_get_server_name_for_url(r)};
-        apr_port_t port = ap_get_server_port(r);
-        bool defaultPort = URI::get_default_port(scheme) == port;
-        std::string res;
-        res.reserve(scheme.length() + host.length() + location.size() + (defaultPort ? 3 : 10));
-
-        res.append(scheme.data(), scheme.length()).append("://").append(host.data(), host.length());
-        if (!defaultPort) res.append(1, ':') << port;
 
-        if (!leadingSlash) res.append(r->parsed_uri.path).append(1, '/');
-        res.append(location);
-        URI normalized{std::move(res)};
-        normalized.normalize_path();
+    uri_builder builder;
+    builder.scheme(scheme).host(host).port(URI::get_default_port(scheme) == port ? 0 : port);
+    if (location.front() != '/' && !base_path.empty()) builder.path(base_path);
+    URI normalized = builder.append_path(parsed.path()).query(parsed.query()).fragment(parsed.fragment()).build();
+    normalized.normalize_path();
+    return {new std::string{normalized.string_move()}, true};
+}
 
-        return {new std::string{normalized.string_move()}, true};
-    }
-    return {&location};
+static optional_ptr<const std::string> _to_absolute(const std::string &location, request_rec *r)
+{
+    return absolute_location(location, ap_run_http_scheme(r), ap_get_server_name_for_url(r), ap_get_server_port(r),
+                             r->parsed_uri.path ? string_view{r->parsed_uri.path} : string_view{});
 }
 
 void http_response_base::add_header(const std::string &name, const std::string &value)
 {
     apr_table_add(_request->headers_out, name.data(), value.data());
 }
+/* Name of a well known header is a literal, only the value is copied to the request pool */
+void http_response_base::add_header(http_header header, string_view value)
+{
+    apr_table_addn(_request->headers_out, header_name(header),
+                   apr_pstrmemdup(_request->pool, value.data(), value.size()));
+}
+void http_response_base::add_header_n(const char* name, const char* value)
+{
+    apr_table_addn(_request->headers_out, name, value);
+}
 void http_response_base::set_header(const std::string &name, const std::string &value)
 {
     apr_table_set(_request->headers_out, name.data(), value.data());
 }
-bool http_response_base::contains_header(const std::string &name) const
+void http_response_base::set_header(http_header header, string_view value)
+{
+    apr_table_setn(_request->headers_out, header_name(header),
+                   apr_pstrmemdup(_request->pool, value.data(), value.size()));
+}
+void http_response_base::set_header_n(const char* name, const char* value)
 {
-    return apr_table_get(_request->headers_out, name.data()) != nullptr;
+    apr_table_setn(_request->headers_out, name, value);
+}
+bool http_response_base::contains_header(const char* name) const
+{
+    return apr_table_get(_request->headers_out, name) != nullptr;
 }
 
 static int add_value(std::vector<std::string> *values, const char *key, const char *val)
@@ -89,12 +86,22 @@ static int add_key_value(std::vector<std::pair<std::string, std::string>> *value
     return 1;
 }
 
-string_view http_response_base::get_header(const std::string& name) const
+struct header_visitor_data
+{
+    header_visit_fn visitor;
+    void *data;
+};
+static int visit_header(header_visitor_data *visitor, const char *key, const char *val)
 {
-    const char *header = apr_table_get(_request->headers_out, name.data());
+    return visitor->visitor(visitor->data, key, val) ? 1 : 0;
+}
+
+string_view http_response_base::get_header(const char* name) const
+{
+    const char *header = apr_table_get(_request->headers_out, name);
     return header ? string_view{header} : string_view{};
 }
-long http_response_base::get_date_header(const std::string& name) const
+long http_response_base::get_date_header(const char* name) const
 {
     string_view view = get_header(name);
     if (view.empty()) return -1;
@@ -103,30 +110,37 @@ long http_response_base::get_date_header(const std::string& name) const
 void http_response_base::get_headers(const std::string& name, std::vector<std::string>& headers) const
 {
     apr_table_do((int (*) (void *, const char *, const char *)) add_value,
-                 (void *) &headers, _request->headers_out, name.data(), NULL);
+                 (void *) &headers, _request->headers_out, name.c_str(), NULL);
 }
 void http_response_base::get_headers(std::vector<std::pair<std::string, std::string>>& headers) const
 {
     apr_table_do((int (*) (void *, const char *, const char *)) add_key_value,
                  (void *) &headers, _request->headers_out, NULL);
 }
+void http_response_base::visit_headers(const char* name, header_visit_fn visitor, void *data) const
+{
+    header_visitor_data visitor_data{visitor, data};
+    /* NULL name means all the headers */
+    apr_table_do((int (*) (void *, const char *, const char *)) visit_header,
+                 (void *) &visitor_data, _request->headers_out, name, NULL);
+}
 string_view http_response_base::get_content_type() const
 {
-    return get_header("Content-Type");
+    return get_header(http_header::content_type);
 }
 void http_response_base::set_content_type(const std::string &content_type)
 {
-    return set_header("Content-Type", content_type.data());
+    return set_header(http_header::content_type, content_type);
 }
 void http_response_base::set_content_length(std::size_t content_length)
 {
     std::string length_str;
     length_str << content_length;
-    return set_header("Content-Length", length_str);
+    return set_header(http_header::content_length, length_str);
 }
 void http_response_base::send_redirect(const std::string &redirectURL)
 {
-    set_header("Location", *_to_absolute(redirectURL, _request));
+    set_header(http_header::location, *_to_absolute(redirectURL, _request));
     _sc = SC_FOUND;
 }
 
@@ -8,32 +8,68 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_IMPL_RESPONSE_H
 #define MOD_SERVLET_IMPL_RESPONSE_H
 
+#include <functional>
+
 #include <servlet/response.h>
 #include <servlet/uri.h>
 #include "time.h"
+#include "cancellation.h"
 
 #include <http_protocol.h>
 
 namespace servlet
 {
 
+/*
+ * Makes a redirect location absolute against the scheme, host and port of the
+ * server and the path of the request. Location with a scheme is returned as is.
+ * Throws uri_syntax_error if the location is not a valid URI reference.
+ */
+optional_ptr<const std::string> absolute_location(const std::string &location, string_view scheme,
+                                                  string_view host, int port, string_view base_path);
+
 class response_sink
 {
 public:
-    response_sink(request_rec *req) : _request{req}, _count{0} {}
+    /* on_commit is called once, before anything is written, while the headers can still be changed */
+    response_sink(request_rec *req, const cancellation_token *cancel = nullptr,
+                  std::function<void()> on_commit = nullptr) :
+            _request{req}, _cancel{cancel}, _on_commit{std::move(on_commit)}, _count{0} {}
     ~response_sink() { flush(); }
 
     inline std::streamsize write(const char* s, std::streamsize n)
     {
+        _commit();
+        deadline_guard guard{_cancel, _request->connection};
+        guard.check();
         int bytesNum = ap_rwrite(s, static_cast<int>(n), _request);
-        if (bytesNum < 0) return 0;
+        if (bytesNum < 0)
+        {
+            guard.check();
+            return 0;
+        }
         _count += bytesNum;
         return bytesNum;
     }
-    inline bool flush() { return ap_rflush(_request) == 0; }
+    inline bool flush()
+    {
+        _commit();
+        deadline_guard guard{_cancel, _request->connection};
+        return !guard.cancelled() && ap_rflush(_request) == 0;
+    }
     inline std::streamsize get_count() { return _count; }
 private:
+    inline void _commit()
+    {
+        if (!_on_commit) return;
+        std::function<void()> on_commit = std::move(_on_commit);
+        _on_commit = nullptr;
+        on_commit();
+    }
+
     request_rec *_request;
+    const cancellation_token *_cancel;
+    std::function<void()> _on_commit;
     std::streamsize _count;
 };
 
@@ -42,7 +78,9 @@ typedef basic_outstream<response_sink, non_buffered, char> response_ostream;
 class http_response_base : public http_response
 {
 public:
-    explicit http_response_base(request_rec* request) noexcept : _request{request}, _out{_request} {}
+    explicit http_response_base(request_rec* request, const cancellation_token *cancel = nullptr,
+                                std::function<void()> on_commit = nullptr) :
+            _request{request}, _out{_request, cancel, std::move(on_commit)} {}
 
     /* No copying, no moving */
     http_response_base(const http_response_base& ) = delete;
@@ -50,9 +88,19 @@ public:
     http_response_base& operator=(const http_response_base& ) = delete;
     http_response_base& operator=(http_response_base&& ) = delete;
 
-    void add_cookie(const cookie& c) override { add_header("Set-cookie", c.to_string()); }
+    void add_cookie(const cookie& c) override { add_header(http_header::set_cookie, c.to_string()); }
+
+    using http_response::add_header;
+    using http_response::add_date_header;
+    using http_response::set_header;
+    using http_response::set_date_header;
+    using http_response::contains_header;
+    using http_response::get_header;
+    using http_response::get_date_header;
 
     void add_header(const std::string &name, const std::string &value) override;
+    void add_header(http_header header, string_view value) override;
+    void add_header_n(const char* name, const char* value) override;
 
     void add_date_header(const std::string &name, long timeSec) override
     {
@@ -60,18 +108,24 @@ public:
     }
 
     void set_header(const std::string &name, const std::string &value) override;
+    void set_header(http_header header, string_view value) override;
+    void set_header_n(const char* name, const char* value) override;
 
     void set_date_header(const std::string &name, long timeSec) override
     {
         set_header(name, format_time("%a, %d-%b-%Y %H:%M:%S %Z", get_gmtm(timeSec), 32));
     }
 
-    bool contains_header(const std::string &name) const override;
+    bool contains_header(const std::string &name) const override { return contains_header(name.c_str()); }
+    bool contains_header(const char* name) const override;
 
-    string_view get_header(const std::string& name) const override;
-    long get_date_header(const std::string& name) const override;
+    string_view get_header(const std::string& name) const override { return get_header(name.c_str()); }
+    string_view get_header(const char* name) const override;
+    long get_date_header(const std::string& name) const override { return get_date_header(name.c_str()); }
+    long get_date_header(const char* name) const override;
     void get_headers(const std::string& name, std::vector<std::string>& headers) const override;
     void get_headers(std::vector<std::pair<std::string, std::string>>& headers) const override;
+    void visit_headers(const char* name, header_visit_fn visitor, void *data) const override;
 
     string_view get_content_type() const override;
     void set_content_type(const std::string &content_type) override;
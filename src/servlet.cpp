@@ -45,7 +45,7 @@ void http_servlet::service(http_request& req, http_response& resp)
             long ifModifiedSince;
             try
             {
-                ifModifiedSince = req.get_date_header(HEADER_IFMODSINCE);
+                ifModifiedSince = req.get_date_header(http_header::if_modified_since);
             }
             catch (bad_cast e)
             {
@@ -140,9 +140,10 @@ void http_servlet::do_trace(http_request &req, http_response &resp)
     buffer.append(uri_view.data(), uri_view.length());
     buffer << req.get_protocol();
 
-    std::vector<std::pair<std::string, std::string>> headers;
-    req.get_headers(headers);
-    for (auto &&header : headers) buffer.append(header.first).append(": ").append(header.second);
+    req.for_each_header([&buffer] (string_view name, string_view value)
+                        {
+                            buffer.append(name.data(), name.size()).append(": ").append(value.data(), value.size());
+                        });
 
     buffer.append("\r\n");
 
@@ -192,15 +193,15 @@ void http_servlet::do_options(http_request &req, http_response &resp)
         allow += METHOD_OPTIONS;
     }
 
-    resp.set_header("Allow", allow);
+    resp.set_header(http_header::allow, allow);
 }
 
 long http_servlet::get_last_modified(http_request& req) { return -1; }
 
 void http_servlet::_maybe_set_last_modified(http_response &resp, long lastModifiedSec)
 {
-    if (resp.contains_header(HEADER_LASTMOD)) return;
-    if (lastModifiedSec >= 0) resp.set_date_header(HEADER_LASTMOD, lastModifiedSec);
+    if (resp.contains_header(http_header::last_modified)) return;
+    if (lastModifiedSec >= 0) resp.set_date_header(header_name(http_header::last_modified), lastModifiedSec);
 }
 
 } // end of servlet namespace
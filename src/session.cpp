@@ -7,75 +7,575 @@ http://boost.org/LICENSE_1_0.txt
 */
 #include "session.h"
 
+#include <cstring>
+#include <experimental/filesystem>
 #include <thread>
-#include <random>
 #include <mutex>
+#include <unordered_map>
+
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "os.h"
+#include "session_codec.h"
 
 namespace servlet
 {
 
-class system_random
+/* Random bytes of the OS are fetched in blocks and are handed out without any locking */
+class thread_random_pool
 {
 public:
-    typedef std::uniform_int_distribution<int> distr_type;
-    system_random() :
-            _gen{static_cast<std::mt19937_64::result_type>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count())} {}
-
-    typename distr_type::result_type operator()() { return _distr(_gen); }
+    void take(unsigned char *out, std::size_t size)
+    {
+        /* A child process must not reuse bytes inherited from its parent */
+        int pid = get_pid();
+        if (_pos + size > sizeof(_buf) || pid != _pid)
+        {
+            system_random_bytes(_buf, sizeof(_buf));
+            _pos = 0;
+            _pid = pid;
+        }
+        std::memcpy(out, _buf + _pos, size);
+        /* Used bytes are not kept in memory */
+        std::memset(_buf + _pos, 0, size);
+        _pos += size;
+    }
 
 private:
-    std::mt19937_64 _gen;
-    distr_type _distr{std::numeric_limits<unsigned char>::min(), std::numeric_limits<unsigned char>::max()};
+    unsigned char _buf[512];
+    std::size_t _pos = sizeof(_buf);
+    int _pid = 0;
 };
 
-void random_bytes(std::array<unsigned char, 16> &bytes)
+/* Last access time of a session is kept with this precision */
+constexpr std::uint32_t SESSION_TOUCH_INTERVAL_SEC = 1;
+/* Rough overheads of the session map entry and of an attribute record, beyond their contents */
+constexpr std::size_t SESSION_ENTRY_OVERHEAD = 160;
+constexpr std::size_t ATTRIBUTE_OVERHEAD = sizeof(cow_any_map::value_type) + sizeof(any) + 32;
+/* A request evicts a bounded number of sessions, however far the budget is exceeded */
+constexpr std::size_t MAX_EVICTIONS_PER_UPDATE = 16;
+
+static const char HEX[] = "0123456789ABCDEF";
+
+session_id session_id::generate()
+{
+    static thread_local thread_random_pool POOL;
+    session_id id;
+    POOL.take(id._bytes, SIZE);
+    return id;
+}
+
+static int _hex_value(char c)
 {
-    static system_random BYTES_RANDOM;
-    static std::mutex BYTES_MX;
-    std::lock_guard<std::mutex> lk{BYTES_MX};
-    for (auto &byte : bytes) byte = static_cast<unsigned char>(BYTES_RANDOM());
+    if (c >= '0' && c <= '9') return c - '0';
+    /* Lower case digits would give one session several IDs */
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool session_id::parse(string_view text, session_id &id) noexcept
+{
+    if (text.size() != 2 * SIZE) return false;
+    unsigned char bytes[SIZE];
+    for (std::size_t i = 0; i < SIZE; ++i)
+    {
+        int high = _hex_value(text[2 * i]);
+        int low = _hex_value(text[2 * i + 1]);
+        if (high < 0 || low < 0) return false;
+        bytes[i] = static_cast<unsigned char>((high << 4) | low);
+    }
+    std::memcpy(id._bytes, bytes, SIZE);
+    return true;
+}
+
+std::string session_id::to_string() const
+{
+    char buffer[SIZE * 2];
+    for (std::size_t i = 0; i < SIZE; ++i)
+    {
+        buffer[2 * i] = HEX[_bytes[i] >> 4];
+        buffer[2 * i + 1] = HEX[_bytes[i] & 0x0f];
+    }
+    return std::string(buffer, sizeof(buffer));
 }
 
 std::string generate_session_id()
 {
-    std::array<unsigned char, 16> random;
+    return session_id::generate().to_string();
+}
+
+/*
+ * Strings repeated by many sessions, like user agents, are kept once while any
+ * session uses them. The table only holds weak references; the last user of a
+ * string removes it.
+ */
+class string_intern_table
+{
+public:
+    static string_intern_table &instance()
+    {
+        /* Is never destroyed, sessions can outlive static objects */
+        static string_intern_table *INSTANCE = new string_intern_table;
+        return *INSTANCE;
+    }
 
-    std::string buffer{};
-    int resultLenBytes = 0;
-    while (resultLenBytes < 16)
+    std::shared_ptr<const std::string> intern(string_view str)
     {
-        random_bytes(random);
-        for (int j = 0; j < 16 && resultLenBytes < 16; ++j)
+        _shard &shard = _shards[std::hash<string_view>{}(str) % SHARDS];
+        std::lock_guard<std::mutex> lock{shard.mx};
+        auto it = shard.table.find(str);
+        if (it != shard.table.end())
         {
-            unsigned char b1 = static_cast<unsigned char>((random[j] & 0xf0) >> 4);
-            unsigned char b2 = static_cast<unsigned char>(random[j] & 0x0f);
-            if (b1 < 10) buffer.append(1, '0' + b1);
-            else buffer.append(1, static_cast<char>('A' + (b1 - 10)));
-            if (b2 < 10) buffer.append(1, '0' + b2);
-            else buffer.append(1, static_cast<char>('A' + (b2 - 10)));
-            ++resultLenBytes;
+            std::shared_ptr<const std::string> found = it->second.lock();
+            if (found) return found;
+            /* Its last user is being destroyed right now */
+            shard.table.erase(it);
         }
+        std::shared_ptr<const std::string> created{new std::string{str.to_string()},
+                                                   [&shard](const std::string *s) { _release(shard, s); }};
+        shard.table.emplace(string_view{*created}, created);
+        return created;
     }
-    return buffer;
+
+private:
+    static constexpr std::size_t SHARDS = 16;
+
+    struct _shard
+    {
+        std::mutex mx;
+        std::unordered_map<string_view, std::weak_ptr<const std::string>> table;
+    };
+
+    static void _release(_shard &shard, const std::string *s)
+    {
+        {
+            std::lock_guard<std::mutex> lock{shard.mx};
+            auto it = shard.table.find(string_view{*s});
+            /* The string could have been interned anew after its last user was gone */
+            if (it != shard.table.end() && it->first.data() == s->data()) shard.table.erase(it);
+        }
+        delete s;
+    }
+
+    _shard _shards[SHARDS];
+};
+
+client_address::client_address(string_view address)
+{
+    char buffer[INET6_ADDRSTRLEN];
+    if (address.size() < sizeof(buffer))
+    {
+        std::memcpy(buffer, address.data(), address.size());
+        buffer[address.size()] = '\0';
+        if (inet_pton(AF_INET, buffer, _bytes) == 1) _family = AF_INET;
+        else if (inet_pton(AF_INET6, buffer, _bytes) == 1) _family = AF_INET6;
+    }
+    /* Packed address must give back exactly the same string */
+    if (_family != 0 && to_string() == address) return;
+    _family = 0;
+    std::memset(_bytes, 0, sizeof(_bytes));
+    _text = string_intern_table::instance().intern(address);
+}
+
+std::string client_address::to_string() const
+{
+    if (_family == 0) return _text ? *_text : std::string{};
+    char buffer[INET6_ADDRSTRLEN];
+    return inet_ntop(_family, _bytes, buffer, sizeof(buffer)) ? std::string{buffer} : std::string{};
+}
+
+bool client_address::equals(string_view address) const
+{
+    if (_family == 0) return _text ? *_text == address : address.empty();
+    char buffer[INET6_ADDRSTRLEN];
+    return inet_ntop(_family, _bytes, buffer, sizeof(buffer)) && string_view{buffer} == address;
 }
 
 http_session::http_session(const string_view &client_ip, const string_view &user_agent) :
-        _session_id{generate_session_id()}, _client_ip{client_ip.to_string()}, _user_agent{user_agent.to_string()},
-        _created{std::chrono::system_clock::now()}, _last_accessed{std::chrono::system_clock::now()} {}
+        _client_ip{client_ip}, _user_agent{string_intern_table::instance().intern(user_agent)},
+        _last_accessed{_to_seconds(std::chrono::system_clock::now())}, _session_id{session_id::generate()},
+        _created{_last_accessed.load(std::memory_order_relaxed)} {}
+
+http_session::http_session(const session_id &id, const string_view &client_ip, const string_view &user_agent,
+                           time_type created, time_type last_accessed) :
+        _client_ip{client_ip}, _user_agent{string_intern_table::instance().intern(user_agent)},
+        _last_accessed{_to_seconds(last_accessed)}, _session_id{id}, _created{_to_seconds(created)} {}
 
 void http_session::reset_session_id()
 {
-    _session_id = std::move(generate_session_id());
+    _session_id = session_id::generate();
 }
 
 void http_session_impl::validate(const string_view &client_ip, const string_view &user_agent)
 {
-    if (_client_ip != client_ip)
+    if (!_client_ip.equals(client_ip))
         throw security_exception{"session was requested by a user with different IP"};
-    if (_user_agent != user_agent)
+    if (*_user_agent != user_agent)
         throw security_exception{"session was requested by a user with different User-Agent"};
-    _new = false;
-    _last_accessed = std::chrono::system_clock::now();
+    /* Concurrent requests of a session only read it, unless a second has passed since the last update */
+    if (_new.load(std::memory_order_relaxed)) _new.store(false, std::memory_order_relaxed);
+    std::uint32_t now = _to_seconds(coarse_system_now());
+    std::uint32_t last = _last_accessed.load(std::memory_order_relaxed);
+    if (now - last >= SESSION_TOUCH_INTERVAL_SEC) _last_accessed.store(now, std::memory_order_relaxed);
+}
+
+template<typename T>
+static void _add_arithmetic(session_attribute_sizes &sizes)
+{
+    sizes.add<T>([](const T&) { return sizeof(T); });
+}
+
+session_attribute_sizes::session_attribute_sizes()
+{
+    add<std::string>([](const std::string &value) { return sizeof(std::string) + value.capacity(); });
+    _add_arithmetic<bool>(*this);
+    _add_arithmetic<int>(*this);
+    _add_arithmetic<long>(*this);
+    _add_arithmetic<long long>(*this);
+    _add_arithmetic<unsigned>(*this);
+    _add_arithmetic<unsigned long>(*this);
+    _add_arithmetic<unsigned long long>(*this);
+    _add_arithmetic<float>(*this);
+    _add_arithmetic<double>(*this);
+}
+
+session_attribute_sizes &session_attribute_sizes::instance()
+{
+    static session_attribute_sizes INSTANCE;
+    return INSTANCE;
+}
+
+void session_attribute_sizes::add(const std::type_info &type, estimator_type estimator)
+{
+    std::unique_lock<std::shared_mutex> lock{_mx};
+    _estimators[type] = std::move(estimator);
+}
+
+void session_attribute_sizes::remove(const std::type_info &type)
+{
+    std::unique_lock<std::shared_mutex> lock{_mx};
+    _estimators.erase(type);
+}
+
+std::size_t session_attribute_sizes::estimate(const any &value) const
+{
+    std::shared_lock<std::shared_mutex> lock{_mx};
+    auto it = _estimators.find(value.type());
+    return it == _estimators.end() ? DEFAULT_SIZE : it->second(value);
+}
+
+std::size_t http_session_impl::memory_size() const
+{
+    /* The ID and the address are inline, the user agent is shared with other sessions */
+    std::size_t size = sizeof(http_session_impl) + SESSION_ENTRY_OVERHEAD;
+    const session_attribute_sizes &sizes = session_attribute_sizes::instance();
+    for (auto &&attr : *snapshot()) size += ATTRIBUTE_OVERHEAD + attr.first.capacity() + sizes.estimate(*attr.second);
+    return size;
+}
+
+std::uint64_t session_scope(string_view context_path)
+{
+    /* FNV-1a, it must give the same value in every process */
+    std::uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : context_path)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+void session_manager::set_shared_store(std::shared_ptr<session_store> store, std::uint64_t scope)
+{
+    _store = std::move(store);
+    _scope = scope;
+}
+
+void session_manager::set_cookie_codec(std::shared_ptr<cookie_session_codec> codec, std::uint64_t scope)
+{
+    _cookie_codec = std::move(codec);
+    _scope = scope;
+}
+
+std::shared_ptr<http_session_impl> session_manager::open_cookie(string_view value, bool &reissue)
+{
+    bool stale = false;
+    std::shared_ptr<http_session_impl> session = _cookie_codec->open(value, _scope, _timeout, stale);
+    if (!session) return nullptr;
+    /* Cookie is sealed with its access time, it is renewed in the second half of the timeout */
+    auto age = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() -
+                                                                session->get_last_accessed_time());
+    reissue = stale || age >= _timeout / 2;
+    return session;
+}
+
+std::string session_manager::seal_cookie(const http_session_impl &session)
+{
+    return _cookie_codec->seal(session, _scope);
+}
+
+/* Attributes which can't be encoded and the principal object live only in this process,
+ * they are carried over to the session decoded after another process changed it */
+static void _keep_local_state(const http_session_impl &local, http_session_impl &refreshed)
+{
+    const session_attribute_codecs &codecs = session_attribute_codecs::instance();
+    for (auto &&attr : *local.snapshot())
+    {
+        if (codecs.can_encode(attr.second->type()) || refreshed.contains_key(attr.first)) continue;
+        refreshed.put_any(attr.first, *attr.second);
+    }
+    std::shared_ptr<principal> p = local.get_principal();
+    std::shared_ptr<principal> decoded = refreshed.get_principal();
+    if (p && decoded && p->get_name() == decoded->get_name()) refreshed.set_principal(std::move(p));
+}
+
+std::shared_ptr<http_session_impl> session_manager::find(const std::string &id)
+{
+    session_id key;
+    /* Not an ID this container could have generated */
+    if (!session_id::parse(id, key)) return nullptr;
+    std::shared_ptr<http_session_impl> local = _sessions.get(key);
+    if (!_store) return local ? local : _restore(id);
+    std::uint64_t version = local ? local->get_version() : 0;
+    std::string data;
+    if (!_store->get(_scope, id, _timeout, version, data))
+    {
+        /* Invalidated or expired in the store; whoever removed it notified the listeners */
+        if (local)
+        {
+            _sessions.erase(key);
+            return nullptr;
+        }
+        return _restore(id);
+    }
+    if (local && local->get_version() == version) return local;
+    std::shared_ptr<http_session_impl> session = decode_session(data);
+    if (local) _keep_local_state(*local, *session);
+    session->set_version(version);
+    session->set_stored_hash(std::hash<std::string>{}(data));
+    _sessions.put(key, session);
+    _account(*session);
+    return session;
+}
+
+std::shared_ptr<http_session_impl> session_manager::_restore(const std::string &id)
+{
+    if (!_snapshot) return nullptr;
+    std::shared_ptr<http_session_impl> session = _snapshot->take(id);
+    if (!session) return nullptr;
+    /* Lost the race to a request which restored it in this process */
+    if (!insert(session)) return _sessions.get(session->get_binary_id());
+    return session;
+}
+
+std::size_t session_manager::write_snapshot(const std::string &dir)
+{
+    std::vector<std::shared_ptr<http_session_impl>> sessions;
+    _sessions.for_each([&sessions](const session_id&, const std::shared_ptr<http_session_impl> &session)
+    {
+        sessions.push_back(session);
+    });
+    if (sessions.empty()) return 0;
+    std::experimental::filesystem::create_directories(dir);
+    session_snapshot_writer writer{session_snapshot_path(dir)};
+    for (auto &&session : sessions)
+    {
+        /* With a shared store the latest version of the session is there */
+        std::shared_ptr<http_session_impl> latest = _store ? find(session->get_id()) : session;
+        if (latest) writer.add(*latest, _timeout);
+    }
+    writer.commit();
+    return writer.size();
+}
+
+bool session_manager::insert(const std::shared_ptr<http_session_impl> &session)
+{
+    if (!_sessions.try_put(session->get_binary_id(), session)) return false;
+    if (!_store) return true;
+    std::string data = encode_session(*session);
+    std::uint64_t version = _store->put(_scope, session->get_id(), data, _timeout, true);
+    if (version == 0)
+    {
+        _sessions.erase(session->get_binary_id());
+        return false;
+    }
+    session->set_version(version);
+    session->set_stored_hash(std::hash<std::string>{}(data));
+    return true;
+}
+
+void session_manager::save(http_session_impl &session)
+{
+    _account(session);
+    if (!_store || session.get_version() == 0) return;
+    std::string data = encode_session(session);
+    std::size_t hash = std::hash<std::string>{}(data);
+    if (hash == session.get_stored_hash()) return; /* Access time has been updated by the lookup */
+    session.set_version(_store->put(_scope, session.get_id(), data, _timeout, false));
+    session.set_stored_hash(hash);
+}
+
+void session_manager::_account(http_session_impl &session)
+{
+    if (_memory_budget == 0) return;
+    /* Is false if the session has been removed while it was used */
+    if (!_sessions.set_weight(session.get_binary_id(), session.memory_size())) return;
+    auto rank = [](const session_id&, const std::shared_ptr<http_session_impl> &s)
+    {
+        /* New session has never been returned by the client */
+        return s->is_new() ? 0 : s->get_principal() ? 2 : 1;
+    };
+    auto evicted = [this](const session_id &id, const std::shared_ptr<http_session_impl> &s)
+    {
+        _memory_evictions.fetch_add(1, std::memory_order_relaxed);
+        /* Only the local copy is dropped if other processes can use the session */
+        if (_store && _store->contains(_scope, id.to_string())) return;
+        destroyed(*s);
+    };
+    for (std::size_t i = 0; i < MAX_EVICTIONS_PER_UPDATE && _sessions.weight() > _memory_budget; ++i)
+    {
+        if (!_sessions.evict(EVICTION_SAMPLE, rank, evicted)) break;
+    }
+}
+
+bool session_manager::erase(const std::string &id)
+{
+    session_id key;
+    if (!session_id::parse(id, key)) return false;
+    bool erased = _sessions.erase(key);
+    if (_store && _store->erase(_scope, id)) erased = true;
+    return erased;
+}
+
+bool session_manager::contains(const std::string &id)
+{
+    session_id key;
+    if (!session_id::parse(id, key)) return false;
+    return _store ? _store->contains(_scope, id) : _sessions.contains_key(key);
+}
+
+void session_manager::add_listener(std::shared_ptr<http_session_listener> listener, const void *owner)
+{
+    std::lock_guard<std::mutex> lock{_listeners_mx};
+    std::shared_ptr<listener_list> listeners = _listeners ? std::make_shared<listener_list>(*_listeners) :
+                                                            std::make_shared<listener_list>();
+    listeners->emplace_back(owner, std::move(listener));
+    _listeners = std::move(listeners);
+}
+
+void session_manager::remove_listeners(const void *owner)
+{
+    std::lock_guard<std::mutex> lock{_listeners_mx};
+    if (!_listeners) return;
+    std::shared_ptr<listener_list> listeners = std::make_shared<listener_list>();
+    for (auto &&l : *_listeners)
+    {
+        if (l.first != owner) listeners->push_back(l);
+    }
+    _listeners = std::move(listeners);
+}
+
+std::shared_ptr<const session_manager::listener_list> session_manager::_get_listeners() const
+{
+    std::lock_guard<std::mutex> lock{_listeners_mx};
+    return _listeners;
+}
+
+void session_manager::created(http_session &session)
+{
+    std::shared_ptr<const listener_list> listeners = _get_listeners();
+    if (!listeners) return;
+    for (auto &&l : *listeners)
+    {
+        try
+        {
+            l.second->session_created(session);
+        }
+        catch (const std::exception &e)
+        {
+            LG->warning() << "Session listener failed on creation of session " << session.get_id()
+                          << ": " << e << std::endl;
+        }
+    }
+}
+
+void session_manager::destroyed(http_session &session)
+{
+    std::shared_ptr<const listener_list> listeners = _get_listeners();
+    if (!listeners) return;
+    for (auto &&l : *listeners)
+    {
+        try
+        {
+            l.second->session_destroyed(session);
+        }
+        catch (const std::exception &e)
+        {
+            LG->warning() << "Session listener failed on destruction of session " << session.get_id()
+                          << ": " << e << std::endl;
+        }
+    }
+}
+
+std::size_t session_manager::sweep(std::size_t budget)
+{
+    return _sessions.expire(budget, [this](const session_id &id, const std::shared_ptr<http_session_impl>& session)
+    {
+        /* Session can be used by other processes, only the local copy is dropped then */
+        if (_store && _store->contains(_scope, id.to_string())) return;
+        destroyed(*session);
+    });
+}
+
+void session_manager::start(std::chrono::milliseconds interval, std::size_t budget)
+{
+    std::lock_guard<std::mutex> lock{_sweeper_mx};
+    if (_sweeper.joinable()) return;
+    _stopped = false;
+    _sweeper = std::thread{&session_manager::_run, this, interval, budget};
+}
+
+void session_manager::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock{_sweeper_mx};
+        if (!_sweeper.joinable()) return;
+        _stopped = true;
+    }
+    _sweeper_cv.notify_all();
+    _sweeper.join();
+}
+
+void session_manager::_run(std::chrono::milliseconds interval, std::size_t budget)
+{
+    std::unique_lock<std::mutex> lock{_sweeper_mx};
+    while (!_sweeper_cv.wait_for(lock, interval, [this] { return _stopped; }))
+    {
+        lock.unlock();
+        try
+        {
+            /* Full batch means there may be more expired sessions */
+            while (sweep(budget) == budget)
+            {
+                std::lock_guard<std::mutex> stop_lock{_sweeper_mx};
+                if (_stopped) break;
+            }
+            if (_store) _store->expire();
+            std::size_t evictions = memory_evictions();
+            if (evictions != _reported_evictions)
+            {
+                LG->warning() << evictions - _reported_evictions << " sessions were evicted to stay within "
+                              << _memory_budget << " bytes, " << evictions << " in total" << std::endl;
+                _reported_evictions = evictions;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            LG->warning() << "Failed to remove expired sessions: " << e << std::endl;
+        }
+        lock.lock();
+    }
 }
 
 } // end of servlet namespace
@@ -8,7 +8,21 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_IMPL_SESSION_H
 #define MOD_SERVLET_IMPL_SESSION_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <servlet/session.h>
+#include <servlet/lib/lru_map.h>
+
+#include "cookie_session_codec.h"
+#include "session_snapshot.h"
+#include "session_store.h"
 
 namespace servlet
 {
@@ -20,9 +34,146 @@ public:
     http_session_impl(const string_view &client_ip, const string_view &user_agent) :
             http_session{client_ip, user_agent} {}
 
+    /* Restores a session which has been created earlier, possibly by another process */
+    http_session_impl(const session_id &id, const string_view &client_ip, const string_view &user_agent,
+                      time_type created, time_type last_accessed) :
+            http_session{id, client_ip, user_agent, created, last_accessed}
+    {
+        _new = false;
+    }
+
     void validate(const string_view &client_ip, const string_view &user_agent);
 
     void reset_session_id() override { http_session::reset_session_id(); }
+
+    std::string get_client_ip() const { return _client_ip.to_string(); }
+    const std::string &get_user_agent() const { return *_user_agent; }
+
+    /* Version of this session in the shared store, 0 if it is not stored there.
+     * Concurrent requests of the session read and write it. */
+    std::uint64_t get_version() const { return _version.load(); }
+    void set_version(std::uint64_t version) { _version.store(version); }
+    /* Hash of the last stored encoding, so that unchanged sessions are not written again */
+    std::size_t get_stored_hash() const { return _stored_hash.load(); }
+    void set_stored_hash(std::size_t hash) { _stored_hash.store(hash); }
+
+    /* Approximate memory used by this session, see session_attribute_sizes */
+    std::size_t memory_size() const;
+
+private:
+    std::atomic<std::uint64_t> _version{0};
+    std::atomic<std::size_t> _stored_hash{0};
+};
+
+/*
+ * Sessions of a web application (or of all of them if sessions are shared)
+ * together with the listeners of these sessions.
+ *
+ * Timed out sessions are removed by a background thread in bounded batches,
+ * so neither lookups nor insertions pay for the expiration, and listeners
+ * are notified about them outside of any request.
+ *
+ * Memory of the sessions can be limited with a budget. When it is exceeded
+ * sessions are evicted before they time out: the ones the client has never
+ * joined first (like those created by crawlers and other clients ignoring
+ * cookies), then unauthenticated ones, and the least recently used of a
+ * sample otherwise.
+ *
+ * With a cookie codec sessions are not kept here at all: every session is sealed
+ * in the cookie sent to its client, and is opened from the cookie on every request.
+ */
+class session_manager
+{
+public:
+    typedef sharded_lru_map<session_id, std::shared_ptr<http_session_impl>> session_map;
+
+    static constexpr std::size_t DEFAULT_SWEEP_BUDGET = 256;
+    /* Number of least recently used sessions of a shard an eviction chooses from */
+    static constexpr std::size_t EVICTION_SAMPLE = 8;
+
+    explicit session_manager(std::size_t timeout_sec) : _sessions{timeout_sec}, _timeout{timeout_sec} {}
+    session_manager(const session_manager&) = delete;
+    session_manager& operator=(const session_manager&) = delete;
+    ~session_manager() noexcept { stop(); }
+
+    /* Sessions of this process. With a shared store it is a cache of decoded sessions. */
+    session_map &sessions() { return _sessions; }
+
+    /* Shares sessions with other processes or hosts through the store; scope separates web applications */
+    void set_shared_store(std::shared_ptr<session_store> store, std::uint64_t scope);
+
+    /* Keeps sessions in cookies sealed with the codec; scope separates web applications */
+    void set_cookie_codec(std::shared_ptr<cookie_session_codec> codec, std::uint64_t scope);
+    /* Returns true if sessions are kept in cookies rather than by the server */
+    bool is_stateless() const { return static_cast<bool>(_cookie_codec); }
+    /*
+     * Returns the session sealed in the cookie, or empty pointer if the cookie is not
+     * valid. reissue is set if the cookie should be replaced even if the session doesn't
+     * change, because its key is being retired or it is about to time out.
+     */
+    std::shared_ptr<http_session_impl> open_cookie(string_view value, bool &reissue);
+    /* Returns the cookie value for the session, or empty string if the session is too big for a cookie */
+    std::string seal_cookie(const http_session_impl &session);
+
+    /* Sessions saved by the processes which served before are restored from the snapshot */
+    void set_snapshot(std::shared_ptr<session_snapshot> snapshot) { _snapshot = std::move(snapshot); }
+    /* Writes sessions of this process to a snapshot file in the directory. Returns the number of sessions. */
+    std::size_t write_snapshot(const std::string &dir);
+
+    /* Returns the session with a given ID or empty pointer if there is no such session */
+    std::shared_ptr<http_session_impl> find(const std::string &id);
+    /* Adds a new session. Returns false if a session with the same ID exists */
+    bool insert(const std::shared_ptr<http_session_impl> &session);
+    /* Writes the changes of the session to the shared store, if there is one */
+    void save(http_session_impl &session);
+    bool erase(const std::string &id);
+    bool contains(const std::string &id);
+
+    /* Listeners are registered by their owner, so that they can be removed together */
+    void add_listener(std::shared_ptr<http_session_listener> listener, const void *owner);
+    void remove_listeners(const void *owner);
+
+    void created(http_session &session);
+    void destroyed(http_session &session);
+
+    /* Limits approximate memory of the sessions of this process, 0 is no limit */
+    void set_memory_budget(std::size_t bytes) { _memory_budget = bytes; }
+    std::size_t memory_usage() const { return _sessions.weight(); }
+    /* Number of sessions evicted to stay within the memory budget */
+    std::size_t memory_evictions() const { return _memory_evictions.load(std::memory_order_relaxed); }
+
+    /* Removes up to budget expired sessions. Returns the number of removed sessions. */
+    std::size_t sweep(std::size_t budget = DEFAULT_SWEEP_BUDGET);
+
+    void start(std::chrono::milliseconds interval, std::size_t budget = DEFAULT_SWEEP_BUDGET);
+    void stop();
+
+private:
+    typedef std::vector<std::pair<const void*, std::shared_ptr<http_session_listener>>> listener_list;
+
+    std::shared_ptr<const listener_list> _get_listeners() const;
+    std::shared_ptr<http_session_impl> _restore(const std::string &id);
+    /* Updates memory size of the session and evicts sessions if the budget is exceeded */
+    void _account(http_session_impl &session);
+    void _run(std::chrono::milliseconds interval, std::size_t budget);
+
+    session_map _sessions;
+    std::chrono::seconds _timeout;
+    std::shared_ptr<session_store> _store;
+    std::uint64_t _scope = 0;
+    std::shared_ptr<session_snapshot> _snapshot;
+    std::shared_ptr<cookie_session_codec> _cookie_codec;
+    std::size_t _memory_budget = 0;
+    std::atomic<std::size_t> _memory_evictions{0};
+    std::size_t _reported_evictions = 0; /* is only used by the sweeper */
+    /* Replaced as a whole on change, so notifications don't hold the lock */
+    std::shared_ptr<const listener_list> _listeners;
+    mutable std::mutex _listeners_mx;
+
+    std::thread _sweeper;
+    std::mutex _sweeper_mx;
+    std::condition_variable _sweeper_cv;
+    bool _stopped = false;
 };
 
 } // end of servlet namespace
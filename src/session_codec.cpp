@@ -0,0 +1,223 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "session_codec.h"
+
+#include <cstdint>
+#include <cstring>
+#include <typeindex>
+
+#include <servlet/lib/exception.h>
+
+namespace servlet
+{
+
+static constexpr std::uint32_t SESSION_FORMAT = 2;
+
+class _writer
+{
+public:
+    template<typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivial types are written as is");
+        _out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void put_string(string_view s)
+    {
+        put(static_cast<std::uint32_t>(s.size()));
+        _out.append(s.data(), s.size());
+    }
+    std::string &str() { return _out; }
+private:
+    std::string _out;
+};
+
+class _reader
+{
+public:
+    explicit _reader(string_view data) : _data{data} {}
+
+    template<typename T>
+    T get()
+    {
+        T value;
+        std::memcpy(&value, _take(sizeof(T)), sizeof(T));
+        return value;
+    }
+    string_view get_string()
+    {
+        std::uint32_t size = get<std::uint32_t>();
+        return string_view{_take(size), size};
+    }
+private:
+    const char *_take(std::size_t size)
+    {
+        if (size > _data.size()) throw io_exception{"Truncated session data"};
+        const char *p = _data.data();
+        _data.remove_prefix(size);
+        return p;
+    }
+    string_view _data;
+};
+
+template<typename T>
+static void _add_trivial(session_attribute_codecs &codecs, const char *name)
+{
+    codecs.add<T>(name, [](const T &value, std::string &out) { out.append(reinterpret_cast<const char*>(&value), sizeof(T)); },
+                  [](string_view data)
+                  {
+                      if (data.size() != sizeof(T)) throw io_exception{"Invalid session attribute data"};
+                      T value;
+                      std::memcpy(&value, data.data(), sizeof(T));
+                      return value;
+                  });
+}
+
+session_attribute_codecs::session_attribute_codecs()
+{
+    add<std::string>("string", [](const std::string &value, std::string &out) { out.append(value); },
+                     [](string_view data) { return data.to_string(); });
+    _add_trivial<bool>(*this, "bool");
+    _add_trivial<int>(*this, "int");
+    _add_trivial<long>(*this, "long");
+    _add_trivial<long long>(*this, "long long");
+    _add_trivial<unsigned>(*this, "unsigned");
+    _add_trivial<unsigned long>(*this, "unsigned long");
+    _add_trivial<unsigned long long>(*this, "unsigned long long");
+    _add_trivial<float>(*this, "float");
+    _add_trivial<double>(*this, "double");
+}
+
+session_attribute_codecs &session_attribute_codecs::instance()
+{
+    static session_attribute_codecs INSTANCE;
+    return INSTANCE;
+}
+
+void session_attribute_codecs::add(const std::type_info &type, std::string name,
+                                   encoder_type encoder, decoder_type decoder)
+{
+    auto codec = std::make_shared<const _codec>(_codec{std::move(name), std::move(encoder), std::move(decoder)});
+    std::unique_lock<std::shared_mutex> lock{_mx};
+    auto old = _by_type.find(type);
+    if (old != _by_type.end()) _by_name.erase(old->second->name);
+    auto old_name = _by_name.find(codec->name);
+    if (old_name != _by_name.end())
+    {
+        for (auto it = _by_type.begin(); it != _by_type.end(); ++it)
+        {
+            if (it->second == old_name->second)
+            {
+                _by_type.erase(it);
+                break;
+            }
+        }
+    }
+    _by_type[type] = codec;
+    _by_name[codec->name] = codec;
+}
+
+void session_attribute_codecs::remove(const std::type_info &type)
+{
+    std::unique_lock<std::shared_mutex> lock{_mx};
+    auto it = _by_type.find(type);
+    if (it == _by_type.end()) return;
+    _by_name.erase(it->second->name);
+    _by_type.erase(it);
+}
+
+bool session_attribute_codecs::encode(const any &value, std::string &name, std::string &out) const
+{
+    std::shared_ptr<const _codec> codec;
+    {
+        std::shared_lock<std::shared_mutex> lock{_mx};
+        auto it = _by_type.find(value.type());
+        if (it == _by_type.end()) return false;
+        codec = it->second;
+    }
+    name = codec->name;
+    codec->encoder(value, out);
+    return true;
+}
+
+bool session_attribute_codecs::can_encode(const std::type_info &type) const
+{
+    std::shared_lock<std::shared_mutex> lock{_mx};
+    return _by_type.find(type) != _by_type.end();
+}
+
+any session_attribute_codecs::decode(string_view name, string_view data) const
+{
+    std::shared_ptr<const _codec> codec;
+    {
+        std::shared_lock<std::shared_mutex> lock{_mx};
+        auto it = _by_name.find(name);
+        if (it == _by_name.end()) return any{};
+        codec = it->second;
+    }
+    return codec->decoder(data);
+}
+
+std::string encode_session(const http_session_impl &session)
+{
+    _writer w;
+    w.put(SESSION_FORMAT);
+    w.put_string(session.get_id());
+    w.put_string(session.get_client_ip());
+    w.put_string(session.get_user_agent());
+    w.put(static_cast<std::int64_t>(session.get_creation_time().time_since_epoch().count()));
+    w.put(static_cast<std::int64_t>(session.get_last_accessed_time().time_since_epoch().count()));
+    std::shared_ptr<principal> p = session.get_principal();
+    w.put(static_cast<std::uint8_t>(p ? 1 : 0));
+    if (p) w.put_string(p->get_name());
+    /* Count is patched when the attributes which can be encoded are known */
+    std::size_t count_pos = w.str().size();
+    w.put(std::uint32_t{0});
+    std::uint32_t count = 0;
+    const session_attribute_codecs &codecs = session_attribute_codecs::instance();
+    std::string type, value;
+    for (auto &&attr : *session.snapshot())
+    {
+        value.clear();
+        /* Attributes of types without a codec stay in this process */
+        if (!codecs.encode(*attr.second, type, value)) continue;
+        w.put_string(attr.first);
+        w.put_string(type);
+        w.put_string(value);
+        ++count;
+    }
+    std::memcpy(&w.str()[count_pos], &count, sizeof(count));
+    return std::move(w.str());
+}
+
+std::shared_ptr<http_session_impl> decode_session(string_view data)
+{
+    _reader r{data};
+    if (r.get<std::uint32_t>() != SESSION_FORMAT) throw io_exception{"Unknown session data format"};
+    session_id id;
+    if (!session_id::parse(r.get_string(), id)) throw io_exception{"Invalid session ID"};
+    string_view client_ip = r.get_string();
+    string_view user_agent = r.get_string();
+    http_session::time_type created{http_session::time_type::duration{r.get<std::int64_t>()}};
+    http_session::time_type last_accessed{http_session::time_type::duration{r.get<std::int64_t>()}};
+    auto session = std::make_shared<http_session_impl>(id, client_ip, user_agent, created, last_accessed);
+    if (r.get<std::uint8_t>()) session->set_principal(new named_principal{r.get_string().to_string()});
+    std::uint32_t count = r.get<std::uint32_t>();
+    const session_attribute_codecs &codecs = session_attribute_codecs::instance();
+    for (std::uint32_t i = 0; i < count; ++i)
+    {
+        std::string name = r.get_string().to_string();
+        string_view type = r.get_string();
+        any value = codecs.decode(type, r.get_string());
+        /* Type unknown to this process, e.g. its web application is not deployed here */
+        if (!value.empty()) session->put_any(name, std::move(value));
+    }
+    return session;
+}
+
+} // end of servlet namespace
@@ -0,0 +1,38 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_SESSION_CODEC_H
+#define MOD_SERVLET_IMPL_SESSION_CODEC_H
+
+#include <memory>
+#include <string>
+#include <experimental/string_view>
+
+#include "session.h"
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+/*
+ * Binary form of sessions kept in the stores shared by several processes.
+ *
+ * Identifier, client, times, principal name and attributes of types
+ * registered in session_attribute_codecs are encoded. Attributes of other
+ * types cannot be restored in another process and are skipped. Numbers
+ * are stored in the byte order of the machine, so hosts sharing sessions
+ * must have the same one.
+ */
+std::string encode_session(const http_session_impl &session);
+
+/* Throws io_exception if the data is not a valid encoding */
+std::shared_ptr<http_session_impl> decode_session(string_view data);
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_SESSION_CODEC_H
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "session_snapshot.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <experimental/filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <servlet/lib/exception.h>
+
+#include "os.h"
+#include "session.h"
+#include "session_codec.h"
+
+namespace servlet
+{
+
+namespace fs = std::experimental::filesystem;
+
+static constexpr char SNAPSHOT_MAGIC[8] = {'M', 'S', 'S', 'N', 'A', 'P', '0', '1'};
+static constexpr char SNAPSHOT_EXT[] = ".snapshot";
+/* New snapshots of exiting processes are looked for not more often than this */
+static constexpr std::chrono::seconds SNAPSHOT_RESCAN_INTERVAL{1};
+
+/* Entries are 8 bytes aligned, followed by the ID and the encoded session */
+struct session_snapshot::_entry_header
+{
+    std::uint32_t taken; /* Set by the process which restored the session */
+    std::uint32_t id_length;
+    std::uint32_t data_size;
+    std::uint32_t reserved;
+    std::int64_t last_accessed; /* http_session::time_type ticks */
+    std::int64_t timeout; /* Seconds */
+
+    char *id() { return reinterpret_cast<char*>(this + 1); }
+    char *data() { return id() + id_length; }
+    std::size_t total_size() const { return (sizeof(*this) + id_length + data_size + 7) & ~std::size_t{7}; }
+
+    bool expired(http_session::time_type now) const
+    {
+        http_session::time_type accessed{http_session::time_type::duration{last_accessed}};
+        return now - accessed > std::chrono::seconds{timeout};
+    }
+};
+
+std::string session_snapshot_path(const std::string &dir)
+{
+    /* Random suffix chosen once per process keeps a process reusing the pid
+     * from replacing a snapshot which is not restored yet */
+    static const std::string name = []
+    {
+        std::uint64_t suffix;
+        system_random_bytes(reinterpret_cast<unsigned char*>(&suffix), sizeof(suffix));
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "/%d-%016llx", get_pid(), static_cast<unsigned long long>(suffix));
+        return std::string{buf};
+    }();
+    return dir + name + SNAPSHOT_EXT;
+}
+
+session_snapshot_writer::session_snapshot_writer(std::string path) :
+        _path{std::move(path)}, _tmp_path{_path + ".tmp"}
+{
+    /* Sessions are readable by the owner only whatever the umask is */
+    int fd = open(_tmp_path.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0) throw io_exception{"Failed to create session snapshot " + _tmp_path};
+    _file = fdopen(fd, "wb");
+    if (!_file)
+    {
+        close(fd);
+        std::remove(_tmp_path.c_str());
+        throw io_exception{"Failed to create session snapshot " + _tmp_path};
+    }
+    if (std::fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, _file) != 1)
+    {
+        std::fclose(_file);
+        std::remove(_tmp_path.c_str());
+        throw io_exception{"Failed to write session snapshot " + _tmp_path};
+    }
+}
+
+session_snapshot_writer::~session_snapshot_writer() noexcept
+{
+    if (!_file) return;
+    std::fclose(_file);
+    std::remove(_tmp_path.c_str());
+}
+
+void session_snapshot_writer::add(const http_session_impl &session, std::chrono::seconds timeout)
+{
+    std::string id = session.get_id();
+    std::string data = encode_session(session);
+    std::string entry(sizeof(session_snapshot::_entry_header), '\0');
+    auto *hdr = reinterpret_cast<session_snapshot::_entry_header*>(&entry[0]);
+    hdr->id_length = static_cast<std::uint32_t>(id.size());
+    hdr->data_size = static_cast<std::uint32_t>(data.size());
+    hdr->last_accessed = session.get_last_accessed_time().time_since_epoch().count();
+    hdr->timeout = timeout.count();
+    std::size_t total = hdr->total_size();
+    entry.append(id).append(data);
+    entry.resize(total, '\0');
+    if (std::fwrite(entry.data(), entry.size(), 1, _file) != 1)
+        throw io_exception{"Failed to write session snapshot " + _tmp_path};
+    ++_count;
+}
+
+void session_snapshot_writer::commit()
+{
+    int rc = std::fclose(_file);
+    _file = nullptr;
+    if (rc != 0 || std::rename(_tmp_path.c_str(), _path.c_str()) != 0)
+    {
+        std::remove(_tmp_path.c_str());
+        throw io_exception{"Failed to write session snapshot " + _path};
+    }
+}
+
+session_snapshot::session_snapshot(std::string dir, std::chrono::seconds max_age) :
+        _dir{std::move(dir)}, _max_age{max_age}
+{
+    _scan();
+}
+
+session_snapshot::~session_snapshot() noexcept
+{
+    for (auto &&m : _maps) munmap(m.second.first, m.second.second);
+}
+
+void session_snapshot::_scan()
+{
+    _last_scan = std::chrono::steady_clock::now();
+    std::error_code ec;
+    if (!fs::is_directory(_dir, ec)) return;
+    auto oldest = fs::file_time_type::clock::now() - _max_age;
+    for (auto &&entry : fs::directory_iterator{_dir, ec})
+    {
+        const fs::path &p = entry.path();
+        if (p.extension() != SNAPSHOT_EXT) continue;
+        std::string path = p.string();
+        if (std::any_of(_maps.begin(), _maps.end(), [&path](auto &&m) { return m.first == path; })) continue;
+        /* Every session in a snapshot this old has expired */
+        if (fs::last_write_time(p, ec) < oldest)
+        {
+            fs::remove(p, ec);
+            continue;
+        }
+        _map(path);
+    }
+}
+
+void session_snapshot::_map(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) return;
+    struct stat st;
+    void *base = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) > sizeof(SNAPSHOT_MAGIC))
+        base = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return;
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    _maps.emplace_back(path, std::make_pair(base, size));
+    char *data = static_cast<char*>(base);
+    if (std::memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) return;
+
+    http_session::time_type now = http_session::time_type::clock::now();
+    std::size_t pos = sizeof(SNAPSHOT_MAGIC);
+    while (pos + sizeof(_entry_header) <= size)
+    {
+        auto *hdr = reinterpret_cast<_entry_header*>(data + pos);
+        std::size_t total = hdr->total_size();
+        if (total > size - pos) break; /* Truncated */
+        pos += total;
+        if (__atomic_load_n(&hdr->taken, __ATOMIC_ACQUIRE) || hdr->expired(now)) continue;
+        string_view id{hdr->id(), hdr->id_length};
+        auto it = _index.find(id);
+        /* Session saved by several processes, the most recently used one is restored */
+        if (it == _index.end()) _index.emplace(id, hdr);
+        else if (it->second->last_accessed < hdr->last_accessed) it->second = hdr;
+    }
+}
+
+std::shared_ptr<http_session_impl> session_snapshot::take(const std::string &id)
+{
+    _entry_header *hdr;
+    {
+        std::lock_guard<std::mutex> lock{_mx};
+        if (std::chrono::steady_clock::now() - _last_scan > SNAPSHOT_RESCAN_INTERVAL) _scan();
+        auto it = _index.find(id);
+        if (it == _index.end()) return nullptr;
+        hdr = it->second;
+        _index.erase(it);
+    }
+    std::uint32_t expected = 0;
+    /* Other process might have restored it already */
+    if (!__atomic_compare_exchange_n(&hdr->taken, &expected, 1u, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return nullptr;
+    if (hdr->expired(http_session::time_type::clock::now())) return nullptr;
+    return decode_session(string_view{hdr->data(), hdr->data_size});
+}
+
+std::size_t session_snapshot::size() const
+{
+    std::lock_guard<std::mutex> lock{_mx};
+    return _index.size();
+}
+
+} // end of servlet namespace
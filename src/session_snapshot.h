@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_SESSION_SNAPSHOT_H
+#define MOD_SERVLET_IMPL_SESSION_SNAPSHOT_H
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <experimental/string_view>
+
+#include <servlet/session.h>
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+class http_session_impl;
+
+/*
+ * Writes sessions of a process to a snapshot file when the process exits.
+ *
+ * The file is written next to its final name and renamed on commit, so that
+ * readers never see a partially written snapshot.
+ */
+class session_snapshot_writer
+{
+public:
+    explicit session_snapshot_writer(std::string path);
+    session_snapshot_writer(const session_snapshot_writer&) = delete;
+    session_snapshot_writer& operator=(const session_snapshot_writer&) = delete;
+    ~session_snapshot_writer() noexcept;
+
+    void add(const http_session_impl &session, std::chrono::seconds timeout);
+    void commit();
+
+    std::size_t size() const { return _count; }
+
+private:
+    std::string _path;
+    std::string _tmp_path;
+    std::FILE *_file;
+    std::size_t _count = 0;
+};
+
+/*
+ * Snapshot files written by the processes which served the web application
+ * before, mapped into memory.
+ *
+ * Sessions are decoded one by one when they are requested. Files are mapped
+ * shared, and a restored session is marked in the file, so it is restored
+ * by one process only and an invalidated session doesn't come back. Files
+ * written later, by processes which exit while this one already runs,
+ * are picked up on lookups.
+ */
+class session_snapshot
+{
+public:
+    /* Snapshots older than max_age are removed */
+    session_snapshot(std::string dir, std::chrono::seconds max_age);
+    session_snapshot(const session_snapshot&) = delete;
+    session_snapshot& operator=(const session_snapshot&) = delete;
+    ~session_snapshot() noexcept;
+
+    /* Decodes the session with a given ID, empty if there is no such session or it has expired */
+    std::shared_ptr<http_session_impl> take(const std::string &id);
+
+    /* Number of sessions which can still be restored */
+    std::size_t size() const;
+
+private:
+    friend class session_snapshot_writer;
+    struct _entry_header;
+
+    void _scan();
+    void _map(const std::string &path);
+
+    std::string _dir;
+    std::chrono::seconds _max_age;
+    mutable std::mutex _mx;
+    std::chrono::steady_clock::time_point _last_scan;
+    std::vector<std::pair<std::string, std::pair<void*, std::size_t>>> _maps;
+    std::unordered_map<string_view, _entry_header*> _index;
+};
+
+/* File name of the snapshot of this process in a given directory */
+std::string session_snapshot_path(const std::string &dir);
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_SESSION_SNAPSHOT_H
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_SESSION_STORE_H
+#define MOD_SERVLET_IMPL_SESSION_STORE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <experimental/string_view>
+
+namespace servlet
+{
+
+using std::experimental::string_view;
+
+/*
+ * Store of encoded sessions shared by several processes or hosts.
+ *
+ * Sessions are identified by their ID and scope, the hash of the context path
+ * of their web application (see session_scope). Every write gives the session
+ * a new version, so that users of the store can keep decoded sessions and
+ * decode them again only when they have been changed by somebody else.
+ * Stores report failures with exceptions.
+ */
+class session_store
+{
+public:
+    virtual ~session_store() noexcept = default;
+
+    /*
+     * Looks up a not expired session and extends its life for timeout. The data
+     * is only copied if the stored version differs from the given one, which is
+     * updated then. Returns false if there is no such session.
+     */
+    virtual bool get(std::uint64_t scope, string_view id, std::chrono::seconds timeout,
+                     std::uint64_t &version, std::string &data) = 0;
+
+    /*
+     * Stores the session data for timeout. If create is true fails if a not expired
+     * session with the same ID exists. Returns the new version of the session or 0
+     * on failure.
+     */
+    virtual std::uint64_t put(std::uint64_t scope, string_view id, string_view data,
+                              std::chrono::seconds timeout, bool create) = 0;
+
+    /* Extends life of the session for timeout. Returns false if there is no such session */
+    virtual bool touch(std::uint64_t scope, string_view id, std::chrono::seconds timeout) = 0;
+
+    virtual bool contains(std::uint64_t scope, string_view id) = 0;
+    virtual bool erase(std::uint64_t scope, string_view id) = 0;
+
+    /* Frees space of expired sessions, if the store doesn't do it by itself. Returns their number. */
+    virtual std::size_t expire() { return 0; }
+};
+
+/* Hash of the web application context path used as the scope of its sessions */
+std::uint64_t session_scope(string_view context_path);
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_SESSION_STORE_H
@@ -0,0 +1,309 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include "shm_session_store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <new>
+#include <system_error>
+#include <pthread.h>
+
+#include <servlet/lib/exception.h>
+
+namespace servlet
+{
+
+static constexpr std::uint64_t SHM_STORE_MAGIC = 0x53455353494f4e31ull; /* "SESSION1" */
+/* Stripes are sized so that a lookup compares a handful of slot hashes */
+static constexpr std::size_t SLOTS_PER_STRIPE = 16;
+
+struct shm_session_store::_header
+{
+    std::uint64_t magic;
+    std::uint64_t size;
+    std::uint64_t slot_size;
+    std::uint32_t stripe_count;
+    std::uint32_t slots_per_stripe;
+    std::uint64_t stripes_offset;
+    std::uint64_t slots_offset;
+};
+
+struct alignas(64) shm_session_store::_stripe
+{
+    pthread_mutex_t mutex;
+    std::uint32_t index;
+};
+
+struct shm_session_store::_slot
+{
+    std::uint64_t hash;
+    std::uint64_t scope;
+    std::uint64_t version; /* Is never reset, so that a reused slot gets a new version */
+    clock_type::rep expires; /* 0 if the slot is free */
+    clock_type::rep accessed;
+    std::uint32_t size;
+    std::uint8_t id_length;
+    char id[MAX_ID_LENGTH + 1];
+
+    char *data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+class shm_session_store::_stripe_lock
+{
+public:
+    _stripe_lock(shm_session_store &store, _stripe &stripe) : _stripe_ref{stripe}
+    {
+        int rc = pthread_mutex_lock(&stripe.mutex);
+        if (rc == EOWNERDEAD)
+        {
+            /* A process died holding the lock, slots of the stripe may be half written */
+            store._clear(stripe);
+            pthread_mutex_consistent(&stripe.mutex);
+        }
+        else if (rc != 0) throw std::system_error{rc, std::system_category(), "Failed to lock session store"};
+    }
+    _stripe_lock(const _stripe_lock&) = delete;
+    _stripe_lock& operator=(const _stripe_lock&) = delete;
+    ~_stripe_lock() noexcept { pthread_mutex_unlock(&_stripe_ref.mutex); }
+private:
+    _stripe &_stripe_ref;
+};
+
+/* Access time of a slot is only written if it has changed by this much, hot sessions are mostly read */
+static constexpr std::chrono::seconds TOUCH_INTERVAL{1};
+
+static constexpr std::size_t _align(std::size_t size) { return (size + 63) & ~std::size_t{63}; }
+
+static std::uint64_t _hash(std::uint64_t scope, string_view id)
+{
+    std::uint64_t h = static_cast<std::uint64_t>(std::hash<string_view>{}(id));
+    return (h ^ scope) * 0x9E3779B97F4A7C15ull;
+}
+
+static shm_session_store::clock_type::rep _expiration(shm_session_store::clock_type::rep now, std::chrono::seconds timeout)
+{
+    typedef shm_session_store::clock_type::duration duration;
+    typedef shm_session_store::clock_type::rep rep;
+    /* Very long timeouts (0 in the configuration is no limit) are never reached */
+    if (timeout >= std::chrono::duration_cast<std::chrono::seconds>(duration::max()) / 2)
+        return std::numeric_limits<rep>::max();
+    return now + std::chrono::duration_cast<duration>(timeout).count();
+}
+
+void shm_session_store::format(void *base, std::size_t size, std::size_t slot_size)
+{
+    slot_size = _align(std::max(slot_size, sizeof(_slot) + 64));
+    std::size_t stripes_offset = _align(sizeof(_header));
+    std::size_t per_stripe = sizeof(_stripe) + SLOTS_PER_STRIPE * slot_size;
+    if (size < stripes_offset + per_stripe)
+        throw config_exception{"Shared memory of " + std::to_string(size) + " bytes is too small for sessions"};
+    std::size_t stripe_count = (size - stripes_offset) / per_stripe;
+    if (stripe_count > std::numeric_limits<std::uint32_t>::max()) stripe_count = std::numeric_limits<std::uint32_t>::max();
+
+    std::memset(base, 0, size);
+    _header *hdr = static_cast<_header*>(base);
+    hdr->size = size;
+    hdr->slot_size = slot_size;
+    hdr->stripe_count = static_cast<std::uint32_t>(stripe_count);
+    hdr->slots_per_stripe = SLOTS_PER_STRIPE;
+    hdr->stripes_offset = stripes_offset;
+    hdr->slots_offset = _align(stripes_offset + stripe_count * sizeof(_stripe));
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    _stripe *stripes = reinterpret_cast<_stripe*>(static_cast<char*>(base) + stripes_offset);
+    for (std::size_t i = 0; i < stripe_count; ++i)
+    {
+        new (&stripes[i]) _stripe{};
+        stripes[i].index = static_cast<std::uint32_t>(i);
+        int rc = pthread_mutex_init(&stripes[i].mutex, &attr);
+        if (rc != 0)
+        {
+            pthread_mutexattr_destroy(&attr);
+            throw std::system_error{rc, std::system_category(), "Failed to initialize session store lock"};
+        }
+    }
+    pthread_mutexattr_destroy(&attr);
+    hdr->magic = SHM_STORE_MAGIC;
+}
+
+shm_session_store::shm_session_store(void *base, std::size_t size) : _hdr{static_cast<_header*>(base)}
+{
+    if (size < sizeof(_header) || _hdr->magic != SHM_STORE_MAGIC || _hdr->size != size)
+        throw config_exception{"Shared memory is not formatted for sessions"};
+}
+
+std::size_t shm_session_store::slot_count() const
+{
+    return static_cast<std::size_t>(_hdr->stripe_count) * _hdr->slots_per_stripe;
+}
+
+std::size_t shm_session_store::max_data_size() const { return _hdr->slot_size - sizeof(_slot); }
+
+shm_session_store::_stripe &shm_session_store::_get_stripe(std::uint64_t hash) const
+{
+    _stripe *stripes = reinterpret_cast<_stripe*>(reinterpret_cast<char*>(_hdr) + _hdr->stripes_offset);
+    return stripes[(hash >> 32) % _hdr->stripe_count];
+}
+
+shm_session_store::_slot *shm_session_store::_slot_at(const _stripe &stripe, std::size_t i) const
+{
+    std::size_t index = static_cast<std::size_t>(stripe.index) * _hdr->slots_per_stripe + i;
+    return reinterpret_cast<_slot*>(reinterpret_cast<char*>(_hdr) + _hdr->slots_offset + index * _hdr->slot_size);
+}
+
+shm_session_store::_slot *shm_session_store::_find(const _stripe &stripe, std::uint64_t hash, std::uint64_t scope,
+                                                   string_view id, clock_type::rep now) const
+{
+    for (std::size_t i = 0; i < _hdr->slots_per_stripe; ++i)
+    {
+        _slot *slot = _slot_at(stripe, i);
+        if (slot->expires > now && slot->hash == hash && slot->scope == scope &&
+                string_view{slot->id, slot->id_length} == id)
+            return slot;
+    }
+    return nullptr;
+}
+
+void shm_session_store::_touch(_slot &slot, clock_type::rep now, std::chrono::seconds timeout)
+{
+    if (now - slot.accessed < std::chrono::duration_cast<clock_type::duration>(TOUCH_INTERVAL).count()) return;
+    slot.accessed = now;
+    slot.expires = _expiration(now, timeout);
+}
+
+void shm_session_store::_clear(_stripe &stripe)
+{
+    for (std::size_t i = 0; i < _hdr->slots_per_stripe; ++i) _slot_at(stripe, i)->expires = 0;
+}
+
+std::uint64_t shm_session_store::put(std::uint64_t scope, string_view id, string_view data,
+                                     std::chrono::seconds timeout, bool create)
+{
+    if (id.size() > MAX_ID_LENGTH) throw io_exception{"Session ID is too long for the shared session store"};
+    if (data.size() > max_data_size())
+        throw io_exception{"Session of " + std::to_string(data.size()) + " bytes doesn't fit shared memory slot of " +
+                           std::to_string(max_data_size()) + " bytes"};
+    std::uint64_t hash = _hash(scope, id);
+    _stripe &stripe = _get_stripe(hash);
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe_lock lock{*this, stripe};
+    _slot *slot = _find(stripe, hash, scope, id, now);
+    if (slot)
+    {
+        if (create) return 0;
+    }
+    else
+    {
+        /* Free or expired slot, otherwise the least recently used one */
+        for (std::size_t i = 0; i < _hdr->slots_per_stripe; ++i)
+        {
+            _slot *candidate = _slot_at(stripe, i);
+            if (candidate->expires <= now)
+            {
+                slot = candidate;
+                break;
+            }
+            if (!slot || candidate->accessed < slot->accessed) slot = candidate;
+        }
+        slot->hash = hash;
+        slot->scope = scope;
+        slot->id_length = static_cast<std::uint8_t>(id.size());
+        std::memcpy(slot->id, id.data(), id.size());
+    }
+    if (++slot->version == 0) slot->version = 1;
+    std::memcpy(slot->data(), data.data(), data.size());
+    slot->size = static_cast<std::uint32_t>(data.size());
+    slot->accessed = now;
+    slot->expires = _expiration(now, timeout);
+    return slot->version;
+}
+
+bool shm_session_store::get(std::uint64_t scope, string_view id, std::chrono::seconds timeout,
+                            std::uint64_t &version, std::string &data)
+{
+    if (id.size() > MAX_ID_LENGTH) return false;
+    std::uint64_t hash = _hash(scope, id);
+    _stripe &stripe = _get_stripe(hash);
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe_lock lock{*this, stripe};
+    _slot *slot = _find(stripe, hash, scope, id, now);
+    if (!slot) return false;
+    _touch(*slot, now, timeout);
+    if (slot->version != version)
+    {
+        data.assign(slot->data(), slot->size);
+        version = slot->version;
+    }
+    return true;
+}
+
+bool shm_session_store::touch(std::uint64_t scope, string_view id, std::chrono::seconds timeout)
+{
+    if (id.size() > MAX_ID_LENGTH) return false;
+    std::uint64_t hash = _hash(scope, id);
+    _stripe &stripe = _get_stripe(hash);
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe_lock lock{*this, stripe};
+    _slot *slot = _find(stripe, hash, scope, id, now);
+    if (!slot) return false;
+    _touch(*slot, now, timeout);
+    return true;
+}
+
+bool shm_session_store::contains(std::uint64_t scope, string_view id)
+{
+    if (id.size() > MAX_ID_LENGTH) return false;
+    std::uint64_t hash = _hash(scope, id);
+    _stripe &stripe = _get_stripe(hash);
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe_lock lock{*this, stripe};
+    return _find(stripe, hash, scope, id, now) != nullptr;
+}
+
+bool shm_session_store::erase(std::uint64_t scope, string_view id)
+{
+    if (id.size() > MAX_ID_LENGTH) return false;
+    std::uint64_t hash = _hash(scope, id);
+    _stripe &stripe = _get_stripe(hash);
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe_lock lock{*this, stripe};
+    _slot *slot = _find(stripe, hash, scope, id, now);
+    if (!slot) return false;
+    slot->expires = 0;
+    return true;
+}
+
+std::size_t shm_session_store::expire()
+{
+    /* Expired slots are free already, only their count is of interest */
+    std::size_t count = 0;
+    clock_type::rep now = clock_type::now().time_since_epoch().count();
+    _stripe *stripes = reinterpret_cast<_stripe*>(reinterpret_cast<char*>(_hdr) + _hdr->stripes_offset);
+    for (std::size_t i = 0; i < _hdr->stripe_count; ++i)
+    {
+        _stripe_lock lock{*this, stripes[i]};
+        for (std::size_t j = 0; j < _hdr->slots_per_stripe; ++j)
+        {
+            _slot *slot = _slot_at(stripes[i], j);
+            if (slot->expires != 0 && slot->expires <= now)
+            {
+                slot->expires = 0;
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+} // end of servlet namespace
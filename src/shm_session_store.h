@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_SHM_SESSION_STORE_H
+#define MOD_SERVLET_IMPL_SHM_SESSION_STORE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <experimental/string_view>
+
+#include "session_store.h"
+
+namespace servlet
+{
+
+/*
+ * Encoded sessions kept in memory shared by the child processes of the server.
+ *
+ * The memory is split into stripes of fixed size slots, each stripe guarded by
+ * a robust process shared mutex. A session lives in the stripe selected by the
+ * hash of its identifier and its scope (the web application it belongs to).
+ * Every slot has a version which changes on each write, so that processes
+ * can keep decoded sessions and only decode them again when they have been
+ * changed by somebody else.
+ *
+ * Expired slots are reused when space in the stripe is needed; if all slots of
+ * a stripe are alive the least recently used one is taken.
+ */
+class shm_session_store : public session_store
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    /* Longest session identifier which can be stored */
+    static constexpr std::size_t MAX_ID_LENGTH = 63;
+
+    /* Formats the memory. Must be done once, before the processes attach to it */
+    static void format(void *base, std::size_t size, std::size_t slot_size);
+
+    /* Attaches to the formatted memory. Throws config_exception if the memory is not formatted */
+    shm_session_store(void *base, std::size_t size);
+
+    /* Throws io_exception if the data does not fit in a slot */
+    std::uint64_t put(std::uint64_t scope, string_view id, string_view data,
+                      std::chrono::seconds timeout, bool create) override;
+    bool get(std::uint64_t scope, string_view id, std::chrono::seconds timeout,
+             std::uint64_t &version, std::string &data) override;
+    bool touch(std::uint64_t scope, string_view id, std::chrono::seconds timeout) override;
+    bool contains(std::uint64_t scope, string_view id) override;
+    bool erase(std::uint64_t scope, string_view id) override;
+    std::size_t expire() override;
+
+    std::size_t slot_count() const;
+    std::size_t max_data_size() const;
+
+private:
+    struct _header;
+    struct _stripe;
+    struct _slot;
+
+    class _stripe_lock;
+
+    _stripe &_get_stripe(std::uint64_t hash) const;
+    _slot *_slot_at(const _stripe &stripe, std::size_t i) const;
+    _slot *_find(const _stripe &stripe, std::uint64_t hash, std::uint64_t scope, string_view id,
+                 clock_type::rep now) const;
+    static void _touch(_slot &slot, clock_type::rep now, std::chrono::seconds timeout);
+    void _clear(_stripe &stripe);
+
+    _header *_hdr;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_SHM_SESSION_STORE_H
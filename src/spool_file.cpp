@@ -0,0 +1,86 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <servlet/lib/exception.h>
+
+#include "spool_file.h"
+#include "os.h"
+
+namespace servlet
+{
+
+std::string __errno_message(const char* msg, const std::string& path)
+{
+    return std::string{msg}.append(" ").append(path).append(": ").append(std::strerror(errno));
+}
+
+_spool_file::~_spool_file() noexcept
+{
+    if (_mapped) ::munmap(_mapped, _mapped_size);
+    if (_fd < 0) return;
+    ::close(_fd);
+    ::unlink(_path.data());
+}
+
+void _spool_file::open(const std::string& dir, std::size_t size_hint, const char* prefix)
+{
+    std::error_code ec;
+    std::experimental::filesystem::create_directories(dir, ec);
+    _path = dir;
+    if (_path.empty() || _path.back() != '/') _path.push_back('/');
+    _path.append(prefix).append("XXXXXX");
+    _fd = ::mkstemp(&_path[0]);
+    if (_fd < 0) throw io_exception{__errno_message("Failed to create temporary file in", dir)};
+    if (size_hint > 0) preallocate_file(_fd, size_hint);
+}
+
+void _spool_file::write(const char* buf, std::size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = ::write(_fd, buf, len);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            throw io_exception{__errno_message("Failed to write to", _path)};
+        }
+        buf += written;
+        len -= static_cast<std::size_t>(written);
+    }
+}
+
+std::string _spool_file::release(std::size_t size)
+{
+    if (::ftruncate(_fd, static_cast<off_t>(size)) != 0 || ::close(_fd) != 0)
+    {
+        throw io_exception{__errno_message("Failed to write to", _path)};
+    }
+    _fd = -1;
+    return std::move(_path);
+}
+
+const char* _spool_file::map(std::size_t size)
+{
+    if (size == 0) return "";
+    if (_mapped) return static_cast<const char*>(_mapped);
+    void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, _fd, 0);
+    if (mapped == MAP_FAILED) throw io_exception{__errno_message("Failed to map", _path)};
+    _mapped = mapped;
+    _mapped_size = size;
+    return static_cast<const char*>(_mapped);
+}
+
+} // end of servlet namespace
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_SPOOL_FILE_H
+#define MOD_SERVLET_IMPL_SPOOL_FILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace servlet
+{
+
+/* Message of io_exception for the failed system call with errno description */
+std::string __errno_message(const char* msg, const std::string& path);
+
+/**
+ * Temporary file which is removed unless it is released.
+ *
+ * <p>Used to store request data which is too big to be kept in
+ * memory: multipart parts and replayable request bodies.</p>
+ */
+class _spool_file
+{
+public:
+    _spool_file() = default;
+    _spool_file(const _spool_file&) = delete;
+    _spool_file& operator=(const _spool_file&) = delete;
+    ~_spool_file() noexcept;
+
+    bool is_open() const { return _fd >= 0; }
+
+    /**
+     * Creates new file in the directory (the directory is created if needed).
+     * @param dir Directory for the file.
+     * @param size_hint Expected size of the file, space is preallocated for it.
+     * @param prefix Prefix of the file name.
+     */
+    void open(const std::string& dir, std::size_t size_hint, const char* prefix = "upload_");
+
+    void write(const char* buf, std::size_t len);
+
+    /* Cuts off preallocated space, closes the file and gives up its ownership */
+    std::string release(std::size_t size);
+
+    /**
+     * Maps the first <code>size</code> bytes of the file to memory for reading.
+     *
+     * <p>The mapping is valid until the file is destroyed, the file is
+     * still removed on destruction.</p>
+     * @param size Size of the written data
+     * @return Pointer to the mapped data
+     */
+    const char* map(std::size_t size);
+
+private:
+    int _fd = -1;
+    std::string _path;
+    void *_mapped = nullptr;
+    std::size_t _mapped_size = 0;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_SPOOL_FILE_H
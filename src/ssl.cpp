@@ -5,70 +5,195 @@ https://github.com/novalexei
 Distributed under the Boost Software License, Version 1.0.
 http://boost.org/LICENSE_1_0.txt
 */
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
 #include "ssl.h"
 #include "config.h"
-#include "time.h"
+#include "string.h"
 
 namespace servlet
 {
 
-static inline certificate::time_type _parse_time(string_view time_str)
+/* Days since 1970-01-01 of the proleptic Gregorian date */
+static long _days_from_civil(long y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<long>(doe) - 719468;
+}
+
+/* mod_ssl formats certificate dates as "Mar  4 12:00:00 2020 GMT".
+ * The time is UTC, so it is converted directly, without going through
+ * local time with mktime. */
+static certificate::time_type _parse_time(const char *time_str)
+{
+    static const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    while (*time_str == ' ') ++time_str;
+    if (std::strlen(time_str) < 3) return certificate::time_type{};
+    unsigned month = 0;
+    while (month < 12 && std::strncmp(MONTHS + month * 3, time_str, 3) != 0) ++month;
+    unsigned day, hour, min, sec;
+    long year;
+    if (month == 12 || std::sscanf(time_str + 3, "%u %u:%u:%u %ld", &day, &hour, &min, &sec, &year) != 5)
+    {
+        return certificate::time_type{};
+    }
+    long epoch = _days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + min * 60 + sec;
+    return std::chrono::system_clock::from_time_t(static_cast<std::time_t>(epoch));
+}
+
+certificate_impl::certificate_impl(const apr_table_t *env, string_view prefix) : _prefix{prefix}
 {
-    std::tm t;
-    string_view_istream in{time_str};
-    in.imbue(std::locale::classic());
-    in >> std::get_time(&t, "%b %d %H:%M:%S %Y");
-    std::time_t epoch = std::mktime(&t); /* This epoch time is local, we need to convert it to GMT */
+    apr_table_do(&certificate_impl::_collect, this, env, NULL);
+}
 
-    t = get_gmtm(epoch);
-    auto gm_diff = std::mktime(&t) - epoch;
-    epoch -= gm_diff;
+int certificate_impl::_collect(void *data, const char *key, const char *value)
+{
+    certificate_impl *cert = static_cast<certificate_impl*>(data);
+    string_view name{key};
+    if (!value || !begins_with(name, cert->_prefix)) return 1;
+    cert->_set(name.substr(cert->_prefix.length()), value);
+    return 1;
+}
 
-    return std::chrono::system_clock::from_time_t(epoch);
+string_view certificate_impl::_own(string_view str)
+{
+    _strings.emplace_back(str.data(), str.size());
+    return _strings.back();
 }
 
-certificate_impl::certificate_impl(const std::map<string_view, string_view, std::less<>>& env, string_view prefix)
+void certificate_impl::_set(string_view suffix, const char *value)
 {
     auto lg = servlet_logger();
-    for (auto &&item : env)
-    {
-        if (!begins_with(item.first, prefix)) continue;
-        lg->config() << "certificate property: " << item.first << " -> " << item.second << '\n';
-        string_view suffix = item.first.substr(prefix.length());
-        if (suffix == "M_VERSION") item.second >> _version;
-        else if (suffix == "M_SERIAL") _serial = item.second;
-        else if (suffix == "A_SIG") _sig_alg = item.second;
-        else if (suffix == "A_KEY") _key_alg = item.second;
-        else if (suffix == "S_DN") _s_DN = item.second;
-        else if (suffix == "I_DN") _i_DN = item.second;
-        else if (begins_with(suffix, "S_DN_")) _s_DN_n.emplace(suffix.substr(5), item.second);
-        else if (begins_with(suffix, "I_DN_")) _i_DN_n.emplace(suffix.substr(5), item.second);
-        else if (begins_with(suffix, "CERT_CHAIN_")) _chain.push_back(item.second);
-        else if (suffix == "CERT") _cert = item.second;
-        else if (suffix == "CERT_RFC4523_CEA") _cea = item.second;
-            /* It seams that mod_ssl populates date fields with strings in format "%b" */
-        else if (suffix == "V_START") _valid_since = _parse_time(item.second);
-        else if (suffix == "V_END") _valid_until = _parse_time(item.second);
-    }
+    if (lg->is_loggable(logging::LEVEL::CONFIG))
+        lg->config() << "certificate property: " << _prefix << suffix << " -> " << value << '\n';
+    if (suffix == "M_VERSION") _version = from_string<int>(value, 0);
+    else if (suffix == "M_SERIAL") _serial = _own(value);
+    else if (suffix == "A_SIG") _sig_alg = _own(value);
+    else if (suffix == "A_KEY") _key_alg = _own(value);
+    else if (suffix == "S_DN") _s_DN = _own(value);
+    else if (suffix == "I_DN") _i_DN = _own(value);
+    else if (begins_with(suffix, "S_DN_")) _s_DN_n.emplace(_own(suffix.substr(5)), _own(value));
+    else if (begins_with(suffix, "I_DN_")) _i_DN_n.emplace(_own(suffix.substr(5)), _own(value));
+    else if (begins_with(suffix, "CERT_CHAIN_")) _chain.push_back(_own(value));
+    else if (suffix == "CERT") _cert = _own(value);
+    else if (suffix == "CERT_RFC4523_CEA") _cea = _own(value);
+    /* It seams that mod_ssl populates date fields with strings in format "%b" */
+    else if (suffix == "V_START") _valid_since = _parse_time(value);
+    else if (suffix == "V_END") _valid_until = _parse_time(value);
+}
+
+certificate_cache& certificate_cache::instance()
+{
+    static certificate_cache CACHE;
+    return CACHE;
+}
+
+/* Looks up "<prefix><suffix>" environment variable without allocation */
+static const char* _get_env(const apr_table_t *env, string_view prefix, const char *suffix)
+{
+    char name[64];
+    std::size_t suffix_len = std::strlen(suffix);
+    if (prefix.size() + suffix_len >= sizeof(name)) return nullptr;
+    std::memcpy(name, prefix.data(), prefix.size());
+    std::memcpy(name + prefix.size(), suffix, suffix_len + 1);
+    return apr_table_get(env, name);
 }
 
-SSL_info::SSL_info(const std::map<string_view, string_view, std::less<>> &env) :
-        _client_cert{env, "SSL_CLIENT_"}, _server_cert{env, "SSL_SERVER_"}
+std::shared_ptr<const certificate_impl> certificate_cache::get(const apr_table_t *env, string_view prefix)
 {
-    for (auto &&item : env)
+    /* Only the whole PEM identifies the certificate exactly. Serial number and
+     * issuer DN can be forged to match a cached certificate, so without PEM
+     * the certificate is parsed for this request only */
+    const char *pem = _get_env(env, prefix, "CERT");
+    if (!pem)
     {
-        if (item.first == "SSL_PROTOCOL") _protocol = item.second;
-        else if (item.first == "SSL_CIPHER") _cipher = item.second;
-        else if (item.first == "SSL_CIPHER_EXPORT") _cipher_export = equal_ic(item.second, "true");
-        else if (item.first == "SSL_CIPHER_USEKEYSIZE") string_view_istream{item.second} >> _cipher_used_bits;
-        else if (item.first == "SSL_CIPHER_ALGKEYSIZE") string_view_istream{item.second} >> _cipher_possible_bits;
-        else if (item.first == "SSL_COMPRESS_METHOD") _compress_method = item.second;
-        else if (item.first == "SSL_SESSION_ID") _session_id = item.second;
-        else if (item.first == "SSL_SESSION_RESUMED")
+        if (!_get_env(env, prefix, "M_SERIAL")) return nullptr;
+        return std::make_shared<const certificate_impl>(env, prefix);
+    }
+    string_view key{pem};
+    std::size_t hash = std::hash<string_view>{}(key);
+    shard &sh = _shards[hash % SHARDS];
+    {
+        std::shared_lock<std::shared_mutex> lock{sh.mutex};
+        auto range = sh.map.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
         {
-            _session_state = equal_ic(item.second, "Resumed") ? SSL_SESSION_STATE::RESUMED : SSL_SESSION_STATE::INITIAL;
+            if (it->second.key == key) return it->second.cert;
         }
     }
+    /* Parsed outside of the lock: two threads can parse the same certificate, only one is kept */
+    std::shared_ptr<const certificate_impl> cert{new certificate_impl{env, prefix}};
+    std::lock_guard<std::shared_mutex> lock{sh.mutex};
+    auto range = sh.map.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second.key == key) return it->second.cert;
+    }
+    /* Certificates seen before are expected to come again; when the shard
+     * is full an arbitrary one is dropped to make room */
+    if (sh.map.size() >= _shard_capacity) sh.map.erase(sh.map.begin());
+    sh.map.emplace(hash, entry{std::string{key.data(), key.size()}, cert});
+    return cert;
+}
+
+std::size_t certificate_cache::size() const
+{
+    std::size_t size = 0;
+    for (auto &&sh : _shards)
+    {
+        std::shared_lock<std::shared_mutex> lock{sh.mutex};
+        size += sh.map.size();
+    }
+    return size;
+}
+
+void certificate_cache::clear()
+{
+    for (auto &&sh : _shards)
+    {
+        std::lock_guard<std::shared_mutex> lock{sh.mutex};
+        sh.map.clear();
+    }
+}
+
+bool SSL_info::is_cipher_export() const
+{
+    return equal_ic(_get("SSL_CIPHER_EXPORT"), "true");
+}
+
+int SSL_info::cipher_used_bits() const
+{
+    return from_string<int>(_get("SSL_CIPHER_USEKEYSIZE"), 0);
+}
+
+int SSL_info::cipher_possible_bits() const
+{
+    return from_string<int>(_get("SSL_CIPHER_ALGKEYSIZE"), 0);
+}
+
+SSL_SESSION_STATE SSL_info::session_state() const
+{
+    return equal_ic(_get("SSL_SESSION_RESUMED"), "Resumed") ? SSL_SESSION_STATE::RESUMED : SSL_SESSION_STATE::INITIAL;
+}
+
+static const certificate_impl EMPTY_CERTIFICATE{};
+
+const certificate& SSL_info::client_certificate() const
+{
+    if (!_client_cert) _client_cert = _cache.get(_env, "SSL_CLIENT_");
+    return _client_cert ? *_client_cert : EMPTY_CERTIFICATE;
+}
+
+const certificate& SSL_info::server_certificate() const
+{
+    if (!_server_cert) _server_cert = _cache.get(_env, "SSL_SERVER_");
+    return _server_cert ? *_server_cert : EMPTY_CERTIFICATE;
 }
 
 } // end of servlet namespace
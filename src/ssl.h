@@ -8,15 +8,39 @@ http://boost.org/LICENSE_1_0.txt
 #ifndef MOD_SERVLET_IMPL_SSL_H
 #define MOD_SERVLET_IMPL_SSL_H
 
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
 #include <servlet/ssl.h>
 
+#include <apr_tables.h>
+
 namespace servlet
 {
 
+/**
+ * Certificate built from mod_ssl environment variables.
+ *
+ * <p>All the strings are owned by the certificate, so it doesn't
+ * depend on the request it was created for and can be cached.</p>
+ */
 class certificate_impl : public certificate
 {
 public:
-    certificate_impl(const std::map<string_view, string_view, std::less<>>& env, string_view prefix);
+    /* Empty certificate: no certificate information available */
+    certificate_impl() = default;
+    /**
+     * Collects the certificate from the environment variables which start
+     * with the prefix (<code>SSL_CLIENT_</code> or <code>SSL_SERVER_</code>).
+     */
+    certificate_impl(const apr_table_t *env, string_view prefix);
+
+    certificate_impl(const certificate_impl&) = delete;
+    certificate_impl& operator=(const certificate_impl&) = delete;
 
     int version() const override { return _version; }
     string_view serial_number() const override { return _serial; }
@@ -38,7 +62,18 @@ public:
     const std::vector<string_view>& certificate_chain() const override { return _chain; }
 
     string_view PEM_encoded() const override { return _cert; }
+
 private:
+    /* apr_table_do callback collecting the environment variables */
+    static int _collect(void *data, const char *key, const char *value);
+    void _set(string_view suffix, const char *value);
+    string_view _own(string_view str);
+
+    string_view _prefix;
+
+    /* Storage for all the strings of this certificate, deque doesn't move them on growth */
+    std::deque<std::string> _strings;
+
     int _version = 0;
     string_view _serial;
     time_type _valid_since;
@@ -56,34 +91,86 @@ private:
     std::vector<string_view> _chain;
 };
 
+/**
+ * Process wide cache of parsed certificates.
+ *
+ * <p>The same client certificates come with request after request, so
+ * they are parsed only once. Certificates are identified by their PEM
+ * encoding if mod_ssl exports it (<code>SSLOptions +ExportCertData</code>),
+ * otherwise by serial number and issuer. A lookup hashes the key, takes
+ * a shared lock on one of the shards and compares the key with the
+ * cached one; nothing is allocated.</p>
+ */
+class certificate_cache
+{
+public:
+    static constexpr std::size_t SHARDS = 16;
+    static constexpr std::size_t DEFAULT_CAPACITY = 1024;
+
+    explicit certificate_cache(std::size_t capacity = DEFAULT_CAPACITY) :
+            _shard_capacity{capacity / SHARDS > 0 ? capacity / SHARDS : 1} {}
+
+    /**
+     * Finds or creates the certificate described by the environment.
+     * @param env Environment variables of the request.
+     * @param prefix <code>SSL_CLIENT_</code> or <code>SSL_SERVER_</code>.
+     * @return The certificate or <code>nullptr</code> if the environment
+     *         has no such certificate.
+     */
+    std::shared_ptr<const certificate_impl> get(const apr_table_t *env, string_view prefix);
+
+    std::size_t size() const;
+    void clear();
+
+    static certificate_cache& instance();
+
+private:
+    struct entry
+    {
+        std::string key;
+        std::shared_ptr<const certificate_impl> cert;
+    };
+    struct shard
+    {
+        mutable std::shared_mutex mutex;
+        std::unordered_multimap<std::size_t, entry> map;
+    };
+
+    std::size_t _shard_capacity;
+    shard _shards[SHARDS];
+};
+
+/**
+ * SSL information looked up in the request environment on demand.
+ */
 class SSL_info : public SSL_information
 {
 public:
-    SSL_info(const std::map<string_view, string_view, std::less<>>& env);
-
-    string_view protocol() const override { return _protocol; }
-    string_view cipher_name() const override { return _cipher; }
-    bool is_cipher_export() const override { return _cipher_export; }
-    int cipher_used_bits() const override { return _cipher_used_bits; }
-    int cipher_possible_bits() const override { return _cipher_possible_bits; }
-    string_view compress_method() const override { return _compress_method; }
-    string_view session_id() const override { return _session_id; }
-    SSL_SESSION_STATE session_state() const override { return _session_state; }
-
-    const certificate& client_certificate() const override { return _client_cert; }
-    const certificate& server_certificate() const override { return _server_cert; }
+    explicit SSL_info(const apr_table_t *env, certificate_cache &cache = certificate_cache::instance()) :
+            _env{env}, _cache{cache} {}
+
+    string_view protocol() const override { return _get("SSL_PROTOCOL"); }
+    string_view cipher_name() const override { return _get("SSL_CIPHER"); }
+    bool is_cipher_export() const override;
+    int cipher_used_bits() const override;
+    int cipher_possible_bits() const override;
+    string_view compress_method() const override { return _get("SSL_COMPRESS_METHOD"); }
+    string_view session_id() const override { return _get("SSL_SESSION_ID"); }
+    SSL_SESSION_STATE session_state() const override;
+
+    const certificate& client_certificate() const override;
+    const certificate& server_certificate() const override;
 private:
-    string_view _protocol;
-    string_view _cipher;
-    bool _cipher_export;
-    int _cipher_used_bits;
-    int _cipher_possible_bits;
-    string_view _compress_method;
-    string_view _session_id;
-    SSL_SESSION_STATE _session_state = SSL_SESSION_STATE::INITIAL;
-
-    certificate_impl _client_cert;
-    certificate_impl _server_cert;
+    string_view _get(const char *name) const
+    {
+        const char *value = apr_table_get(_env, name);
+        return value ? string_view{value} : string_view{};
+    }
+
+    const apr_table_t *_env;
+    certificate_cache &_cache;
+    mutable std::shared_ptr<const certificate_impl> _client_cert;
+    mutable std::shared_ptr<const certificate_impl> _server_cert;
 };
 
 } // end of servlet namespace
@@ -8,6 +8,9 @@ http://boost.org/LICENSE_1_0.txt
 #include <servlet/uri.h>
 #include "string.h"
 
+#include <cstring>
+#include <memory>
+
 namespace servlet
 {
 
@@ -148,37 +151,23 @@ void URI::_initialize(string_view scheme, string_view user_info, string_view hos
     }
 }
 
+/* Empty parts are moved too, so that they keep pointing to their insertion points */
+static inline URI::string_view _move_part(URI::string_view part, URI::string_view from, URI::string_view to)
+{
+    if (part.data() < from.data() || part.data() > from.data()+from.length()) return URI::string_view{to.data(), 0};
+    return to.substr(part.data()-from.data(), part.length());
+}
+
 void URI::_move_parts(const URI& other)
 {
-    if (!other._scheme.empty())
-    {
-        _scheme = _uri_view.substr(other._scheme.begin()-other._uri_view.begin(), other._scheme.length());
-    }
-    if (!other._user_info.empty())
-    {
-        _user_info = _uri_view.substr(other._user_info.begin()-other._uri_view.begin(), other._user_info.length());
-    }
-    if (!other._host.empty())
-    {
-        _host = _uri_view.substr(other._host.begin()-other._uri_view.begin(), other._host.length());
-    }
-    if (!other._port.empty())
-    {
-        _port = _uri_view.substr(other._port.begin()-other._uri_view.begin(), other._port.length());
-    }
+    _scheme = _move_part(other._scheme, other._uri_view, _uri_view);
+    _user_info = _move_part(other._user_info, other._uri_view, _uri_view);
+    _host = _move_part(other._host, other._uri_view, _uri_view);
+    _port = _move_part(other._port, other._uri_view, _uri_view);
     _port_i = other._port_i;
-    if (!other._path.empty())
-    {
-        _path = _uri_view.substr(other._path.begin()-other._uri_view.begin(), other._path.length());
-    }
-    if (!other._query.empty())
-    {
-        _query = _uri_view.substr(other._query.begin()-other._uri_view.begin(), other._query.length());
-    }
-    if (!other._fragment.empty())
-    {
-        _fragment = _uri_view.substr(other._fragment.begin()-other._uri_view.begin(), other._fragment.length());
-    }
+    _path = _move_part(other._path, other._uri_view, _uri_view);
+    _query = _move_part(other._query, other._uri_view, _uri_view);
+    _fragment = _move_part(other._fragment, other._uri_view, _uri_view);
 }
 
 URI &URI::operator=(const URI& other)
@@ -260,7 +249,8 @@ URI::string_view URI::authority() const noexcept
 void _resize_part(std::size_t offset, URI::string_view& part, const URI::string_view& from_uri_view,
                   const URI::string_view& to_uri_view, int_fast16_t resize_bytes)
 {
-    if (part.empty()) return;
+    /* Undefined parts are left alone, empty ones are moved with their insertion points */
+    if (part.data() < from_uri_view.data() || part.data() > from_uri_view.data() + from_uri_view.length()) return;
     std::size_t start_pos = part.begin() - from_uri_view.begin();
     URI::string_view::size_type length = part.length();
     if (start_pos > offset) part = URI::string_view{to_uri_view.data()+start_pos+resize_bytes, length};
@@ -528,91 +518,82 @@ void URI::set_fragment(string_view fragment)
     _uri_view = new_uri_view;
 }
 
-static bool _tokenize_path(URI::string_view path, std::vector<URI::string_view>& tokens)
+/* Removes "." and ".." segments from the path in a single pass (RFC 3986 5.2.4).
+ * Path can only get shorter, so it is rewritten in place. ".." segments which can't be removed
+ * are kept in relative paths and dropped in absolute ones. Returns new length of the path. */
+static std::size_t _remove_dot_segments(char* path, std::size_t length)
 {
-    tokenizer t{path, "/"};
-    bool has_removable_tokens = false;
-    for (const auto &&token : t)
+    const char *in = path;
+    const char *const last = path + length;
+    char *out = path;
+    bool absolute = length > 0 && *path == '/';
+    if (absolute)
     {
-        tokens.push_back(token);
-        if (!has_removable_tokens && (token == "." || token == "..")) has_removable_tokens = true;
+        ++in;
+        ++out;
     }
-    if (!has_removable_tokens) return false;
-    for (int ind = 0; ind < tokens.size(); ++ind)
+    /* Output before this point can't be removed: leading slash or leading ".." segments */
+    char *floor = out;
+    while (in != last)
     {
-        if (tokens[ind] == ".") tokens[ind] = string_view{};
-        else if (tokens[ind] == "..")
+        const char *segment_end = static_cast<const char*>(std::memchr(in, '/', last-in));
+        if (!segment_end) segment_end = last;
+        std::size_t segment_length = segment_end - in;
+        /* Segment is copied together with the slash following it */
+        std::size_t copy_length = segment_end == last ? segment_length : segment_length + 1;
+        bool is_dot_dot = segment_length == 2 && in[0] == '.' && in[1] == '.';
+        if (is_dot_dot && out != floor)
         {
-            int back_ind = ind-1;
-            while (back_ind >= 0)
-            {
-                if (!tokens[back_ind].empty())
-                {
-                    if (tokens[back_ind] != "..") tokens[ind] = string_view{};
-                    break;
-                }
-                --back_ind;
-            }
-            tokens[back_ind] = string_view{};
+            /* Output ends with slash here, remove the last segment before it */
+            --out;
+            while (out != floor && out[-1] != '/') --out;
         }
+        else if (is_dot_dot ? !absolute : segment_length != 1 || in[0] != '.')
+        {
+            if (out != in) std::memmove(out, in, copy_length);
+            out += copy_length;
+            if (is_dot_dot) floor = out;
+        }
+        in += copy_length;
     }
-    return true;
+    return out - path;
 }
 
-static std::unique_ptr<std::string> _normalize_path(URI::string_view path)
+/* Keeps path on the stack unless it is too long */
+struct path_buffer
 {
-    std::vector<string_view> path_tokens;
-    if (!_tokenize_path(path, path_tokens)) return {};
-    bool front_slash = path.front() == '/';
-    bool end_slash = path.back() == '/';
-    std::unique_ptr<std::string> tmp_path{new std::string{}};
-    for (auto &&token : path_tokens)
+    static constexpr std::size_t STACK_SIZE = 1024;
+
+    char* reserve(std::size_t size)
     {
-        if (!token.empty())
-        {
-            if (front_slash) tmp_path->append(1, '/');
-            tmp_path->append(token.data(), token.length());
-            front_slash = true;
-        }
+        if (size <= STACK_SIZE) return _stack;
+        _heap.reset(new char[size]);
+        return _heap.get();
     }
-    if (end_slash) tmp_path->append(1, '/');
-    return tmp_path;
+
+private:
+    char _stack[STACK_SIZE];
+    std::unique_ptr<char[]> _heap;
+};
+
+/* Copies path into the buffer and removes dot segments from the copy */
+static URI::string_view _normalized_copy(URI::string_view path, path_buffer& buffer)
+{
+    if (path.empty()) return path;
+    char *buf = buffer.reserve(path.length());
+    std::memcpy(buf, path.data(), path.length());
+    return URI::string_view{buf, _remove_dot_segments(buf, path.length())};
 }
 
 void URI::normalize_path()
 {
-    std::vector<string_view> path_tokens;
-    if (!_tokenize_path(_path, path_tokens)) return;
-    bool end_slash = _path.back() == '/';
-    bool did_skip = false;
-    std::size_t current_pos = _path.begin() - _uri_view.begin();
-    std::size_t new_size = current_pos;
-    for (auto &&token : path_tokens)
-    {
-        if (!token.empty())
-        {
-            if (!did_skip) current_pos += token.length()+1;
-            else
-            {
-                _uri[current_pos] = '/';
-                ++current_pos;
-                /* We use std::copy instead of std::string::replace because the ranges can overlap and replace
-                 * doesn't regulate this situation and might not work correctly with all the std lib implementations */
-                std::copy(token.begin(), token.end(), _uri.begin()+current_pos);
-                current_pos += token.length();
-            }
-        }
-        else did_skip = true;
-    }
-    if (end_slash)
-    {
-        _uri[current_pos] = '/';
-        ++current_pos;
-    }
+    if (_path.empty()) return;
+    std::size_t offset = _path.begin() - _uri_view.begin();
     /* After path normalization string can only get shorter, thus no allocation and copying possible */
-    new_size = current_pos - new_size;
-    _uri.erase(_path.begin()-_uri_view.begin()+new_size, _path.length() - new_size);
-    _resize_parts(_path.begin()-_uri_view.begin(), new_size-_path.length());
+    std::size_t new_length = _remove_dot_segments(&_uri[offset], _path.length());
+    if (new_length == _path.length()) return;
+    _uri.erase(offset + new_length, _path.length() - new_length);
+    _resize_parts(offset, new_length - _path.length());
 }
 
 void URI::normalize()
@@ -648,50 +629,56 @@ URI URI::create_with_normalized_path() const
     return uri;
 }
 
-static std::string _relativize_path(URI::string_view base, URI::string_view relative)
+/* Returns the next non-empty segment of the path and moves the path past it */
+static URI::string_view _next_segment(URI::string_view& path)
+{
+    while (!path.empty() && path.front() == '/') path.remove_prefix(1);
+    URI::string_view segment = path.substr(0, path.find('/'));
+    path.remove_prefix(segment.length());
+    return segment;
+}
+
+/* Writes relative path into buf which should fit 2*base.length()+relative.length()+3 chars
+ * Both paths are expected to be normalized. Returns the length of the relative path */
+static std::size_t _relativize_path(URI::string_view base, URI::string_view relative, char* buf)
 {
-    std::vector<string_view> base_tokens;
-    std::vector<string_view> relative_tokens;
-    _tokenize_path(base, base_tokens);
-    _tokenize_path(relative, relative_tokens);
+    bool base_end_slash = !base.empty() && base.back() == '/';
+    bool relative_end_slash = !relative.empty() && relative.back() == '/';
     std::size_t up_levels = 0;
-    auto base_it = base_tokens.begin();
-    auto relative_it = relative_tokens.begin();
-    while (true)
-    {
-        while (base_it != base_tokens.end() && (*base_it).empty()) ++base_it;
-        while (relative_it != relative_tokens.end() && (*relative_it).empty()) ++relative_it;
-        if (base_it == base_tokens.end()) break;
-        else if (relative_it == relative_tokens.end() || *base_it != *relative_it)
+    URI::string_view base_segment = _next_segment(base);
+    URI::string_view relative_segment = _next_segment(relative);
+    while (!base_segment.empty())
+    {
+        if (relative_segment.empty() || base_segment != relative_segment)
         {
-            do { if (!(*base_it).empty()) ++up_levels; ++base_it; } while (base_it != base_tokens.end());
+            do { ++up_levels; base_segment = _next_segment(base); } while (!base_segment.empty());
             break;
         }
-        ++base_it; ++relative_it;
+        base_segment = _next_segment(base);
+        relative_segment = _next_segment(relative);
     }
-    if (up_levels > 0 && base.back() != '/') --up_levels;
-    std::string res;
+    if (up_levels > 0 && !base_end_slash) --up_levels;
+    char *out = buf;
     bool set_slash = up_levels > 0;
     while (up_levels > 0)
     {
-        res.append(2, '.');
+        *out++ = '.';
+        *out++ = '.';
         --up_levels;
-        if (up_levels > 0) res.append(1, '/');
+        if (up_levels > 0) *out++ = '/';
     }
-    if (relative_it == relative_tokens.end()) return res;
+    if (relative_segment.empty()) return out - buf;
     do
     {
-        if (!(*relative_it).empty())
-        {
-            if (set_slash) res.append(1, '/');
-            res.append((*relative_it).data(), (*relative_it).length());
-            set_slash = true;
-        }
-        ++relative_it;
+        if (set_slash) *out++ = '/';
+        std::memcpy(out, relative_segment.data(), relative_segment.length());
+        out += relative_segment.length();
+        set_slash = true;
+        relative_segment = _next_segment(relative);
     }
-    while (relative_it != relative_tokens.end());
-    if (relative.back() == '/') res.append(1, '/');
-    return res;
+    while (!relative_segment.empty());
+    if (relative_end_slash) *out++ = '/';
+    return out - buf;
 }
 
 URI URI::relativize(const URI &other) const
@@ -701,41 +688,34 @@ URI URI::relativize(const URI &other) const
     if (!has_authority() || !other.has_authority() || authority() != other.authority()) return other;
     if (_path.empty() || other._path.empty()) return other;
 
-    return {string_view{}, string_view{}, string_view{}, 0,
-            _relativize_path(_path, other._path), other._query, other._fragment};
+    path_buffer base_buffer, other_buffer, relative_buffer;
+    string_view base = _normalized_copy(_path, base_buffer);
+    string_view other_path = _normalized_copy(other._path, other_buffer);
+    char *buf = relative_buffer.reserve(2*base.length() + other_path.length() + 3);
+    string_view path{buf, _relativize_path(base, other_path, buf)};
+    return uri_builder{}.path(path).query(other._query).fragment(other._fragment).build();
 }
 
-static std::string _resolve_path(URI::string_view base, URI::string_view child)
+/* Merges paths into buf which should fit base.length()+child.length() chars
+ * and normalizes the result. Returns the length of the resolved path */
+static std::size_t _resolve_path(URI::string_view base, URI::string_view child, char* buf)
 {
+    std::size_t length = 0;
     URI::string_view::size_type i = base.rfind('/');
-    URI::string_view::size_type cn = child.length();
-    if (cn == 0)
+    /* 5.2 (6a) */
+    if (i != URI::string_view::npos)
     {
-        /* 5.2 (6a) */
-        if (i >= 0)
-        {
-            URI::string_view path = base.substr(0, i + 1);
-            /* 5.2 (6c-f) */
-            std::unique_ptr<std::string> normalized = _normalize_path(path);
-            return static_cast<bool>(normalized) ? std::move(*normalized) : path.to_string();
-        }
+        length = i + 1;
+        std::memcpy(buf, base.data(), length);
     }
-    else
+    /* 5.2 (6b) */
+    if (!child.empty())
     {
-        std::string sb;
-        sb.reserve(base.length() + cn);
-        /* 5.2 (6a) */
-        if (i >= 0) sb.append(base.data(), i + 1);
-        /* 5.2 (6b) */
-        sb.append(child.data(), cn);
-        /* 5.2 (6c-f) */
-        std::unique_ptr<std::string> normalized = _normalize_path(sb);
-        return static_cast<bool>(normalized) ? std::move(*normalized) : sb;
+        std::memcpy(buf + length, child.data(), child.length());
+        length += child.length();
     }
-    /* 5.2 (6g): If the result is absolute but the path begins with "../",
-     * then we simply leave the path as-is */
-
-    return std::string{}; /* Only empty path is left here */
+    /* 5.2 (6c-f). Unlike 5.2 (6g) leading ".." segments are dropped from the absolute path */
+    return _remove_dot_segments(buf, length);
 }
 
 /* RFC2396 5.2 */
@@ -750,44 +730,31 @@ URI URI::resolve(const URI &uri) const
         && !uri._fragment.empty() && uri._query.empty())
     {
         if (!_fragment.empty() && uri._fragment == _fragment) return *this;
-        URI ru;
-        ru._initialize(_scheme, _user_info, _host, _port, _path, _query, uri._fragment);
-        return ru;
+        return uri_builder{*this}.fragment(uri._fragment).build();
     }
     /* 5.2 (3): Child is absolute */
     if (!uri._scheme.empty()) return uri;
 
-    URI ru;		/* Resolved URI */
-    string_view scheme = _scheme;
-    string_view query = uri._query;
-    string_view fragment = uri._fragment;
-    string_view host = _host;
-    string_view user_info = _user_info;
-    string_view port = _port;
-    string_view path = uri._path;
-    string_type path_str;
+    /* Resolved URI is built in one go, the resolved path is kept on the stack */
+    uri_builder builder;
+    builder.scheme(_scheme).query(uri._query).fragment(uri._fragment);
+    path_buffer buffer;
 
     /* 5.2 (4): Authority */
     if (!uri.has_authority())
     {
+        builder.user_info(_user_info).host(_host).port(_port_i);
         if (uri._path.empty() || uri._path.front() != '/') /* 5.2 (6): Resolve relative path */
         {
-            path_str = _resolve_path(_path, uri._path);
-            path = path_str;
+            char *buf = buffer.reserve(_path.length() + uri._path.length());
+            builder.path(string_view{buf, _resolve_path(_path, uri._path, buf)});
         }
-        /* else 5.2 (5): Child path is absolute */
-    }
-    else
-    {
-        host = uri._host;
-        user_info = uri._user_info;
-        host = uri._host;
-        port = uri._port;
+        else builder.path(uri._path); /* 5.2 (5): Child path is absolute */
     }
+    else builder.user_info(uri._user_info).host(uri._host).port(uri._port_i).path(uri._path);
 
-    /* 5.2 (7): Recombine (nothing to do here) */
-    ru._initialize(scheme, user_info, host, port, path, query, fragment);
-    return ru;
+    /* 5.2 (7): Recombine */
+    return builder.build();
 }
 
 int URI::compare(const URI &other) const noexcept
@@ -837,4 +804,127 @@ void URI::_initialize()
     _parse(it, last);
 }
 
+uri_builder::uri_builder(const URI& uri) : _scheme{uri.scheme()}, _user_info{uri.user_info()}, _host{uri.host()},
+                                           _port{uri.port()}, _query{uri.query()}, _fragment{uri.fragment()}
+{
+    append_path(uri.path());
+}
+
+uri_builder& uri_builder::append_path(string_view part)
+{
+    if (part.empty()) return *this;
+    if (_path_parts_num == MAX_PATH_PARTS) throw uri_builder_error{"Too many path parts"};
+    _path_parts[_path_parts_num++] = part;
+    return *this;
+}
+
+/* Calls func for each piece of the path joining parts with single slashes */
+template <typename Func>
+static void _for_each_path_piece(const URI::string_view* parts, std::size_t num, bool absolute, Func func)
+{
+    static const URI::string_view SLASH{"/", 1};
+    bool ends_with_slash = false;
+    for (std::size_t i = 0; i < num; ++i)
+    {
+        URI::string_view part = parts[i];
+        if (i == 0)
+        {
+            if (absolute && part.front() != '/') func(SLASH);
+        }
+        else if (ends_with_slash && part.front() == '/') part.remove_prefix(1);
+        else if (!ends_with_slash && part.front() != '/') func(SLASH);
+        if (part.empty()) continue;
+        func(part);
+        ends_with_slash = part.back() == '/';
+    }
+}
+
+static std::size_t _port_to_chars(uint16_t port, char* buf)
+{
+    char digits[5];
+    std::size_t len = 0;
+    do
+    {
+        digits[len++] = static_cast<char>('0' + port % 10);
+        port /= 10;
+    }
+    while (port > 0);
+    for (std::size_t i = 0; i < len; ++i) buf[i] = digits[len-i-1];
+    return len;
+}
+
+URI uri_builder::build() const
+{
+    bool has_authority = !_user_info.empty() || !_host.empty() || _port > 0;
+    if (has_authority && _host.empty()) throw uri_builder_error{"Host expected"};
+
+    std::size_t path_len = 0;
+    _for_each_path_piece(_path_parts, _path_parts_num, has_authority,
+                         [&path_len](string_view piece) { path_len += piece.length(); });
+    std::size_t query_len = _query.length();
+    for (auto &&param : _query_params)
+    {
+        if (query_len > 0) ++query_len; /* '&' */
+        query_len += param.first.length() + 1 + param.second.length();
+    }
+    if (!has_authority && !_scheme.empty() && path_len == 0 && query_len == 0 && _fragment.empty())
+    {
+        throw uri_builder_error{"Path or query of fragment expected"};
+    }
+    char port_buf[5];
+    std::size_t port_len = _port > 0 ? _port_to_chars(_port, port_buf) : 0;
+
+    URI uri;
+    std::string &str = uri._uri;
+    str.reserve(_scheme.length() + 3 + _user_info.length() + 1 + _host.length() + 1 + port_len +
+                path_len + 1 + query_len + 1 + _fragment.length());
+
+    if (!_scheme.empty()) str.append(_scheme.data(), _scheme.length()).append(1, ':');
+    if (has_authority) str.append("//", 2);
+    std::size_t user_info_pos = str.length();
+    if (!_user_info.empty()) str.append(_user_info.data(), _user_info.length()).append(1, '@');
+    std::size_t host_pos = str.length();
+    str.append(_host.data(), _host.length());
+    std::size_t port_pos = str.length();
+    if (port_len > 0)
+    {
+        str.append(1, ':').append(port_buf, port_len);
+        ++port_pos;
+    }
+    std::size_t path_pos = str.length();
+    _for_each_path_piece(_path_parts, _path_parts_num, has_authority,
+                         [&str](string_view piece) { str.append(piece.data(), piece.length()); });
+    std::size_t query_pos = str.length();
+    if (query_len > 0)
+    {
+        str.append(1, '?').append(_query.data(), _query.length());
+        ++query_pos;
+        for (auto &&param : _query_params)
+        {
+            if (str.length() > query_pos) str.append(1, '&');
+            str.append(param.first.data(), param.first.length()).append(1, '=')
+               .append(param.second.data(), param.second.length());
+        }
+    }
+    std::size_t fragment_pos = str.length();
+    if (!_fragment.empty())
+    {
+        str.append(1, '#').append(_fragment.data(), _fragment.length());
+        ++fragment_pos;
+    }
+
+    /* Empty parts point to the place where they would be inserted by the setters */
+    const char *base = str.data();
+    uri._uri_view = string_view{str};
+    uri._scheme = string_view{base, _scheme.length()};
+    uri._user_info = string_view{base+user_info_pos, _user_info.length()};
+    uri._host = string_view{base+host_pos, _host.length()};
+    uri._port = string_view{base+port_pos, port_len};
+    uri._port_i = _port;
+    uri._path = string_view{base+path_pos, path_len};
+    uri._query = string_view{base+query_pos, query_len};
+    uri._fragment = string_view{base+fragment_pos, _fragment.length()};
+    return uri;
+}
+
 } // end of servlet namespace
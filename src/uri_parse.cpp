@@ -5,8 +5,15 @@ https://github.com/novalexei
 Distributed under the Boost Software License, Version 1.0.
 http://boost.org/LICENSE_1_0.txt
 */
+#include <cstring>
+
 #include <servlet/uri.h>
 #include "string.h"
+#include "uri_simd.h"
+
+#ifdef SERVLET_URI_SIMD
+#include <immintrin.h>
+#endif
 
 namespace servlet
 {
@@ -33,7 +40,7 @@ static const uint_fast32_t T_UNRESERVED     = T_UNRESERVED_ADD|T_ALPHA|T_DIGIT;
 static const uint_fast32_t T_PCHAR          = T_PCHAR_ADD|T_UNRESERVED|T_SUBDELIM;
 
 /* Delimiter table for the ASCII character set */
-static const uint_fast32_t CHAR_MAP[256] =
+static constexpr uint_fast32_t CHAR_MAP[256] =
         {
                 T_NUL,                                               /* 0x00     */
                 0,                                                   /* 0x01     */
@@ -295,6 +302,206 @@ static const uint_fast32_t CHAR_MAP[256] =
 
 static char HEX_CHARS[] = "0123456789ABCDEF";
 
+/*
+ * Character class in the form of two nibble lookup tables: character c belongs
+ * to the class if (lo[c & 0x0f] & hi[c >> 4]) != 0. Bit h of lo[l] is set if
+ * character (h << 4 | l) is in the class. Non-ASCII characters are never part
+ * of any class. This form allows to test 16/32 characters at a time with
+ * a byte shuffle, while scalar code keeps using CHAR_MAP with the same mask.
+ */
+struct char_class
+{
+    constexpr explicit char_class(uint_fast32_t m) : mask{m}, lo{}, hi{}
+    {
+        for (int c = 0; c < 0x80; ++c)
+        {
+            if (CHAR_MAP[c] & m) lo[c & 0x0f] |= static_cast<uint8_t>(1 << (c >> 4));
+        }
+        for (int h = 0; h < 8; ++h) hi[h] = static_cast<uint8_t>(1 << h);
+    }
+
+    uint_fast32_t mask;
+    alignas(16) uint8_t lo[16];
+    alignas(16) uint8_t hi[16];
+};
+
+static constexpr char_class SCHEME_CLASS{T_SCHEME};
+static constexpr char_class UNRESERVED_SUBDELIM_CLASS{T_UNRESERVED|T_SUBDELIM};
+static constexpr char_class USER_INFO_CLASS{T_UNRESERVED|T_SUBDELIM|T_COLON};
+static constexpr char_class PCHAR_CLASS{T_PCHAR};
+static constexpr char_class PATH_CLASS{T_PCHAR|T_SLASH};
+static constexpr char_class QUERY_CLASS{T_PCHAR|T_SLASH|T_QUESTION};
+
+/*
+ * Scanning kernels. Every kernel returns pointer to the first character in
+ * [first, last) matching the condition or last if there is no such character:
+ *   find_pct         - '%'
+ *   find_pct_or_plus - '%' or '+'
+ *   skip_class       - character which is not in the given class
+ */
+struct uri_kernels
+{
+    const char* (*find_pct)(const char* first, const char* last);
+    const char* (*find_pct_or_plus)(const char* first, const char* last);
+    const char* (*skip_class)(const char* first, const char* last, const char_class& cls);
+};
+
+static const char* _find_pct_scalar(const char* first, const char* last)
+{
+    while (first != last && *first != '%') ++first;
+    return first;
+}
+
+static const char* _find_pct_or_plus_scalar(const char* first, const char* last)
+{
+    while (first != last && *first != '%' && *first != '+') ++first;
+    return first;
+}
+
+static const char* _skip_class_scalar(const char* first, const char* last, const char_class& cls)
+{
+    while (first != last && (CHAR_MAP[static_cast<unsigned char>(*first)] & cls.mask)) ++first;
+    return first;
+}
+
+static const uri_kernels SCALAR_KERNELS = {_find_pct_scalar, _find_pct_or_plus_scalar, _skip_class_scalar};
+
+#ifdef SERVLET_URI_SIMD
+
+__attribute__((target("sse4.2")))
+static const char* _find_pct_sse42(const char* first, const char* last)
+{
+    const __m128i pct = _mm_set1_epi8('%');
+    for (; last - first >= 16; first += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, pct));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _find_pct_scalar(first, last);
+}
+
+__attribute__((target("sse4.2")))
+static const char* _find_pct_or_plus_sse42(const char* first, const char* last)
+{
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    for (; last - first >= 16; first += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, plus)));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _find_pct_or_plus_scalar(first, last);
+}
+
+__attribute__((target("sse4.2")))
+static const char* _skip_class_sse42(const char* first, const char* last, const char_class& cls)
+{
+    const __m128i lo_table = _mm_load_si128(reinterpret_cast<const __m128i*>(cls.lo));
+    const __m128i hi_table = _mm_load_si128(reinterpret_cast<const __m128i*>(cls.hi));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    for (; last - first >= 16; first += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _skip_class_scalar(first, last, cls);
+}
+
+static const uri_kernels SSE42_KERNELS = {_find_pct_sse42, _find_pct_or_plus_sse42, _skip_class_sse42};
+
+__attribute__((target("avx2")))
+static const char* _find_pct_avx2(const char* first, const char* last)
+{
+    const __m256i pct = _mm256_set1_epi8('%');
+    for (; last - first >= 32; first += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pct)));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _find_pct_sse42(first, last);
+}
+
+__attribute__((target("avx2")))
+static const char* _find_pct_or_plus_avx2(const char* first, const char* last)
+{
+    const __m256i pct = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8('+');
+    for (; last - first >= 32; first += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, pct),
+                                                                                _mm256_cmpeq_epi8(v, plus))));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _find_pct_or_plus_sse42(first, last);
+}
+
+__attribute__((target("avx2")))
+static const char* _skip_class_avx2(const char* first, const char* last, const char_class& cls)
+{
+    const __m256i lo_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(cls.lo)));
+    const __m256i hi_table = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(cls.hi)));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    for (; last - first >= 32; first += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+        __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble));
+        __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero)));
+        if (m) return first + __builtin_ctz(m);
+    }
+    return _skip_class_sse42(first, last, cls);
+}
+
+static const uri_kernels AVX2_KERNELS = {_find_pct_avx2, _find_pct_or_plus_avx2, _skip_class_avx2};
+
+#endif // SERVLET_URI_SIMD
+
+uri_simd_level get_supported_uri_simd_level()
+{
+#ifdef SERVLET_URI_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return uri_simd_level::avx2;
+    if (__builtin_cpu_supports("sse4.2")) return uri_simd_level::sse42;
+#endif
+    return uri_simd_level::scalar;
+}
+
+/* Starts with scalar kernels (constant initialized, so URIs parsed during static
+ * initialization of other units are safe) and gets upgraded at load time. */
+static const uri_kernels* _kernels = &SCALAR_KERNELS;
+static uri_simd_level _kernels_level = uri_simd_level::scalar;
+static const uri_simd_level _kernels_selected = set_uri_simd_level(uri_simd_level::avx2);
+
+uri_simd_level get_uri_simd_level() { return _kernels_level; }
+
+uri_simd_level set_uri_simd_level(uri_simd_level level)
+{
+    uri_simd_level supported = get_supported_uri_simd_level();
+    if (level > supported) level = supported;
+#ifdef SERVLET_URI_SIMD
+    if (level == uri_simd_level::avx2) _kernels = &AVX2_KERNELS;
+    else if (level == uri_simd_level::sse42) _kernels = &SSE42_KERNELS;
+    else _kernels = &SCALAR_KERNELS;
+#endif
+    _kernels_level = level;
+    return level;
+}
+
+static inline URI::string_view::iterator _skip_class(URI::string_view::iterator first,
+                                                     URI::string_view::iterator last, const char_class& cls)
+{
+    return _kernels->skip_class(first, last, cls);
+}
+
 static inline bool _is_pct_encoded(URI::string_view::iterator beg, URI::string_view::iterator end)
 {
     if (beg == end || *beg != '%') return false;
@@ -310,12 +517,19 @@ static inline bool _is_pchar(URI::string_view::iterator beg, URI::string_view::i
 }
 
 static inline void _encode(URI::string_view::iterator& beg, URI::string_view::iterator end,
-                           uint_fast32_t allowed_mask, std::string& to)
+                           const char_class& allowed, std::string& to)
 {
     while (beg != end)
     {
-        if (CHAR_MAP[static_cast<unsigned char>(*beg)] & allowed_mask) to.append(1, *beg);
-        else if (_is_pct_encoded(beg, end))
+        /* Bulk copy the run of allowed characters */
+        auto run_end = _skip_class(beg, end, allowed);
+        if (run_end != beg)
+        {
+            to.append(beg, run_end);
+            beg = run_end;
+            if (beg == end) break;
+        }
+        if (_is_pct_encoded(beg, end))
         {
             to.append(beg, beg+3);
             beg += 2; /* another one will be added at the end of the loop */
@@ -332,7 +546,7 @@ std::string URI::to_ASCII_string() const
     auto it = _uri_view.begin();
     if (_scheme.begin() > it || !_scheme.empty()) { ascii.append(&*it, _scheme.end()-it); it = _scheme.end(); }
     if (_user_info.begin() > it) { ascii.append(&*it, _user_info.begin()-it); it = _user_info.begin(); }
-    if (!_user_info.empty()) _encode(it, _user_info.end(), T_UNRESERVED|T_SUBDELIM|T_COLON, ascii);
+    if (!_user_info.empty()) _encode(it, _user_info.end(), USER_INFO_CLASS, ascii);
     if (_host.begin() > it) { ascii.append(&*it, _host.begin()-it); it = _host.begin(); }
     if (!_host.empty())
     {
@@ -340,15 +554,15 @@ std::string URI::to_ASCII_string() const
         {
             ascii.append(&*it, _host.end()-it); it = _host.end();
         }
-        else _encode(it, _host.end(), T_UNRESERVED|T_SUBDELIM, ascii);
+        else _encode(it, _host.end(), UNRESERVED_SUBDELIM_CLASS, ascii);
     }
     if (!_port.empty()) { ascii.append(&*it, _port.end()-it); it = _port.end(); }
     if (_path.begin() > it) { ascii.append(&*it, _path.begin()-it); it = _path.begin(); }
-    if (!_path.empty()) _encode(it, _path.end(), T_PCHAR|T_SLASH, ascii);
+    if (!_path.empty()) _encode(it, _path.end(), PATH_CLASS, ascii);
     if (_query.begin() > it) { ascii.append(&*it, _query.begin()-it); it = _query.begin(); }
-    if (!_query.empty()) _encode(it, _query.end(), T_PCHAR|T_SLASH|T_QUESTION, ascii);
+    if (!_query.empty()) _encode(it, _query.end(), QUERY_CLASS, ascii);
     if (_fragment.begin() > it) { ascii.append(&*it, _fragment.begin()-it); it = _fragment.begin(); }
-    if (!_fragment.empty()) _encode(it, _fragment.end(), T_PCHAR|T_SLASH|T_QUESTION, ascii);
+    if (!_fragment.empty()) _encode(it, _fragment.end(), QUERY_CLASS, ascii);
     return ascii;
 }
 
@@ -369,40 +583,74 @@ static inline char percent_encode(ConstIterator it)
     return static_cast<char>((0x10 * v0) + v1);
 }
 
+static inline void _throw_non_ascii(const char* pct)
+{
+    throw uri_syntax_error{string_view{"Unable to decode characters outside the ASCII character set: '"}
+                           + pct[1] + pct[2] + "'"};
+}
+
 void URI::_decode_encoded_unreserved_chars()
 {
-    auto it = _uri.begin();
-    auto it2 = it;
-    while (it != _uri.end())
+    const char* const data = _uri.data();
+    const char* const last = data + _uri.size();
+
+    /* First pass only validates, so that the URI is left untouched if it
+     * contains invalid escapes. Note that _uri is null terminated, so
+     * reading the hex digits of the truncated escape is safe and fails. */
+    bool has_unreserved = false;
+    for (const char* it = _kernels->find_pct(data, last); it != last; it = _kernels->find_pct(it+1, last))
     {
-        if (*it == '%')
+        const char opt_char = percent_encode(it);
+        if (opt_char == '\0') _throw_non_ascii(it);
+        if (CHAR_MAP[static_cast<unsigned char>(opt_char)] & T_UNRESERVED) has_unreserved = true;
+    }
+    if (!has_unreserved) return;
+
+    /* Parts boundaries as offsets. Parts containing decoded character shrink,
+     * parts after it are shifted. Empty parts are left intact. */
+    string_view* parts[] = {&_scheme, &_user_info, &_host, &_port, &_path, &_query, &_fragment};
+    constexpr std::size_t parts_num = sizeof(parts)/sizeof(parts[0]);
+    std::size_t starts[parts_num], ends[parts_num], shifts[parts_num] = {}, shrinks[parts_num] = {};
+    for (std::size_t i = 0; i < parts_num; ++i)
+    {
+        starts[i] = parts[i]->data() - _uri_view.data();
+        ends[i] = starts[i] + parts[i]->length();
+    }
+
+    char* out = &_uri[0];
+    const char* in = data;
+    while (in != last)
+    {
+        const char* pct = _kernels->find_pct(in, last);
+        if (pct != in)
         {
-            const auto sfirst = it;
-            const char opt_char = percent_encode(sfirst);
-            if (opt_char == '\0')
-            {
-                throw uri_syntax_error{string_view{"Unable to decode characters outside the ASCII character set: '"}
-                                       + (*++it) + (*++it) + "'"};
-            }
-            if (CHAR_MAP[static_cast<unsigned char>(opt_char)] & T_UNRESERVED)
-            {
-                *it2 = opt_char;
-                /* We use here +1 iterator in order to ensure that the iterator is located
-                 * totally within part's boundaries */
-                auto it_offset  = it-_uri.begin();
-                auto it2_offset = it2-_uri.begin();
-                _uri.erase((it2-_uri.begin())+1, 2);
-                _resize_parts(it2-_uri.begin()+1, -2);
-                it = _uri.begin() + it_offset + 1;
-                it2 = _uri.begin() + it2_offset + 1;
-            }
-            else *it2 = *it;
+            if (out != in) std::memmove(out, in, pct-in);
+            out += pct-in;
+            in = pct;
+            if (in == last) break;
         }
-        else *it2 = *it;
-        ++it; ++it2;
+        const char opt_char = percent_encode(in);
+        if (CHAR_MAP[static_cast<unsigned char>(opt_char)] & T_UNRESERVED)
+        {
+            const std::size_t pos = in - data;
+            for (std::size_t i = 0; i < parts_num; ++i)
+            {
+                if (parts[i]->empty()) continue;
+                if (starts[i] > pos+1) shifts[i] += 2;
+                else if (ends[i] > pos+1) shrinks[i] += 2;
+            }
+            *out++ = opt_char;
+            in += 3;
+        }
+        else *out++ = *in++;
+    }
+    _uri.resize(out - data);
+    _uri_view = string_view{_uri};
+    for (std::size_t i = 0; i < parts_num; ++i)
+    {
+        if (parts[i]->empty()) continue;
+        *parts[i] = string_view{_uri.data() + starts[i] - shifts[i], ends[i] - starts[i] - shrinks[i]};
     }
-    if (it2 == _uri.end()) return;
-    _uri.erase(it2, _uri.end());
 }
 
 std::string URI::decode(string_view str)
@@ -410,12 +658,26 @@ std::string URI::decode(string_view str)
     if (str.empty()) return {};
     std::string res;
     res.reserve(str.length());
-    auto it = str.begin();
-    auto it2 = it;
-    while (it != str.end())
+    const char* it = str.data();
+    const char* const last = it + str.length();
+    while (it != last)
     {
+        /* Bulk copy everything up to the next escape */
+        const char* special = _kernels->find_pct_or_plus(it, last);
+        if (special != it)
+        {
+            res.append(it, special);
+            it = special;
+            if (it == last) break;
+        }
         if (*it == '%')
         {
+            /* Don't read past the end of the view: truncated escape is invalid,
+             * unless it is kept as is anyway (see percent_encode) */
+            if (last - it < 3 && (last - it < 2 || it[1] < '8'))
+            {
+                throw uri_syntax_error{"Truncated percent encoded character in '" + str.to_string() + "'"};
+            }
             const char opt_char = percent_encode(it);
             if (opt_char != '\0')
             {
@@ -424,9 +686,8 @@ std::string URI::decode(string_view str)
             }
             else res += *it;
         }
-        else if (*it == '+') res += ' ';
-        else res += *it;
-        ++it; ++it2;
+        else res += ' '; /* '+' */
+        ++it;
     }
     return res;
 }
@@ -451,11 +712,11 @@ enum class hier_part_state
     path
 };
 
-inline static bool _advance(string_view::const_iterator &it, string_view::const_iterator last, uint_fast32_t mask)
+inline static bool _advance(string_view::const_iterator &it, string_view::const_iterator last, const char_class& cls)
 {
-    bool res = false;
-    while (it != last && (CHAR_MAP[static_cast<unsigned char>(*it)] & mask)) ++it, res = true;
-    return res;
+    string_view::const_iterator first = it;
+    it = _skip_class(it, last, cls);
+    return it != first;
 }
 
 static inline bool _skip_pct_encoded(string_view::const_iterator &it, string_view::const_iterator last)
@@ -472,26 +733,22 @@ static inline bool _skip_pct_encoded(string_view::const_iterator &it, string_vie
     return true;
 }
 
+/* Skips the whole run of pchars (or single percent encoded character) */
 static inline bool _skip_pchar(string_view::const_iterator &it, string_view::const_iterator last)
 {
-    if (it != last && (CHAR_MAP[static_cast<unsigned char>(*it)] & T_PCHAR))
-    {
-        ++it;
-        return true;
-    }
-    return _skip_pct_encoded(it, last);
+    return _advance(it, last, PCHAR_CLASS) || _skip_pct_encoded(it, last);
 }
 
 static bool _validate_scheme(string_view::const_iterator &it, string_view::const_iterator last)
 {
-    return _advance(it, last, T_SCHEME) && *it == ':';
+    return _advance(it, last, SCHEME_CLASS) && *it == ':';
 }
 
 static bool _validate_user_info(string_view::const_iterator it, string_view::const_iterator last)
 {
     while (it != last)
     {
-        bool res = _advance(it, last, T_UNRESERVED | T_SUBDELIM) || _skip_pct_encoded(it, last);
+        bool res = _advance(it, last, UNRESERVED_SUBDELIM_CLASS) || _skip_pct_encoded(it, last);
         if (it == last) return true;
         if (*it == ':')
         {
@@ -507,7 +764,7 @@ static bool _validate_fragment(string_view::const_iterator &it, string_view::con
 {
     while (it != last)
     {
-        if (!_advance(it, last, T_PCHAR|T_SLASH|T_QUESTION) && !_skip_pct_encoded(it, last)) return false;
+        if (!_advance(it, last, QUERY_CLASS) && !_skip_pct_encoded(it, last)) return false;
     }
     return true;
 }
@@ -579,6 +836,7 @@ void URI::_parse(string_view::const_iterator &it, string_view::const_iterator la
         {
             hp_state = hier_part_state::authority;
         }
+        else hp_state = hier_part_state::path; /* Relative path starting with scheme characters, like "g;x" */
     }
     else
     {
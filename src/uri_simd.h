@@ -0,0 +1,56 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_URI_SIMD_H
+#define MOD_SERVLET_IMPL_URI_SIMD_H
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SERVLET_URI_SIMD
+#endif
+
+namespace servlet
+{
+
+/**
+ * Instruction set used by the URI scanning kernels (percent-decoding,
+ * encoding and validation) in uri_parse.cpp.
+ *
+ * <p>The best level supported by the CPU is selected at load time.
+ * Lower levels are always available; <code>scalar</code> is the
+ * reference implementation the vector kernels must agree with.</p>
+ */
+enum class uri_simd_level
+{
+    scalar,
+    sse42,
+    avx2
+};
+
+/**
+ * Returns the best kernel level supported by the running CPU.
+ */
+uri_simd_level get_supported_uri_simd_level();
+
+/**
+ * Returns the kernel level currently used by the URI functions.
+ */
+uri_simd_level get_uri_simd_level();
+
+/**
+ * Switches the URI functions to the given kernel level.
+ *
+ * <p>The level is capped to what the running CPU supports. This is
+ * meant for tests and benchmarks and is not thread safe with respect
+ * to concurrent URI processing.</p>
+ * @param level Requested kernel level.
+ * @return Kernel level actually set.
+ */
+uri_simd_level set_uri_simd_level(uri_simd_level level);
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_URI_SIMD_H
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#include <cstring>
+#include <limits>
+
+#include <servlet/uri.h>
+#include <servlet/lib/exception.h>
+
+#include "urlencoded_parser.h"
+
+namespace servlet
+{
+
+urlencoded_parser::urlencoded_parser(consumer_type consumer, std::size_t max_name_size, std::size_t max_value_size) :
+        _consumer{consumer}, _max_name_size{max_name_size}, _max_value_size{max_value_size}
+{
+    if (_max_name_size == 0) _max_name_size = std::numeric_limits<std::size_t>::max();
+    if (_max_value_size == 0) _max_value_size = std::numeric_limits<std::size_t>::max();
+}
+
+void urlencoded_parser::parse(const char *data, std::size_t size)
+{
+    const char *last = data + size;
+    while (data != last)
+    {
+        const char *amp = static_cast<const char*>(std::memchr(data, '&', last - data));
+        const char *token_end = amp ? amp : last;
+        if (!_reading_value)
+        {
+            const char *eq = static_cast<const char*>(std::memchr(data, '=', token_end - data));
+            if (eq)
+            {
+                _append(_name, _max_name_size, "name", data, eq);
+                _reading_value = true;
+                data = eq + 1;
+            }
+            else _append(_name, _max_name_size, "name", data, token_end);
+        }
+        if (_reading_value) _append(_value, _max_value_size, "value", data, token_end);
+        if (!amp) return;
+        _flush();
+        data = amp + 1;
+    }
+}
+
+void urlencoded_parser::finish()
+{
+    _flush();
+}
+
+void urlencoded_parser::_append(std::string &to, std::size_t max_size, const char *limit_name,
+                                const char *first, const char *last)
+{
+    std::size_t size = last - first;
+    if (size > max_size - to.size())
+    {
+        throw request_too_large_exception{std::string{"Form parameter "}.append(limit_name)
+                                                  .append(" is longer than ").append(std::to_string(max_size))};
+    }
+    to.append(first, size);
+}
+
+void urlencoded_parser::_flush()
+{
+    if (!_name.empty() || _reading_value)
+    {
+        if (_value.empty()) _consumer(URI::decode(_name), {});
+        else _consumer(URI::decode(_name), URI::decode(_value));
+    }
+    _name.clear();
+    _value.clear();
+    _reading_value = false;
+}
+
+} // end of servlet namespace
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2016 Alexei Novakov
+https://github.com/novalexei
+
+Distributed under the Boost Software License, Version 1.0.
+http://boost.org/LICENSE_1_0.txt
+*/
+#ifndef MOD_SERVLET_IMPL_URLENCODED_PARSER_H
+#define MOD_SERVLET_IMPL_URLENCODED_PARSER_H
+
+#include <string>
+#include <functional>
+
+namespace servlet
+{
+
+/**
+ * Incremental parser of <code>application/x-www-form-urlencoded</code> data.
+ *
+ * <p>Data is fed chunk by chunk as it is read from the request body.
+ * Names and values can be split between chunks: partially read tokens are
+ * carried over to the next chunk. Each name-value pair is decoded and passed
+ * to the consumer as soon as its terminating <code>'&'</code> is read, so the
+ * body is never kept in memory as a whole.</p>
+ *
+ * <p>Names and values longer than the limits (counted in encoded
+ * characters) are rejected rather than truncated. Pairs are decoded with
+ * the same rules as #URI::parse_query.</p>
+ */
+class urlencoded_parser
+{
+public:
+    typedef std::function<void(std::string&&, std::string&&)> consumer_type;
+
+    /**
+     * @param consumer Function called with decoded name and value of each pair
+     * @param max_name_size Maximum encoded size of the name, <code>0</code> for no limit
+     * @param max_value_size Maximum encoded size of the value, <code>0</code> for no limit
+     */
+    urlencoded_parser(consumer_type consumer, std::size_t max_name_size, std::size_t max_value_size);
+
+    /**
+     * Parses next chunk of data.
+     * @param data Chunk of the data
+     * @param size Size of the chunk
+     * @throws uri_syntax_error if encoded name or value is malformed
+     * @throws request_too_large_exception if name or value is over its limit
+     */
+    void parse(const char *data, std::size_t size);
+
+    /**
+     * Passes the last pair to the consumer, should be called when all the data is parsed.
+     * @throws uri_syntax_error if encoded name or value is malformed
+     */
+    void finish();
+
+private:
+    void _append(std::string &to, std::size_t max_size, const char *limit_name, const char *first, const char *last);
+    void _flush();
+
+    consumer_type _consumer;
+    std::size_t _max_name_size;
+    std::size_t _max_value_size;
+
+    std::string _name;
+    std::string _value;
+    bool _reading_value = false;
+};
+
+} // end of servlet namespace
+
+#endif // MOD_SERVLET_IMPL_URLENCODED_PARSER_H
@@ -92,6 +92,53 @@ static std::size_t _read_int(apr_xml_elem *base_elem, const char* int_element_na
     return dflt;
 }
 
+/* Deadline in milliseconds: a whole non-negative number of at most a year,
+ * so that it can be added to the steady clock */
+static std::chrono::milliseconds _read_deadline(apr_xml_elem *elem)
+{
+    static constexpr long MAX_DEADLINE = 365L * 24 * 3600 * 1000;
+    if (!elem->first_cdata.first || !elem->first_cdata.first->text) return std::chrono::milliseconds{0};
+    string_view value = trim_view(elem->first_cdata.first->text);
+    long ms = -1;
+    try
+    {
+        ms = string_cast<long>(value, true);
+    }
+    catch (const bad_cast&) {}
+    if (ms < 0 || ms > MAX_DEADLINE)
+    {
+        throw config_exception{std::string{"Invalid "}.append(elem->name).append(" value: '")
+                                       .append(value.data(), value.size()).append("'")};
+    }
+    return std::chrono::milliseconds{ms};
+}
+
+static void _read_multipart_config(apr_xml_elem *base_elem, multipart_config &mp_cfg)
+{
+    for (apr_xml_elem *elem = base_elem->first_child; elem; elem = elem->next)
+    {
+        if (!elem->first_cdata.first || !elem->first_cdata.first->text) continue;
+        const char *text = elem->first_cdata.first->text;
+        if (std::strcmp(elem->name, "buffer-size") == 0)
+            mp_cfg.buffer_size = string_cast<std::size_t>(text);
+        else if (std::strcmp(elem->name, "file-size-threshold") == 0)
+            mp_cfg.file_size_threshold = string_cast<std::size_t>(text);
+        else if (std::strcmp(elem->name, "max-file-size") == 0)
+            mp_cfg.max_file_size = string_cast<std::size_t>(text);
+        else if (std::strcmp(elem->name, "location") == 0)
+            mp_cfg.location = trim_view(string_view{text}).to_string();
+        else if (std::strcmp(elem->name, "digest") == 0)
+        {
+            string_view digest = trim_view(string_view{text});
+            if (equal_ic(digest, "crc32c")) mp_cfg.digest = digest_algorithm::crc32c;
+            else if (equal_ic(digest, "xxh64")) mp_cfg.digest = digest_algorithm::xxh64;
+            else if (equal_ic(digest, "none")) mp_cfg.digest = digest_algorithm::none;
+            else LG->warning() << "Unknown multipart digest " << digest << std::endl;
+        }
+    }
+    if (mp_cfg.buffer_size < MIN_MULTIPART_BUFFER_SIZE) mp_cfg.buffer_size = MIN_MULTIPART_BUFFER_SIZE;
+}
+
 static void _read_error_page(apr_xml_elem *base_elem, tree_map<int, std::string>& pages)
 {
     int code = 0;
@@ -154,6 +201,8 @@ void dispatcher::_read_servlet_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
     string_view factory;
     bool has_name = false;
     int load_on_startup = -2;
+    bool body_replay = false;
+    std::chrono::milliseconds deadline{0};
     std::map<std::string, std::string, std::less<>> init_params{};
     for (apr_xml_elem *elem = base_elem->first_child; elem; elem = elem->next)
     {
@@ -185,6 +234,16 @@ void dispatcher::_read_servlet_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
                 if (load_on_startup < 0) load_on_startup = -1;
             }
         }
+        else if (std::strcmp(elem->name, "body-replay") == 0)
+        {
+            string_view value;
+            if (elem->first_cdata.first && elem->first_cdata.first->text)
+                value = trim_view(elem->first_cdata.first->text);
+            /* Empty element is enough to turn it on */
+            body_replay = value.empty() || equal_ic(value, "on") || equal_ic(value, "true");
+        }
+        else if (std::strcmp(elem->name, "deadline") == 0)
+            deadline = _read_deadline(elem);
         else if (std::strcmp(elem->name, "init-param") == 0) _read_init_param(elem, init_params);
     }
     if (has_name)
@@ -199,6 +258,8 @@ void dispatcher::_read_servlet_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
         {
             _servlet_config *s_config = new _servlet_config{name.to_string(), _ctx_path, _path, std::move(init_params)};
             std::shared_ptr<servlet_factory> sf{new servlet_factory{new default_servlet{}, s_config}};
+            sf->set_body_replay(body_replay);
+            sf->set_deadline(deadline);
             cfg.get_servlets().try_emplace(name).first->second.set_factory(sf);
             return;
         }
@@ -210,6 +271,8 @@ void dispatcher::_read_servlet_tag(apr_xml_elem *base_elem, _webapp_config& cfg,
         std::shared_ptr<dso> d = _find_or_load_dso(dso_map, dso_name);
         _servlet_config *s_config = new _servlet_config{name.to_string(), _ctx_path, _path, std::move(init_params)};
         std::shared_ptr<servlet_factory> sf{new servlet_factory{d, symbol_name, s_config, load_on_startup}};
+        sf->set_body_replay(body_replay);
+        sf->set_deadline(deadline);
         cfg.get_servlets().try_emplace(name).first->second.set_factory(sf);
     }
 }
@@ -255,6 +318,39 @@ void dispatcher::_read_filter_tag(apr_xml_elem *base_elem, _webapp_config &cfg,
     }
 }
 
+void dispatcher::_read_listener_tag(apr_xml_elem *base_elem, _webapp_config &cfg,
+                                    std::map<std::string, std::shared_ptr<dso>> &dso_map)
+{
+    string_view factory;
+    for (apr_xml_elem *elem = base_elem->first_child; elem; elem = elem->next)
+    {
+        if (std::strcmp(elem->name, "listener-factory") == 0)
+        {
+            if (!elem->first_cdata.first || !elem->first_cdata.first->text)
+                LG->warning() << "Tag listener with empty listener-factory" << std::endl;
+            else factory = trim_view(string_view{elem->first_cdata.first->text});
+        }
+    }
+    if (factory.empty()) return;
+    auto colon_ind = factory.find(':');
+    if (colon_ind == string_view::npos || colon_ind == 0 || colon_ind >= factory.size() - 1)
+        throw config_exception{"Invalid listener-factory string: '" + factory + "'"};
+    std::string dso_name = factory.substr(0, colon_ind).to_string();
+    std::string symbol_name = factory.substr(colon_ind + 1).to_string();
+    std::shared_ptr<dso> d = _find_or_load_dso(dso_map, dso_name);
+    http_session_listener* (*listener_factory)();
+    if (!d->get_dso() ||
+            apr_dso_sym((apr_dso_handle_sym_t*)&listener_factory, d->get_dso(), symbol_name.data()) != APR_SUCCESS)
+    {
+        LG->warning() << "Failed to load session listener from " << factory << std::endl;
+        return;
+    }
+    http_session_listener *listener = listener_factory();
+    if (!listener) return;
+    /* The library stays loaded while the listener is alive */
+    cfg.get_listeners().emplace_back(listener, [d](http_session_listener *l) { delete l; });
+}
+
 void dispatcher::_read_webapp_config(_webapp_config &cfg, apr_xml_elem *root)
 {
     std::size_t filter_order = 0;
@@ -266,6 +362,8 @@ void dispatcher::_read_webapp_config(_webapp_config &cfg, apr_xml_elem *root)
             _read_servlet_tag(elem, cfg, dso_map);
         else if (std::strcmp(elem->name, "filter") == 0)
             _read_filter_tag(elem, cfg, dso_map);
+        else if (std::strcmp(elem->name, "listener") == 0)
+            _read_listener_tag(elem, cfg, dso_map);
         else if (std::strcmp(elem->name, "servlet-mapping") == 0)
             _read_servlet_mapping(cfg, elem);
         else if (std::strcmp(elem->name, "filter-mapping") == 0)
@@ -274,8 +372,17 @@ void dispatcher::_read_webapp_config(_webapp_config &cfg, apr_xml_elem *root)
             _read_mime_type_mapping(elem, cfg.get_mime_type_mapping());
         else if (std::strcmp(elem->name, "session-config") == 0)
             cfg.set_session_timeout(_read_int(elem, "session-timeout", 30));
+        else if (std::strcmp(elem->name, "multipart-config") == 0)
+            _read_multipart_config(elem, cfg.get_multipart_config());
         else if (std::strcmp(elem->name, "error-page") == 0)
             _read_error_page(elem, _error_pages);
+        else if (std::strcmp(elem->name, "deadline-header") == 0)
+        {
+            if (elem->first_cdata.first && elem->first_cdata.first->text)
+                cfg.set_deadline_header(trim_view(string_view{elem->first_cdata.first->text}).to_string());
+        }
+        else if (std::strcmp(elem->name, "max-deadline") == 0)
+            cfg.set_max_deadline(_read_deadline(elem));
         elem = elem->next;
     }
 }
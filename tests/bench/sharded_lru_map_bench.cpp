@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <servlet/lib/lru_map.h>
+
+using namespace servlet;
+
+typedef sharded_lru_map<std::string, std::shared_ptr<int>> session_like_map;
+
+/* Session lookup pattern: mostly gets of existing keys, few new keys */
+template<typename Map, typename Get>
+static double run_contention(Map& map, Get get, int threads, int ops)
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < 4096; ++i) keys.push_back("SESSION" + std::to_string(i * 7919));
+    for (auto &&k : keys) map.put(k, std::make_shared<int>(1));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&map, &keys, &get, t, ops] ()
+        {
+            for (int i = 0; i < ops; ++i)
+            {
+                const std::string& key = keys[(i * 31 + t * 977) % keys.size()];
+                if (i % 64 == 0) map.put(key, std::make_shared<int>(i));
+                else get(map, key);
+            }
+        });
+    }
+    for (auto &&w : workers) w.join();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void contention()
+{
+    const int threads = std::max(4u, std::thread::hardware_concurrency());
+    const int ops = 100000;
+    lru_tree_map<std::string, std::shared_ptr<int>> single{600};
+    double single_ms = run_contention(single, [] (decltype(single)& m, const std::string& k)
+    {
+        auto ref = m.get(k);
+        return ref.has_value();
+    }, threads, ops);
+    session_like_map sharded{600};
+    double sharded_ms = run_contention(sharded, [] (session_like_map& m, const std::string& k)
+    {
+        return static_cast<bool>(m.get(k));
+    }, threads, ops);
+    std::cout << threads << " threads x " << ops << " operations: lru_tree_map " << single_ms
+              << " ms, sharded_lru_map " << sharded_ms << " ms" << std::endl;
+}
+
+int main()
+{
+    contention();
+    return 0;
+}
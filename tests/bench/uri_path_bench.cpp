@@ -0,0 +1,129 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <servlet/uri.h>
+
+using namespace servlet;
+
+/* Reference implementation which was used before single pass dot segment removal */
+static std::unique_ptr<std::string> tokenizing_normalize_path(string_view path)
+{
+    std::vector<string_view> tokens;
+    bool has_removable_tokens = false;
+    for (string_view::size_type pos = 0; pos < path.length();)
+    {
+        auto end = path.find('/', pos);
+        if (end == string_view::npos) end = path.length();
+        if (end > pos)
+        {
+            string_view token = path.substr(pos, end - pos);
+            tokens.push_back(token);
+            if (token == "." || token == "..") has_removable_tokens = true;
+        }
+        pos = end + 1;
+    }
+    if (!has_removable_tokens) return {};
+    for (std::size_t ind = 0; ind < tokens.size(); ++ind)
+    {
+        if (tokens[ind] == ".") tokens[ind] = string_view{};
+        else if (tokens[ind] == "..")
+        {
+            for (std::size_t back_ind = ind; back_ind > 0; --back_ind)
+            {
+                if (!tokens[back_ind-1].empty())
+                {
+                    if (tokens[back_ind-1] != "..")
+                    {
+                        tokens[ind] = string_view{};
+                        tokens[back_ind-1] = string_view{};
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    bool front_slash = path.front() == '/';
+    std::unique_ptr<std::string> res{new std::string{}};
+    for (auto &&token : tokens)
+    {
+        if (token.empty()) continue;
+        if (front_slash) res->append(1, '/');
+        res->append(token.data(), token.length());
+        front_slash = true;
+    }
+    if (path.back() == '/') res->append(1, '/');
+    return res;
+}
+
+template <typename Func>
+static long long measure_us(int iterations, Func func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) func();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+static void normalize_benchmark()
+{
+    URI uris[] = {URI{"/context/servlet/./path/../info/index.html"}, URI{"/a/b/c/d/e/f/g/h/../../../../x"},
+                  URI{"/static/css/main.css"}, URI{"/a/./b/./c/./d/./e/"}};
+    const int iterations = 200000;
+    std::size_t sink = 0;
+    long long tokenizing = measure_us(iterations, [&uris, &sink]
+    {
+        for (auto &&parsed : uris)
+        {
+            URI uri{parsed};
+            auto normalized = tokenizing_normalize_path(uri.path());
+            if (normalized) uri.set_path(*normalized);
+            sink += uri.path().length();
+        }
+    });
+    long long in_place = measure_us(iterations, [&uris, &sink]
+    {
+        for (auto &&parsed : uris)
+        {
+            URI uri{parsed};
+            uri.normalize_path();
+            sink += uri.path().length();
+        }
+    });
+    std::cout << "normalize_path: tokenizing " << tokenizing << "us, in place " << in_place
+              << "us (" << sink << ")" << std::endl;
+}
+
+static void resolve_benchmark()
+{
+    URI base{"http://www.example.com:8080/context/servlet/path/index.html"};
+    URI relatives[] = {URI{"../other/page.html?x=1"}, URI{"./images/logo.png"}, URI{"../../a/b/../c/"}};
+    const int iterations = 200000;
+    std::size_t sink = 0;
+    long long tokenizing = measure_us(iterations, [&base, &relatives, &sink]
+    {
+        for (auto &&relative : relatives)
+        {
+            std::string path = base.path().substr(0, base.path().rfind('/') + 1).to_string();
+            path.append(relative.path().data(), relative.path().length());
+            auto normalized = tokenizing_normalize_path(path);
+            URI resolved{base.scheme(), base.user_info(), base.host(), base.port(),
+                         normalized ? *normalized : path, relative.query(), relative.fragment()};
+            sink += resolved.uri_view().length();
+        }
+    });
+    long long single_pass = measure_us(iterations, [&base, &relatives, &sink]
+    {
+        for (auto &&relative : relatives) sink += base.resolve(relative).uri_view().length();
+    });
+    std::cout << "resolve: tokenizing " << tokenizing << "us, single pass " << single_pass
+              << "us (" << sink << ")" << std::endl;
+}
+
+int main()
+{
+    normalize_benchmark();
+    resolve_benchmark();
+    return 0;
+}
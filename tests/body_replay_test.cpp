@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <experimental/filesystem>
+#include <servlet/lib/io.h>
+#include "../src/body_replay.h"
+#include "../src/multipart.h"
+
+using namespace servlet;
+
+static std::string read_all(std::istream& in)
+{
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+static std::string make_body(std::size_t size)
+{
+    std::string body;
+    for (std::size_t i = 0; body.size() < size; ++i) body.append(std::to_string(i)).append(1, ',');
+    body.resize(size);
+    return body;
+}
+
+static std::size_t spooled_files(const std::string& dir)
+{
+    std::size_t count = 0;
+    for (auto &&entry : std::experimental::filesystem::directory_iterator{dir}) ++count;
+    return count;
+}
+
+class body_replay_test : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        _dir = (std::experimental::filesystem::temp_directory_path() / "body_replay_test").string();
+        std::experimental::filesystem::remove_all(_dir);
+        std::experimental::filesystem::create_directories(_dir);
+    }
+    void TearDown() override { std::experimental::filesystem::remove_all(_dir); }
+
+    std::string _dir;
+};
+
+TEST_F(body_replay_test, memory)
+{
+    std::string body = make_body(100000);
+    std::istringstream src{body};
+    body_replay replay{1024 * 1024, _dir};
+    {
+        instream<tee_source> tee{src, replay};
+        ASSERT_EQ(body, read_all(tee));
+    }
+    ASSERT_TRUE(replay.is_complete());
+    ASSERT_EQ(body.size(), replay.size());
+    ASSERT_EQ(0u, spooled_files(_dir));
+    for (int i = 0; i < 3; ++i)
+    {
+        instream<replay_source> in{replay};
+        char buf[16];
+        /* Replayed data is handed out in place */
+        auto chunk = read_chunk(in, buf, sizeof(buf));
+        ASSERT_EQ(replay.data().first, chunk.first);
+        ASSERT_EQ(body, std::string(chunk.first, chunk.second));
+    }
+}
+
+TEST_F(body_replay_test, file)
+{
+    std::string body = make_body(300000);
+    std::istringstream src{body};
+    {
+        body_replay replay{50000, _dir};
+        instream<tee_source> tee{src, replay};
+        ASSERT_EQ(body, read_all(tee));
+        ASSERT_TRUE(replay.is_complete());
+        ASSERT_EQ(1u, spooled_files(_dir));
+        instream<replay_source> in1{replay};
+        instream<replay_source> in2{replay};
+        ASSERT_EQ(body, read_all(in1));
+        ASSERT_EQ(body, read_all(in2));
+    }
+    /* Temporary file is removed with the replay */
+    ASSERT_EQ(0u, spooled_files(_dir));
+}
+
+TEST_F(body_replay_test, partial_read)
+{
+    std::string body = make_body(20000);
+    std::istringstream src{body};
+    body_replay replay{1000, _dir};
+    instream<tee_source> tee{src, replay};
+    char buf[100];
+    tee.read(buf, sizeof(buf));
+    ASSERT_FALSE(replay.is_complete());
+    /* Whatever is left is read to complete the replay */
+    tee.ignore(std::numeric_limits<std::streamsize>::max());
+    replay.finish();
+    instream<replay_source> in{replay};
+    ASSERT_EQ(body, read_all(in));
+}
+
+TEST_F(body_replay_test, empty)
+{
+    std::istringstream src{""};
+    body_replay replay{1000, _dir};
+    instream<tee_source> tee{src, replay};
+    ASSERT_EQ("", read_all(tee));
+    ASSERT_TRUE(replay.is_complete());
+    instream<replay_source> in{replay};
+    ASSERT_EQ("", read_all(in));
+}
+
+/* Stream buffer failing after the given data as if the connection broke */
+class failing_buf : public std::stringbuf
+{
+public:
+    explicit failing_buf(const std::string& data) : std::stringbuf{data} {}
+protected:
+    int_type underflow() override
+    {
+        int_type c = std::stringbuf::underflow();
+        if (traits_type::eq_int_type(c, traits_type::eof())) throw io_exception{"connection reset"};
+        return c;
+    }
+};
+
+TEST_F(body_replay_test, read_error)
+{
+    failing_buf buf{make_body(5000)};
+    std::istream src{&buf};
+    body_replay replay{1000, _dir};
+    instream<tee_source> tee{src, replay};
+    ASSERT_THROW(read_all(tee), io_exception);
+    /* Body read up to the error is not replayed as the whole one */
+    ASSERT_TRUE(replay.is_failed());
+    ASSERT_FALSE(replay.is_complete());
+    instream<replay_source> in{replay};
+    ASSERT_EQ("", read_all(in));
+}
+
+TEST_F(body_replay_test, limit)
+{
+    std::string body = make_body(5000);
+    /* Source stops at the limit like the request stream does */
+    std::istringstream src{body.substr(0, 3000)};
+    body_replay replay{1000, _dir};
+    instream<tee_source> tee{src, replay, 3000u};
+    ASSERT_EQ(3000u, read_all(tee).size());
+    ASSERT_TRUE(replay.is_failed());
+    ASSERT_FALSE(replay.is_complete());
+    /* Body under the limit is complete */
+    std::istringstream small{body.substr(0, 2999)};
+    body_replay small_replay{1000, _dir};
+    instream<tee_source> small_tee{small, small_replay, 3000u};
+    read_all(small_tee);
+    ASSERT_TRUE(small_replay.is_complete());
+}
+
+TEST_F(body_replay_test, multipart)
+{
+    std::string body = "--xyz\r\n"
+                       "Content-Disposition: form-data; name=\"name\"\r\n\r\n"
+                       "alice\r\n"
+                       "--xyz\r\n"
+                       "Content-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n"
+                       + make_body(10000) + "\r\n"
+                       "--xyz--\r\n";
+    std::istringstream src{body};
+    body_replay replay{1000, _dir};
+    /* Filter reads the body before the servlet */
+    {
+        instream<tee_source> tee{src, replay};
+        ASSERT_EQ(body, read_all(tee));
+    }
+    instream<replay_source> in{replay};
+    std::map<std::string, std::vector<std::string>, std::less<>> params;
+    multipart_config config;
+    multipart_input_impl input{nullptr, "--xyz", 0, &params, 0, config, nullptr, &in};
+    ASSERT_TRUE(input.to_next_part());
+    ASSERT_EQ("alice", read_all(input.get_input_stream()));
+    ASSERT_TRUE(input.to_next_part());
+    ASSERT_EQ(make_body(10000), read_all(input.get_input_stream()));
+    ASSERT_FALSE(input.to_next_part());
+    ASSERT_EQ(1u, params.size());
+    ASSERT_EQ("alice", params["name"].front());
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+#include <servlet/cancellation.h>
+
+using namespace servlet;
+
+TEST(cancellation_test, no_deadline)
+{
+    cancellation_token token;
+    ASSERT_FALSE(token.has_deadline());
+    ASSERT_EQ(std::chrono::milliseconds::max(), token.remaining_time());
+    ASSERT_FALSE(token.is_cancelled());
+    ASSERT_NO_THROW(token.throw_if_cancelled());
+    token.cancel();
+    ASSERT_EQ(cancel_reason::cancelled, token.reason());
+    ASSERT_THROW(token.throw_if_cancelled(), request_cancelled_exception);
+}
+
+TEST(cancellation_test, deadline)
+{
+    cancellation_token token{cancellation_token::clock_type::now() + std::chrono::milliseconds{50}};
+    ASSERT_TRUE(token.has_deadline());
+    ASSERT_FALSE(token.is_cancelled());
+    ASSERT_GT(token.remaining_time().count(), 0);
+    ASSERT_LE(token.remaining_time().count(), 50);
+    std::this_thread::sleep_for(std::chrono::milliseconds{60});
+    ASSERT_EQ(std::chrono::milliseconds::zero(), token.remaining_time());
+    ASSERT_EQ(cancel_reason::deadline, token.reason());
+    /* The first reason stays */
+    token.cancel();
+    ASSERT_EQ(cancel_reason::deadline, token.reason());
+    ASSERT_THROW(token.throw_if_cancelled(), io_exception);
+}
+
+class abortable_token : public cancellation_token
+{
+public:
+    using cancellation_token::cancellation_token;
+    bool aborted = false;
+protected:
+    bool client_aborted() const noexcept override { return aborted; }
+};
+
+TEST(cancellation_test, client_abort)
+{
+    abortable_token token{cancellation_token::clock_type::now() - std::chrono::seconds{1}};
+    token.aborted = true;
+    /* Client abort is checked before the deadline */
+    ASSERT_EQ(cancel_reason::client_abort, token.reason());
+    token.aborted = false;
+    ASSERT_EQ(cancel_reason::client_abort, token.reason());
+}
+
+TEST(cancellation_test, cancel_from_other_thread)
+{
+    cancellation_token token;
+    std::thread canceller{[&token] () { token.cancel(); }};
+    while (!token.is_cancelled()) std::this_thread::yield();
+    canceller.join();
+    ASSERT_EQ(cancel_reason::cancelled, token.reason());
+}
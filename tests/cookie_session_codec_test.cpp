@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <servlet/lib/exception.h>
+#include "../src/cookie_session_codec.h"
+#include "../src/session.h"
+
+using namespace servlet;
+
+static const std::string SECRET = "0123456789abcdef0123456789abcdef";
+
+TEST(cookie_session_codec_test, seal_and_open)
+{
+    for (auto c : {cookie_session_codec::cipher::aes_256_gcm, cookie_session_codec::cipher::chacha20_poly1305})
+    {
+        cookie_session_codec codec{SECRET, c, std::chrono::hours{1}};
+        http_session_impl session{"10.0.0.1", "agent"};
+        session.put<std::string>("user", "alice");
+        session.set_principal(new named_principal{"alice"});
+        std::string cookie = codec.seal(session, 1);
+        ASSERT_FALSE(cookie.empty());
+        /* Sent as a cookie value without quoting */
+        ASSERT_EQ(std::string::npos, cookie.find_first_not_of(
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"));
+        /* Every seal uses a new nonce */
+        ASSERT_NE(cookie, codec.seal(session, 1));
+
+        bool stale = true;
+        std::shared_ptr<http_session_impl> opened = codec.open(cookie, 1, std::chrono::seconds{60}, stale);
+        ASSERT_TRUE(opened);
+        ASSERT_FALSE(stale);
+        ASSERT_EQ(session.get_id(), opened->get_id());
+        ASSERT_EQ("alice", *opened->get<std::string>("user"));
+        ASSERT_EQ("alice", opened->get_principal()->get_name());
+        opened->validate("10.0.0.1", "agent");
+
+        /* Another web application doesn't accept it */
+        ASSERT_FALSE(codec.open(cookie, 2, std::chrono::seconds{60}, stale));
+        /* Neither does a host with another secret */
+        cookie_session_codec other{SECRET + "x", c, std::chrono::hours{1}};
+        ASSERT_FALSE(other.open(cookie, 1, std::chrono::seconds{60}, stale));
+    }
+}
+
+TEST(cookie_session_codec_test, tampered)
+{
+    cookie_session_codec codec{SECRET, cookie_session_codec::cipher::aes_256_gcm, std::chrono::hours{1}};
+    http_session_impl session{"10.0.0.1", "agent"};
+    session.put<std::string>("role", "user");
+    std::string cookie = codec.seal(session, 1);
+    bool stale;
+    for (std::size_t i = 0; i < cookie.size(); ++i)
+    {
+        std::string forged = cookie;
+        forged[i] = forged[i] == 'A' ? 'B' : 'A';
+        ASSERT_FALSE(codec.open(forged, 1, std::chrono::seconds{60}, stale));
+    }
+    ASSERT_FALSE(codec.open(cookie.substr(0, cookie.size() - 4), 1, std::chrono::seconds{60}, stale));
+    ASSERT_FALSE(codec.open("", 1, std::chrono::seconds{60}, stale));
+    ASSERT_FALSE(codec.open("not a cookie!", 1, std::chrono::seconds{60}, stale));
+    ASSERT_FALSE(codec.open(session.get_id(), 1, std::chrono::seconds{60}, stale));
+}
+
+TEST(cookie_session_codec_test, key_rotation)
+{
+    cookie_session_codec codec{SECRET, cookie_session_codec::cipher::aes_256_gcm, std::chrono::hours{1}};
+    auto now = std::chrono::system_clock::now();
+    http_session_impl session{"10.0.0.1", "agent"};
+    std::string cookie = codec.seal(session, 1, now - std::chrono::hours{1});
+    bool stale = false;
+    /* Sealed with the previous key, it is still accepted */
+    ASSERT_TRUE(codec.open(cookie, 1, std::chrono::hours{2}, stale, now));
+    ASSERT_TRUE(stale);
+    /* Key is retired when no session sealed with it can be alive */
+    ASSERT_FALSE(codec.open(cookie, 1, std::chrono::hours{2}, stale, now + std::chrono::hours{3}));
+}
+
+TEST(cookie_session_codec_test, limits)
+{
+    cookie_session_codec codec{SECRET, cookie_session_codec::cipher::aes_256_gcm, std::chrono::hours{1}};
+    http_session_impl session{"10.0.0.1", "agent"};
+    std::string cookie = codec.seal(session, 1);
+    bool stale;
+    /* Session times out in the cookie as well */
+    ASSERT_FALSE(codec.open(cookie, 1, std::chrono::seconds{60}, stale,
+                            std::chrono::system_clock::now() + std::chrono::seconds{120}));
+    session.put<std::string>("big", std::string(cookie_session_codec::MAX_COOKIE_SIZE, 'x'));
+    ASSERT_EQ("", codec.seal(session, 1));
+
+    ASSERT_THROW(cookie_session_codec("short", cookie_session_codec::cipher::aes_256_gcm, std::chrono::hours{1}),
+                 config_exception);
+    ASSERT_THROW(cookie_session_codec::parse_cipher("des"), config_exception);
+}
+
+TEST(cookie_session_codec_test, manager)
+{
+    auto codec = std::make_shared<cookie_session_codec>(SECRET, cookie_session_codec::cipher::aes_256_gcm,
+                                                        std::chrono::hours{1});
+    session_manager manager{600};
+    ASSERT_FALSE(manager.is_stateless());
+    manager.set_cookie_codec(codec, 1);
+    ASSERT_TRUE(manager.is_stateless());
+
+    http_session_impl session{"10.0.0.1", "agent"};
+    session.put<int>("visits", 1);
+    std::string cookie = manager.seal_cookie(session);
+    bool reissue = true;
+    std::shared_ptr<http_session_impl> opened = manager.open_cookie(cookie, reissue);
+    ASSERT_TRUE(opened);
+    /* Fresh cookie is not sent again unless the session changes */
+    ASSERT_FALSE(reissue);
+    ASSERT_EQ(1, *opened->get<int>("visits"));
+    ASSERT_EQ(0u, manager.sessions().size());
+}
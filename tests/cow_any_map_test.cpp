@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <experimental/string_view>
+#include <servlet/lib/cow_any_map.h>
+
+using namespace servlet;
+
+TEST(cow_any_map_test, operations)
+{
+    cow_any_map m;
+    ASSERT_TRUE(m.empty());
+    ASSERT_TRUE(m.put<std::string>("b", "value"));
+    ASSERT_TRUE(m.put<int>("a", 1));
+    ASSERT_TRUE(m.put<std::vector<int>>("c", 1, 2));
+    ASSERT_FALSE(m.put<int>("a", 2));
+    ASSERT_EQ(3u, m.size());
+    ASSERT_EQ(2, *m.get<int>("a"));
+    ASSERT_EQ("value", *m.get<std::string>(std::experimental::string_view{"b"}));
+    ASSERT_EQ(2u, m.get<std::vector<int>>("c")->size());
+    ASSERT_FALSE(m.get<int>("d"));
+    ASSERT_THROW(m.get<int>("b"), std::experimental::bad_any_cast);
+    ASSERT_TRUE(m.contains_key("c"));
+
+    /* Records are sorted and not affected by later changes */
+    std::shared_ptr<const cow_any_map::snapshot_type> records = m.snapshot();
+    std::shared_ptr<const int> a = m.get<int>("a");
+    ASSERT_TRUE(m.erase("a"));
+    ASSERT_FALSE(m.erase("a"));
+    ASSERT_FALSE(m.contains_key("a"));
+    ASSERT_EQ(2, *a);
+    ASSERT_EQ(3u, records->size());
+    ASSERT_EQ("a", (*records)[0].first);
+    ASSERT_EQ("b", (*records)[1].first);
+    ASSERT_EQ("c", (*records)[2].first);
+
+    m.clear();
+    ASSERT_EQ(0u, m.size());
+}
+
+TEST(cow_any_map_test, compute)
+{
+    cow_any_map m;
+    std::atomic<int> created{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&m, &created]
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                m.compute<int>("counter", [](const int *old) { return old ? *old + 1 : 1; });
+                m.compute_if_absent<std::string>("once", [&created](const std::string&)
+                {
+                    ++created;
+                    return std::string{"created"};
+                });
+                /* Readers see either the old or the new value, never a torn one */
+                ASSERT_LT(0, *m.get<int>("counter"));
+                m.put<int>("t" + std::to_string(i % 10), i);
+            }
+        });
+    }
+    for (auto &&t : threads) t.join();
+    ASSERT_EQ(8000, *m.get<int>("counter"));
+    ASSERT_EQ(1, created);
+    ASSERT_EQ("created", *m.get<std::string>("once"));
+    ASSERT_EQ(12u, m.size());
+}
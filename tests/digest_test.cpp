@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include "../src/digest.h"
+#include "../src/multipart.h"
+
+using namespace servlet;
+
+static std::uint64_t xxh64(const std::string& str)
+{
+    xxh64_state state;
+    state.update(str.data(), str.size());
+    return state.value();
+}
+
+TEST(digest_test, crc32c)
+{
+    ASSERT_EQ(0, crc32c(0, "", 0));
+    ASSERT_EQ(0xE3069283, crc32c(0, "123456789", 9));
+    /* RFC 3720, B.4 */
+    std::string zeros(32, '\0');
+    ASSERT_EQ(0x8A9136AA, crc32c(0, zeros.data(), zeros.size()));
+    std::string ones(32, '\xff');
+    ASSERT_EQ(0x62A8AB43, crc32c(0, ones.data(), ones.size()));
+    ASSERT_EQ(0xE3069283, crc32c_sw(0, "123456789", 9));
+    ASSERT_EQ(0xE3069283, crc32c(crc32c(0, "1234", 4), "56789", 5));
+}
+
+TEST(digest_test, xxh64)
+{
+    ASSERT_EQ(0xEF46DB3751D8E999ULL, xxh64(""));
+    ASSERT_EQ(0xD24EC4F1A98C6E5BULL, xxh64("a"));
+    ASSERT_EQ(0x44BC2CF5AD770999ULL, xxh64("abc"));
+    ASSERT_EQ(0xFBCEA83C8A378BF1ULL, xxh64("Nobody inspects the spammish repetition"));
+}
+
+TEST(digest_test, incremental)
+{
+    std::mt19937 gen{20581};
+    std::uniform_int_distribution<int> ch_dist{0, 255};
+    std::string data(1000, '\0');
+    for (auto &ch : data) ch = static_cast<char>(ch_dist(gen));
+    for (std::size_t len : {0, 1, 7, 31, 32, 33, 64, 100, 1000})
+    {
+        std::string str = data.substr(0, len);
+        std::uint32_t crc = crc32c_sw(0, str.data(), str.size());
+        ASSERT_EQ(crc, crc32c(0, str.data(), str.size()));
+        std::uint64_t xxh = xxh64(str);
+        for (std::size_t split = 0; split <= len; ++split)
+        {
+            for (auto alg : {digest_algorithm::crc32c, digest_algorithm::xxh64})
+            {
+                part_digest digest{alg};
+                digest.update(str.data(), split);
+                digest.update(str.data() + split, len - split);
+                ASSERT_EQ(alg == digest_algorithm::crc32c ? crc : xxh, digest.value()) << len << " " << split;
+            }
+        }
+    }
+    part_digest digest{digest_algorithm::xxh64};
+    digest.update(data.data(), data.size());
+    digest.reset();
+    digest.update("abc", 3);
+    ASSERT_EQ(0x44BC2CF5AD770999ULL, digest.value());
+}
+
+TEST(digest_test, multipart)
+{
+    std::string data = "Nobody inspects the spammish repetition";
+    std::string part = "--xyz\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n" + data;
+    multipart_config config;
+    config.digest = digest_algorithm::xxh64;
+    {
+        std::istringstream body{part + "\r\n--xyz--\r\n"};
+        multipart_input_impl input{nullptr, "--xyz", 0, nullptr, 0, config, nullptr, &body};
+        ASSERT_TRUE(input.to_next_part());
+        ASSERT_FALSE(input.get_digest());
+        std::istream &in = input.get_input_stream();
+        ASSERT_EQ(data, std::string(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}));
+        ASSERT_TRUE(input.get_digest());
+        ASSERT_EQ(0xFBCEA83C8A378BF1ULL, *input.get_digest());
+    }
+    /* Part without the closing delimiter is truncated */
+    {
+        std::istringstream body{part};
+        multipart_input_impl input{nullptr, "--xyz", 0, nullptr, 0, config, nullptr, &body};
+        ASSERT_TRUE(input.to_next_part());
+        std::istream &in = input.get_input_stream();
+        ASSERT_EQ(data, std::string(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}));
+        ASSERT_FALSE(input.get_digest());
+    }
+    /* Part cut by the input limit */
+    {
+        std::istringstream body{part + "\r\n--xyz--\r\n"};
+        multipart_input_impl input{nullptr, "--xyz", part.size() - 10, nullptr, 0, config, nullptr, &body};
+        ASSERT_TRUE(input.to_next_part());
+        std::istream &in = input.get_input_stream();
+        in.ignore(std::numeric_limits<std::streamsize>::max());
+        ASSERT_FALSE(input.get_digest());
+    }
+}
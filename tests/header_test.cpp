@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <servlet/header.h>
+
+using namespace servlet;
+
+TEST(header_test, names)
+{
+    ASSERT_STREQ("Accept", header_name(http_header::accept));
+    ASSERT_STREQ("Content-Type", header_name(http_header::content_type));
+    ASSERT_STREQ("If-Modified-Since", header_name(http_header::if_modified_since));
+    ASSERT_STREQ("User-Agent", header_name(http_header::user_agent));
+    ASSERT_STREQ("X-Requested-With", header_name(http_header::x_requested_with));
+    /* Literals are shared, no copies are made */
+    ASSERT_EQ(header_name(http_header::host), header_name(http_header::host));
+}
+
+TEST(header_test, name_buffer)
+{
+    std::string name{"Content-Type: text/html"};
+    header_name_buffer short_name{string_view{name}.substr(0, 12)};
+    ASSERT_STREQ("Content-Type", short_name.c_str());
+    std::string long_name(200, 'x');
+    header_name_buffer long_buf{long_name};
+    ASSERT_EQ(long_name, long_buf.c_str());
+    header_name_buffer empty{string_view{}};
+    ASSERT_STREQ("", empty.c_str());
+}
+
+static void visit(header_visit_fn fn, void *data)
+{
+    for (auto &&h : {std::make_pair("A", "1"), std::make_pair("B", "2"), std::make_pair("C", "3")})
+    {
+        if (!fn(data, h.first, h.second)) return;
+    }
+}
+
+TEST(header_test, visitor_adapter)
+{
+    std::vector<std::string> seen;
+    auto all = [&seen] (string_view name, string_view value) { seen.emplace_back(name.to_string() + value.to_string()); };
+    visit(&header_visitor_adapter<decltype(all)>::visit, &all);
+    ASSERT_EQ((std::vector<std::string>{"A1", "B2", "C3"}), seen);
+
+    seen.clear();
+    auto until_b = [&seen] (string_view name, string_view value)
+    {
+        seen.emplace_back(name.to_string());
+        return name != "B";
+    };
+    visit(&header_visitor_adapter<decltype(until_b)>::visit, &until_b);
+    ASSERT_EQ((std::vector<std::string>{"A", "B"}), seen);
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <string>
+#include <zlib.h>
+#include <servlet/lib/exception.h>
+#include "../src/inflate_filter.h"
+
+using namespace servlet;
+
+/* Source handing out the data in small pieces like network buckets */
+class string_source : public basic_source<char>
+{
+public:
+    string_source(const std::string& data, std::size_t piece) : _data{data}, _piece{piece} {}
+
+    std::streamsize read(char* s, std::streamsize n) override
+    {
+        std::size_t size = std::min({static_cast<std::size_t>(n), _piece, _data.size() - _pos});
+        std::memcpy(s, _data.data() + _pos, size);
+        _pos += size;
+        return size;
+    }
+private:
+    const std::string& _data;
+    std::size_t _piece;
+    std::size_t _pos = 0;
+};
+
+/* window_bits: 15 - zlib, -15 - raw deflate, 31 - gzip */
+static std::string compress(const std::string& data, int window_bits)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&zs, data.size()) + 32, '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+static std::string inflate_all(const std::string& compressed, content_coding coding,
+                               std::size_t limit, std::size_t piece)
+{
+    filtered_instream in{new string_source{compressed, piece}};
+    in->add_filter(new inflate_filter{coding, limit, 64});
+    in.exceptions(std::ios::badbit);
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+static std::string sample_text()
+{
+    std::mt19937 gen{2016};
+    std::uniform_int_distribution<int> dist{0, 25};
+    std::string text;
+    for (int i = 0; i < 20000; ++i) text.append(1, static_cast<char>('a' + dist(gen) % (i % 7 + 1)));
+    return text;
+}
+
+TEST(inflate_filter_test, parse_coding)
+{
+    ASSERT_EQ(content_coding::gzip, parse_content_coding(" GZip "));
+    ASSERT_EQ(content_coding::gzip, parse_content_coding("x-gzip"));
+    ASSERT_EQ(content_coding::deflate, parse_content_coding("deflate"));
+    ASSERT_EQ(content_coding::identity, parse_content_coding("br"));
+    ASSERT_EQ(content_coding::identity, parse_content_coding(""));
+}
+
+TEST(inflate_filter_test, formats)
+{
+    std::string text = sample_text();
+    for (std::size_t piece : {1, 7, 100, 100000})
+    {
+        ASSERT_EQ(text, inflate_all(compress(text, 31), content_coding::gzip, text.size(), piece));
+        ASSERT_EQ(text, inflate_all(compress(text, 15), content_coding::deflate, text.size(), piece));
+        ASSERT_EQ(text, inflate_all(compress(text, -15), content_coding::deflate, text.size(), piece));
+    }
+    ASSERT_EQ("", inflate_all(compress("", 31), content_coding::gzip, 0, 10));
+}
+
+TEST(inflate_filter_test, empty_body)
+{
+    for (content_coding coding : {content_coding::gzip, content_coding::deflate})
+    {
+        ASSERT_EQ("", inflate_all("", coding, 100, 10));
+    }
+}
+
+TEST(inflate_filter_test, gzip_members)
+{
+    std::string text = sample_text();
+    std::string first = text.substr(0, 5000), second = text.substr(5000);
+    std::string gz = compress(first, 31) + compress(second, 31) + compress("", 31);
+    for (std::size_t piece : {1, 7, 100, 100000})
+    {
+        ASSERT_EQ(text, inflate_all(gz, content_coding::gzip, text.size(), piece));
+    }
+    /* Truncated last member is still an error */
+    ASSERT_THROW(inflate_all(gz.substr(0, gz.size() - 30), content_coding::gzip, text.size(), 100), io_exception);
+}
+
+TEST(inflate_filter_test, limit)
+{
+    /* 10Mb of zeroes compress to about 10Kb */
+    std::string bomb = compress(std::string(10 * 1024 * 1024, '\0'), 31);
+    ASSERT_LT(bomb.size(), 64 * 1024u);
+    ASSERT_THROW(inflate_all(bomb, content_coding::gzip, 1024 * 1024, 4096), io_exception);
+    std::string text = sample_text();
+    ASSERT_THROW(inflate_all(compress(text, 31), content_coding::gzip, text.size() - 1, 100), io_exception);
+}
+
+TEST(inflate_filter_test, invalid_data)
+{
+    std::string text = sample_text();
+    std::string gz = compress(text, 31);
+    ASSERT_THROW(inflate_all(gz.substr(0, gz.size() / 2), content_coding::gzip, text.size(), 100), io_exception);
+    gz[gz.size() / 2] ^= 0x55;
+    gz[gz.size() / 2 + 1] ^= 0x55;
+    ASSERT_THROW(inflate_all(gz, content_coding::gzip, text.size(), 100), std::exception);
+    ASSERT_THROW(inflate_all("not compressed at all", content_coding::gzip, text.size(), 100), io_exception);
+}
+
+TEST(inflate_filter_test, state_reuse)
+{
+    std::string text = sample_text();
+    std::string gz = compress(text, 31);
+    std::string raw = compress(text, -15);
+    for (int i = 0; i < 10; ++i)
+    {
+        /* abandoned filter leaves its state in the middle of a stream */
+        {
+            filtered_instream in{new string_source{gz, 100}};
+            in->add_filter(new inflate_filter{content_coding::gzip, text.size(), 64});
+            char buf[10];
+            in.read(buf, sizeof(buf));
+        }
+        ASSERT_EQ(text, inflate_all(i % 2 ? gz : raw, i % 2 ? content_coding::gzip : content_coding::deflate,
+                                    text.size(), 1000));
+    }
+}
@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <vector>
+#include <servlet/lib/io.h>
+
+using namespace servlet;
+
+class vector_provider
+{
+public:
+    typedef buffer_provider category;
+
+    explicit vector_provider(std::vector<std::string> *chunks) : _chunks{chunks} {}
+
+    std::pair<char*, std::size_t> get_buffer()
+    {
+        if (_next >= _chunks->size()) return {nullptr, 0};
+        std::string &chunk = (*_chunks)[_next++];
+        return {&chunk[0], chunk.size()};
+    }
+
+private:
+    std::vector<std::string> *_chunks;
+    std::size_t _next = 0;
+};
+
+TEST(io_chunk_test, zero_copy)
+{
+    std::vector<std::string> chunks{"first chunk", "second ", "third"};
+    instream<vector_provider> in{&chunks};
+    char buf[4];
+    auto chunk = read_chunk(in, buf, sizeof(buf));
+    ASSERT_EQ(chunks[0].data(), chunk.first);
+    ASSERT_EQ(chunks[0].size(), chunk.second);
+    /* Stream and chunk reads can be mixed */
+    std::string word;
+    in >> word;
+    ASSERT_EQ("second", word);
+    /* What is left of the current chunk comes first */
+    chunk = read_chunk(in, buf, sizeof(buf));
+    ASSERT_EQ(" ", std::string(chunk.first, chunk.second));
+    chunk = read_chunk(in, buf, sizeof(buf));
+    ASSERT_EQ(chunks[2].data(), chunk.first);
+    in.unget();
+    ASSERT_EQ('d', in.get());
+    ASSERT_EQ(nullptr, read_chunk(in, buf, sizeof(buf)).first);
+    ASSERT_TRUE(in.eof());
+}
+
+TEST(io_chunk_test, partially_read)
+{
+    std::vector<std::string> chunks{"abcdef", "gh"};
+    instream<vector_provider> in{&chunks};
+    ASSERT_EQ('a', in.get());
+    char buf[4];
+    auto chunk = read_chunk(in, buf, sizeof(buf));
+    ASSERT_EQ(chunks[0].data() + 1, chunk.first);
+    ASSERT_EQ("bcdef", std::string(chunk.first, chunk.second));
+    chunk = read_chunk(in, buf, sizeof(buf));
+    ASSERT_EQ("gh", std::string(chunk.first, chunk.second));
+}
+
+TEST(io_chunk_test, copy_fallback)
+{
+    std::istringstream in{"0123456789"};
+    char buf[4];
+    std::string res;
+    for (auto chunk = read_chunk(in, buf, sizeof(buf)); chunk.first; chunk = read_chunk(in, buf, sizeof(buf)))
+    {
+        ASSERT_EQ(buf, chunk.first);
+        res.append(chunk.first, chunk.second);
+    }
+    ASSERT_EQ("0123456789", res);
+    ASSERT_TRUE(in.eof());
+}
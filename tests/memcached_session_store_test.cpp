@@ -0,0 +1,324 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <servlet/lib/exception.h>
+#include "../src/memcached_session_store.h"
+#include "../src/session.h"
+#include "../src/session_codec.h"
+
+using namespace servlet;
+
+/* Minimal memcached speaking the commands used by the store */
+class stub_memcached
+{
+public:
+    stub_memcached()
+    {
+        _fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        socklen_t len = sizeof(addr);
+        getsockname(_fd, reinterpret_cast<sockaddr*>(&addr), &len);
+        _port = ntohs(addr.sin_port);
+        listen(_fd, 16);
+        _acceptor = std::thread{&stub_memcached::_accept, this};
+    }
+    ~stub_memcached()
+    {
+        shutdown(_fd, SHUT_RDWR);
+        _acceptor.join();
+        {
+            std::lock_guard<std::mutex> lock{_mx};
+            for (int fd : _clients) shutdown(fd, SHUT_RDWR);
+        }
+        for (auto &&t : _threads) t.join();
+        close(_fd);
+    }
+
+    std::string address() const { return "127.0.0.1:" + std::to_string(_port); }
+
+    std::atomic<int> connections{0};
+    std::atomic<int> commands{0};
+
+private:
+    typedef std::chrono::steady_clock clock_type;
+    struct _item
+    {
+        std::string data;
+        clock_type::time_point expires;
+    };
+
+    void _accept()
+    {
+        for (;;)
+        {
+            int fd = accept(_fd, nullptr, nullptr);
+            if (fd < 0) return;
+            ++connections;
+            std::lock_guard<std::mutex> lock{_mx};
+            _clients.push_back(fd);
+            _threads.emplace_back(&stub_memcached::_serve, this, fd);
+        }
+    }
+
+    static clock_type::time_point _expires(long long exptime)
+    {
+        if (exptime < 0) return clock_type::now();
+        if (exptime == 0) return clock_type::time_point::max();
+        return clock_type::now() + std::chrono::seconds{exptime};
+    }
+
+    _item *_find(const std::string &key)
+    {
+        auto it = _items.find(key);
+        if (it == _items.end()) return nullptr;
+        if (it->second.expires <= clock_type::now())
+        {
+            _items.erase(it);
+            return nullptr;
+        }
+        return &it->second;
+    }
+
+    std::string _execute(const std::string &line, std::string &in)
+    {
+        ++commands;
+        std::istringstream args{line};
+        std::string cmd, key;
+        args >> cmd >> key;
+        std::lock_guard<std::mutex> lock{_mx};
+        if (cmd == "get")
+        {
+            _item *item = _find(key);
+            if (!item) return "END\r\n";
+            return "VALUE " + key + " 0 " + std::to_string(item->data.size()) + "\r\n" + item->data + "\r\nEND\r\n";
+        }
+        if (cmd == "mg") return _find(key) ? "HD\r\n" : "EN\r\n";
+        if (cmd == "touch")
+        {
+            long long exptime;
+            args >> exptime;
+            _item *item = _find(key);
+            if (!item) return "NOT_FOUND\r\n";
+            item->expires = _expires(exptime);
+            return "TOUCHED\r\n";
+        }
+        if (cmd == "set" || cmd == "add")
+        {
+            long long flags, exptime;
+            std::size_t size;
+            args >> flags >> exptime >> size;
+            std::string data = in.substr(0, size);
+            in.erase(0, size + 2);
+            if (cmd == "add" && _find(key)) return "NOT_STORED\r\n";
+            _items[key] = _item{data, _expires(exptime)};
+            return "STORED\r\n";
+        }
+        if (cmd == "delete") return _items.erase(key) ? "DELETED\r\n" : "NOT_FOUND\r\n";
+        return "ERROR\r\n";
+    }
+
+    void _serve(int fd)
+    {
+        std::string in;
+        char buf[4096];
+        for (;;)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) return;
+            in.append(buf, n);
+            std::string out;
+            for (;;)
+            {
+                std::size_t eol = in.find("\r\n");
+                if (eol == std::string::npos) break;
+                std::string line = in.substr(0, eol);
+                /* Wait for the whole data block of a storage command */
+                if ((line.compare(0, 4, "set ") == 0 || line.compare(0, 4, "add ") == 0) &&
+                    in.size() < eol + 2 + std::stoul(line.substr(line.rfind(' ') + 1)) + 2) break;
+                in.erase(0, eol + 2);
+                out += _execute(line, in);
+            }
+            if (!out.empty()) send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+        }
+    }
+
+    int _fd;
+    int _port;
+    std::thread _acceptor;
+    std::mutex _mx;
+    std::vector<int> _clients;
+    std::vector<std::thread> _threads;
+    std::map<std::string, _item> _items;
+};
+
+TEST(memcached_session_store_test, operations)
+{
+    stub_memcached server;
+    memcached_session_store store{server.address(), 4, std::chrono::milliseconds{1000}, std::chrono::milliseconds{0}};
+    std::chrono::seconds timeout{60};
+    std::uint64_t v1 = store.put(1, "A", "data1", timeout, true);
+    ASSERT_NE(0u, v1);
+    ASSERT_EQ(0u, store.put(1, "A", "other", timeout, true));
+    /* Scopes are separate */
+    ASSERT_NE(0u, store.put(2, "A", "scope2", timeout, true));
+
+    std::uint64_t version = 0;
+    std::string data;
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ(v1, version);
+    ASSERT_EQ("data1", data);
+    /* Data is not copied if the version is known */
+    data.clear();
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ("", data);
+
+    std::uint64_t v2 = store.put(1, "A", std::string(10000, 'x'), timeout, false);
+    ASSERT_NE(v1, v2);
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ(v2, version);
+    ASSERT_EQ(std::string(10000, 'x'), data);
+
+    ASSERT_TRUE(store.touch(1, "A", timeout));
+    ASSERT_TRUE(store.contains(1, "A"));
+    ASSERT_TRUE(store.erase(1, "A"));
+    ASSERT_FALSE(store.erase(1, "A"));
+    ASSERT_FALSE(store.touch(1, "A", timeout));
+    ASSERT_FALSE(store.get(1, "A", timeout, version, data));
+    ASSERT_TRUE(store.contains(2, "A"));
+
+    /* Expired immediately */
+    ASSERT_NE(0u, store.put(1, "B", "data", std::chrono::seconds{0}, true));
+    ASSERT_FALSE(store.contains(1, "B"));
+
+    /* IDs which would break the protocol are never sent */
+    int commands = server.commands;
+    ASSERT_FALSE(store.get(1, "A\r\nflush_all", timeout, version, data));
+    ASSERT_FALSE(store.contains(1, std::string(300, 'A')));
+    ASSERT_THROW(store.put(1, "A B", "data", timeout, true), io_exception);
+    ASSERT_EQ(commands, server.commands);
+
+    /* Sequential requests reuse one connection */
+    ASSERT_EQ(1, server.connections);
+}
+
+TEST(memcached_session_store_test, near_cache)
+{
+    stub_memcached server;
+    memcached_session_store first{server.address(), 4, std::chrono::milliseconds{1000}, std::chrono::milliseconds{200}};
+    memcached_session_store second{server.address(), 4, std::chrono::milliseconds{1000}, std::chrono::milliseconds{200}};
+    std::chrono::seconds timeout{60};
+    ASSERT_NE(0u, first.put(1, "A", "data1", timeout, true));
+    std::uint64_t version = 0;
+    std::string data;
+    ASSERT_TRUE(second.get(1, "A", timeout, version, data));
+
+    int commands = server.commands;
+    ASSERT_TRUE(second.get(1, "A", timeout, version, data));
+    ASSERT_EQ(commands, server.commands);
+
+    /* Another host's change is seen when the near cache entry gets old */
+    std::uint64_t v2 = first.put(1, "A", "data2", timeout, false);
+    ASSERT_TRUE(second.get(1, "A", timeout, version, data));
+    ASSERT_NE(v2, version);
+    std::this_thread::sleep_for(std::chrono::milliseconds{250});
+    ASSERT_TRUE(second.get(1, "A", timeout, version, data));
+    ASSERT_EQ(v2, version);
+    ASSERT_EQ("data2", data);
+}
+
+TEST(memcached_session_store_test, failures)
+{
+    int port;
+    {
+        stub_memcached server;
+        port = std::stoi(server.address().substr(10));
+        memcached_session_store store{server.address(), 4, std::chrono::milliseconds{1000}, std::chrono::milliseconds{0}};
+        ASSERT_NE(0u, store.put(1, "A", "data", std::chrono::seconds{60}, true));
+    }
+    memcached_session_store store{"127.0.0.1:" + std::to_string(port), 4,
+                                  std::chrono::milliseconds{1000}, std::chrono::milliseconds{0}};
+    ASSERT_THROW(store.contains(1, "A"), io_exception);
+    ASSERT_THROW(memcached_session_store(" , ", 4, std::chrono::milliseconds{1000}, std::chrono::milliseconds{0}),
+                 config_exception);
+}
+
+TEST(memcached_session_store_test, hosts)
+{
+    /* Two managers stand for two hosts sharing the servers */
+    stub_memcached server1, server2;
+    std::string servers = server1.address() + "," + server2.address();
+    auto store1 = std::make_shared<memcached_session_store>(servers, 4, std::chrono::milliseconds{1000},
+                                                            std::chrono::milliseconds{0});
+    auto store2 = std::make_shared<memcached_session_store>(servers, 4, std::chrono::milliseconds{1000},
+                                                            std::chrono::milliseconds{0});
+    ASSERT_EQ(2u, store1->server_count());
+    session_manager first{60};
+    session_manager second{60};
+    first.set_shared_store(store1, 7);
+    second.set_shared_store(store2, 7);
+
+    std::vector<std::string> ids;
+    for (int i = 0; i < 20; ++i)
+    {
+        auto session = std::make_shared<http_session_impl>("10.0.0.1", "agent");
+        ASSERT_TRUE(first.insert(session));
+        session->put<std::string>("user", "user" + std::to_string(i));
+        first.save(*session);
+        ids.push_back(session->get_id());
+    }
+    /* Sessions are spread over the servers */
+    ASSERT_LT(0, server1.commands);
+    ASSERT_LT(0, server2.commands);
+    for (int i = 0; i < 20; ++i)
+    {
+        std::shared_ptr<http_session_impl> other = second.find(ids[i]);
+        ASSERT_TRUE(other);
+        ASSERT_EQ("user" + std::to_string(i), *other->get<std::string>("user"));
+    }
+    ASSERT_TRUE(second.erase(ids[0]));
+    ASSERT_FALSE(first.find(ids[0]));
+}
+
+struct point
+{
+    int x;
+    int y;
+};
+
+TEST(session_attribute_codecs_test, custom_type)
+{
+    session_attribute_codecs &codecs = session_attribute_codecs::instance();
+    codecs.add<point>("test.point",
+                      [](const point &p, std::string &out) { out.append(std::to_string(p.x)).append(1, ',').
+                                                                     append(std::to_string(p.y)); },
+                      [](string_view data)
+                      {
+                          std::size_t comma = data.find(',');
+                          return point{std::stoi(data.substr(0, comma).to_string()),
+                                       std::stoi(data.substr(comma + 1).to_string())};
+                      });
+    http_session_impl session{"10.0.0.1", "agent"};
+    session.put<point>("point", point{3, -4});
+    std::string data = encode_session(session);
+    std::shared_ptr<http_session_impl> decoded = decode_session(data);
+    ASSERT_EQ(3, decoded->get<point>("point")->x);
+    ASSERT_EQ(-4, decoded->get<point>("point")->y);
+
+    /* Attributes of a type no longer known are dropped */
+    codecs.remove(typeid(point));
+    ASSERT_FALSE(decode_session(data)->get<point>("point"));
+    ASSERT_EQ(0u, decode_session(encode_session(session))->size());
+}
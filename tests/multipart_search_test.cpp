@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include "../src/boundary_search.h"
+#include "../src/buffer_pool.h"
+
+using namespace servlet;
+
+static const char* naive_search(const std::string& pattern, const char* first, const char* last)
+{
+    const char* found = std::search(first, last, pattern.begin(), pattern.end());
+    return found == last ? nullptr : found;
+}
+
+TEST(multipart_search_test, search)
+{
+    boundary_searcher searcher{"--XyZ"};
+    ASSERT_EQ(6, searcher.size());
+    std::string data{"abc\r\n--XyZ\r\n"};
+    ASSERT_EQ(data.data() + 4, searcher.search(data.data(), data.data() + data.size()));
+    ASSERT_EQ(nullptr, searcher.search(data.data(), data.data() + 9));
+    ASSERT_EQ(data.data() + 4, searcher.search(data.data() + 4, data.data() + 10));
+    ASSERT_EQ(nullptr, searcher.search(data.data() + 5, data.data() + data.size()));
+    data = "\n--XyY\n-XyZ\n--xyZ\n\n--XyZ";
+    ASSERT_EQ(data.data() + 18, searcher.search(data.data(), data.data() + data.size()));
+    ASSERT_EQ(nullptr, searcher.search(data.data(), data.data()));
+}
+
+TEST(multipart_search_test, search_random)
+{
+    std::mt19937 gen{20561};
+    std::uniform_int_distribution<int> ch_dist{0, 7};
+    for (std::string boundary : {"--a", "--XyZ", "----WebKitFormBoundary7MA4YWxkTrZu0gW"})
+    {
+        boundary_searcher searcher{boundary};
+        std::string pattern = "\n" + boundary;
+        for (int i = 0; i < 5000; ++i)
+        {
+            /* Data is made of pieces of the delimiter to produce many near matches */
+            std::string data;
+            std::size_t len = std::uniform_int_distribution<std::size_t>{0, 200}(gen);
+            while (data.size() < len)
+            {
+                int ch = ch_dist(gen);
+                if (ch == 0) data.append(pattern.substr(0, std::uniform_int_distribution<std::size_t>{1, pattern.size()}(gen)));
+                else if (ch == 1) data.push_back('\r');
+                else data.push_back(pattern[ch % pattern.size()]);
+            }
+            const char* first = data.data();
+            const char* last = first + data.size();
+            while (true)
+            {
+                const char* expected = naive_search(pattern, first, last);
+                ASSERT_EQ(expected, searcher.search(first, last)) << data;
+                if (!expected) break;
+                first = expected + 1;
+            }
+        }
+    }
+}
+
+TEST(multipart_search_test, pooled_buffer)
+{
+    char* data;
+    {
+        pooled_buffer buf{64*1024};
+        ASSERT_EQ(64*1024, buf.size());
+        data = buf.data();
+    }
+    {
+        /* Smaller request is served by the pooled buffer */
+        pooled_buffer buf{1024};
+        ASSERT_EQ(data, buf.data());
+        ASSERT_EQ(64*1024, buf.size());
+        pooled_buffer buf2{1024};
+        ASSERT_NE(data, buf2.data());
+        ASSERT_EQ(1024, buf2.size());
+    }
+    pooled_buffer big{128*1024};
+    ASSERT_EQ(128*1024, big.size());
+    pooled_buffer buf{1024};
+    ASSERT_EQ(1024, buf.size());
+}
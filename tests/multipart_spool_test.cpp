@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <experimental/filesystem>
+#include <sys/stat.h>
+#include "../src/multipart.h"
+#include "../src/spool_file.h"
+
+using namespace servlet;
+namespace fs = std::experimental::filesystem;
+
+static std::string make_content(std::size_t size)
+{
+    std::string content;
+    for (std::size_t i = 0; content.size() < size; ++i) content.append(std::to_string(i)).append(1, ';');
+    content.resize(size);
+    return content;
+}
+
+static std::string make_body(const std::string& content)
+{
+    return "--xyz\r\n"
+           "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n\r\n"
+           + content + "\r\n"
+           "--xyz--\r\n";
+}
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream in{path, std::ios::binary};
+    return std::string{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+static std::size_t spooled_files(const std::string& dir)
+{
+    std::size_t count = 0;
+    for (auto &&entry : fs::directory_iterator{dir}) ++count;
+    return count;
+}
+
+class multipart_spool_test : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        _dir = (fs::temp_directory_path() / "multipart_spool_test").string();
+        fs::remove_all(_dir);
+        fs::create_directories(_dir);
+        _config.location = _dir + "/work";
+        _config.file_size_threshold = 1000;
+    }
+    void TearDown() override { fs::remove_all(_dir); }
+
+    spooled_part spool(const std::string& content)
+    {
+        std::istringstream body{make_body(content)};
+        multipart_input_impl input{nullptr, "--xyz", 0, &_params, 0, _config, nullptr, &body};
+        if (!input.to_next_part()) throw io_exception{"no part"};
+        return input.spool_part();
+    }
+
+    std::string _dir;
+    multipart_config _config;
+    std::map<std::string, std::vector<std::string>, std::less<>> _params;
+};
+
+TEST_F(multipart_spool_test, in_memory)
+{
+    std::string content = make_content(1000);
+    spooled_part part = spool(content);
+    ASSERT_TRUE(part.in_memory());
+    ASSERT_EQ("", part.get_path());
+    ASSERT_EQ(content, part.get_data());
+    ASSERT_EQ(content.size(), part.get_size());
+    ASSERT_EQ("form-data", part.get_headers().at("Content-Disposition").front());
+    /* Nothing is written to the spool directory */
+    ASSERT_FALSE(fs::exists(_config.location));
+    part.move_to(_dir + "/moved");
+    ASSERT_EQ(content, read_file(_dir + "/moved"));
+}
+
+TEST_F(multipart_spool_test, file)
+{
+    std::string content = make_content(100000);
+    spooled_part part = spool(content);
+    ASSERT_FALSE(part.in_memory());
+    ASSERT_EQ("", part.get_data());
+    ASSERT_EQ(content.size(), part.get_size());
+    /* Spool directory is created on demand */
+    ASSERT_EQ(fs::path{_config.location}, fs::path{part.get_path()}.parent_path());
+    ASSERT_EQ(content, read_file(part.get_path()));
+    std::string temporary = part.get_path();
+    part.move_to(_dir + "/moved");
+    ASSERT_FALSE(fs::exists(temporary));
+    ASSERT_EQ(_dir + "/moved", part.get_path());
+    ASSERT_EQ(content, read_file(_dir + "/moved"));
+    ASSERT_EQ(0u, spooled_files(_config.location));
+}
+
+TEST_F(multipart_spool_test, cleanup)
+{
+    std::string temporary;
+    {
+        spooled_part part = spool(make_content(5000));
+        temporary = part.get_path();
+        ASSERT_TRUE(fs::exists(temporary));
+        /* Moved from part doesn't own the file */
+        spooled_part other{std::move(part)};
+        ASSERT_TRUE(fs::exists(temporary));
+        /* Assigned over part removes its file */
+        other = spool(make_content(3000));
+        ASSERT_FALSE(fs::exists(temporary));
+        temporary = other.get_path();
+    }
+    ASSERT_FALSE(fs::exists(temporary));
+    ASSERT_EQ(0u, spooled_files(_config.location));
+}
+
+TEST_F(multipart_spool_test, max_file_size)
+{
+    _config.max_file_size = 4000;
+    ASSERT_EQ(4000u, spool(make_content(4000)).get_size());
+    ASSERT_THROW(spool(make_content(4001)), io_exception);
+    /* File of the rejected part is removed */
+    ASSERT_EQ(0u, spooled_files(_config.location));
+}
+
+TEST_F(multipart_spool_test, spool_file)
+{
+    std::string path;
+    {
+        _spool_file file;
+        file.open(_config.location, 1024 * 1024, "test_");
+        file.write("abc", 3);
+        path = file.release(3);
+    }
+    /* Released file stays, preallocated space is cut off */
+    struct stat st;
+    ASSERT_EQ(0, ::stat(path.data(), &st));
+    ASSERT_EQ(3, st.st_size);
+    ASSERT_EQ("abc", read_file(path));
+    std::remove(path.data());
+    {
+        _spool_file file;
+        file.open(_config.location, 0, "test_");
+        file.write("abc", 3);
+        ASSERT_EQ(1u, spooled_files(_config.location));
+    }
+    ASSERT_EQ(0u, spooled_files(_config.location));
+}
+
+TEST_F(multipart_spool_test, form_value_limit)
+{
+    std::string body = "--xyz\r\n"
+                       "Content-Disposition: form-data; name=\"comment\"\r\n\r\n"
+                       + make_content(101) + "\r\n"
+                       "--xyz--\r\n";
+    std::istringstream in{body};
+    multipart_input_impl input{nullptr, "--xyz", 0, &_params, 100, _config, nullptr, &in};
+    /* Form values over the limit are rejected rather than truncated */
+    ASSERT_THROW(while (input.to_next_part()) ;, request_too_large_exception);
+    /* Files are not form values */
+    std::istringstream file_in{make_body(make_content(101))};
+    multipart_input_impl file_input{nullptr, "--xyz", 0, &_params, 100, _config, nullptr, &file_in};
+    ASSERT_TRUE(file_input.to_next_part());
+    ASSERT_EQ(101u, file_input.spool_part().get_size());
+}
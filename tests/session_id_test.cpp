@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <servlet/session.h>
+
+using namespace servlet;
+
+TEST(session_id_test, format)
+{
+    for (int i = 0; i < 100; ++i)
+    {
+        std::string id = generate_session_id();
+        ASSERT_EQ(32u, id.size());
+        ASSERT_TRUE(std::all_of(id.begin(), id.end(), [] (char c) { return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F'); }));
+    }
+}
+
+TEST(session_id_test, unique_across_threads)
+{
+    const int threads = 8;
+    const int per_thread = 10000;
+    std::vector<std::vector<std::string>> ids(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&ids, t, per_thread] ()
+        {
+            for (int i = 0; i < per_thread; ++i) ids[t].push_back(generate_session_id());
+        });
+    }
+    for (auto &&w : workers) w.join();
+    std::set<std::string> all;
+    for (auto &&v : ids) all.insert(v.begin(), v.end());
+    ASSERT_EQ(static_cast<std::size_t>(threads * per_thread), all.size());
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <servlet/lib/exception.h>
+#include "../src/session.h"
+
+using namespace servlet;
+
+class counting_listener : public http_session_listener
+{
+public:
+    void session_created(http_session &session) override { ++created; }
+    void session_destroyed(http_session &session) override
+    {
+        ++destroyed;
+        last_thread = std::this_thread::get_id();
+    }
+
+    std::atomic<int> created{0};
+    std::atomic<int> destroyed{0};
+    std::thread::id last_thread;
+};
+
+static std::shared_ptr<http_session_impl> add_session(session_manager &manager)
+{
+    auto session = std::make_shared<http_session_impl>("127.0.0.1", "test");
+    while (!manager.sessions().try_put(session->get_binary_id(), session)) session->reset_session_id();
+    manager.created(*session);
+    return session;
+}
+
+TEST(session_manager_test, sweep)
+{
+    session_manager manager{0};
+    auto listener = std::make_shared<counting_listener>();
+    manager.add_listener(listener, &manager);
+    for (int i = 0; i < 1000; ++i) add_session(manager);
+    ASSERT_EQ(1000, listener->created);
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    /* Expired sessions stay in the map until swept */
+    ASSERT_EQ(1000u, manager.sessions().size());
+    ASSERT_EQ(0, listener->destroyed);
+    ASSERT_EQ(300u, manager.sweep(300));
+    ASSERT_EQ(300, listener->destroyed);
+    while (manager.sweep(300) > 0);
+    ASSERT_EQ(1000, listener->destroyed);
+    ASSERT_EQ(0u, manager.sessions().size());
+
+    manager.remove_listeners(&manager);
+    add_session(manager);
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    ASSERT_EQ(1u, manager.sweep());
+    ASSERT_EQ(1000, listener->destroyed);
+}
+
+TEST(session_manager_test, background_sweeper)
+{
+    auto listener = std::make_shared<counting_listener>();
+    {
+        session_manager manager{0};
+        manager.add_listener(listener, nullptr);
+        for (int i = 0; i < 500; ++i) add_session(manager);
+        manager.start(std::chrono::milliseconds{10}, 64);
+        for (int i = 0; i < 200 && manager.sessions().size() > 0; ++i)
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        ASSERT_EQ(0u, manager.sessions().size());
+        ASSERT_EQ(500, listener->destroyed);
+        /* Expired sessions are reported outside of the request threads */
+        ASSERT_NE(std::this_thread::get_id(), listener->last_thread);
+    }
+    /* Destructor stops the sweeper */
+    ASSERT_EQ(500, listener->destroyed);
+}
+
+TEST(session_manager_test, live_sessions_kept)
+{
+    session_manager manager{60};
+    auto listener = std::make_shared<counting_listener>();
+    manager.add_listener(listener, &manager);
+    auto session = add_session(manager);
+    ASSERT_EQ(0u, manager.sweep());
+    ASSERT_EQ(session, manager.sessions().get(session->get_binary_id()));
+    ASSERT_EQ(0, listener->destroyed);
+}
+
+TEST(session_manager_test, memory_budget)
+{
+    session_manager manager{60};
+    auto listener = std::make_shared<counting_listener>();
+    manager.add_listener(listener, &manager);
+    manager.set_memory_budget(64 * 1024);
+
+    /* User who has logged in */
+    auto alice = std::make_shared<http_session_impl>("127.0.0.1", "test");
+    ASSERT_TRUE(manager.insert(alice));
+    alice->validate("127.0.0.1", "test");
+    alice->set_principal(new named_principal{"alice"});
+    manager.save(*alice);
+    ASSERT_EQ(alice->memory_size(), manager.memory_usage());
+
+    /* Flood of sessions whose clients never come back */
+    for (int i = 0; i < 5000; ++i)
+    {
+        auto session = std::make_shared<http_session_impl>("10.0.0.1", "crawler");
+        ASSERT_TRUE(manager.insert(session));
+        session->put<std::string>("page", std::string(200, 'x'));
+        manager.save(*session);
+        ASSERT_LE(manager.memory_usage(), 64u * 1024);
+    }
+    ASSERT_LT(4000u, manager.memory_evictions());
+    ASSERT_EQ(static_cast<int>(manager.memory_evictions()), listener->destroyed);
+    ASSERT_EQ(alice, manager.find(alice->get_id()));
+}
+
+TEST(session_manager_test, attribute_sizes)
+{
+    http_session_impl session{"127.0.0.1", "test"};
+    std::size_t empty = session.memory_size();
+    session.put<std::vector<char>>("unknown", std::vector<char>(1024 * 1024));
+    ASSERT_GT(empty + 1024, session.memory_size());
+    session_attribute_sizes::instance().add<std::vector<char>>([](const std::vector<char> &v) { return v.capacity(); });
+    ASSERT_LT(empty + 1024 * 1024, session.memory_size());
+    session_attribute_sizes::instance().remove(typeid(std::vector<char>));
+}
+
+TEST(session_manager_test, compact_session)
+{
+    http_session_impl first{"2001:db8::1", "agent"};
+    http_session_impl second{"2001:db8::1", "agent"};
+    /* User agent is shared, not copied */
+    ASSERT_EQ(&first.get_user_agent(), &second.get_user_agent());
+    ASSERT_EQ("2001:db8::1", first.get_client_ip());
+    first.validate("2001:db8::1", "agent");
+    /* The same address written differently is a different client, as before */
+    ASSERT_THROW(first.validate("2001:DB8::1", "agent"), security_exception);
+    ASSERT_THROW(first.validate("2001:db8::1", "agent2"), security_exception);
+
+    http_session_impl v4{"10.0.0.1", "agent"};
+    v4.validate("10.0.0.1", "agent");
+    ASSERT_THROW(v4.validate("10.0.0.2", "agent"), security_exception);
+    ASSERT_THROW(v4.validate("10.0.0.01", "agent"), security_exception);
+    /* Strings which aren't addresses are kept as they are */
+    http_session_impl other{"unix:/run/socket", ""};
+    ASSERT_EQ("unix:/run/socket", other.get_client_ip());
+    other.validate("unix:/run/socket", "");
+    ASSERT_THROW(other.validate("unix:/run/socket2", ""), security_exception);
+
+    session_id id;
+    ASSERT_TRUE(session_id::parse(first.get_id(), id));
+    ASSERT_EQ(first.get_binary_id(), id);
+    ASSERT_FALSE(session_id::parse(std::string(32, 'a'), id));
+    ASSERT_FALSE(session_id::parse("unknown", id));
+}
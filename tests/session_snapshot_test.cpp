@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <experimental/filesystem>
+#include "../src/os.h"
+#include "../src/session.h"
+#include "../src/session_snapshot.h"
+
+using namespace servlet;
+
+namespace fs = std::experimental::filesystem;
+
+class session_snapshot_test : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        _dir = (fs::temp_directory_path() / "session_snapshot_test").string();
+        fs::remove_all(_dir);
+    }
+    void TearDown() override { fs::remove_all(_dir); }
+
+    std::string _dir;
+};
+
+static std::shared_ptr<http_session_impl> add_session(session_manager &manager, const std::string &user)
+{
+    auto session = std::make_shared<http_session_impl>("10.0.0.1", "agent");
+    session->put<std::string>("user", user);
+    session->set_principal(new named_principal{user});
+    EXPECT_TRUE(manager.insert(session));
+    return session;
+}
+
+TEST_F(session_snapshot_test, restore)
+{
+    std::string alice, bob;
+    {
+        session_manager old_process{60};
+        alice = add_session(old_process, "alice")->get_id();
+        bob = add_session(old_process, "bob")->get_id();
+        ASSERT_EQ(2u, old_process.write_snapshot(_dir));
+    }
+    ASSERT_TRUE(fs::exists(session_snapshot_path(_dir)));
+
+    session_manager new_process{60};
+    new_process.set_snapshot(std::make_shared<session_snapshot>(_dir, std::chrono::seconds{60}));
+    ASSERT_FALSE(new_process.find("unknown"));
+    std::shared_ptr<http_session_impl> restored = new_process.find(alice);
+    ASSERT_TRUE(restored);
+    ASSERT_EQ("alice", *restored->get<std::string>("user"));
+    ASSERT_EQ("alice", restored->get_principal()->get_name());
+    ASSERT_FALSE(restored->is_new());
+    /* Restored session is a regular one now */
+    ASSERT_EQ(restored, new_process.find(alice));
+    ASSERT_TRUE(new_process.erase(alice));
+    ASSERT_FALSE(new_process.find(alice));
+    ASSERT_TRUE(new_process.find(bob));
+}
+
+TEST_F(session_snapshot_test, restored_once)
+{
+    std::string id;
+    {
+        session_manager old_process{60};
+        id = add_session(old_process, "alice")->get_id();
+        old_process.write_snapshot(_dir);
+    }
+    /* Two processes started after the restart */
+    session_snapshot first{_dir, std::chrono::seconds{60}};
+    session_snapshot second{_dir, std::chrono::seconds{60}};
+    ASSERT_EQ(1u, first.size());
+    ASSERT_EQ(1u, second.size());
+    ASSERT_TRUE(first.take(id));
+    ASSERT_FALSE(second.take(id));
+    /* Snapshot loaded later doesn't see it either */
+    session_snapshot third{_dir, std::chrono::seconds{60}};
+    ASSERT_EQ(0u, third.size());
+}
+
+TEST_F(session_snapshot_test, expired)
+{
+    {
+        session_manager old_process{0};
+        add_session(old_process, "alice");
+        /* Nothing to write: the session expired in the map already */
+        std::this_thread::sleep_for(std::chrono::milliseconds{5});
+        ASSERT_EQ(0u, old_process.write_snapshot(_dir));
+    }
+    ASSERT_FALSE(fs::exists(_dir));
+    {
+        session_manager old_process{1};
+        add_session(old_process, "alice");
+        ASSERT_EQ(1u, old_process.write_snapshot(_dir));
+    }
+    /* Snapshot older than the session timeout is removed */
+    fs::last_write_time(session_snapshot_path(_dir), fs::file_time_type::clock::now() - std::chrono::hours{1});
+    session_snapshot snapshot{_dir, std::chrono::seconds{60}};
+    ASSERT_EQ(0u, snapshot.size());
+    ASSERT_FALSE(fs::exists(session_snapshot_path(_dir)));
+}
+
+TEST_F(session_snapshot_test, private_file)
+{
+    {
+        session_manager old_process{60};
+        add_session(old_process, "alice");
+        ASSERT_EQ(1u, old_process.write_snapshot(_dir));
+    }
+    std::string path = session_snapshot_path(_dir);
+    /* Name is not just the pid which can be reused by a later process */
+    ASSERT_NE(_dir + "/" + std::to_string(get_pid()) + ".snapshot", path);
+    fs::perms p = fs::status(path).permissions();
+    ASSERT_EQ(fs::perms::owner_read | fs::perms::owner_write, p & fs::perms::all);
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <servlet/lib/lru_map.h>
+
+using namespace servlet;
+
+typedef sharded_lru_map<std::string, std::shared_ptr<int>> session_like_map;
+
+TEST(sharded_lru_map_test, operations)
+{
+    session_like_map map{60};
+    ASSERT_FALSE(map.get("a"));
+    ASSERT_TRUE(map.try_put("a", std::make_shared<int>(1)));
+    ASSERT_FALSE(map.try_put("a", std::make_shared<int>(2)));
+    ASSERT_EQ(1, *map.get("a"));
+    ASSERT_TRUE(map.put("a", std::make_shared<int>(3)));
+    ASSERT_EQ(3, *map.get("a"));
+    ASSERT_FALSE(map.put("b", std::make_shared<int>(4)));
+    ASSERT_TRUE(map.contains_key("b"));
+    ASSERT_EQ(2u, map.size());
+    ASSERT_TRUE(map.erase("a"));
+    ASSERT_FALSE(map.erase("a"));
+    ASSERT_FALSE(map.contains_key("a"));
+    map.clear();
+    ASSERT_EQ(0u, map.size());
+}
+
+TEST(sharded_lru_map_test, expiration)
+{
+    session_like_map map{0};
+    for (int i = 0; i < 1000; ++i) map.put(std::to_string(i), std::make_shared<int>(i));
+    std::this_thread::sleep_for(std::chrono::milliseconds{5});
+    /* Expired elements are not returned even if they have not been removed yet */
+    ASSERT_FALSE(map.get("1"));
+    ASSERT_FALSE(map.contains_key("2"));
+    ASSERT_EQ(1000u, map.size());
+    /* Expired element is replaced as if it was absent */
+    ASSERT_TRUE(map.try_put("3", std::make_shared<int>(3)));
+    /* Expired elements are removed in bounded batches */
+    std::vector<int> removed;
+    auto collect = [&removed] (const std::string& key, const std::shared_ptr<int>& value)
+    {
+        ASSERT_EQ(key, std::to_string(*value));
+        removed.push_back(*value);
+    };
+    ASSERT_EQ(100u, map.expire(100, collect));
+    ASSERT_EQ(900u, map.size());
+    while (map.expire(100, collect) == 100);
+    ASSERT_EQ(0u, map.size());
+    ASSERT_EQ(1000u, removed.size());
+    std::sort(removed.begin(), removed.end());
+    for (int i = 0; i < 1000; ++i) ASSERT_EQ(i, removed[i]);
+
+    map.set_timeout(60);
+    map.put("x", std::make_shared<int>(1));
+    ASSERT_TRUE(map.get("x"));
+}
+
+TEST(sharded_lru_map_test, deferred_touch)
+{
+    typedef sharded_lru_map<std::string, std::shared_ptr<int>, std::hash<std::string>, 1> single_shard_map;
+    single_shard_map map{2};
+    map.put("a", std::make_shared<int>(1));
+    map.put("b", std::make_shared<int>(2));
+    map.put("c", std::make_shared<int>(3));
+    std::this_thread::sleep_for(single_shard_map::touch_interval() + std::chrono::milliseconds{100});
+    /* Only the first access in the touch interval counts */
+    ASSERT_TRUE(map.get("a"));
+    ASSERT_TRUE(map.get("a"));
+    std::this_thread::sleep_for(single_shard_map::touch_interval() + std::chrono::milliseconds{100});
+    ASSERT_TRUE(map.get("a"));
+    ASSERT_FALSE(map.get("b"));
+    /* Accessed element is moved behind the expired ones before they are removed */
+    std::vector<std::string> removed;
+    ASSERT_EQ(2u, map.expire(10, [&removed] (const std::string& key, const std::shared_ptr<int>&)
+    {
+        removed.push_back(key);
+    }));
+    ASSERT_EQ((std::vector<std::string>{"b", "c"}), removed);
+    ASSERT_EQ(1u, map.size());
+    /* Erased element does not stay in the relink queue */
+    ASSERT_TRUE(map.erase("a"));
+    ASSERT_EQ(0u, map.expire(10, [] (const std::string&, const std::shared_ptr<int>&) {}));
+}
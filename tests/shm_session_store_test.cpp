@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <servlet/lib/exception.h>
+#include "../src/session.h"
+#include "../src/session_codec.h"
+#include "../src/shm_session_store.h"
+
+using namespace servlet;
+
+/* Anonymous shared mapping is inherited by forked children like apr_shm */
+class shm_session_store_test : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        _mem = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        ASSERT_NE(MAP_FAILED, _mem);
+        shm_session_store::format(_mem, SIZE, 1024);
+    }
+    void TearDown() override { munmap(_mem, SIZE); }
+
+    static constexpr std::size_t SIZE = 1024 * 1024;
+    void *_mem;
+};
+
+TEST(session_codec_test, round_trip)
+{
+    http_session_impl session{"10.0.0.1", "agent"};
+    session.put<std::string>("name", "value");
+    session.put<int>("int", -5);
+    session.put<unsigned long>("ulong", 5ul);
+    session.put<double>("double", 2.5);
+    session.put<bool>("flag", true);
+    session.put<std::vector<int>>("skipped", 1, 2);
+    session.set_principal(new named_principal{"user"});
+
+    std::shared_ptr<http_session_impl> decoded = decode_session(encode_session(session));
+    ASSERT_EQ(session.get_id(), decoded->get_id());
+    ASSERT_EQ(session.get_creation_time(), decoded->get_creation_time());
+    ASSERT_FALSE(decoded->is_new());
+    ASSERT_EQ("user", decoded->get_principal()->get_name());
+    ASSERT_EQ("value", *decoded->get<std::string>("name"));
+    ASSERT_EQ(-5, *decoded->get<int>("int"));
+    ASSERT_EQ(5ul, *decoded->get<unsigned long>("ulong"));
+    ASSERT_EQ(2.5, *decoded->get<double>("double"));
+    ASSERT_TRUE(*decoded->get<bool>("flag"));
+    /* Attributes of unknown types stay in the process */
+    ASSERT_EQ(5u, decoded->size());
+    decoded->validate("10.0.0.1", "agent");
+    ASSERT_THROW(decoded->validate("10.0.0.2", "agent"), security_exception);
+
+    std::string data = encode_session(session);
+    ASSERT_THROW(decode_session(string_view{data}.substr(0, data.size() - 1)), io_exception);
+}
+
+TEST_F(shm_session_store_test, operations)
+{
+    shm_session_store store{_mem, SIZE};
+    std::chrono::seconds timeout{60};
+    std::uint64_t v1 = store.put(1, "A", "data1", timeout, true);
+    ASSERT_NE(0u, v1);
+    ASSERT_EQ(0u, store.put(1, "A", "other", timeout, true));
+    /* Scopes are separate */
+    ASSERT_NE(0u, store.put(2, "A", "scope2", timeout, true));
+
+    std::uint64_t version = 0;
+    std::string data;
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ(v1, version);
+    ASSERT_EQ("data1", data);
+    /* Data is not copied if the version is known */
+    data.clear();
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ("", data);
+
+    std::uint64_t v2 = store.put(1, "A", "data2", timeout, false);
+    ASSERT_NE(v1, v2);
+    ASSERT_TRUE(store.get(1, "A", timeout, version, data));
+    ASSERT_EQ(v2, version);
+    ASSERT_EQ("data2", data);
+
+    ASSERT_TRUE(store.contains(1, "A"));
+    ASSERT_TRUE(store.erase(1, "A"));
+    ASSERT_FALSE(store.erase(1, "A"));
+    ASSERT_FALSE(store.get(1, "A", timeout, version, data));
+    ASSERT_TRUE(store.contains(2, "A"));
+
+    ASSERT_THROW(store.put(1, "B", std::string(store.max_data_size() + 1, 'x'), timeout, true), io_exception);
+    ASSERT_THROW(shm_session_store(_mem, SIZE / 2), config_exception);
+}
+
+TEST_F(shm_session_store_test, expiration_and_eviction)
+{
+    shm_session_store store{_mem, SIZE};
+    ASSERT_NE(0u, store.put(1, "A", "data", std::chrono::seconds{0}, true));
+    std::this_thread::sleep_for(std::chrono::milliseconds{2});
+    ASSERT_FALSE(store.contains(1, "A"));
+    /* Expired session does not prevent creation of a new one */
+    ASSERT_NE(0u, store.put(1, "A", "data", std::chrono::seconds{60}, true));
+
+    /* Store full of live sessions drops the least recently used ones */
+    std::size_t count = store.slot_count() * 2;
+    for (std::size_t i = 0; i < count; ++i)
+        ASSERT_NE(0u, store.put(1, "S" + std::to_string(i), "data", std::chrono::seconds{60}, true));
+    ASSERT_TRUE(store.contains(1, "S" + std::to_string(count - 1)));
+}
+
+TEST_F(shm_session_store_test, processes)
+{
+    shm_session_store store{_mem, SIZE};
+    std::chrono::seconds timeout{60};
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        for (int i = 0; i < 100; ++i) store.put(1, "C" + std::to_string(i), "child", timeout, true);
+        _exit(0);
+    }
+    for (int i = 0; i < 100; ++i) store.put(1, "P" + std::to_string(i), "parent", timeout, true);
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    std::uint64_t version = 0;
+    std::string data;
+    ASSERT_TRUE(store.get(1, "C42", timeout, version, data));
+    ASSERT_EQ("child", data);
+}
+
+TEST_F(shm_session_store_test, managers)
+{
+    /* Two managers stand for two child processes */
+    auto store = std::make_shared<shm_session_store>(_mem, SIZE);
+    session_manager first{60};
+    session_manager second{60};
+    first.set_shared_store(store, 7);
+    second.set_shared_store(store, 7);
+
+    auto session = std::make_shared<http_session_impl>("10.0.0.1", "agent");
+    ASSERT_TRUE(first.insert(session));
+    session->put<std::string>("user", "alice");
+    first.save(*session);
+
+    std::shared_ptr<http_session_impl> other = second.find(session->get_id());
+    ASSERT_TRUE(other);
+    ASSERT_EQ("alice", *other->get<std::string>("user"));
+    /* Decoded session is cached until it changes */
+    ASSERT_EQ(other, second.find(session->get_id()));
+    other->put<int>("visits", 2);
+    second.save(*other);
+    std::shared_ptr<http_session_impl> updated = first.find(session->get_id());
+    ASSERT_NE(session, updated);
+    ASSERT_EQ(2, *updated->get<int>("visits"));
+
+    /* Session with the same ID can't be created by another process */
+    auto clash = std::make_shared<http_session_impl>(session->get_binary_id(), "10.0.0.2", "agent",
+                                                     http_session::time_type::clock::now(),
+                                                     http_session::time_type::clock::now());
+    ASSERT_FALSE(second.insert(clash));
+
+    ASSERT_TRUE(second.erase(session->get_id()));
+    ASSERT_FALSE(first.contains(session->get_id()));
+    ASSERT_FALSE(first.find(session->get_id()));
+}
+
+TEST_F(shm_session_store_test, local_attributes)
+{
+    auto store = std::make_shared<shm_session_store>(_mem, SIZE);
+    session_manager first{60};
+    session_manager second{60};
+    first.set_shared_store(store, 7);
+    second.set_shared_store(store, 7);
+
+    auto session = std::make_shared<http_session_impl>("10.0.0.1", "agent");
+    ASSERT_TRUE(first.insert(session));
+    session->put<std::vector<int>>("cart", 1, 2);
+    session->put<std::string>("user", "alice");
+    first.save(*session);
+
+    std::shared_ptr<http_session_impl> other = second.find(session->get_id());
+    ASSERT_FALSE(other->contains_key("cart"));
+    other->put<std::string>("user", "bob");
+    second.save(*other);
+
+    /* Session changed by another process keeps the attributes which are not shared */
+    std::shared_ptr<http_session_impl> updated = first.find(session->get_id());
+    ASSERT_NE(session, updated);
+    ASSERT_EQ("bob", *updated->get<std::string>("user"));
+    ASSERT_EQ((std::vector<int>{1, 2}), *updated->get<std::vector<int>>("cart"));
+}
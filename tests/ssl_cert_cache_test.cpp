@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "../src/ssl.h"
+
+using namespace servlet;
+
+/* Minimal replacement of APR table, enough for the SSL environment */
+struct apr_table_t
+{
+    std::vector<std::pair<std::string, std::string>> entries;
+};
+
+extern "C" const char* apr_table_get(const apr_table_t *t, const char *key)
+{
+    for (auto &&e : t->entries) if (e.first == key) return e.second.c_str();
+    return nullptr;
+}
+
+extern "C" int apr_table_do(int (*comp)(void*, const char*, const char*), void *rec, const apr_table_t *t, ...)
+{
+    for (auto &&e : t->entries) if (!comp(rec, e.first.c_str(), e.second.c_str())) return 0;
+    return 1;
+}
+
+static apr_table_t make_env(const std::string& serial, bool with_pem)
+{
+    apr_table_t env;
+    env.entries = {
+            {"HTTPS", "on"},
+            {"SSL_PROTOCOL", "TLSv1.2"},
+            {"SSL_CIPHER", "ECDHE-RSA-AES256-GCM-SHA384"},
+            {"SSL_CIPHER_USEKEYSIZE", "256"},
+            {"SSL_CIPHER_ALGKEYSIZE", "256"},
+            {"SSL_SESSION_RESUMED", "Resumed"},
+            {"SSL_CLIENT_M_VERSION", "3"},
+            {"SSL_CLIENT_M_SERIAL", serial},
+            {"SSL_CLIENT_S_DN", "CN=client,O=Test"},
+            {"SSL_CLIENT_S_DN_CN", "client"},
+            {"SSL_CLIENT_I_DN", "CN=Test CA,O=Test"},
+            {"SSL_CLIENT_I_DN_CN", "Test CA"},
+            {"SSL_CLIENT_V_START", "Mar  4 12:30:45 2020 GMT"},
+            {"SSL_CLIENT_V_END", "Dec 31 23:59:59 2030 GMT"},
+            {"SSL_CLIENT_CERT_CHAIN_0", "chain0"}
+    };
+    if (with_pem) env.entries.emplace_back("SSL_CLIENT_CERT", "-----BEGIN CERTIFICATE-----" + serial);
+    return env;
+}
+
+TEST(ssl_cert_cache_test, lazy_info)
+{
+    certificate_cache cache;
+    apr_table_t env = make_env("01", false);
+    SSL_info info{&env, cache};
+    ASSERT_EQ("TLSv1.2", info.protocol());
+    ASSERT_EQ(256, info.cipher_used_bits());
+    ASSERT_EQ(SSL_SESSION_STATE::RESUMED, info.session_state());
+    ASSERT_EQ("", info.compress_method());
+    ASSERT_EQ(0u, cache.size());
+    /* No server certificate in the environment */
+    ASSERT_EQ("", info.server_certificate().serial_number());
+    ASSERT_EQ(0u, cache.size());
+}
+
+TEST(ssl_cert_cache_test, certificate)
+{
+    certificate_cache cache;
+    apr_table_t env = make_env("0A1B", true);
+    const certificate *cert;
+    {
+        SSL_info info{&env, cache};
+        cert = &info.client_certificate();
+    }
+    SSL_info info{&env, cache};
+    const certificate &c = info.client_certificate();
+    ASSERT_EQ(3, c.version());
+    ASSERT_EQ("0A1B", c.serial_number());
+    ASSERT_EQ("CN=client,O=Test", c.subject_DN());
+    ASSERT_EQ("client", c.subject_DN_components().at("CN"));
+    ASSERT_EQ("Test CA", c.issuer_DN_components().at("CN"));
+    ASSERT_EQ(1u, c.certificate_chain().size());
+    ASSERT_EQ("-----BEGIN CERTIFICATE-----0A1B", c.PEM_encoded());
+    ASSERT_EQ(1583325045, std::chrono::system_clock::to_time_t(c.valid_since()));
+    ASSERT_EQ(1924991999, std::chrono::system_clock::to_time_t(c.valid_until()));
+    /* The same certificate is parsed only once */
+    ASSERT_EQ(cert, &c);
+    ASSERT_EQ(1u, cache.size());
+    /* Strings are owned by the certificate, not by the request */
+    env.entries.clear();
+    ASSERT_EQ("CN=Test CA,O=Test", c.issuer_DN());
+}
+
+TEST(ssl_cert_cache_test, keys)
+{
+    certificate_cache cache;
+    apr_table_t env1 = make_env("01", true);
+    apr_table_t env2 = make_env("02", true);
+    apr_table_t env3 = make_env("01", true);
+    /* Other certificate claiming the same serial number and issuer */
+    env3.entries.back().second += "forged";
+    auto c1 = cache.get(&env1, "SSL_CLIENT_");
+    auto c2 = cache.get(&env2, "SSL_CLIENT_");
+    auto c3 = cache.get(&env3, "SSL_CLIENT_");
+    ASSERT_NE(c1, c2);
+    ASSERT_NE(c1, c3);
+    ASSERT_EQ("-----BEGIN CERTIFICATE-----01forged", c3->PEM_encoded());
+    ASSERT_EQ(c1, cache.get(&env1, "SSL_CLIENT_"));
+    ASSERT_EQ(3u, cache.size());
+    cache.clear();
+    ASSERT_EQ(0u, cache.size());
+}
+
+TEST(ssl_cert_cache_test, no_pem)
+{
+    certificate_cache cache;
+    apr_table_t env = make_env("01", false);
+    /* Without PEM the certificate cannot be identified exactly, so it is not cached */
+    auto c1 = cache.get(&env, "SSL_CLIENT_");
+    auto c2 = cache.get(&env, "SSL_CLIENT_");
+    ASSERT_EQ("01", c1->serial_number());
+    ASSERT_NE(c1, c2);
+    ASSERT_EQ(0u, cache.size());
+}
+
+TEST(ssl_cert_cache_test, capacity)
+{
+    certificate_cache cache{certificate_cache::SHARDS * 2};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&cache, t] ()
+        {
+            for (int i = 0; i < 500; ++i)
+            {
+                apr_table_t env = make_env(std::to_string(i % (100 + t)), i % 2);
+                auto cert = cache.get(&env, "SSL_CLIENT_");
+                ASSERT_EQ(std::to_string(i % (100 + t)), cert->serial_number());
+            }
+        });
+    }
+    for (auto &&t : threads) t.join();
+    ASSERT_LE(cache.size(), certificate_cache::SHARDS * 2);
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+#include <servlet/uri.h>
+#include "../src/response.h"
+
+using namespace servlet;
+
+/* Built URI must have exactly the same parts as the URI parsed from the same string */
+static void check_parts(const URI& built)
+{
+    URI parsed{built.uri_view()};
+    ASSERT_EQ(parsed.scheme(), built.scheme());
+    ASSERT_EQ(parsed.user_info(), built.user_info());
+    ASSERT_EQ(parsed.host(), built.host());
+    ASSERT_EQ(parsed.port_view(), built.port_view());
+    ASSERT_EQ(parsed.port(), built.port());
+    ASSERT_EQ(parsed.path(), built.path());
+    ASSERT_EQ(parsed.query(), built.query());
+    ASSERT_EQ(parsed.fragment(), built.fragment());
+}
+
+TEST(uri_builder_test, full)
+{
+    URI uri = uri_builder{}.scheme("http").user_info("user").host("www.example.com").port(8080)
+            .path("/path").query("query").fragment("fragment").build();
+    ASSERT_EQ("http://user@www.example.com:8080/path?query#fragment", uri.uri_view());
+    check_parts(uri);
+    ASSERT_EQ(8080, uri.port());
+}
+
+TEST(uri_builder_test, partial)
+{
+    URI uri = uri_builder{}.scheme("https").host("example.com").build();
+    ASSERT_EQ("https://example.com", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.host("example.com").path("a/b").build();
+    ASSERT_EQ("//example.com/a/b", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.path("/a/b").query("q").build();
+    ASSERT_EQ("/a/b?q", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.scheme("mailto").path("user@example.com").build();
+    ASSERT_EQ("mailto:user@example.com", uri.uri_view());
+    ASSERT_EQ("mailto", uri.scheme());
+    ASSERT_EQ("user@example.com", uri.path());
+
+    uri = uri_builder{}.host("[::1]").port(80).path("/").fragment("f").build();
+    ASSERT_EQ("//[::1]:80/#f", uri.uri_view());
+    check_parts(uri);
+
+    ASSERT_TRUE(uri_builder{}.build().uri_view().empty());
+}
+
+TEST(uri_builder_test, path_parts)
+{
+    ASSERT_EQ("http://h/a/b/c", uri_builder{}.scheme("http").host("h")
+            .append_path("a").append_path("b/").append_path("/c").build().uri_view());
+    ASSERT_EQ("/a/b", uri_builder{}.path("/x").path("/a").append_path("").append_path("b").build().uri_view());
+    ASSERT_EQ("a/b/", uri_builder{}.path("a/").append_path("/").append_path("b/").build().uri_view());
+    uri_builder builder;
+    for (int i = 0; i < 4; ++i) builder.append_path("p");
+    ASSERT_THROW(builder.append_path("p"), uri_builder_error);
+}
+
+TEST(uri_builder_test, query)
+{
+    URI uri = uri_builder{}.path("/p").add_to_query("a", "1").add_to_query("b", "").build();
+    ASSERT_EQ("/p?a=1&b=", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.path("/p").query("x=0").add_to_query("a", "1").fragment("f").build();
+    ASSERT_EQ("/p?x=0&a=1#f", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.path("/p").add_to_query("a", "1").query("x=0").build();
+    ASSERT_EQ("/p?x=0", uri.uri_view());
+}
+
+TEST(uri_builder_test, from_uri)
+{
+    URI base{"http://user@www.example.com:8080/path/to?query#fragment"};
+    URI uri = uri_builder{base}.build();
+    ASSERT_EQ(base.uri_view(), uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{base}.user_info("").port(0).append_path("file").add_to_query("a", "b").fragment("").build();
+    ASSERT_EQ("http://www.example.com/path/to/file?query&a=b", uri.uri_view());
+    check_parts(uri);
+}
+
+TEST(uri_builder_test, errors)
+{
+    ASSERT_THROW(uri_builder{}.scheme("http").user_info("user").build(), uri_builder_error);
+    ASSERT_THROW(uri_builder{}.port(80).path("/p").build(), uri_builder_error);
+    ASSERT_THROW(uri_builder{}.scheme("http").build(), uri_builder_error);
+}
+
+TEST(uri_builder_test, setters_on_built)
+{
+    /* Empty parts of the built URI must be positioned so that setters work */
+    URI uri = uri_builder{}.scheme("http").host("example.com").build();
+    uri.set_path("/path");
+    uri.set_query("q");
+    uri.set_fragment("f");
+    uri.set_port(8080);
+    uri.set_user_info("user");
+    ASSERT_EQ("http://user@example.com:8080/path?q#f", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.path("/path").build();
+    uri.set_fragment("f");
+    uri.set_query("q");
+    ASSERT_EQ("/path?q#f", uri.uri_view());
+    check_parts(uri);
+
+    uri = uri_builder{}.scheme("http").host("h").path("/a/./b/../c").build();
+    uri.normalize_path();
+    ASSERT_EQ("http://h/a/c", uri.uri_view());
+}
+
+TEST(uri_builder_test, redirect_location)
+{
+    auto location = [](const std::string& loc, int port)
+    {
+        return std::string{*absolute_location(loc, "http", "example.com", port, "/app/page")};
+    };
+    ASSERT_EQ("http://example.com/app/page/other?x=1#f", location("other?x=1#f", 80));
+    ASSERT_EQ("http://example.com:8080/a/c", location("/a/b/../c", 8080));
+    ASSERT_EQ("http://other.com/x", location("//other.com/x", 80));
+    ASSERT_EQ("https://other.com/x?y", location("https://other.com/x?y", 80));
+    /* Malformed locations are not sent to the client */
+    ASSERT_THROW(location("/a\r\nSet-Cookie: x=y", 80), uri_syntax_error);
+    ASSERT_THROW(location("/a b", 80), uri_syntax_error);
+    ASSERT_THROW(location("http://host:99999/", 80), uri_syntax_error);
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <servlet/uri.h>
+
+using namespace servlet;
+
+static std::string normalized(const std::string& path)
+{
+    URI uri{path};
+    uri.normalize_path();
+    return uri.path().to_string();
+}
+
+TEST(uri_path_test, normalize_path)
+{
+    ASSERT_EQ("/a/g", normalized("/a/b/c/./../../g"));
+    ASSERT_EQ("mid/6", normalized("mid/content=5/../6"));
+    ASSERT_EQ("/a/b/", normalized("/a/b/c/.."));
+    ASSERT_EQ("/a/b/", normalized("/a/b/."));
+    ASSERT_EQ("/a//b", normalized("/a//./b"));
+    ASSERT_EQ("/a/", normalized("/a//.."));
+    ASSERT_EQ("/", normalized("/."));
+    ASSERT_EQ("/g", normalized("/../../g"));
+    ASSERT_EQ("../g", normalized("../g"));
+    ASSERT_EQ("../../g", normalized("a/../../../g"));
+    ASSERT_EQ("../b/", normalized("./../b/."));
+    ASSERT_EQ("/a/b/c", normalized("/a/b/c"));
+    ASSERT_EQ("/a/..b/.c/", normalized("/a/..b/.c/"));
+}
+
+TEST(uri_path_test, normalize_keeps_parts)
+{
+    URI uri{"http://host/a/./b/../c?q#f"};
+    uri.normalize_path();
+    ASSERT_EQ("http://host/a/c?q#f", uri.uri_view());
+    ASSERT_EQ("/a/c", uri.path());
+    ASSERT_EQ("q", uri.query());
+    ASSERT_EQ("f", uri.fragment());
+
+    uri = URI{"http://host/a/b/.."};
+    uri.normalize_path();
+    uri.set_query("q");
+    ASSERT_EQ("http://host/a/?q", uri.uri_view());
+}
+
+/* RFC 3986 5.4 examples which are resolved the same way by RFC 2396 */
+TEST(uri_path_test, rfc_resolve)
+{
+    URI base{"http://a/b/c/d;p?q"};
+    std::pair<const char*, const char*> examples[] = {
+            {"g:h", "g:h"}, {"g", "http://a/b/c/g"}, {"./g", "http://a/b/c/g"}, {"g/", "http://a/b/c/g/"},
+            {"/g", "http://a/g"}, {"//g", "http://g"}, {"g?y", "http://a/b/c/g?y"}, {"#s", "http://a/b/c/d;p?q#s"},
+            {"g#s", "http://a/b/c/g#s"}, {"g?y#s", "http://a/b/c/g?y#s"}, {";x", "http://a/b/c/;x"},
+            {"g;x", "http://a/b/c/g;x"}, {"g;x?y#s", "http://a/b/c/g;x?y#s"}, {".", "http://a/b/c/"},
+            {"./", "http://a/b/c/"}, {"..", "http://a/b/"}, {"../", "http://a/b/"}, {"../g", "http://a/b/g"},
+            {"../..", "http://a/"}, {"../../", "http://a/"}, {"../../g", "http://a/g"},
+            {"../../../g", "http://a/g"}, {"../../../../g", "http://a/g"}, {"g.", "http://a/b/c/g."},
+            {".g", "http://a/b/c/.g"}, {"g..", "http://a/b/c/g.."}, {"..g", "http://a/b/c/..g"},
+            {"./../g", "http://a/b/g"}, {"./g/.", "http://a/b/c/g/"}, {"g/./h", "http://a/b/c/g/h"},
+            {"g/../h", "http://a/b/c/h"}, {"g;x=1/./y", "http://a/b/c/g;x=1/y"}, {"g;x=1/../y", "http://a/b/c/y"},
+            {"g?y/./x", "http://a/b/c/g?y/./x"}, {"g#s/../x", "http://a/b/c/g#s/../x"}
+    };
+    for (auto &&example : examples)
+    {
+        URI resolved = base.resolve(URI{example.first});
+        ASSERT_EQ(example.second, resolved.uri_view()) << example.first;
+        ASSERT_EQ(URI{example.second}.path(), resolved.path()) << example.first;
+    }
+}
+
+TEST(uri_path_test, long_path_resolve)
+{
+    std::string segment(100, 'a');
+    std::string base_path;
+    for (int i = 0; i < 20; ++i) base_path.append("/").append(segment);
+    URI base{"http://host" + base_path};
+    URI resolved = base.resolve(URI{"../b"});
+    ASSERT_EQ("http://host" + base_path.substr(0, base_path.length() - 2*101) + "/b", resolved.uri_view());
+}
+
+TEST(uri_path_test, relativize)
+{
+    URI base{"http://host/a/b/c/"};
+    ASSERT_EQ("d/e", base.relativize(URI{"http://host/a/b/c/d/e"}).uri_view());
+    ASSERT_EQ("d/?q#f", base.relativize(URI{"http://host/a/b/c/./d/?q#f"}).uri_view());
+    ASSERT_EQ("../../x/", base.relativize(URI{"http://host/a/x/"}).uri_view());
+    ASSERT_EQ("http://other/a/b", base.relativize(URI{"http://other/a/b"}).uri_view());
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <servlet/uri.h>
+#include "../src/uri_simd.h"
+
+using namespace servlet;
+
+static const char URI_ALPHABET[] = "abcxyzABCXYZ0189%%%%++//??##::@@[]-._~!$&'()*,;= \"<>\\^`{|}\x01\x7f\x80\xc3\xff";
+static const char* ESCAPES[] = {"%41", "%7e", "%7E", "%2F", "%2f", "%20", "%25", "%3A", "%C3", "%a9", "%00", "%zz", "%4"};
+
+static std::string random_string(std::mt19937& gen, std::size_t max_len, bool clean)
+{
+    std::uniform_int_distribution<std::size_t> len_dist{0, max_len};
+    std::uniform_int_distribution<std::size_t> char_dist{0, sizeof(URI_ALPHABET)-2};
+    std::uniform_int_distribution<std::size_t> esc_dist{0, sizeof(ESCAPES)/sizeof(ESCAPES[0])-1};
+    std::uniform_int_distribution<int> kind_dist{0, 99};
+    std::string str;
+    std::size_t len = len_dist(gen);
+    while (str.length() < len)
+    {
+        int kind = kind_dist(gen);
+        /* mostly long clean runs with rare special characters */
+        if (kind < (clean ? 85 : 40)) str.append(1, "abcdefghijklmnop0123456789-._~"[kind % 30]);
+        else if (kind < 95) str.append(ESCAPES[esc_dist(gen)]);
+        else str.append(1, URI_ALPHABET[char_dist(gen)]);
+    }
+    return str;
+}
+
+template <typename Func>
+static std::string run(Func func)
+{
+    try { return "ok:" + func(); }
+    catch (const uri_syntax_error&) { return "uri_syntax_error"; }
+    catch (const std::exception&) { return "exception"; }
+}
+
+static std::string parts(const URI& uri)
+{
+    std::string res{uri.string()};
+    for (auto part : {uri.scheme(), uri.user_info(), uri.host(), uri.port_view(),
+                      uri.path(), uri.query(), uri.fragment()})
+    {
+        res.append("|").append(part.data(), part.length());
+    }
+    return res;
+}
+
+template <typename Func>
+static void differential(Func func)
+{
+    uri_simd_level supported = get_supported_uri_simd_level();
+    set_uri_simd_level(uri_simd_level::scalar);
+    std::string expected = run(func);
+    for (auto level : {uri_simd_level::sse42, uri_simd_level::avx2})
+    {
+        if (level > supported) continue;
+        set_uri_simd_level(level);
+        ASSERT_EQ(expected, run(func)) << "level " << static_cast<int>(level);
+    }
+    set_uri_simd_level(supported);
+}
+
+TEST(uri_simd_test, level_selection)
+{
+    uri_simd_level supported = get_supported_uri_simd_level();
+    ASSERT_EQ(supported, get_uri_simd_level());
+    ASSERT_EQ(uri_simd_level::scalar, set_uri_simd_level(uri_simd_level::scalar));
+    ASSERT_EQ(uri_simd_level::scalar, get_uri_simd_level());
+    ASSERT_EQ(supported, set_uri_simd_level(uri_simd_level::avx2));
+}
+
+TEST(uri_simd_test, decode)
+{
+    ASSERT_EQ("a b~c/%9", URI::decode("a+b%7ec%2F%9"));
+    ASSERT_EQ("%00%9z", URI::decode("%00%9z"));
+    ASSERT_EQ(std::string(100, 'a') + " ~~" + std::string(40, 'b'),
+              URI::decode(std::string(100, 'a') + "+%7E%7e" + std::string(40, 'b')));
+    ASSERT_THROW(URI::decode("abc%4"), uri_syntax_error);
+    ASSERT_THROW(URI::decode("abc%1z"), uri_syntax_error);
+}
+
+TEST(uri_simd_test, decode_differential)
+{
+    std::mt19937 gen{20161};
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string str = random_string(gen, 120, i % 2 == 0);
+        differential([&str] { return URI::decode(str); });
+    }
+}
+
+TEST(uri_simd_test, parse_differential)
+{
+    std::mt19937 gen{20162};
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string str = random_string(gen, 120, true);
+        differential([&str] { return parts(URI{"http://user@host:8080/" + str}); });
+        differential([&str] { return parts(URI{"/" + str + "?" + str + "#" + str}); });
+        differential([&str] { return parts(URI{str}); });
+    }
+}
+
+TEST(uri_simd_test, normalize_differential)
+{
+    std::mt19937 gen{20163};
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string str = random_string(gen, 120, true);
+        differential([&str]
+                     {
+                         URI uri{"http://user%41@host/" + str + "?" + str};
+                         uri.normalize();
+                         return parts(uri);
+                     });
+    }
+}
+
+TEST(uri_simd_test, to_ascii_differential)
+{
+    std::mt19937 gen{20164};
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string str = random_string(gen, 120, i % 2 == 0);
+        differential([&str] { return URI{"http", str, "host", 80, "/" + str, str, str}.to_ASCII_string(); });
+    }
+}
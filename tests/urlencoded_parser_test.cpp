@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <servlet/uri.h>
+#include "../src/urlencoded_parser.h"
+
+using namespace servlet;
+
+typedef std::vector<std::pair<std::string, std::string>> pairs;
+
+static pairs parse_chunked(const std::string& data, std::size_t chunk_size,
+                           std::size_t max_name_size = 0, std::size_t max_value_size = 0)
+{
+    pairs res;
+    urlencoded_parser parser{[&res](std::string&& name, std::string&& value) { res.emplace_back(name, value); },
+                             max_name_size, max_value_size};
+    for (std::size_t pos = 0; pos < data.length(); pos += chunk_size)
+    {
+        parser.parse(data.data() + pos, std::min(chunk_size, data.length() - pos));
+    }
+    parser.finish();
+    return res;
+}
+
+TEST(urlencoded_parser_test, same_as_parse_query)
+{
+    const char* bodies[] = {"a=1&b=2", "name=John+Smith&city=New%20York&empty=&flag&&=x&a==b",
+                            "%41%42=%7e%7E&x+y=1+2%2B3", "single", "", "&&&", "key=value&"};
+    for (auto body : bodies)
+    {
+        pairs expected;
+        URI::parse_query(body, [&expected](std::string&& name, std::string&& value)
+        {
+            expected.emplace_back(name, value);
+        });
+        std::string data{body};
+        for (std::size_t chunk_size = 1; chunk_size <= data.length() + 1; ++chunk_size)
+        {
+            ASSERT_EQ(expected, parse_chunked(data, chunk_size)) << body << " by " << chunk_size;
+        }
+    }
+}
+
+TEST(urlencoded_parser_test, limits)
+{
+    for (std::size_t chunk_size : {1, 3, 7, 1000})
+    {
+        /* Limits are inclusive and counted in encoded characters */
+        pairs res = parse_chunked("name=%41%42%43&n=" + std::string(10, 'v'), chunk_size, 4, 10);
+        ASSERT_EQ(2, res.size());
+        ASSERT_EQ((std::pair<std::string, std::string>{"name", "ABC"}), res[0]);
+        ASSERT_EQ((std::pair<std::string, std::string>{"n", std::string(10, 'v')}), res[1]);
+        /* Parameters over the limits are rejected rather than truncated */
+        ASSERT_THROW(parse_chunked("long_name=v&n=v", chunk_size, 4, 10), request_too_large_exception);
+        ASSERT_THROW(parse_chunked("long_name", chunk_size, 4, 10), request_too_large_exception);
+        ASSERT_THROW(parse_chunked("n=" + std::string(11, 'v') + "&a=b", chunk_size, 4, 10),
+                     request_too_large_exception);
+        ASSERT_THROW(parse_chunked("n=%41%42%43%44", chunk_size, 4, 10), request_too_large_exception);
+    }
+}
+
+TEST(urlencoded_parser_test, malformed)
+{
+    ASSERT_THROW(parse_chunked("a=%4", 1), uri_syntax_error);
+    ASSERT_THROW(parse_chunked("a%1z=1&b=2", 4), uri_syntax_error);
+}